@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//! \file
+
+#ifndef TNT_FILAMENT_BACKEND_DISKBLOBCACHE_H
+#define TNT_FILAMENT_BACKEND_DISKBLOBCACHE_H
+
+#include <utils/compiler.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament::backend {
+
+class Platform;
+
+/**
+ * DiskBlobCache is a persistent, size-bounded key/value store that can be used as the blob cache
+ * of any Platform (see Platform::setBlobFunc()), so that program binaries compiled by the
+ * backend are reused across runs of the application.
+ *
+ * The cache is made of two files in the given directory: a data file, where entries are only
+ * ever appended, and an index file, which is rewritten by flush() and when the cache is
+ * destroyed. If the index is missing or out of date (e.g. the application was killed), it is
+ * rebuilt from the data file.
+ *
+ * - Each entry is checksummed, corrupted entries are discarded when they're retrieved.
+ * - When the cache exceeds its maximum size, the least recently used entries are evicted. The
+ *   space they used in the data file is reclaimed once it becomes significant.
+ * - The whole cache is discarded if it was written with a different version string. This
+ *   should be used to invalidate the cache when the driver (or the application) is updated.
+ *
+ * All methods are thread-safe.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * DiskBlobCache cache({ .path = cacheDir, .version = driverVersion });
+ * cache.attach(*platform);
+ * Engine* engine = Engine::create(Engine::Backend::OPENGL, platform);
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+class UTILS_PUBLIC DiskBlobCache {
+public:
+    struct Config {
+        /**
+         * Directory where the cache files are stored. It is created if needed.
+         */
+        const char* UTILS_NONNULL path;
+
+        /**
+         * Base name of the cache files, this allows several caches to share a directory.
+         */
+        const char* UTILS_NONNULL name = "filament_blob_cache";
+
+        /**
+         * Version of the cached data, e.g. a string identifying the GPU driver. Entries written
+         * with a different version are discarded.
+         */
+        const char* UTILS_NULLABLE version = nullptr;
+
+        /**
+         * Maximum size in bytes of the cached entries, least recently used entries are evicted
+         * beyond that.
+         */
+        size_t maxSize = 32u * 1024u * 1024u;
+    };
+
+    /**
+     * Opens or creates a cache. If the cache files can't be created, the cache is still usable
+     * but never stores anything, see isPersistent().
+     */
+    explicit DiskBlobCache(Config const& config);
+
+    /**
+     * Writes the index of the cache and closes its files.
+     */
+    ~DiskBlobCache() noexcept;
+
+    DiskBlobCache(DiskBlobCache const&) = delete;
+    DiskBlobCache& operator=(DiskBlobCache const&) = delete;
+
+    /**
+     * Sets this cache as the blob cache of the given Platform. The cache must outlive the
+     * Platform's usage of it, typically the Engine created with this Platform.
+     */
+    void attach(Platform& platform);
+
+    /**
+     * Associates a value with a key, replacing the previous value if any. Values larger than
+     * the maximum size of the cache are ignored.
+     */
+    void insert(const void* UTILS_NONNULL key, size_t keySize,
+            const void* UTILS_NONNULL value, size_t valueSize);
+
+    /**
+     * Retrieves the value associated with a key. The value is written to `value` only if
+     * `valueSize` is large enough, `value` is left untouched otherwise or if the entry is
+     * corrupted.
+     *
+     * @return the size of the value associated with the key, 0 if there is no such value.
+     */
+    size_t retrieve(const void* UTILS_NONNULL key, size_t keySize,
+            void* UTILS_NONNULL value, size_t valueSize);
+
+    /**
+     * Writes the index of the cache to disk.
+     */
+    void flush();
+
+    /**
+     * Removes all entries from the cache.
+     */
+    void clear();
+
+    /**
+     * @return the number of entries in the cache.
+     */
+    size_t getEntryCount() const noexcept;
+
+    /**
+     * @return the size in bytes of the entries in the cache, keys included.
+     */
+    size_t getSize() const noexcept;
+
+    /**
+     * @return whether the cache is backed by files, false if they couldn't be opened.
+     */
+    bool isPersistent() const noexcept;
+
+private:
+    struct Impl;
+    Impl* UTILS_NONNULL mImpl;
+};
+
+} // namespace filament::backend
+
+#endif // TNT_FILAMENT_BACKEND_DISKBLOBCACHE_H
@@ -33,13 +33,17 @@
 
 #include <utils/compiler.h>
 #include <utils/debug.h>
+#include <utils/Mutex.h>
 #include <utils/ThreadUtils.h>
 
+#include <atomic>
 #include <cstddef>
 #include <functional>
+#include <memory>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 #ifndef NDEBUG
 #include <thread>
@@ -54,8 +58,11 @@
 
 namespace filament::backend {
 
+class CommandStreamProfiler;
+
 class CommandBase {
     static constexpr size_t FILAMENT_OBJECT_ALIGNMENT = alignof(std::max_align_t);
+    friend class CommandStreamProfiler;
 
 protected:
     using Execute = Dispatcher::Execute;
@@ -167,6 +174,7 @@ struct CommandType<void (Driver::*)(ARGS...)> {
 // ------------------------------------------------------------------------------------------------
 
 class CustomCommand : public CommandBase {
+    friend class CommandStreamProfiler;
     std::function<void()> mCommand;
     static void execute(Driver&, CommandBase* base, intptr_t* next) noexcept;
 public:
@@ -178,6 +186,7 @@ public:
 // ------------------------------------------------------------------------------------------------
 
 class NoopCommand : public CommandBase {
+    friend class CommandStreamProfiler;
     intptr_t mNext;
     static void execute(Driver&, CommandBase* self, intptr_t* next) noexcept {
         *next = static_cast<NoopCommand*>(self)->mNext;
@@ -187,6 +196,24 @@ public:
             : CommandBase(execute), mNext(intptr_t((char *)next - (char *)this)) { }
 };
 
+class CommandStream;
+
+// Jumps between a primary CommandStream and the buffer of a SecondaryCommandStream. The jump
+// back to the primary stream also returns the secondary buffer, whose commands have all been
+// executed by then.
+class JumpCommand : public CommandBase {
+    friend class CommandStreamProfiler;
+    intptr_t mNext;
+    CommandStream* mPrimary;
+    CircularBuffer* mBuffer;
+    static void execute(Driver&, CommandBase* self, intptr_t* next) noexcept;
+public:
+    inline explicit JumpCommand(void* next,
+            CommandStream* primary = nullptr, CircularBuffer* buffer = nullptr) noexcept
+            : CommandBase(execute), mNext(intptr_t((char *)next - (char *)this)),
+              mPrimary(primary), mBuffer(buffer) { }
+};
+
 // ------------------------------------------------------------------------------------------------
 
 #if !defined(NDEBUG) || (FILAMENT_DEBUG_COMMANDS >= FILAMENT_DEBUG_COMMANDS_ENABLE)
@@ -280,12 +307,45 @@ public:
     inline PodType* allocatePod(
             size_t count = 1, size_t alignment = alignof(PodType)) noexcept;
 
+    /*
+     * Reserves the current position of this stream for the commands of a
+     * SecondaryCommandStream, typically recorded from another thread. The commands recorded
+     * there are executed at this position, that is, in the order the reservations were made,
+     * regardless of when they were recorded.
+     * All SecondaryCommandStreams must be finished before this stream is flushed.
+     */
+    struct Reservation {
+        JumpCommand* jump;
+    };
+    Reservation reserve() noexcept;
+
+    // number of reservations whose SecondaryCommandStream is not finished yet
+    uint32_t getPendingReservationCount() const noexcept {
+        return mPendingReservationCount.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Sets the profiler recording the commands executed by execute(), or nullptr to stop
+     * profiling. This takes effect at the next call to execute(). The profiler must outlive
+     * this CommandStream.
+     */
+    void setProfiler(CommandStreamProfiler* profiler) noexcept {
+        mProfiler.store(profiler, std::memory_order_release);
+    }
+
 private:
+    friend class JumpCommand;
+    friend class SecondaryCommandStream;
+
     inline void* allocateCommand(size_t size) {
         assert_invariant(utils::ThreadUtils::isThisThread(mThreadId));
         return mCurrentBuffer.allocate(size);
     }
 
+    // SecondaryCommandStream buffers, each is used by one thread at a time
+    CircularBuffer* acquireSecondaryBuffer(size_t size);
+    void releaseSecondaryBuffer(CircularBuffer* buffer) noexcept;
+
     // We use a copy of Dispatcher (instead of a pointer) because this removes one dereference
     // when executing driver commands.
     Driver& UTILS_RESTRICT mDriver;
@@ -298,6 +358,53 @@ private:
 #endif
 
     bool mUsePerformanceCounter = false;
+
+    std::atomic<uint32_t> mPendingReservationCount{ 0 };
+
+    utils::Mutex mSecondaryBufferLock;
+    std::vector<std::unique_ptr<CircularBuffer>> mSecondaryBuffers;
+    std::vector<CircularBuffer*> mFreeSecondaryBuffers;
+
+    std::atomic<CommandStreamProfiler*> mProfiler{ nullptr };
+};
+
+/*
+ * A CommandStream recording into its own buffer, whose commands are executed at the position
+ * of a CommandStream::reserve() in a primary CommandStream. This allows several threads to
+ * record commands at the same time, each into its own buffer, without any synchronization.
+ *
+ * The buffer is taken from a pool kept by the primary stream, and is returned to it once its
+ * commands have been executed. It must be able to hold all the recorded commands, recording
+ * more than `capacity` bytes is a fatal error, raised by finish().
+ *
+ * A SecondaryCommandStream must be created on the thread recording the commands, and finish()
+ * must be called before the primary stream is flushed. Synchronous DriverApi calls are made on
+ * the recording thread.
+ */
+class SecondaryCommandStream {
+public:
+    SecondaryCommandStream(CommandStream& primary, CommandStream::Reservation reservation,
+            size_t capacity);
+
+    SecondaryCommandStream(SecondaryCommandStream const& rhs) = delete;
+    SecondaryCommandStream& operator=(SecondaryCommandStream const& rhs) = delete;
+
+    ~SecondaryCommandStream() noexcept;
+
+    // the stream to record commands into
+    CommandStream& getStream() noexcept { return mStream; }
+
+    // Terminates the recorded commands and splices them into the primary stream. No more
+    // commands can be recorded after this call.
+    void finish() noexcept;
+
+private:
+    CommandStream& mPrimary;
+    JumpCommand* const mJump;
+    size_t const mCapacity;
+    CircularBuffer* const mBuffer;
+    CommandStream mStream;
+    bool mFinished = false;
 };
 
 void* CommandStream::allocate(size_t size, size_t alignment) noexcept {
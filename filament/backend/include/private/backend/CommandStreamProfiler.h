@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_BACKEND_PRIVATE_COMMANDSTREAMPROFILER_H
+#define TNT_FILAMENT_BACKEND_PRIVATE_COMMANDSTREAMPROFILER_H
+
+#include "private/backend/Dispatcher.h"
+
+#include <utils/Mutex.h>
+
+#include <tsl/robin_map.h>
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils::io {
+class ostream;
+} // namespace utils::io
+
+namespace filament::backend {
+
+class CommandBase;
+class Driver;
+
+/*
+ * Records how many times each command of a CommandStream is executed, how many bytes it uses
+ * in the CircularBuffer and how long it takes on the driver thread.
+ *
+ * Statistics are accumulated per frame, frames are delimited by the endFrame command. Each
+ * command execution is also recorded as an event (up to a maximum), so it can be exported as
+ * a Chrome trace.
+ *
+ * The profiler is attached to a CommandStream with CommandStream::setProfiler() and records
+ * on the driver thread. Everything below can be called from any thread.
+ *
+ * Commands that are not driver methods are reported as:
+ *  - "queueCommand" for CommandStream::queueCommand()
+ *  - "noop" for jumps in the stream, including the memory returned by CommandStream::allocate()
+ */
+class CommandStreamProfiler {
+public:
+    struct Stats {
+        uint32_t count = 0;         // number of times the command was executed
+        uint64_t bytes = 0;         // bytes used in the CircularBuffer
+        uint64_t duration = 0;      // time spent executing the command, in nanoseconds
+    };
+
+    explicit CommandStreamProfiler(Dispatcher const& dispatcher,
+            uint32_t maxFrameCount = 120, uint32_t maxEventCount = 1u << 18) noexcept;
+
+    ~CommandStreamProfiler() noexcept;
+
+    CommandStreamProfiler(CommandStreamProfiler const&) = delete;
+    CommandStreamProfiler& operator=(CommandStreamProfiler const&) = delete;
+
+    // number of distinct commands, command ids are in [0, getCommandCount())
+    size_t getCommandCount() const noexcept { return mNames.size(); }
+
+    const char* getCommandName(size_t id) const noexcept { return mNames[id]; }
+
+    // number of completed frames available, at most maxFrameCount
+    size_t getFrameCount() const noexcept;
+
+    // statistics of a completed frame indexed by command id, frame 0 is the oldest available
+    std::vector<Stats> getFrameStats(size_t frame) const;
+
+    // statistics of all commands executed since the last reset(), indexed by command id
+    std::vector<Stats> getTotalStats() const;
+
+    // discards everything recorded so far
+    void reset() noexcept;
+
+    // writes the completed frames as CSV, with columns: frame,command,count,bytes,duration_ns
+    void writeHistogram(utils::io::ostream& out) const;
+
+    // writes the recorded events in the Chrome trace event format (chrome://tracing, Perfetto)
+    void writeChromeTrace(utils::io::ostream& out) const;
+
+    // executes and records the commands starting at `base`, this is used by CommandStream
+    void execute(Driver& driver, CommandBase* base);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Event {
+        uint64_t begin;         // in nanoseconds since mEpoch
+        uint32_t duration;      // in nanoseconds
+        uint32_t bytes;
+        uint32_t command;
+    };
+
+    struct Frame {
+        uint32_t index;
+        uint64_t begin;         // in nanoseconds since mEpoch
+        uint64_t end;
+        std::vector<Stats> stats;
+    };
+
+    void addCommand(Dispatcher::Execute execute, const char* name);
+    uint32_t getCommandId(Dispatcher::Execute execute) const noexcept;
+    uint64_t now() const noexcept;
+    void endFrame(uint64_t time);
+
+    // constant after construction
+    std::vector<const char*> mNames;
+    tsl::robin_map<Dispatcher::Execute, uint32_t> mIds;
+    uint32_t mEndFrameId = 0;
+    uint32_t const mMaxFrameCount;
+    uint32_t const mMaxEventCount;
+    clock::time_point const mEpoch;
+
+    mutable utils::Mutex mLock;
+    std::deque<Frame> mFrames;
+    Frame mCurrentFrame;
+    std::vector<Stats> mTotals;
+    std::vector<Event> mEvents;
+    uint32_t mFrameIndex = 0;
+    bool mFrameStarted = false;
+};
+
+} // namespace filament::backend
+
+#endif // TNT_FILAMENT_BACKEND_PRIVATE_COMMANDSTREAMPROFILER_H
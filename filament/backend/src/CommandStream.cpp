@@ -15,16 +15,21 @@
  */
 
 #include "private/backend/CommandStream.h"
+#include "private/backend/CommandStreamProfiler.h"
 
 #if DEBUG_COMMAND_STREAM
 #include <utils/CallStack.h>
 #endif
 
 #include <utils/Log.h>
+#include <utils/Panic.h>
 #include <utils/Profiler.h>
 #include <utils/Systrace.h>
 
+#include <algorithm>
 #include <functional>
+#include <memory>
+#include <mutex>
 
 #ifdef __ANDROID__
 #include <sys/system_properties.h>
@@ -87,9 +92,15 @@ void CommandStream::execute(void* buffer) {
         }
     }
 
-    mDriver.execute([this, buffer]() {
+    CommandStreamProfiler* const commandProfiler = mProfiler.load(std::memory_order_acquire);
+
+    mDriver.execute([this, buffer, commandProfiler]() {
         Driver& UTILS_RESTRICT driver = mDriver;
         CommandBase* UTILS_RESTRICT base = static_cast<CommandBase*>(buffer);
+        if (UTILS_UNLIKELY(commandProfiler)) {
+            commandProfiler->execute(driver, base);
+            return;
+        }
         while (UTILS_LIKELY(base)) {
             base = base->execute(driver);
         }
@@ -114,6 +125,96 @@ void CommandStream::queueCommand(std::function<void()> command) {
     new(allocateCommand(CustomCommand::align(sizeof(CustomCommand)))) CustomCommand(std::move(command));
 }
 
+CommandStream::Reservation CommandStream::reserve() noexcept {
+    size_t const size = CommandBase::align(sizeof(JumpCommand));
+    char* const p = static_cast<char*>(allocateCommand(size));
+    // until it's recorded, the reservation just jumps to the next command
+    JumpCommand* const jump = new(p) JumpCommand(p + size);
+    mPendingReservationCount.fetch_add(1, std::memory_order_relaxed);
+    return { jump };
+}
+
+CircularBuffer* CommandStream::acquireSecondaryBuffer(size_t size) {
+    size_t const blockSize = CircularBuffer::getBlockSize();
+    size = (size + blockSize - 1u) & ~(blockSize - 1u);
+
+    CircularBuffer* buffer = nullptr;
+    {
+        std::lock_guard<utils::Mutex> const lock(mSecondaryBufferLock);
+        auto& freeBuffers = mFreeSecondaryBuffers;
+        auto const pos = std::find_if(freeBuffers.begin(), freeBuffers.end(),
+                [size](CircularBuffer const* buffer) { return buffer->size() >= size; });
+        if (pos != freeBuffers.end()) {
+            buffer = *pos;
+            freeBuffers.erase(pos);
+        }
+    }
+
+    if (UTILS_UNLIKELY(!buffer)) {
+        // the buffers are kept until this stream is destroyed, so this happens rarely
+        auto newBuffer = std::make_unique<CircularBuffer>(size);
+        buffer = newBuffer.get();
+        std::lock_guard<utils::Mutex> const lock(mSecondaryBufferLock);
+        mSecondaryBuffers.push_back(std::move(newBuffer));
+    }
+
+    // discard the commands previously recorded, they've all been executed
+    buffer->getBuffer();
+    return buffer;
+}
+
+void CommandStream::releaseSecondaryBuffer(CircularBuffer* buffer) noexcept {
+    std::lock_guard<utils::Mutex> const lock(mSecondaryBufferLock);
+    mFreeSecondaryBuffers.push_back(buffer);
+}
+
+// ------------------------------------------------------------------------------------------------
+
+SecondaryCommandStream::SecondaryCommandStream(CommandStream& primary,
+        CommandStream::Reservation reservation, size_t capacity)
+        : mPrimary(primary),
+          mJump(reservation.jump),
+          mCapacity(capacity),
+          // leave room for the jump back to the primary stream
+          mBuffer(primary.acquireSecondaryBuffer(
+                  capacity + CommandBase::align(sizeof(JumpCommand)))),
+          mStream(primary.mDriver, *mBuffer) {
+}
+
+SecondaryCommandStream::~SecondaryCommandStream() noexcept {
+    if (!mFinished) {
+        finish();
+    }
+}
+
+void SecondaryCommandStream::finish() noexcept {
+    assert_invariant(!mFinished);
+
+    CircularBuffer& buffer = *mBuffer;
+    if (buffer.empty()) {
+        // nothing to splice, the reservation keeps jumping to the next command
+        mPrimary.releaseSecondaryBuffer(mBuffer);
+    } else {
+        // Overflowing the capacity can only overwrite this stream's own buffer, which nobody else
+        // uses until it's released, so it's enough to check once everything is recorded.
+        ASSERT_POSTCONDITION(buffer.getUsed() <= mCapacity,
+                "SecondaryCommandStream overflow.\n"
+                "Space needed: %u bytes, capacity: %u bytes",
+                unsigned(buffer.getUsed()), unsigned(mCapacity));
+
+        // jump back to the primary stream, right after the reservation, and return the buffer
+        size_t const size = CommandBase::align(sizeof(JumpCommand));
+        new(mStream.allocateCommand(size))
+                JumpCommand(reinterpret_cast<char*>(mJump) + size, &mPrimary, mBuffer);
+
+        CircularBuffer::Range const range = buffer.getBuffer();
+        new(mJump) JumpCommand(range.tail);
+    }
+
+    mFinished = true;
+    mPrimary.mPendingReservationCount.fetch_sub(1, std::memory_order_release);
+}
+
 template<typename... ARGS>
 template<void (Driver::*METHOD)(ARGS...)>
 template<std::size_t... I>
@@ -149,6 +250,15 @@ void CommandType<void (Driver::*)(ARGS...)>::Command<METHOD>::log() noexcept  {
 
 // ------------------------------------------------------------------------------------------------
 
+void JumpCommand::execute(Driver&, CommandBase* base, intptr_t* next) noexcept {
+    JumpCommand* const self = static_cast<JumpCommand*>(base);
+    *next = self->mNext;
+    if (self->mBuffer) {
+        // all the commands of the secondary buffer have been executed, it can be reused
+        self->mPrimary->releaseSecondaryBuffer(self->mBuffer);
+    }
+}
+
 void CustomCommand::execute(Driver&, CommandBase* base, intptr_t* next) noexcept {
     *next = CustomCommand::align(sizeof(CustomCommand));
     static_cast<CustomCommand*>(base)->mCommand();
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "private/backend/CommandStreamProfiler.h"
+
+#include "private/backend/CommandStream.h"
+
+#include <utils/debug.h>
+#include <utils/ostream.h>
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+#include <stdio.h>
+
+namespace filament::backend {
+
+CommandStreamProfiler::CommandStreamProfiler(Dispatcher const& dispatcher,
+        uint32_t maxFrameCount, uint32_t maxEventCount) noexcept
+        : mMaxFrameCount(std::max(1u, maxFrameCount)),
+          mMaxEventCount(maxEventCount),
+          mEpoch(clock::now()) {
+    // "noop" must be first, it's also used for any command we wouldn't know about
+    addCommand(&NoopCommand::execute, "noop");
+    addCommand(&CustomCommand::execute, "queueCommand");
+    addCommand(&JumpCommand::execute, "jump");
+
+#define DECL_DRIVER_API_SYNCHRONOUS(RetType, methodName, paramsDecl, params)
+#define DECL_DRIVER_API(methodName, paramsDecl, params)                     \
+    addCommand(dispatcher.methodName##_, #methodName);
+#define DECL_DRIVER_API_RETURN(RetType, methodName, paramsDecl, params)     \
+    addCommand(dispatcher.methodName##_, #methodName);
+#include "private/backend/DriverAPI.inc"
+
+    mEndFrameId = getCommandId(dispatcher.endFrame_);
+    mCurrentFrame.stats.resize(mNames.size());
+    mTotals.resize(mNames.size());
+}
+
+CommandStreamProfiler::~CommandStreamProfiler() noexcept = default;
+
+void CommandStreamProfiler::addCommand(Dispatcher::Execute execute, const char* name) {
+    // two commands could end up with the same function if the linker merged identical
+    // functions, in that case they're reported under the first name.
+    if (mIds.find(execute) == mIds.end()) {
+        mIds[execute] = uint32_t(mNames.size());
+        mNames.push_back(name);
+    }
+}
+
+uint32_t CommandStreamProfiler::getCommandId(Dispatcher::Execute execute) const noexcept {
+    auto const pos = mIds.find(execute);
+    return UTILS_LIKELY(pos != mIds.end()) ? pos->second : 0;
+}
+
+uint64_t CommandStreamProfiler::now() const noexcept {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::now() - mEpoch).count());
+}
+
+void CommandStreamProfiler::execute(Driver& driver, CommandBase* base) {
+    // The lock is held for the whole buffer, the other threads only access the recorded
+    // data occasionally.
+    std::lock_guard<utils::Mutex> const lock(mLock);
+
+    Stats* const UTILS_RESTRICT totals = mTotals.data();
+    size_t const noopSize = CommandBase::align(sizeof(NoopCommand));
+    size_t const jumpSize = CommandBase::align(sizeof(JumpCommand));
+    uint32_t const jumpId = getCommandId(&JumpCommand::execute);
+
+    // Only one timestamp is taken per command, so the time of a command includes the
+    // (small) overhead of recording the previous one.
+    uint64_t begin = now();
+    if (!mFrameStarted) {
+        mCurrentFrame.begin = begin;
+        mFrameStarted = true;
+    }
+
+    while (UTILS_LIKELY(base)) {
+        uint32_t const id = getCommandId(base->mExecute);
+        CommandBase* const next = base->execute(driver);
+        uint64_t const end = now();
+
+        // all jumps in the stream are forward, except the one terminating the buffer and the
+        // ones to and from secondary command streams
+        size_t const bytes = id == jumpId ? jumpSize :
+                next ? uintptr_t(next) - uintptr_t(base) : noopSize;
+        uint64_t const duration = end - begin;
+
+        Stats& frame = mCurrentFrame.stats[id];
+        frame.count++;
+        frame.bytes += bytes;
+        frame.duration += duration;
+        totals[id].count++;
+        totals[id].bytes += bytes;
+        totals[id].duration += duration;
+
+        if (mEvents.size() < mMaxEventCount) {
+            mEvents.push_back({ begin,
+                    uint32_t(std::min<uint64_t>(duration, std::numeric_limits<uint32_t>::max())),
+                    uint32_t(std::min<size_t>(bytes, std::numeric_limits<uint32_t>::max())),
+                    id });
+        }
+
+        if (UTILS_UNLIKELY(id == mEndFrameId)) {
+            endFrame(end);
+        }
+
+        base = next;
+        begin = end;
+    }
+}
+
+void CommandStreamProfiler::endFrame(uint64_t time) {
+    if (mFrames.size() >= mMaxFrameCount) {
+        // recycle the oldest frame
+        mFrames.pop_front();
+    }
+    mCurrentFrame.index = mFrameIndex++;
+    mCurrentFrame.end = time;
+    mFrames.push_back(mCurrentFrame);
+    std::fill(mCurrentFrame.stats.begin(), mCurrentFrame.stats.end(), Stats{});
+    mCurrentFrame.begin = time;
+}
+
+size_t CommandStreamProfiler::getFrameCount() const noexcept {
+    std::lock_guard<utils::Mutex> const lock(mLock);
+    return mFrames.size();
+}
+
+std::vector<CommandStreamProfiler::Stats> CommandStreamProfiler::getFrameStats(
+        size_t frame) const {
+    std::lock_guard<utils::Mutex> const lock(mLock);
+    assert_invariant(frame < mFrames.size());
+    return mFrames[frame].stats;
+}
+
+std::vector<CommandStreamProfiler::Stats> CommandStreamProfiler::getTotalStats() const {
+    std::lock_guard<utils::Mutex> const lock(mLock);
+    return mTotals;
+}
+
+void CommandStreamProfiler::reset() noexcept {
+    std::lock_guard<utils::Mutex> const lock(mLock);
+    mFrames.clear();
+    std::fill(mCurrentFrame.stats.begin(), mCurrentFrame.stats.end(), Stats{});
+    std::fill(mTotals.begin(), mTotals.end(), Stats{});
+    mEvents.clear();
+    mFrameIndex = 0;
+    mFrameStarted = false;
+}
+
+void CommandStreamProfiler::writeHistogram(utils::io::ostream& out) const {
+    std::lock_guard<utils::Mutex> const lock(mLock);
+    out << "frame,command,count,bytes,duration_ns\n";
+    for (Frame const& frame : mFrames) {
+        for (size_t i = 0, c = frame.stats.size(); i < c; i++) {
+            Stats const& stats = frame.stats[i];
+            if (stats.count) {
+                out << frame.index << ',' << mNames[i] << ','
+                    << stats.count << ',' << stats.bytes << ',' << stats.duration << '\n';
+            }
+        }
+    }
+    flush(out);
+}
+
+void CommandStreamProfiler::writeChromeTrace(utils::io::ostream& out) const {
+    std::lock_guard<utils::Mutex> const lock(mLock);
+
+    // Chrome trace timestamps are in microseconds. Frames and commands are on separate tracks
+    // so that the frames don't hide the commands.
+    struct Microseconds {
+        char str[32];
+    };
+    auto const us = [](uint64_t ns) {
+        Microseconds r;
+        snprintf(r.str, sizeof(r.str), "%.3f", double(ns) * 1e-3);
+        return r;
+    };
+
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+           "\"args\":{\"name\":\"frames\"}},\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,"
+           "\"args\":{\"name\":\"commands\"}}";
+    for (Frame const& frame : mFrames) {
+        out << ",\n{\"name\":\"frame " << frame.index << "\",\"cat\":\"frame\",\"ph\":\"X\","
+            << "\"pid\":1,\"tid\":1,\"ts\":" << us(frame.begin).str
+            << ",\"dur\":" << us(frame.end - frame.begin).str << '}';
+    }
+    for (Event const& event : mEvents) {
+        out << ",\n{\"name\":\"" << mNames[event.command] << "\",\"cat\":\"command\","
+            << "\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":" << us(event.begin).str
+            << ",\"dur\":" << us(event.duration).str
+            << ",\"args\":{\"bytes\":" << event.bytes << "}}";
+    }
+    out << "\n]}\n";
+    flush(out);
+}
+
+} // namespace filament::backend
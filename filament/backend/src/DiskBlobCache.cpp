@@ -0,0 +1,567 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <backend/DiskBlobCache.h>
+
+#include <backend/Platform.h>
+
+#include <utils/Hash.h>
+#include <utils/Log.h>
+#include <utils/Mutex.h>
+#include <utils/Path.h>
+#include <utils/Systrace.h>
+
+#include <tsl/robin_map.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace utils;
+
+namespace filament::backend {
+
+namespace {
+
+// Both files start with a header identifying the format and the version of the cached data.
+// The data file is a sequence of records: a RecordHeader followed by the key and the value.
+// The index file is an IndexHeader followed by `count` IndexEntry.
+
+constexpr uint32_t DATA_MAGIC   = 0x44434246;  // "FBCD"
+constexpr uint32_t INDEX_MAGIC  = 0x49434246;  // "FBCI"
+constexpr uint32_t RECORD_MAGIC = 0x52434246;  // "FBCR"
+constexpr uint32_t FORMAT_VERSION = 1;
+
+struct DataHeader {
+    uint32_t magic;
+    uint32_t format;
+    uint64_t version;
+};
+
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t checksum;
+    uint64_t keyHash;
+};
+
+struct IndexHeader {
+    uint32_t magic;
+    uint32_t format;
+    uint64_t version;
+    uint64_t dataSize;
+    uint64_t tick;
+    uint64_t count;
+};
+
+struct IndexEntry {
+    uint64_t keyHash;
+    uint64_t offset;
+    uint64_t lastUse;
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+uint64_t hash64(void const* data, size_t size) noexcept {
+    if (!size) {
+        return 0;
+    }
+    auto const* const p = static_cast<uint8_t const*>(data);
+    return (uint64_t(hash::murmurSlow(p, size, 0x9e3779b9u)) << 32u) |
+            hash::murmurSlow(p, size, 0x85ebca6bu);
+}
+
+uint32_t checksum(void const* key, size_t keySize, void const* value, size_t valueSize) noexcept {
+    uint32_t h = hash::murmurSlow(static_cast<uint8_t const*>(key), keySize, 0);
+    if (valueSize) {
+        h = hash::murmurSlow(static_cast<uint8_t const*>(value), valueSize, h);
+    }
+    return h;
+}
+
+// fseek() and ftell() use a long, which is only 32 bits on Windows
+int seek(FILE* file, uint64_t offset, int origin) noexcept {
+#if defined(WIN32)
+    return _fseeki64(file, __int64(offset), origin);
+#else
+    return fseeko(file, off_t(offset), origin);
+#endif
+}
+
+uint64_t tell(FILE* file) noexcept {
+#if defined(WIN32)
+    return uint64_t(_ftelli64(file));
+#else
+    return uint64_t(ftello(file));
+#endif
+}
+
+bool readAt(FILE* file, uint64_t offset, void* data, size_t size) noexcept {
+    return !seek(file, offset, SEEK_SET) && fread(data, 1, size, file) == size;
+}
+
+bool writeAt(FILE* file, uint64_t offset, void const* data, size_t size) noexcept {
+    return !seek(file, offset, SEEK_SET) && fwrite(data, 1, size, file) == size;
+}
+
+bool replaceFile(std::string const& from, std::string const& to) noexcept {
+    if (rename(from.c_str(), to.c_str()) == 0) {
+        return true;
+    }
+    // rename() doesn't replace existing files on all platforms
+    remove(to.c_str());
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+} // anonymous namespace
+
+struct DiskBlobCache::Impl {
+    struct Entry {
+        uint64_t offset;
+        uint64_t lastUse;
+        uint32_t keySize;
+        uint32_t valueSize;
+        uint32_t checksum;
+
+        size_t getRecordSize() const noexcept {
+            return sizeof(RecordHeader) + keySize + valueSize;
+        }
+    };
+
+    explicit Impl(Config const& config);
+    ~Impl() noexcept;
+
+    bool openDataFile() noexcept;
+    bool createDataFile() noexcept;
+    bool loadIndex() noexcept;
+    void rebuildIndex() noexcept;
+    void writeIndex() noexcept;
+    void erase(uint64_t keyHash) noexcept;
+    void evict() noexcept;
+    void compact() noexcept;
+
+    mutable Mutex lock;
+    std::string dataPath;
+    std::string indexPath;
+    uint64_t const version;
+    size_t const maxSize;
+    FILE* data = nullptr;
+    uint64_t dataSize = 0;      // end of the valid records in the data file
+    size_t liveSize = 0;        // size of the records of all the entries
+    uint64_t tick = 0;          // used to order the entries by last use
+    bool dirty = false;         // the index file is out of date
+    tsl::robin_map<uint64_t, Entry> entries;
+};
+
+DiskBlobCache::Impl::Impl(Config const& config)
+        : version(config.version ? hash64(config.version, strlen(config.version)) : 0),
+          maxSize(config.maxSize) {
+    Path const dir(config.path);
+    if (!dir.exists()) {
+        dir.mkdirRecursive();
+    }
+    std::string const name(config.name);
+    dataPath = dir.concat(Path(name + ".data")).getPath();
+    indexPath = dir.concat(Path(name + ".index")).getPath();
+
+    if (!openDataFile()) {
+        if (!createDataFile()) {
+            slog.w << "DiskBlobCache: couldn't create " << dataPath << io::endl;
+            return;
+        }
+    }
+    if (!loadIndex()) {
+        rebuildIndex();
+    }
+}
+
+DiskBlobCache::Impl::~Impl() noexcept {
+    if (data) {
+        writeIndex();
+        fclose(data);
+    }
+}
+
+bool DiskBlobCache::Impl::openDataFile() noexcept {
+    data = fopen(dataPath.c_str(), "r+b");
+    if (!data) {
+        return false;
+    }
+    DataHeader header{};
+    if (!readAt(data, 0, &header, sizeof(header)) ||
+            header.magic != DATA_MAGIC || header.format != FORMAT_VERSION ||
+            header.version != version) {
+        // this cache was written by another version, it is discarded entirely
+        fclose(data);
+        data = nullptr;
+        return false;
+    }
+    seek(data, 0, SEEK_END);
+    dataSize = tell(data);
+    return true;
+}
+
+bool DiskBlobCache::Impl::createDataFile() noexcept {
+    if (data) {
+        fclose(data);
+    }
+    remove(indexPath.c_str());
+    entries.clear();
+    liveSize = 0;
+    dataSize = 0;
+    dirty = true;
+    data = fopen(dataPath.c_str(), "w+b");
+    if (!data) {
+        return false;
+    }
+    DataHeader const header{ DATA_MAGIC, FORMAT_VERSION, version };
+    if (!writeAt(data, 0, &header, sizeof(header)) || fflush(data)) {
+        fclose(data);
+        data = nullptr;
+        return false;
+    }
+    dataSize = sizeof(header);
+    return true;
+}
+
+bool DiskBlobCache::Impl::loadIndex() noexcept {
+    FILE* const file = fopen(indexPath.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    IndexHeader header{};
+    bool valid = readAt(file, 0, &header, sizeof(header)) &&
+            header.magic == INDEX_MAGIC && header.format == FORMAT_VERSION &&
+            header.version == version &&
+            // the data file can be larger than recorded if a write was interrupted
+            header.dataSize >= sizeof(DataHeader) && header.dataSize <= dataSize &&
+            header.count <= header.dataSize / sizeof(RecordHeader);
+
+    if (valid) {
+        std::vector<IndexEntry> items(header.count);
+        valid = fread(items.data(), sizeof(IndexEntry), items.size(), file) == items.size();
+        for (size_t i = 0; valid && i < items.size(); i++) {
+            IndexEntry const& item = items[i];
+            Entry const entry{ item.offset, item.lastUse,
+                    item.keySize, item.valueSize, item.checksum };
+            valid = entry.offset >= sizeof(DataHeader) &&
+                    entry.offset + entry.getRecordSize() <= header.dataSize;
+            if (valid) {
+                entries[item.keyHash] = entry;
+                liveSize += entry.getRecordSize();
+            }
+        }
+    }
+    fclose(file);
+
+    if (!valid) {
+        entries.clear();
+        liveSize = 0;
+        return false;
+    }
+    dataSize = header.dataSize;
+    tick = header.tick;
+    return true;
+}
+
+void DiskBlobCache::Impl::rebuildIndex() noexcept {
+    SYSTRACE_CALL();
+    entries.clear();
+    liveSize = 0;
+    uint64_t const size = dataSize;
+    uint64_t offset = sizeof(DataHeader);
+    RecordHeader record{};
+    // records are appended, so the last one for a given key is the current one
+    while (offset + sizeof(RecordHeader) <= size &&
+            readAt(data, offset, &record, sizeof(record)) && record.magic == RECORD_MAGIC) {
+        Entry const entry{ offset, ++tick, record.keySize, record.valueSize, record.checksum };
+        if (offset + entry.getRecordSize() > size) {
+            // the last record is incomplete
+            break;
+        }
+        erase(record.keyHash);
+        entries[record.keyHash] = entry;
+        liveSize += entry.getRecordSize();
+        offset += entry.getRecordSize();
+    }
+    // anything past the last valid record will be overwritten
+    dataSize = offset;
+    dirty = true;
+}
+
+void DiskBlobCache::Impl::writeIndex() noexcept {
+    if (!dirty || !data) {
+        return;
+    }
+
+    std::vector<IndexEntry> items;
+    items.reserve(entries.size());
+    for (auto const& [keyHash, entry] : entries) {
+        items.push_back({ keyHash, entry.offset, entry.lastUse,
+                entry.keySize, entry.valueSize, entry.checksum, 0 });
+    }
+    IndexHeader const header{ INDEX_MAGIC, FORMAT_VERSION, version, dataSize, tick,
+            items.size() };
+
+    // write to a temporary file first, so we never leave a partially written index behind
+    std::string const path = indexPath + ".tmp";
+    FILE* const file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return;
+    }
+    bool const success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(items.data(), sizeof(IndexEntry), items.size(), file) == items.size();
+    fclose(file);
+    if (success && replaceFile(path, indexPath)) {
+        dirty = false;
+    } else {
+        remove(path.c_str());
+    }
+}
+
+void DiskBlobCache::Impl::erase(uint64_t keyHash) noexcept {
+    auto const pos = entries.find(keyHash);
+    if (pos != entries.end()) {
+        liveSize -= pos->second.getRecordSize();
+        entries.erase(pos);
+        dirty = true;
+    }
+}
+
+void DiskBlobCache::Impl::evict() noexcept {
+    // evict more than strictly needed, so we don't have to do this at each insertion
+    size_t const target = maxSize - maxSize / 4;
+
+    std::vector<std::pair<uint64_t, uint64_t>> lru; // lastUse, keyHash
+    lru.reserve(entries.size());
+    for (auto const& [keyHash, entry] : entries) {
+        lru.emplace_back(entry.lastUse, keyHash);
+    }
+    std::sort(lru.begin(), lru.end());
+    for (size_t i = 0; i < lru.size() && liveSize > target; i++) {
+        erase(lru[i].second);
+    }
+}
+
+void DiskBlobCache::Impl::compact() noexcept {
+    SYSTRACE_CALL();
+
+    // keep the records in the same order as in the current file
+    std::vector<std::pair<uint64_t, uint64_t>> records; // offset, keyHash
+    records.reserve(entries.size());
+    for (auto const& [keyHash, entry] : entries) {
+        records.emplace_back(entry.offset, keyHash);
+    }
+    std::sort(records.begin(), records.end());
+
+    std::string const path = dataPath + ".tmp";
+    FILE* const file = fopen(path.c_str(), "w+b");
+    if (!file) {
+        return;
+    }
+
+    DataHeader const header{ DATA_MAGIC, FORMAT_VERSION, version };
+    bool success = writeAt(file, 0, &header, sizeof(header));
+    uint64_t offset = sizeof(header);
+    std::vector<uint8_t> buffer;
+    for (size_t i = 0; success && i < records.size(); i++) {
+        Entry& entry = entries[records[i].second];
+        buffer.resize(entry.getRecordSize());
+        success = readAt(data, entry.offset, buffer.data(), buffer.size()) &&
+                writeAt(file, offset, buffer.data(), buffer.size());
+        entry.offset = offset;
+        offset += buffer.size();
+    }
+    success = success && !fflush(file);
+    fclose(file);
+
+    fclose(data);
+    data = nullptr;
+    if (success && replaceFile(path, dataPath)) {
+        dataSize = offset;
+        dirty = true;
+        data = fopen(dataPath.c_str(), "r+b");
+        if (data) {
+            writeIndex();
+            return;
+        }
+    }
+
+    // the offsets were partially updated, recover from whichever data file we have now
+    remove(path.c_str());
+    entries.clear();
+    liveSize = 0;
+    if (openDataFile()) {
+        rebuildIndex();
+    } else {
+        createDataFile();
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+DiskBlobCache::DiskBlobCache(Config const& config)
+        : mImpl(new Impl(config)) {
+}
+
+DiskBlobCache::~DiskBlobCache() noexcept {
+    delete mImpl;
+}
+
+void DiskBlobCache::attach(Platform& platform) {
+    platform.setBlobFunc(
+            [this](void const* key, size_t keySize, void const* value, size_t valueSize) {
+                insert(key, keySize, value, valueSize);
+            },
+            [this](void const* key, size_t keySize, void* value, size_t valueSize) {
+                return retrieve(key, keySize, value, valueSize);
+            });
+}
+
+void DiskBlobCache::insert(void const* key, size_t keySize, void const* value, size_t valueSize) {
+    SYSTRACE_CALL();
+    Impl& impl = *mImpl;
+    size_t const recordSize = sizeof(RecordHeader) + keySize + valueSize;
+    if (!keySize || recordSize > impl.maxSize) {
+        return;
+    }
+
+    RecordHeader const record{ RECORD_MAGIC, uint32_t(keySize), uint32_t(valueSize),
+            checksum(key, keySize, value, valueSize), hash64(key, keySize) };
+
+    std::lock_guard<Mutex> const lock(impl.lock);
+    if (!impl.data) {
+        return;
+    }
+
+    uint64_t const offset = impl.dataSize;
+    bool const success = writeAt(impl.data, offset, &record, sizeof(record)) &&
+            fwrite(key, 1, keySize, impl.data) == keySize &&
+            fwrite(value, 1, valueSize, impl.data) == valueSize &&
+            !fflush(impl.data);
+    if (!success) {
+        // whatever was written past dataSize will be overwritten
+        return;
+    }
+
+    impl.erase(record.keyHash);
+    impl.entries[record.keyHash] = { offset, ++impl.tick,
+            record.keySize, record.valueSize, record.checksum };
+    impl.liveSize += recordSize;
+    impl.dataSize += recordSize;
+    impl.dirty = true;
+
+    if (impl.liveSize > impl.maxSize) {
+        impl.evict();
+    }
+
+    // reclaim the space used by evicted and replaced entries once it becomes significant
+    uint64_t const deadSize = impl.dataSize - sizeof(DataHeader) - impl.liveSize;
+    if (deadSize > impl.maxSize / 2) {
+        impl.compact();
+    }
+}
+
+size_t DiskBlobCache::retrieve(void const* key, size_t keySize, void* value, size_t valueSize) {
+    SYSTRACE_CALL();
+    Impl& impl = *mImpl;
+    if (!keySize) {
+        return 0;
+    }
+
+    uint64_t const keyHash = hash64(key, keySize);
+
+    std::lock_guard<Mutex> const lock(impl.lock);
+    auto pos = impl.entries.find(keyHash);
+    if (pos == impl.entries.end() || pos->second.keySize != keySize) {
+        return 0;
+    }
+
+    Impl::Entry& entry = pos.value();
+    if (entry.valueSize > valueSize) {
+        // the caller's buffer is too small, just return the size
+        return entry.valueSize;
+    }
+
+    // The caller's buffer is only written once the entry is known to be valid, so the value is
+    // read into a temporary buffer until its checksum is verified.
+    RecordHeader record{};
+    std::vector<uint8_t> stored(keySize + entry.valueSize);
+    bool valid = readAt(impl.data, entry.offset, &record, sizeof(record)) &&
+            record.magic == RECORD_MAGIC && record.keyHash == keyHash &&
+            record.keySize == entry.keySize && record.valueSize == entry.valueSize &&
+            fread(stored.data(), 1, keySize, impl.data) == keySize;
+
+    if (valid && memcmp(stored.data(), key, keySize)) {
+        // a different key with the same hash
+        return 0;
+    }
+
+    uint8_t* const storedValue = stored.data() + keySize;
+    valid = valid &&
+            fread(storedValue, 1, entry.valueSize, impl.data) == entry.valueSize &&
+            checksum(key, keySize, storedValue, entry.valueSize) == entry.checksum;
+    if (UTILS_UNLIKELY(!valid)) {
+        slog.w << "DiskBlobCache: discarding corrupted entry" << io::endl;
+        impl.erase(keyHash);
+        return 0;
+    }
+
+    memcpy(value, storedValue, entry.valueSize);
+
+    entry.lastUse = ++impl.tick;
+    impl.dirty = true;
+    return entry.valueSize;
+}
+
+void DiskBlobCache::flush() {
+    std::lock_guard<Mutex> const lock(mImpl->lock);
+    mImpl->writeIndex();
+}
+
+void DiskBlobCache::clear() {
+    std::lock_guard<Mutex> const lock(mImpl->lock);
+    if (mImpl->data) {
+        mImpl->createDataFile();
+        mImpl->writeIndex();
+    }
+}
+
+size_t DiskBlobCache::getEntryCount() const noexcept {
+    std::lock_guard<Mutex> const lock(mImpl->lock);
+    return mImpl->entries.size();
+}
+
+size_t DiskBlobCache::getSize() const noexcept {
+    std::lock_guard<Mutex> const lock(mImpl->lock);
+    return mImpl->liveSize;
+}
+
+bool DiskBlobCache::isPersistent() const noexcept {
+    std::lock_guard<Mutex> const lock(mImpl->lock);
+    return mImpl->data != nullptr;
+}
+
+} // namespace filament::backend
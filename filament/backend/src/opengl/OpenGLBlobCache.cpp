@@ -52,16 +52,21 @@ GLuint OpenGLBlobCache::retrieve(BlobCacheKey* outKey, Platform& platform,
     constexpr size_t DEFAULT_BLOB_SIZE = 65536;
     std::unique_ptr<Blob, decltype(&::free)> blob{ (Blob*)malloc(DEFAULT_BLOB_SIZE), &::free };
 
-    size_t const blobSize = platform.retrieveBlob(
+    size_t blobSize = platform.retrieveBlob(
             key.data(), key.size(), blob.get(), DEFAULT_BLOB_SIZE);
 
-    if (blobSize > 0) {
-        if (blobSize > DEFAULT_BLOB_SIZE) {
-            // our buffer was too small, retry with the correct size
-            blob.reset((Blob*)malloc(blobSize));
-            platform.retrieveBlob(
-                    key.data(), key.size(), blob.get(), blobSize);
+    if (blobSize > DEFAULT_BLOB_SIZE) {
+        // our buffer was too small, retry with the correct size
+        blob.reset((Blob*)malloc(blobSize));
+        size_t const size = platform.retrieveBlob(
+                key.data(), key.size(), blob.get(), blobSize);
+        if (size != blobSize) {
+            // the cache entry changed or was discarded in the meantime
+            blobSize = 0;
         }
+    }
+
+    if (blobSize > 0) {
 
         GLsizei const programBinarySize = GLsizei(blobSize - sizeof(Blob));
 
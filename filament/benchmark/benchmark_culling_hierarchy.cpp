@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include <filament/Frustum.h>
+#include "Culler.h"
+#include "CullingHierarchy.h"
+
+#include <math/mat4.h>
+
+#include <vector>
+#include <random>
+
+using namespace filament;
+using namespace filament::math;
+
+// Compares flat culling (all boxes tested) against the culling hierarchy, with boxes
+// scattered in a large volume around the camera, as in a big mostly-static scene.
+class FilamentCullingHierarchyFixture : public benchmark::Fixture {
+protected:
+    Frustum frustum{};
+    std::vector<float3> boxesCenter;
+    std::vector<float3> boxesExtent;
+    std::vector<uint32_t> keys;
+    std::vector<Culler::result_type> visibles;
+    CullingHierarchy hierarchy;
+
+public:
+    void SetUp(benchmark::State const& state) override {
+        size_t const count = size_t(state.range(0));
+        size_t const capacity = Culler::round(count);
+
+        std::default_random_engine gen; // NOLINT
+        std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+        std::uniform_real_distribution<float> size(0.1f, 5.0f);
+
+        frustum = Frustum{ mat4f::perspective(45.0f, 1.0f, 0.1f, 500.0f) };
+
+        boxesCenter.resize(capacity);
+        boxesExtent.resize(capacity);
+        keys.resize(count);
+        visibles.resize(capacity);
+        for (size_t i = 0; i < count; i++) {
+            boxesCenter[i] = { position(gen), position(gen), position(gen) };
+            boxesExtent[i] = { size(gen), size(gen), size(gen) };
+            keys[i] = uint32_t(i);
+        }
+        hierarchy.update(keys.data(), boxesCenter.data(), boxesExtent.data(), count);
+    }
+
+    void TearDown(benchmark::State const&) override {
+        hierarchy.clear();
+    }
+};
+
+BENCHMARK_DEFINE_F(FilamentCullingHierarchyFixture, flatCulling)(benchmark::State& state) {
+    size_t const count = size_t(state.range(0));
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            Culler::intersects(visibles.data(), frustum,
+                    boxesCenter.data(), boxesExtent.data(), count, 0);
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(int64_t(state.iterations() * count));
+    }
+}
+
+BENCHMARK_DEFINE_F(FilamentCullingHierarchyFixture, hierarchyCulling)(benchmark::State& state) {
+    size_t const count = size_t(state.range(0));
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            hierarchy.cull(visibles.data(), frustum, 0);
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(int64_t(state.iterations() * count));
+    }
+}
+
+// includes the cost of detecting changes and refitting when a single box moved
+BENCHMARK_DEFINE_F(FilamentCullingHierarchyFixture, hierarchyRefit)(benchmark::State& state) {
+    size_t const count = size_t(state.range(0));
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            boxesCenter[count / 2].x += 1.0f;
+            hierarchy.update(keys.data(), boxesCenter.data(), boxesExtent.data(), count);
+            hierarchy.cull(visibles.data(), frustum, 0);
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(int64_t(state.iterations() * count));
+    }
+}
+
+// includes the cost of removing a primitive and inserting a new one
+BENCHMARK_DEFINE_F(FilamentCullingHierarchyFixture, hierarchyInsertRemove)(benchmark::State& state) {
+    size_t const count = size_t(state.range(0));
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            keys[count / 2] += uint32_t(count);
+            hierarchy.update(keys.data(), boxesCenter.data(), boxesExtent.data(), count);
+            hierarchy.cull(visibles.data(), frustum, 0);
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(int64_t(state.iterations() * count));
+    }
+}
+
+BENCHMARK_REGISTER_F(FilamentCullingHierarchyFixture, flatCulling)
+        ->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+
+BENCHMARK_REGISTER_F(FilamentCullingHierarchyFixture, hierarchyCulling)
+        ->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+
+BENCHMARK_REGISTER_F(FilamentCullingHierarchyFixture, hierarchyRefit)
+        ->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+
+BENCHMARK_REGISTER_F(FilamentCullingHierarchyFixture, hierarchyInsertRemove)
+        ->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
@@ -103,3 +103,64 @@ BENCHMARK_F(FilamentCullingFixture, sphereCulling)(benchmark::State& state) {
         state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
     }
 }
+
+// Per-ISA variants, these force a specific culling kernel so that regressions in any of them are
+// visible regardless of which one is selected at runtime. Unsupported kernels are skipped.
+
+static const char* isaName(Culler::Isa isa) {
+    switch (isa) {
+        case Culler::Isa::SCALAR:   return "scalar";
+        case Culler::Isa::SSE:      return "SSE";
+        case Culler::Isa::AVX2:     return "AVX2";
+        case Culler::Isa::NEON:     return "NEON";
+    }
+    return "unknown";
+}
+
+BENCHMARK_DEFINE_F(FilamentCullingFixture, boxCullingIsa)(benchmark::State& state) {
+    auto const isa = Culler::Isa(state.range(0));
+    state.SetLabel(isaName(isa));
+    if (!Culler::Test::isSupported(isa)) {
+        state.SkipWithError("ISA not supported");
+        return;
+    }
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            Culler::Test::intersects(isa, visibles, frustum, boxesCenter.data(), boxesExtent.data(), BATCH_SIZE);
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+    }
+}
+
+BENCHMARK_DEFINE_F(FilamentCullingFixture, sphereCullingIsa)(benchmark::State& state) {
+    auto const isa = Culler::Isa(state.range(0));
+    state.SetLabel(isaName(isa));
+    if (!Culler::Test::isSupported(isa)) {
+        state.SkipWithError("ISA not supported");
+        return;
+    }
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            Culler::Test::intersects(isa, visibles, frustum, spheres.data(), BATCH_SIZE);
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+    }
+}
+
+BENCHMARK_REGISTER_F(FilamentCullingFixture, boxCullingIsa)
+        ->Arg(int(Culler::Isa::SCALAR))
+        ->Arg(int(Culler::Isa::SSE))
+        ->Arg(int(Culler::Isa::AVX2))
+        ->Arg(int(Culler::Isa::NEON));
+
+BENCHMARK_REGISTER_F(FilamentCullingFixture, sphereCullingIsa)
+        ->Arg(int(Culler::Isa::SCALAR))
+        ->Arg(int(Culler::Isa::SSE))
+        ->Arg(int(Culler::Isa::AVX2))
+        ->Arg(int(Culler::Isa::NEON));
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include "Allocators.h"
+#include "Froxelizer.h"
+
+#include "details/Engine.h"
+#include "details/Scene.h"
+
+#include <filament/Engine.h>
+#include <filament/LightManager.h>
+#include <filament/Viewport.h>
+
+#include <utils/Entity.h>
+#include <utils/EntityManager.h>
+
+#include <math/mat4.h>
+#include <math/vec4.h>
+
+#include <memory>
+#include <random>
+
+using namespace filament;
+using namespace filament::math;
+using namespace utils;
+
+// Froxelizes point lights randomly distributed in the view frustum, this measures the CPU cost
+// of building the froxel and record buffers for a given number of lights.
+class FilamentFroxelizerFixture : public benchmark::Fixture {
+protected:
+    FEngine* engine = nullptr;
+    Entity light;
+    std::unique_ptr<LinearAllocatorArena> arena;
+    std::unique_ptr<RootArenaScope> scope;
+    std::unique_ptr<Froxelizer> froxelizer;
+    FScene::LightSoa lights;
+    mat4f const projection = mat4f::perspective(60, 16.0f / 9.0f, 0.1, 100);
+
+public:
+    void SetUp(benchmark::State const& state) override {
+        size_t const count = size_t(state.range(0));
+
+        engine = downcast(Engine::create(Engine::Backend::NOOP));
+        light = EntityManager::get().create();
+        LightManager::Builder(LightManager::Type::POINT).build(*engine, light);
+        LightManager::Instance const instance = engine->getLightManager().getInstance(light);
+
+        // light positions are given in view space, the view matrix is the identity
+        std::default_random_engine gen; // NOLINT
+        std::uniform_real_distribution<float> depth(1.0f, 100.0f);
+        std::uniform_real_distribution<float> side(-0.5f, 0.5f);
+        std::uniform_real_distribution<float> radius(0.5f, 5.0f);
+        lights.clear();
+        lights.push_back({}, {}, {}, {}, {}, {}, {}, {});   // directional light slot
+        for (size_t i = 0; i < count; i++) {
+            float const z = depth(gen);
+            float4 const sphere{ side(gen) * z, side(gen) * z, -z, radius(gen) };
+            lights.push_back(sphere, {}, {}, {}, instance, 1, {}, {});
+        }
+
+        // the froxelizer's temporary data scale with the number of lights (~1 KiB per light)
+        arena = std::make_unique<LinearAllocatorArena>("benchmark", 8 * 1024 * 1024);
+        scope = std::make_unique<RootArenaScope>(*arena);
+
+        froxelizer = std::make_unique<Froxelizer>(*engine);
+        froxelizer->prepare(engine->getDriverApi(), *scope,
+                { 0, 0, 1920, 1080 }, projection, 0.1f, 100.0f, count);
+    }
+
+    void TearDown(benchmark::State const&) override {
+        froxelizer->terminate(engine->getDriverApi());
+        froxelizer.reset();
+        scope.reset();
+        arena.reset();
+        engine->getLightManager().destroy(light);
+        EntityManager::get().destroy(light);
+        Engine::destroy((Engine**)&engine);
+    }
+};
+
+BENCHMARK_DEFINE_F(FilamentFroxelizerFixture, froxelizeLights)(benchmark::State& state) {
+    size_t const count = size_t(state.range(0));
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            froxelizer->froxelizeLights(*engine, mat4f{}, lights);
+            benchmark::DoNotOptimize(froxelizer->getFroxelBufferUser().data());
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(int64_t(state.iterations() * count));
+    }
+}
+
+BENCHMARK_REGISTER_F(FilamentFroxelizerFixture, froxelizeLights)
+        ->Arg(256)->Arg(1024)->Arg(4096)->UseRealTime();
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include "RenderPass.h"
+
+#include "components/RenderableManager.h"
+
+#include "details/Engine.h"
+#include "details/IndexBuffer.h"
+#include "details/Material.h"
+#include "details/Scene.h"
+#include "details/VertexBuffer.h"
+
+#include <filament/Engine.h>
+#include <filament/IndexBuffer.h>
+#include <filament/RenderableManager.h>
+#include <filament/VertexBuffer.h>
+
+#include <utils/Entity.h>
+#include <utils/EntityManager.h>
+
+#include <math/vec3.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace filament;
+using namespace filament::math;
+using namespace utils;
+
+// Compares std::sort() and the radix sort used by RenderPass on commands with keys that look
+// like what RenderPass generates: a few passes, a few hundred materials, and a depth field.
+// Both benchmarks include copying the unsorted commands at each iteration.
+class FilamentRenderPassSortFixture : public benchmark::Fixture {
+protected:
+    using Command = RenderPass::Command;
+    std::vector<Command> unsorted;
+    std::vector<Command> commands;
+    std::vector<uint8_t> arenaStorage;
+
+public:
+    void SetUp(benchmark::State const& state) override {
+        size_t const count = size_t(state.range(0));
+        std::default_random_engine gen; // NOLINT
+        std::uniform_int_distribution<uint64_t> pass(0, 3);
+        std::uniform_int_distribution<uint64_t> material(0, 255);
+        std::uniform_int_distribution<uint64_t> depth(0, 0xFFFF);
+        unsorted.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            unsorted[i].key = (pass(gen) << 60) | (material(gen) << 32) | (depth(gen) << 8);
+            unsorted[i].primitive.index = uint32_t(i);
+        }
+        commands.resize(count);
+        // enough for the key/index pairs
+        arenaStorage.resize(count * 32 + 4096);
+    }
+};
+
+BENCHMARK_DEFINE_F(FilamentRenderPassSortFixture, stdSort)(benchmark::State& state) {
+    size_t const count = size_t(state.range(0));
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            std::copy(unsorted.begin(), unsorted.end(), commands.begin());
+            std::sort(commands.begin(), commands.end());
+            benchmark::DoNotOptimize(commands.data());
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(int64_t(state.iterations() * count));
+    }
+}
+
+BENCHMARK_DEFINE_F(FilamentRenderPassSortFixture, radixSort)(benchmark::State& state) {
+    size_t const count = size_t(state.range(0));
+    RenderPass::Arena arena("benchmark",
+            { arenaStorage.data(), arenaStorage.data() + arenaStorage.size() });
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            std::copy(unsorted.begin(), unsorted.end(), commands.begin());
+            RenderPass::radixSortCommands(arena,
+                    commands.data(), commands.data() + commands.size());
+            benchmark::DoNotOptimize(commands.data());
+        }
+        benchmark::ClobberMemory();
+        pc.stop();
+        state.SetItemsProcessed(int64_t(state.iterations() * count));
+    }
+}
+
+BENCHMARK_REGISTER_F(FilamentRenderPassSortFixture, stdSort)
+        ->Arg(1'000)->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+
+BENCHMARK_REGISTER_F(FilamentRenderPassSortFixture, radixSort)
+        ->Arg(1'000)->Arg(10'000)->Arg(100'000)->Arg(1'000'000);
+
+// Builds the color pass of a scene of single-primitive renderables, a given percentage of which
+// change every frame, with and without a RenderPass::CommandCache. With the cache, the cost
+// should be dominated by the changed renderables, plus a small per-renderable check and copy.
+class FilamentCommandCacheFixture : public benchmark::Fixture {
+protected:
+    FEngine* engine = nullptr;
+    FVertexBuffer* vertexBuffer = nullptr;
+    FIndexBuffer* indexBuffer = nullptr;
+    std::vector<Entity> entities;
+    FScene::RenderableSoa soa;
+    std::vector<uint8_t> arenaStorage;
+
+public:
+    void SetUp(benchmark::State const& state) override {
+        size_t const count = size_t(state.range(0));
+
+        engine = downcast(Engine::create(Engine::Backend::NOOP));
+        vertexBuffer = downcast(VertexBuffer::Builder()
+                .vertexCount(3)
+                .bufferCount(1)
+                .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+                .build(*engine));
+        indexBuffer = downcast(IndexBuffer::Builder()
+                .indexCount(3)
+                .bufferType(IndexBuffer::IndexType::USHORT)
+                .build(*engine));
+        FMaterialInstance const* const mi = engine->getDefaultMaterial()->getDefaultInstance();
+
+        FRenderableManager& rcm = engine->getRenderableManager();
+        entities.resize(count);
+        EntityManager::get().create(count, entities.data());
+
+        // the renderables are spread in front of the camera, which looks down -z
+        std::default_random_engine gen; // NOLINT
+        std::uniform_real_distribution<float> side(-50.0f, 50.0f);
+        std::uniform_real_distribution<float> depth(1.0f, 100.0f);
+        soa.setCapacity(count + 1);
+        soa.resize(count + 1);
+        for (size_t i = 0; i < count; i++) {
+            RenderableManager::Builder(1)
+                    .geometry(0, RenderableManager::PrimitiveType::TRIANGLES,
+                            vertexBuffer, indexBuffer)
+                    .material(0, mi)
+                    .boundingBox({ {}, { 1, 1, 1 } })
+                    .build(*engine, entities[i]);
+            FRenderableManager::Instance const ri = rcm.getInstance(entities[i]);
+            soa.elementAt<FScene::RENDERABLE_INSTANCE>(i) = ri;
+            soa.elementAt<FScene::VISIBILITY_STATE>(i) = rcm.getVisibility(ri);
+            soa.elementAt<FScene::SKINNING_BUFFER>(i) = rcm.getSkinningBufferInfo(ri);
+            soa.elementAt<FScene::MORPHING_BUFFER>(i) = rcm.getMorphingBufferInfo(ri);
+            soa.elementAt<FScene::INSTANCES>(i) = rcm.getInstancesInfo(ri);
+            soa.elementAt<FScene::WORLD_AABB_CENTER>(i) = { side(gen), side(gen), -depth(gen) };
+            soa.elementAt<FScene::VISIBLE_MASK>(i) = 1;
+            soa.elementAt<FScene::PRIMITIVES>(i) = rcm.getRenderPrimitives(ri, 0);
+        }
+
+        // enough for the commands and the sort's key/index pairs
+        arenaStorage.resize(count * 256 + 65536);
+    }
+
+    void TearDown(benchmark::State const&) override {
+        FRenderableManager& rcm = engine->getRenderableManager();
+        for (Entity const entity : entities) {
+            rcm.destroy(entity);
+        }
+        EntityManager::get().destroy(entities.size(), entities.data());
+        entities.clear();
+        soa.clear();
+        engine->destroy(vertexBuffer);
+        engine->destroy(indexBuffer);
+        Engine::destroy((Engine**)&engine);
+    }
+
+    void run(benchmark::State& state, RenderPass::CommandCache* cache) {
+        size_t const count = size_t(state.range(0));
+        size_t const changedCount = count * size_t(state.range(1)) / 100;
+        FRenderableManager& rcm = engine->getRenderableManager();
+        RenderPass::Arena arena("benchmark",
+                { arenaStorage.data(), arenaStorage.data() + arenaStorage.size() });
+        void* const top = arena.getCurrent();
+        CameraInfo const camera;
+        std::default_random_engine gen; // NOLINT
+        std::uniform_int_distribution<size_t> index(0, count - 1);
+        uint16_t blendOrder = 0;
+
+        auto buildPass = [&]() {
+            RenderPass const pass = RenderPassBuilder(arena)
+                    .commandTypeFlags(RenderPass::CommandTypeFlags::COLOR)
+                    .geometry(soa, { 0, uint32_t(count) }, {})
+                    .camera(camera)
+                    .commandCache(cache)
+                    .build(*engine);
+            benchmark::DoNotOptimize(pass.begin());
+        };
+
+        // the first frame fills the cache
+        buildPass();
+        arena.rewind(top);
+        {
+            PerformanceCounters pc(state);
+            for (auto _ : state) {
+                // any change to the renderable's state invalidates its commands
+                blendOrder++;
+                for (size_t i = 0; i < changedCount; i++) {
+                    rcm.setBlendOrderAt(soa.elementAt<FScene::RENDERABLE_INSTANCE>(index(gen)),
+                            0, 0, blendOrder);
+                }
+                buildPass();
+                arena.rewind(top);
+            }
+            benchmark::ClobberMemory();
+            pc.stop();
+            state.SetItemsProcessed(int64_t(state.iterations() * count));
+        }
+    }
+};
+
+BENCHMARK_DEFINE_F(FilamentCommandCacheFixture, noCache)(benchmark::State& state) {
+    run(state, nullptr);
+}
+
+BENCHMARK_DEFINE_F(FilamentCommandCacheFixture, cache)(benchmark::State& state) {
+    RenderPass::CommandCache cache;
+    run(state, &cache);
+}
+
+// arguments are the number of renderables and the percentage that changes every frame
+BENCHMARK_REGISTER_F(FilamentCommandCacheFixture, noCache)
+        ->Args({ 10'000, 0 })->Args({ 100'000, 0 });
+
+BENCHMARK_REGISTER_F(FilamentCommandCacheFixture, cache)
+        ->Args({ 10'000, 0 })->Args({ 10'000, 1 })->Args({ 10'000, 10 })->Args({ 10'000, 100 })
+        ->Args({ 100'000, 0 })->Args({ 100'000, 1 })->Args({ 100'000, 10 })
+        ->Args({ 100'000, 100 });
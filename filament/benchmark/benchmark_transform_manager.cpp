@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include "components/TransformManager.h"
+
+#include <utils/EntityManager.h>
+#include <utils/JobSystem.h>
+
+#include <math/mat4.h>
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+using namespace filament;
+using namespace filament::math;
+using namespace utils;
+
+// Measures the cost of committing a local transform transaction in which one node out of
+// eight changed, with deep hierarchies (a few long chains) and wide hierarchies (a single
+// root with many children). Arg(1) selects serial (0) or parallel (1) propagation.
+class FilamentTransformManagerFixture : public benchmark::Fixture {
+protected:
+    std::unique_ptr<JobSystem> js;
+    std::optional<FTransformManager> tcm;
+    std::vector<Entity> entities;
+
+    void createHierarchy(benchmark::State const& state, size_t chainLength) {
+        size_t const count = size_t(state.range(0));
+        bool const parallel = state.range(1) != 0;
+
+        js = std::make_unique<JobSystem>();
+        js->adopt();
+        if (parallel) {
+            tcm.emplace(*js);
+        } else {
+            tcm.emplace();
+        }
+
+        entities.resize(count);
+        EntityManager::get().create(count, entities.data());
+
+        mat4f const t = mat4f::translation(float3{ 0.01f, 0.0f, 0.0f });
+        tcm->openLocalTransformTransaction();
+        for (size_t i = 0; i < count; i++) {
+            // each chain starts with a root, the first node of the first chain is the root
+            // of all other chains (i.e. chainLength = 1 gives the widest hierarchy).
+            TransformManager::Instance parent{};
+            if (i % chainLength) {
+                parent = tcm->getInstance(entities[i - 1]);
+            } else if (i) {
+                parent = tcm->getInstance(entities[0]);
+            }
+            tcm->create(entities[i], parent, t);
+        }
+        tcm->commitLocalTransformTransaction();
+    }
+
+    void run(benchmark::State& state) {
+        size_t const count = entities.size();
+        float angle = 0.0f;
+        {
+            PerformanceCounters pc(state);
+            for (auto _ : state) {
+                angle += 0.01f;
+                mat4f const t = mat4f::rotation(angle, float3{ 0, 1, 0 });
+                tcm->openLocalTransformTransaction();
+                for (size_t i = 0; i < count; i += 8) {
+                    tcm->setTransform(tcm->getInstance(entities[i]), t);
+                }
+                tcm->commitLocalTransformTransaction();
+            }
+            benchmark::ClobberMemory();
+            pc.stop();
+            state.SetItemsProcessed(int64_t(state.iterations() * count));
+        }
+    }
+
+public:
+    void TearDown(benchmark::State const&) override {
+        EntityManager::get().destroy(entities.size(), entities.data());
+        entities.clear();
+        tcm.reset();
+        js->emancipate();
+        js.reset();
+    }
+};
+
+BENCHMARK_DEFINE_F(FilamentTransformManagerFixture, deepHierarchy)(benchmark::State& state) {
+    createHierarchy(state, 256);
+    run(state);
+}
+
+BENCHMARK_DEFINE_F(FilamentTransformManagerFixture, wideHierarchy)(benchmark::State& state) {
+    createHierarchy(state, 1);
+    run(state);
+}
+
+BENCHMARK_REGISTER_F(FilamentTransformManagerFixture, deepHierarchy)
+        ->Args({ 10'000, 0 })->Args({ 10'000, 1 })->Args({ 100'000, 0 })->Args({ 100'000, 1 });
+
+BENCHMARK_REGISTER_F(FilamentTransformManagerFixture, wideHierarchy)
+        ->Args({ 10'000, 0 })->Args({ 10'000, 1 })->Args({ 100'000, 0 })->Args({ 100'000, 1 });
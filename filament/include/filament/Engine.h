@@ -32,6 +32,9 @@ namespace utils {
 class Entity;
 class EntityManager;
 class JobSystem;
+namespace io {
+class ostream;
+} // namespace io
 } // namespace utils
 
 namespace filament {
@@ -662,6 +665,11 @@ public:
      * that the scene doesn't contain any identical primitives, automatic instancing can have some
      * overhead and it is then best to disable it.
      *
+     * When enabled, opaque draws are sorted so that identical primitives are consecutive, instead
+     * of front-to-back. The number of draw calls saved during the current frame can be queried
+     * with the DebugRegistry properties "d.instancing.draw_calls_saved" and
+     * "d.instancing.instanced_draw_calls".
+     *
      * Disabled by default.
      *
      * @param enable true to enable, false to disable automatic instancing.
@@ -677,6 +685,140 @@ public:
      */
     bool isAutomaticInstancingEnabled() const noexcept;
 
+    /**
+     * Enables or disables the profiling of the backend command stream.
+     *
+     * When enabled, the number of executions, the space used in the command buffer and the
+     * time spent on the backend thread are recorded for each type of backend command. This
+     * works with all backends, including Backend::NOOP, which allows measuring the cost of the
+     * command stream itself on headless machines. The overhead is small but not negligible, so
+     * this shouldn't be left enabled in production.
+     *
+     * Enabling profiling discards the previously recorded data. Disabling it keeps the recorded
+     * data available until profiling is enabled again.
+     *
+     * @param enable true to enable, false to disable command stream profiling.
+     *
+     * @see writeCommandStreamHistogram
+     * @see writeCommandStreamTrace
+     */
+    void setCommandStreamProfilingEnabled(bool enable);
+
+    /**
+     * @return true if command stream profiling is enabled, false otherwise.
+     * @see setCommandStreamProfilingEnabled
+     */
+    bool isCommandStreamProfilingEnabled() const noexcept;
+
+    /**
+     * Writes the per-frame statistics recorded by the command stream profiler as CSV, with the
+     * columns: frame, command, count, bytes, duration_ns. Frames end with Renderer::endFrame()
+     * and only the last 120 frames are kept.
+     *
+     * Commands are recorded as they're executed by the backend thread, call flushAndWait()
+     * first to make sure all commands issued so far are accounted for.
+     *
+     * @param out stream to write the histogram to.
+     *
+     * @see setCommandStreamProfilingEnabled
+     */
+    void writeCommandStreamHistogram(utils::io::ostream& out) const;
+
+    /**
+     * Writes each backend command execution recorded by the command stream profiler as a
+     * JSON trace, in the Chrome trace event format (viewable with chrome://tracing or
+     * Perfetto). Only the first 262,144 commands are recorded.
+     *
+     * @param out stream to write the trace to.
+     *
+     * @see setCommandStreamProfilingEnabled
+     * @see writeCommandStreamHistogram
+     */
+    void writeCommandStreamTrace(utils::io::ostream& out) const;
+
+    /**
+     * Writes a manifest of the variants of each material used since the materials were
+     * created, i.e. the shader programs that were needed to render. Variants are listed in the
+     * order they were first used.
+     *
+     * The manifest is meant to be saved at the end of a representative session of the
+     * application and given to loadMaterialVariantManifest() at the next start, so that these
+     * variants are compiled when the materials are loaded instead of the first time they're
+     * needed, which otherwise causes a hitch, e.g. when a light or a shadow first appears.
+     *
+     * Materials are identified by their package, a material that is modified must be
+     * profiled again.
+     *
+     * @param out stream to write the manifest to, it's a small text file.
+     *
+     * @see loadMaterialVariantManifest
+     */
+    void writeMaterialVariantManifest(utils::io::ostream& out) const;
+
+    /**
+     * Sets the manifest written by writeMaterialVariantManifest() in a previous session. The
+     * variants it lists are compiled for the materials that already exist and for each
+     * material created afterwards, in the order they were first used in that session.
+     * Compilation is asynchronous on backends that support parallel shader compilation.
+     *
+     * Loading a manifest replaces the previous one.
+     *
+     * @param data manifest data, it doesn't need to outlive this call.
+     * @param size size of the manifest in bytes.
+     * @return false if the data is not a valid manifest, in which case nothing is compiled.
+     *
+     * @see writeMaterialVariantManifest
+     */
+    bool loadMaterialVariantManifest(const void* UTILS_NONNULL data, size_t size);
+
+    /**
+     * Statistics of the cache of the transient textures used by the frame graph (e.g. the
+     * render targets of the post-processing passes).
+     *
+     * Counters accumulate from the creation of the Engine, the sizes are estimates of the GPU
+     * memory used by the textures. A steady number of misses and evictions typically means that
+     * the cache budget is too small, or that the resolution of a View changes every frame.
+     *
+     * @see getResourceAllocatorStats
+     */
+    struct ResourceAllocatorStats {
+        uint64_t hits = 0;          //!< number of textures reused from the cache
+        uint64_t misses = 0;        //!< number of textures that had to be created
+        uint64_t evictions = 0;     //!< number of cached textures destroyed
+        size_t cachedSize = 0;      //!< size in bytes of the textures in the cache
+        size_t inUseSize = 0;       //!< size in bytes of the textures currently in use
+        uint32_t cachedCount = 0;   //!< number of textures in the cache
+        uint32_t inUseCount = 0;    //!< number of textures currently in use
+    };
+
+    /**
+     * Sets the maximum size of the cache of transient textures, this overrides
+     * Config::resourceAllocatorCacheSizeMB.
+     *
+     * Textures that are no longer in use are kept in the cache so they can be reused by the
+     * following frames. When the cache exceeds its budget, the least recently used textures
+     * are destroyed first and, among textures last used in the same frame, the largest ones.
+     * Textures larger than the budget are never cached. Independently of the budget, textures
+     * unused for more than Config::resourceAllocatorCacheMaxAge frames are destroyed.
+     *
+     * @param budget maximum size in bytes of the textures in the cache.
+     *
+     * @see getResourceAllocatorStats
+     */
+    void setResourceAllocatorCacheBudget(size_t budget) noexcept;
+
+    /**
+     * @return the maximum size in bytes of the cache of transient textures.
+     * @see setResourceAllocatorCacheBudget
+     */
+    size_t getResourceAllocatorCacheBudget() const noexcept;
+
+    /**
+     * @return the statistics of the cache of transient textures.
+     * @see ResourceAllocatorStats
+     */
+    ResourceAllocatorStats getResourceAllocatorStats() const noexcept;
+
     /**
      * Creates a SwapChain from the given Operating System's native window handle.
      *
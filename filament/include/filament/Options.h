@@ -475,6 +475,7 @@ struct TemporalAntiAliasingOptions {
 
     bool preventFlickering = false;     //!< adjust the feedback dynamically to reduce flickering
     bool historyReprojection = true;    //!< whether to apply history reprojection (debug option)
+    bool motionVectors = false;         //!< reproject the history of moving objects using per-object motion vectors, useful with upscaling
 };
 
 /**
@@ -595,6 +596,52 @@ struct SoftShadowOptions {
     float penumbraRatioScale = 1.0f;
 };
 
+/**
+ * View-level options for caching shadow maps across frames.
+ * @see setShadowMapCachingOptions()
+ * @warning This API is still experimental and subject to change.
+ */
+struct ShadowMapCachingOptions {
+    /**
+     * Enables shadow map caching. A cached shadow map is not rendered again as long as its light
+     * and the shadow casters within its frustum don't change.
+     * Caching is not supported with ShadowType::VSM, in which case this option is ignored.
+     */
+    bool enabled = false;
+
+    /**
+     * A cached directional shadow cascade is reused until the cascade's projection has moved by
+     * more than this fraction of the shadow map, which allows caching cascades while the camera
+     * moves. Parts of the cascade's frustum not covered by the cached shadow map can lose their
+     * shadows, so this should be kept small and is typically only useful for the far cascades.
+     * 0 means cascades are cached only when their projection didn't change.
+     */
+    float cascadeThreshold = 0.0f;
+};
+
+/**
+ * View-level options for the shadow map atlas, the texture all the shadow maps of a View are
+ * packed into. Shadow maps of different sizes share the layers of the atlas.
+ * @see setShadowMapAtlasOptions()
+ * @warning This API is still experimental and subject to change.
+ */
+struct ShadowMapAtlasOptions {
+    /**
+     * Chooses the resolution of spot and point light shadow maps from the light's coverage of
+     * the screen. LightManager::ShadowOptions::mapSize becomes the maximum resolution, lights
+     * covering a small part of the screen use a shadow map up to 8 times smaller.
+     */
+    bool screenSpaceResolution = false;
+
+    /**
+     * Maximum size in bytes of the shadow map atlas, or 0 for no limit. When the shadow maps
+     * don't fit, the resolution of the largest shadow maps is lowered until they do, down to
+     * 1/8th of LightManager::ShadowOptions::mapSize. At equal resolution, the farthest spot and
+     * point lights are lowered first.
+     */
+    uint32_t memoryBudget = 0;
+};
+
 /**
  * Options for stereoscopic (multi-eye) rendering.
  */
@@ -334,6 +334,20 @@ public:
          */
         Builder& screenSpaceContactShadows(bool enable) noexcept;
 
+        /**
+         * Controls if this renderable hides other renderables when occlusion culling is enabled
+         * on the View (false by default).
+         *
+         * The occluding shape of an occluder is its axis-aligned bounding box, transformed by
+         * its world transform. Therefore only renderables that entirely fill their bounding box,
+         * such as walls, floors or buildings, should be marked as occluders, otherwise objects
+         * that are actually visible could be culled. Instanced renderables are never used as
+         * occluders.
+         *
+         * @see View::setOcclusionCullingEnabled()
+         */
+        Builder& occluder(bool enable) noexcept;
+
         /**
          * Allows bones to be swapped out and shared using SkinningBuffer.
          *
@@ -689,6 +703,21 @@ public:
      */
     void setScreenSpaceContactShadows(Instance instance, bool enable) noexcept;
 
+    /**
+     * Changes whether or not the renderable hides other renderables when occlusion culling is
+     * enabled.
+     *
+     * \see Builder::occluder()
+     */
+    void setOccluder(Instance instance, bool enable) noexcept;
+
+    /**
+     * Checks if the renderable is an occluder.
+     *
+     * \see Builder::occluder()
+     */
+    bool isOccluder(Instance instance) const noexcept;
+
     /**
      * Checks if the renderable can cast shadows.
      *
@@ -168,6 +168,31 @@ public:
      */
     bool hasEntity(utils::Entity entity) const noexcept;
 
+    /**
+     * Enables or disables hierarchical culling.
+     *
+     * When enabled, a bounding volume hierarchy of the renderables' world-space bounding boxes is
+     * maintained across frames and used to reject or accept whole groups of renderables during
+     * frustum culling. This benefits large scenes where most renderables don't move. Renderables
+     * added to or removed from the scene are inserted into or removed from the hierarchy, and
+     * the nodes above the ones that moved are refit. It is only rebuilt when a large part of
+     * the scene changed at once, so this is counterproductive when most renderables move every
+     * frame.
+     *
+     * Hierarchical culling is disabled by default.
+     *
+     * @param enabled true to enable hierarchical culling, false to disable it.
+     */
+    void setHierarchicalCullingEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether hierarchical culling is enabled.
+     *
+     * @return true if hierarchical culling is enabled.
+     * @see setHierarchicalCullingEnabled
+     */
+    bool isHierarchicalCullingEnabled() const noexcept;
+
     /**
      * Invokes user functor on each entity in the scene.
      *
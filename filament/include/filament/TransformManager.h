@@ -323,6 +323,10 @@ public:
      * Commits the currently open local transform transaction. When this returns, calls
      * to getWorldTransform() will return the proper value.
      *
+     * Only the world transforms of the components whose local transform changed during the
+     * transaction, and of their descendants, are recomputed. Independent subtrees are processed
+     * in parallel.
+     *
      * @attention failing to call this method when done updating the local transform will cause
      *            a lot of rendering problems. The system never closes the transaction
      *            automatically.
@@ -85,6 +85,8 @@ public:
     using MultiSampleAntiAliasingOptions = filament::MultiSampleAntiAliasingOptions;
     using VsmShadowOptions = filament::VsmShadowOptions;
     using SoftShadowOptions = filament::SoftShadowOptions;
+    using ShadowMapCachingOptions = filament::ShadowMapCachingOptions;
+    using ShadowMapAtlasOptions = filament::ShadowMapAtlasOptions;
     using ScreenSpaceReflectionsOptions = filament::ScreenSpaceReflectionsOptions;
     using GuardBandOptions = filament::GuardBandOptions;
     using StereoscopicOptions = filament::StereoscopicOptions;
@@ -605,6 +607,82 @@ public:
      */
     SoftShadowOptions getSoftShadowOptions() const noexcept;
 
+    /**
+     * Sets the shadow map caching options of this View (caching is disabled by default).
+     *
+     * When enabled, the shadow maps are kept from one frame to the next and a shadow map is only
+     * rendered again when its light, its projection or the shadow casters in its frustum change.
+     * This greatly reduces the cost of shadows for static lights in mostly static scenes.
+     *
+     * Shadow casters are considered changed when they move, when their geometry or material
+     * instances are replaced, or when they're skinned or morphed. Changes made to the content of
+     * a caster's buffers, or to the parameters of its material instances, are not detected:
+     * invalidateShadowMaps() must be called after such changes.
+     *
+     * @param options Options for shadow map caching.
+     *
+     * @see getShadowMapStats, invalidateShadowMaps
+     *
+     * @warning This API is still experimental and subject to change.
+     */
+    void setShadowMapCachingOptions(ShadowMapCachingOptions const& options) noexcept;
+
+    /**
+     * Returns the shadow map caching options associated with this View.
+     *
+     * @return value set by setShadowMapCachingOptions().
+     */
+    ShadowMapCachingOptions getShadowMapCachingOptions() const noexcept;
+
+    /**
+     * Discards the shadow maps kept by shadow map caching, they are all rendered again in the
+     * next frame.
+     *
+     * This must be called after changing the content of a shadow caster's vertex or index buffers,
+     * or the parameters of its material instances, which shadow map caching doesn't detect.
+     *
+     * @see setShadowMapCachingOptions
+     */
+    void invalidateShadowMaps() noexcept;
+
+    /**
+     * Sets the shadow map atlas options of this View.
+     *
+     * All the shadow maps of a View are packed into a texture atlas made of several layers.
+     * These options control the resolution of each shadow map and the memory used by the atlas.
+     *
+     * @param options Options for the shadow map atlas.
+     *
+     * @see getShadowMapStats
+     *
+     * @warning This API is still experimental and subject to change.
+     */
+    void setShadowMapAtlasOptions(ShadowMapAtlasOptions const& options) noexcept;
+
+    /**
+     * Returns the shadow map atlas options associated with this View.
+     *
+     * @return value set by setShadowMapAtlasOptions().
+     */
+    ShadowMapAtlasOptions getShadowMapAtlasOptions() const noexcept;
+
+    /** Shadow maps used in the last frame rendered with this View */
+    struct ShadowMapStats {
+        uint32_t renderedCount = 0;     //!< shadow maps rendered during the frame
+        uint32_t cachedCount = 0;       //!< shadow maps reused from a previous frame
+        uint32_t atlasDimension = 0;    //!< width and height in texels of the shadow map atlas
+        uint32_t atlasLayerCount = 0;   //!< number of layers of the shadow map atlas
+    };
+
+    /**
+     * Returns how many shadow maps were rendered and how many were reused from the cache in the
+     * last frame rendered with this View, as well as the size of the shadow map atlas.
+     *
+     * @return the shadow map statistics of the last frame
+     * @see setShadowMapCachingOptions, setShadowMapAtlasOptions
+     */
+    ShadowMapStats getShadowMapStats() const noexcept;
+
     /**
      * Enables or disables post processing. Enabled by default.
      *
@@ -707,6 +785,51 @@ public:
      */
     StereoscopicOptions const& getStereoscopicOptions() const noexcept;
 
+    /**
+     * Enables or disables occlusion culling (disabled by default).
+     *
+     * When enabled, the renderables marked as occluders (see RenderableManager::Builder::occluder)
+     * that are visible are rasterized on the CPU into a low resolution depth buffer after
+     * frustum culling. Renderables entirely hidden behind occluders are then culled.
+     *
+     * This is beneficial for dense scenes with large occluders, e.g. indoor or city scenes.
+     * Occlusion culling has no effect when frustum culling is disabled.
+     *
+     * @param enabled true to enable occlusion culling, false to disable it.
+     */
+    void setOcclusionCullingEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether occlusion culling is enabled.
+     *
+     * @return true if occlusion culling is enabled.
+     * @see setOcclusionCullingEnabled
+     */
+    bool isOcclusionCullingEnabled() const noexcept;
+
+    /**
+     * Enables or disables caching of the rendering commands (disabled by default).
+     *
+     * When enabled, the commands generated for a renderable are kept from one frame to the next
+     * and reused as long as nothing that affects them changed (material instance, primitives,
+     * visibility, approximate distance to the camera, etc...). This makes the cost of preparing
+     * the color pass mostly proportional to the number of renderables that changed, which is
+     * beneficial for large scenes that are mostly static.
+     *
+     * The cache uses memory proportional to the number of visible primitives.
+     *
+     * @param enabled true to enable command caching, false to disable it.
+     */
+    void setCommandCachingEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether command caching is enabled.
+     *
+     * @return true if command caching is enabled.
+     * @see setCommandCachingEnabled
+     */
+    bool isCommandCachingEnabled() const noexcept;
+
     // for debugging...
 
     //! debugging: allows to entirely disable frustum culling. (culling enabled by default).
@@ -20,6 +20,21 @@
 
 #include <math/fast.h>
 
+#include <utils/debug.h>
+
+#include <string.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#   include <arm_neon.h>
+#   define FILAMENT_CULLER_USE_NEON 1
+#elif defined(__x86_64__) && defined(__SSE2__) && (defined(__clang__) || defined(__GNUC__))
+#   include <immintrin.h>
+#   define FILAMENT_CULLER_USE_SSE 1
+#   if !defined(__EMSCRIPTEN__)
+#       define FILAMENT_CULLER_USE_AVX2 1
+#   endif
+#endif
+
 using namespace filament::math;
 
 // use 8 if Culler::result_type is 8-bits, on ARMv8 it allows the compiler to write eight
@@ -31,15 +46,38 @@ namespace filament {
 static_assert(Culler::MODULO % FILAMENT_CULLER_VECTORIZE_HINT == 0,
         "MODULO m=must be a multiple of FILAMENT_CULLER_VECTORIZE_HINT");
 
-void Culler::intersects(
-        result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
+static_assert(Culler::MODULO % 8 == 0,
+        "MODULO must be a multiple of the widest kernel (8)");
+
+namespace {
+
+using result_type = Culler::result_type;
+
+using BoxKernel = void(*)(result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit);
+
+using SphereKernel = void(*)(result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
         float4 const* UTILS_RESTRICT b,
-        size_t count) noexcept {
+        size_t count);
+
+struct Kernels {
+    BoxKernel box;
+    SphereKernel sphere;
+};
 
-    float4 const * const UTILS_RESTRICT planes = frustum.mPlanes;
+// ------------------------------------------------------------------------------------------------
+// Scalar kernels
+// ------------------------------------------------------------------------------------------------
 
-    count = round(count);
+void intersectsSphereScalar(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
     #pragma clang loop vectorize_width(FILAMENT_CULLER_VECTORIZE_HINT)
     for (size_t i = 0; i < count; i++) {
         int visible = ~0;
@@ -59,16 +97,12 @@ void Culler::intersects(
     }
 }
 
-void Culler::intersects(
+void intersectsBoxScalar(
         result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
+        float4 const* UTILS_RESTRICT planes,
         float3 const* UTILS_RESTRICT center,
         float3 const* UTILS_RESTRICT extent,
         size_t count, size_t bit) noexcept {
-
-    float4 const * UTILS_RESTRICT const planes = frustum.mPlanes;
-
-    count = round(count);
     #pragma clang loop vectorize_width(FILAMENT_CULLER_VECTORIZE_HINT)
     for (size_t i = 0; i < count; i++) {
         int visible = ~0;
@@ -93,6 +127,371 @@ void Culler::intersects(
     }
 }
 
+#if defined(FILAMENT_CULLER_USE_SSE)
+
+// ------------------------------------------------------------------------------------------------
+// x86 kernels
+//
+// The inputs are stored as arrays of float3/float4 (AoS), they're transposed in registers to SoA
+// so that each lane processes one object. An object is visible if the dot product with all
+// 6 planes is negative, i.e. if the sign bit of the AND of the 6 results is set, this matches
+// exactly what fast::signbit() does in the scalar kernels.
+// ------------------------------------------------------------------------------------------------
+
+// expands a 4-bits mask to four bytes set to 0 or 1 (little-endian)
+constexpr uint32_t EXPAND_MASK4[16] = {
+        0x00000000, 0x00000001, 0x00000100, 0x00000101,
+        0x00010000, 0x00010001, 0x00010100, 0x00010101,
+        0x01000000, 0x01000001, 0x01000100, 0x01000101,
+        0x01010000, 0x01010001, 0x01010100, 0x01010101,
+};
+
+inline void storeResults4(result_type* UTILS_RESTRICT results, uint32_t mask) noexcept {
+    uint32_t const r = EXPAND_MASK4[mask & 0xF];
+    memcpy(results, &r, sizeof(r));
+}
+
+inline void mergeResults4(result_type* UTILS_RESTRICT results,
+        uint32_t mask, size_t bit) noexcept {
+    uint32_t r;
+    memcpy(&r, results, sizeof(r));
+    r &= ~(0x01010101u << bit);
+    r |= EXPAND_MASK4[mask & 0xF] << bit;
+    memcpy(results, &r, sizeof(r));
+}
+
+// a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3  ->  x, y, z
+inline void transpose3x4(__m128 a, __m128 b, __m128 c,
+        __m128& x, __m128& y, __m128& z) noexcept {
+    __m128 const x0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 2, 3, 0));   // x0 x1 x2 x2
+    __m128 const x1 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));   // x2 x2 x3 x3
+    __m128 const y0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));   // y0 y0 y1 y1
+    __m128 const y1 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));   // y2 y2 y3 y3
+    __m128 const z0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));   // z0 z0 z1 z1
+    __m128 const z1 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));   // z2 z2 z3 z3
+    x = _mm_shuffle_ps(x0, x1, _MM_SHUFFLE(2, 0, 1, 0));
+    y = _mm_shuffle_ps(y0, y1, _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(z0, z1, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+inline void loadBox4(float3 const* UTILS_RESTRICT v,
+        __m128& x, __m128& y, __m128& z) noexcept {
+    float const* const p = &v->x;
+    transpose3x4(_mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8), x, y, z);
+}
+
+inline void loadSphere4(float4 const* UTILS_RESTRICT v,
+        __m128& x, __m128& y, __m128& z, __m128& w) noexcept {
+    float const* const p = &v->x;
+    x = _mm_loadu_ps(p);
+    y = _mm_loadu_ps(p + 4);
+    z = _mm_loadu_ps(p + 8);
+    w = _mm_loadu_ps(p + 12);
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+}
+
+void intersectsSphereSSE(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 x, y, z, w;
+        loadSphere4(b + i, x, y, z, w);
+        __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (size_t j = 0; j < 6; j++) {
+            __m128 dot = _mm_mul_ps(_mm_set1_ps(planes[j].x), x);
+            dot = _mm_add_ps(dot, _mm_mul_ps(_mm_set1_ps(planes[j].y), y));
+            dot = _mm_add_ps(dot, _mm_mul_ps(_mm_set1_ps(planes[j].z), z));
+            dot = _mm_add_ps(dot, _mm_set1_ps(planes[j].w));
+            dot = _mm_sub_ps(dot, w);
+            visible = _mm_and_ps(visible, dot);
+        }
+        storeResults4(results + i, uint32_t(_mm_movemask_ps(visible)));
+    }
+}
+
+void intersectsBoxSSE(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 cx, cy, cz, ex, ey, ez;
+        loadBox4(center + i, cx, cy, cz);
+        loadBox4(extent + i, ex, ey, ez);
+        __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (size_t j = 0; j < 6; j++) {
+            float4 const p = planes[j];
+            __m128 dot = _mm_sub_ps(
+                    _mm_mul_ps(_mm_set1_ps(p.x), cx),
+                    _mm_mul_ps(_mm_set1_ps(std::abs(p.x)), ex));
+            dot = _mm_add_ps(dot, _mm_sub_ps(
+                    _mm_mul_ps(_mm_set1_ps(p.y), cy),
+                    _mm_mul_ps(_mm_set1_ps(std::abs(p.y)), ey)));
+            dot = _mm_add_ps(dot, _mm_sub_ps(
+                    _mm_mul_ps(_mm_set1_ps(p.z), cz),
+                    _mm_mul_ps(_mm_set1_ps(std::abs(p.z)), ez)));
+            dot = _mm_add_ps(dot, _mm_set1_ps(p.w));
+            visible = _mm_and_ps(visible, dot);
+        }
+        mergeResults4(results + i, uint32_t(_mm_movemask_ps(visible)), bit);
+    }
+}
+
+#endif // FILAMENT_CULLER_USE_SSE
+
+#if defined(FILAMENT_CULLER_USE_AVX2)
+
+// These are compiled for AVX2 regardless of the compiler flags, they must only be called
+// after checking the CPU supports it.
+#define FILAMENT_CULLER_AVX2 __attribute__((target("avx2")))
+
+FILAMENT_CULLER_AVX2
+inline __m256 combine(__m128 lo, __m128 hi) noexcept {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+FILAMENT_CULLER_AVX2
+void intersectsSphereAVX2(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    for (size_t i = 0; i < count; i += 8) {
+        __m128 x0, y0, z0, w0, x1, y1, z1, w1;
+        loadSphere4(b + i, x0, y0, z0, w0);
+        loadSphere4(b + i + 4, x1, y1, z1, w1);
+        __m256 const x = combine(x0, x1);
+        __m256 const y = combine(y0, y1);
+        __m256 const z = combine(z0, z1);
+        __m256 const w = combine(w0, w1);
+        __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (size_t j = 0; j < 6; j++) {
+            __m256 dot = _mm256_mul_ps(_mm256_set1_ps(planes[j].x), x);
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(_mm256_set1_ps(planes[j].y), y));
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(_mm256_set1_ps(planes[j].z), z));
+            dot = _mm256_add_ps(dot, _mm256_set1_ps(planes[j].w));
+            dot = _mm256_sub_ps(dot, w);
+            visible = _mm256_and_ps(visible, dot);
+        }
+        uint32_t const mask = uint32_t(_mm256_movemask_ps(visible));
+        storeResults4(results + i, mask);
+        storeResults4(results + i + 4, mask >> 4u);
+    }
+}
+
+FILAMENT_CULLER_AVX2
+void intersectsBoxAVX2(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    for (size_t i = 0; i < count; i += 8) {
+        __m128 cx0, cy0, cz0, ex0, ey0, ez0;
+        __m128 cx1, cy1, cz1, ex1, ey1, ez1;
+        loadBox4(center + i, cx0, cy0, cz0);
+        loadBox4(center + i + 4, cx1, cy1, cz1);
+        loadBox4(extent + i, ex0, ey0, ez0);
+        loadBox4(extent + i + 4, ex1, ey1, ez1);
+        __m256 const cx = combine(cx0, cx1);
+        __m256 const cy = combine(cy0, cy1);
+        __m256 const cz = combine(cz0, cz1);
+        __m256 const ex = combine(ex0, ex1);
+        __m256 const ey = combine(ey0, ey1);
+        __m256 const ez = combine(ez0, ez1);
+        __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (size_t j = 0; j < 6; j++) {
+            float4 const p = planes[j];
+            __m256 dot = _mm256_sub_ps(
+                    _mm256_mul_ps(_mm256_set1_ps(p.x), cx),
+                    _mm256_mul_ps(_mm256_set1_ps(std::abs(p.x)), ex));
+            dot = _mm256_add_ps(dot, _mm256_sub_ps(
+                    _mm256_mul_ps(_mm256_set1_ps(p.y), cy),
+                    _mm256_mul_ps(_mm256_set1_ps(std::abs(p.y)), ey)));
+            dot = _mm256_add_ps(dot, _mm256_sub_ps(
+                    _mm256_mul_ps(_mm256_set1_ps(p.z), cz),
+                    _mm256_mul_ps(_mm256_set1_ps(std::abs(p.z)), ez)));
+            dot = _mm256_add_ps(dot, _mm256_set1_ps(p.w));
+            visible = _mm256_and_ps(visible, dot);
+        }
+        uint32_t const mask = uint32_t(_mm256_movemask_ps(visible));
+        mergeResults4(results + i, mask, bit);
+        mergeResults4(results + i + 4, mask >> 4u, bit);
+    }
+}
+
+#undef FILAMENT_CULLER_AVX2
+
+#endif // FILAMENT_CULLER_USE_AVX2
+
+#if defined(FILAMENT_CULLER_USE_NEON)
+
+// ------------------------------------------------------------------------------------------------
+// ARMv8 kernels
+//
+// vld3q/vld4q de-interleave the AoS inputs for free. Eight objects are processed per iteration
+// so that the results can be narrowed and written as a single 64-bits store.
+// ------------------------------------------------------------------------------------------------
+
+inline uint32x4_t sphereVisible4(float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b) noexcept {
+    float32x4x4_t const s = vld4q_f32(&b->x);
+    uint32x4_t visible = vdupq_n_u32(~0u);
+    for (size_t j = 0; j < 6; j++) {
+        float32x4_t dot = vmulq_n_f32(s.val[0], planes[j].x);
+        dot = vmlaq_n_f32(dot, s.val[1], planes[j].y);
+        dot = vmlaq_n_f32(dot, s.val[2], planes[j].z);
+        dot = vaddq_f32(dot, vdupq_n_f32(planes[j].w));
+        dot = vsubq_f32(dot, s.val[3]);
+        visible = vandq_u32(visible, vreinterpretq_u32_f32(dot));
+    }
+    return vshrq_n_u32(visible, 31);
+}
+
+inline uint32x4_t boxVisible4(float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent) noexcept {
+    float32x4x3_t const c = vld3q_f32(&center->x);
+    float32x4x3_t const e = vld3q_f32(&extent->x);
+    uint32x4_t visible = vdupq_n_u32(~0u);
+    for (size_t j = 0; j < 6; j++) {
+        float4 const p = planes[j];
+        float32x4_t dot = vmulq_n_f32(c.val[0], p.x);
+        dot = vmlsq_n_f32(dot, e.val[0], std::abs(p.x));
+        dot = vmlaq_n_f32(dot, c.val[1], p.y);
+        dot = vmlsq_n_f32(dot, e.val[1], std::abs(p.y));
+        dot = vmlaq_n_f32(dot, c.val[2], p.z);
+        dot = vmlsq_n_f32(dot, e.val[2], std::abs(p.z));
+        dot = vaddq_f32(dot, vdupq_n_f32(p.w));
+        visible = vandq_u32(visible, vreinterpretq_u32_f32(dot));
+    }
+    return vshrq_n_u32(visible, 31);
+}
+
+inline uint8x8_t narrow8(uint32x4_t lo, uint32x4_t hi) noexcept {
+    return vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+}
+
+void intersectsSphereNEON(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    for (size_t i = 0; i < count; i += 8) {
+        vst1_u8(results + i, narrow8(
+                sphereVisible4(planes, b + i),
+                sphereVisible4(planes, b + i + 4)));
+    }
+}
+
+void intersectsBoxNEON(
+        result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    int8x8_t const shift = vdup_n_s8(int8_t(bit));
+    uint8x8_t const clear = vdup_n_u8(uint8_t(1u << bit));
+    for (size_t i = 0; i < count; i += 8) {
+        uint8x8_t const visible = narrow8(
+                boxVisible4(planes, center + i, extent + i),
+                boxVisible4(planes, center + i + 4, extent + i + 4));
+        uint8x8_t r = vld1_u8(results + i);
+        r = vbic_u8(r, clear);
+        r = vorr_u8(r, vshl_u8(visible, shift));
+        vst1_u8(results + i, r);
+    }
+}
+
+#endif // FILAMENT_CULLER_USE_NEON
+
+bool isIsaSupported(Culler::Isa isa) noexcept {
+    switch (isa) {
+        case Culler::Isa::SCALAR:
+            return true;
+        case Culler::Isa::SSE:
+#if defined(FILAMENT_CULLER_USE_SSE)
+            return true;
+#else
+            return false;
+#endif
+        case Culler::Isa::AVX2:
+#if defined(FILAMENT_CULLER_USE_AVX2)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        case Culler::Isa::NEON:
+#if defined(FILAMENT_CULLER_USE_NEON)
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+Kernels getKernels(Culler::Isa isa) noexcept {
+    switch (isa) {
+#if defined(FILAMENT_CULLER_USE_SSE)
+        case Culler::Isa::SSE:
+            return { intersectsBoxSSE, intersectsSphereSSE };
+#endif
+#if defined(FILAMENT_CULLER_USE_AVX2)
+        case Culler::Isa::AVX2:
+            return { intersectsBoxAVX2, intersectsSphereAVX2 };
+#endif
+#if defined(FILAMENT_CULLER_USE_NEON)
+        case Culler::Isa::NEON:
+            return { intersectsBoxNEON, intersectsSphereNEON };
+#endif
+        default:
+            return { intersectsBoxScalar, intersectsSphereScalar };
+    }
+}
+
+Culler::Isa selectIsa() noexcept {
+    for (Culler::Isa isa : { Culler::Isa::AVX2, Culler::Isa::NEON, Culler::Isa::SSE }) {
+        if (isIsaSupported(isa)) {
+            return isa;
+        }
+    }
+    return Culler::Isa::SCALAR;
+}
+
+// CPU detection happens only once, the first time a culling kernel is needed.
+Kernels const& kernels() noexcept {
+    static const Kernels sKernels = getKernels(Culler::getIsa());
+    return sKernels;
+}
+
+} // anonymous namespace
+
+Culler::Isa Culler::getIsa() noexcept {
+    static const Isa sIsa = selectIsa();
+    return sIsa;
+}
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    kernels().sphere(results, frustum.mPlanes, b, round(count));
+}
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    kernels().box(results, frustum.mPlanes, center, extent, round(count), bit);
+}
+
 /*
  * returns whether a box intersects with the frustum
  */
@@ -138,4 +537,26 @@ void Culler::Test::intersects(
     Culler::intersects(results, frustum, b, count);
 }
 
+bool Culler::Test::isSupported(Isa isa) noexcept {
+    return isIsaSupported(isa);
+}
+
+void Culler::Test::intersects(Isa isa,
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float3 const* UTILS_RESTRICT c,
+        float3 const* UTILS_RESTRICT e,
+        size_t count) noexcept {
+    assert_invariant(isIsaSupported(isa));
+    getKernels(isa).box(results, frustum.mPlanes, c, e, round(count), 0);
+}
+
+void Culler::Test::intersects(Isa isa,
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float4 const* UTILS_RESTRICT b, size_t count) noexcept {
+    assert_invariant(isIsaSupported(isa));
+    getKernels(isa).sphere(results, frustum.mPlanes, b, round(count));
+}
+
 } // namespace filament
@@ -25,6 +25,8 @@
 #include <math/vec4.h>
 #include <math/vec2.h>
 
+#include <stdint.h>
+
 namespace filament {
 
 /*
@@ -44,6 +46,20 @@ public:
 
     using result_type = uint8_t;
 
+    /*
+     * Instruction set used by the batched intersection kernels. The best kernel available
+     * on the current CPU is selected once, at runtime, the first time it's needed.
+     */
+    enum class Isa : uint8_t {
+        SCALAR,     // plain C++, relies on auto-vectorization
+        SSE,        // 4-wide, x86-64
+        AVX2,       // 8-wide, x86-64 (runtime detected)
+        NEON        // 4-wide, ARMv8
+    };
+
+    // returns the instruction set used by intersects()
+    static Isa getIsa() noexcept;
+
     /*
      * returns whether each AABB in an array intersects with the frustum
      */
@@ -88,6 +104,20 @@ public:
                 Frustum const& frustum,
                 math::float4 const* b,
                 size_t count) noexcept;
+
+        // these variants force a specific kernel, which must be supported
+        static bool isSupported(Isa isa) noexcept;
+
+        static void intersects(Isa isa, result_type* results,
+                Frustum const& frustum,
+                math::float3 const* c,
+                math::float3 const* e,
+                size_t count) noexcept;
+
+        static void intersects(Isa isa, result_type* results,
+                Frustum const& frustum,
+                math::float4 const* b,
+                size_t count) noexcept;
     };
 };
 
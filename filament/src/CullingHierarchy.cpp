@@ -0,0 +1,520 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CullingHierarchy.h"
+
+#include <utils/debug.h>
+#include <utils/Systrace.h>
+
+#include <math/vec4.h>
+
+#include <algorithm>
+#include <limits>
+
+using namespace filament::math;
+
+namespace filament {
+
+CullingHierarchy::CullingHierarchy() noexcept = default;
+
+CullingHierarchy::~CullingHierarchy() noexcept = default;
+
+void CullingHierarchy::clear() noexcept {
+    // swap with empty containers to actually free the memory
+    std::vector<Node>().swap(mNodes);
+    std::vector<uint8_t>().swap(mDirty);
+    std::vector<uint32_t>().swap(mFreeNodes);
+    std::vector<Primitive>().swap(mPrimitives);
+    std::vector<uint32_t>().swap(mFreePrimitives);
+    tsl::robin_map<uint32_t, uint32_t>().swap(mPrimitiveMap);
+    std::vector<Added>().swap(mAdded);
+    std::vector<uint32_t>().swap(mMoved);
+    mRoot = NONE;
+    mTooDeep = false;
+}
+
+CullingHierarchy::Update CullingHierarchy::update(uint32_t const* keys,
+        float3 const* center, float3 const* extent, size_t count) {
+    beginUpdate(count);
+    for (size_t i = 0; i < count; i++) {
+        updatePrimitive(keys[i], uint32_t(i), center[i], extent[i]);
+    }
+    return endUpdate();
+}
+
+void CullingHierarchy::beginUpdate(size_t count) {
+    // at most `count` primitives can be added or moved
+    if (mAdded.size() < count) {
+        mAdded.resize(count);
+        mMoved.resize(count);
+    }
+    mAddedCount.store(0, std::memory_order_relaxed);
+    mMovedCount.store(0, std::memory_order_relaxed);
+    mReportedCount = uint32_t(count);
+    mFrame++;
+}
+
+void CullingHierarchy::updatePrimitive(uint32_t key, uint32_t index,
+        float3 const& center, float3 const& extent) noexcept {
+    // this can run concurrently: the map is only read here, and each key is reported once so
+    // each primitive is only written by a single thread.
+    auto const pos = mPrimitiveMap.find(key);
+    if (UTILS_UNLIKELY(pos == mPrimitiveMap.end())) {
+        uint32_t const i = mAddedCount.fetch_add(1, std::memory_order_relaxed);
+        assert_invariant(i < mReportedCount);
+        mAdded[i] = { center, key, extent, index };
+        return;
+    }
+    Primitive& prim = mPrimitives[pos->second];
+    assert_invariant(prim.frame != mFrame);
+    assert_invariant(index < mReportedCount);
+    prim.index = index;
+    prim.frame = mFrame;
+    // the leaves keep a copy of the indices so that cull() doesn't need to touch the primitives
+    // of the subtrees it accepts or rejects
+    mNodes[prim.leaf].indices[prim.slot] = index;
+    if (prim.center != center || prim.extent != extent) {
+        prim.center = center;
+        prim.extent = extent;
+        uint32_t const i = mMovedCount.fetch_add(1, std::memory_order_relaxed);
+        assert_invariant(i < mReportedCount);
+        mMoved[i] = pos->second;
+    }
+}
+
+CullingHierarchy::Update CullingHierarchy::endUpdate() {
+    SYSTRACE_CALL();
+
+    uint32_t const added = mAddedCount.load(std::memory_order_relaxed);
+    uint32_t const moved = mMovedCount.load(std::memory_order_relaxed);
+
+    // every reported primitive was either found or added, so the ones that weren't found
+    // were removed. We only need to look for them when there are some.
+    assert_invariant(added <= mReportedCount);
+    size_t const found = mReportedCount - added;
+    assert_invariant(found <= mPrimitiveMap.size());
+    size_t const removed = mPrimitiveMap.size() - found;
+
+    if (!added && !moved && !removed) {
+        return Update::NONE;
+    }
+
+    // Incremental updates keep the existing topology of the tree, which becomes increasingly
+    // loose. When a large part of the scene changed, rebuild instead, this also handles the
+    // initial build.
+    bool const full = mTooDeep || added + moved + removed > mReportedCount / 4;
+
+    if (removed) {
+        for (uint32_t p = 0, e = uint32_t(mPrimitives.size()); p < e; p++) {
+            Primitive const& prim = mPrimitives[p];
+            if (prim.leaf != NONE && prim.frame != mFrame) {
+                mPrimitiveMap.erase(prim.key);
+                if (!full) {
+                    remove(p);
+                }
+                mPrimitives[p].leaf = NONE;
+                mFreePrimitives.push_back(p);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < added; i++) {
+        Added const& a = mAdded[i];
+        uint32_t const p = allocatePrimitive();
+        mPrimitives[p] = { a.center, a.index, a.extent, NONE, a.key, mFrame, 0 };
+        mPrimitiveMap.emplace(a.key, p);
+        if (!full) {
+            insert(p);
+        }
+    }
+
+    if (full || mTooDeep) {
+        rebuild();
+        return Update::REBUILD;
+    }
+
+    if (moved) {
+        // flag the paths from the moved primitives to the root, then refit only those nodes
+        for (uint32_t i = 0; i < moved; i++) {
+            uint32_t n = mPrimitives[mMoved[i]].leaf;
+            while (n != NONE && !mDirty[n]) {
+                mDirty[n] = true;
+                n = mNodes[n].parent;
+            }
+        }
+        refitDirty(mRoot);
+    }
+    return Update::REFIT;
+}
+
+uint32_t CullingHierarchy::allocateNode(uint32_t parent) noexcept {
+    uint32_t index;
+    if (!mFreeNodes.empty()) {
+        index = mFreeNodes.back();
+        mFreeNodes.pop_back();
+    } else {
+        index = uint32_t(mNodes.size());
+        mNodes.emplace_back();
+        mDirty.push_back(false);
+    }
+    mNodes[index].parent = parent;
+    mNodes[index].count = 0;
+    mDirty[index] = false;
+    return index;
+}
+
+uint32_t CullingHierarchy::allocatePrimitive() noexcept {
+    if (!mFreePrimitives.empty()) {
+        uint32_t const index = mFreePrimitives.back();
+        mFreePrimitives.pop_back();
+        return index;
+    }
+    mPrimitives.emplace_back();
+    return uint32_t(mPrimitives.size() - 1);
+}
+
+void CullingHierarchy::insert(uint32_t p) noexcept {
+    float3 const bmin = mPrimitives[p].center - mPrimitives[p].extent;
+    float3 const bmax = mPrimitives[p].center + mPrimitives[p].extent;
+
+    if (mRoot == NONE) {
+        mRoot = allocateNode(NONE);
+        Node& root = mNodes[mRoot];
+        root.count = 1;
+        root.min = bmin;
+        root.max = bmax;
+        place(mRoot, 0, p);
+        return;
+    }
+
+    // half the surface area of a box
+    auto area = [](float3 const& min, float3 const& max) {
+        float3 const d = max - min;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    };
+
+    // descend into the child whose surface area grows the least
+    uint32_t n = mRoot;
+    size_t depth = 0;
+    while (!mNodes[n].isLeaf()) {
+        Node const& node = mNodes[n];
+        Node const& c0 = mNodes[node.items[0]];
+        Node const& c1 = mNodes[node.items[1]];
+        float const cost0 = area(min(c0.min, bmin), max(c0.max, bmax)) - area(c0.min, c0.max);
+        float const cost1 = area(min(c1.min, bmin), max(c1.max, bmax)) - area(c1.min, c1.max);
+        n = cost0 <= cost1 ? node.items[0] : node.items[1];
+        depth++;
+    }
+
+    Node& leaf = mNodes[n];
+    if (leaf.count < LEAF_SIZE) {
+        place(n, leaf.count++, p);
+        refitPath(n);
+    } else {
+        split(n, p);
+        depth++;
+    }
+
+    if (UTILS_UNLIKELY(depth >= MAX_DEPTH)) {
+        mTooDeep = true;
+    }
+}
+
+void CullingHierarchy::split(uint32_t leaf, uint32_t p) noexcept {
+    // distribute the full leaf's primitives plus the new one into two new leaves, split at the
+    // median of the centers along the largest axis of the centers' bounds.
+    uint32_t items[LEAF_SIZE + 1];
+    std::copy_n(mNodes[leaf].items, LEAF_SIZE, items);
+    items[LEAF_SIZE] = p;
+
+    float3 cmin{ std::numeric_limits<float>::max() };
+    float3 cmax{ std::numeric_limits<float>::lowest() };
+    for (uint32_t const i : items) {
+        cmin = min(cmin, mPrimitives[i].center);
+        cmax = max(cmax, mPrimitives[i].center);
+    }
+    float3 const size = cmax - cmin;
+    size_t const axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+    std::sort(std::begin(items), std::end(items), [this, axis](uint32_t lhs, uint32_t rhs) {
+        return mPrimitives[lhs].center[axis] < mPrimitives[rhs].center[axis];
+    });
+
+    uint32_t const half = (LEAF_SIZE + 1) / 2;
+    uint32_t const children[2] = { allocateNode(leaf), allocateNode(leaf) };
+    uint32_t const counts[2] = { half, LEAF_SIZE + 1 - half };
+    for (size_t c = 0, first = 0; c < 2; first += counts[c], c++) {
+        Node& child = mNodes[children[c]];
+        child.count = counts[c];
+        for (uint32_t i = 0; i < counts[c]; i++) {
+            place(children[c], i, items[first + i]);
+        }
+        computeBounds(child);
+    }
+
+    // the leaf becomes their parent
+    Node& node = mNodes[leaf];
+    node.count = 0;
+    node.items[0] = children[0];
+    node.items[1] = children[1];
+    refitPath(leaf);
+}
+
+void CullingHierarchy::place(uint32_t leaf, uint32_t slot, uint32_t p) noexcept {
+    Primitive& prim = mPrimitives[p];
+    Node& node = mNodes[leaf];
+    node.items[slot] = p;
+    node.indices[slot] = prim.index;
+    prim.leaf = leaf;
+    prim.slot = slot;
+}
+
+void CullingHierarchy::remove(uint32_t p) noexcept {
+    uint32_t const leaf = mPrimitives[p].leaf;
+    Node& node = mNodes[leaf];
+    assert_invariant(node.items[mPrimitives[p].slot] == p);
+    // move the last primitive of the leaf in the removed one's slot
+    place(leaf, mPrimitives[p].slot, node.items[--node.count]);
+
+    if (node.count) {
+        refitPath(leaf);
+        return;
+    }
+
+    // the leaf is now empty, remove it and replace its parent by its sibling
+    uint32_t const parent = node.parent;
+    mFreeNodes.push_back(leaf);
+    if (parent == NONE) {
+        mRoot = NONE;
+        return;
+    }
+
+    Node const& parentNode = mNodes[parent];
+    uint32_t const sibling = parentNode.items[0] == leaf ? parentNode.items[1] : parentNode.items[0];
+    uint32_t const grandparent = parentNode.parent;
+    mNodes[sibling].parent = grandparent;
+    mFreeNodes.push_back(parent);
+    if (grandparent == NONE) {
+        mRoot = sibling;
+        return;
+    }
+
+    Node& grandparentNode = mNodes[grandparent];
+    grandparentNode.items[grandparentNode.items[0] == parent ? 0 : 1] = sibling;
+    refitPath(grandparent);
+}
+
+void CullingHierarchy::refitPath(uint32_t node) noexcept {
+    while (node != NONE) {
+        computeBounds(mNodes[node]);
+        node = mNodes[node].parent;
+    }
+}
+
+void CullingHierarchy::refitDirty(uint32_t node) noexcept {
+    Node& n = mNodes[node];
+    if (!n.isLeaf()) {
+        for (size_t c = 0; c < 2; c++) {
+            if (mDirty[n.items[c]]) {
+                refitDirty(n.items[c]);
+            }
+        }
+    }
+    computeBounds(n);
+    mDirty[node] = false;
+}
+
+void CullingHierarchy::rebuild() {
+    SYSTRACE_CALL();
+    std::vector<uint32_t> primitives;
+    primitives.reserve(mPrimitiveMap.size());
+    for (auto const& [key, p] : mPrimitiveMap) {
+        primitives.push_back(p);
+    }
+
+    mNodes.clear();
+    mDirty.clear();
+    mFreeNodes.clear();
+    mRoot = NONE;
+    mTooDeep = false;
+
+    size_t const count = primitives.size();
+    if (count) {
+        // a binary tree with leaves of at least LEAF_SIZE/2 primitives has at most this many nodes
+        size_t const capacity = 2 * ((count + LEAF_SIZE / 2 - 1) / (LEAF_SIZE / 2));
+        mNodes.reserve(capacity);
+        mDirty.reserve(capacity);
+        mRoot = build(primitives.data(), uint32_t(count), NONE);
+    }
+}
+
+uint32_t CullingHierarchy::build(uint32_t* primitives, uint32_t count, uint32_t parent) {
+    uint32_t const index = allocateNode(parent);
+
+    if (count <= LEAF_SIZE) {
+        Node& node = mNodes[index];
+        node.count = count;
+        for (uint32_t i = 0; i < count; i++) {
+            place(index, i, primitives[i]);
+        }
+        computeBounds(node);
+        return index;
+    }
+
+    // split at the median of the centers along the largest axis of the centers' bounds
+    float3 cmin{ std::numeric_limits<float>::max() };
+    float3 cmax{ std::numeric_limits<float>::lowest() };
+    for (uint32_t i = 0; i < count; i++) {
+        cmin = min(cmin, mPrimitives[primitives[i]].center);
+        cmax = max(cmax, mPrimitives[primitives[i]].center);
+    }
+    float3 const size = cmax - cmin;
+    size_t const axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+
+    uint32_t const half = count / 2;
+    std::nth_element(primitives, primitives + half, primitives + count,
+            [this, axis](uint32_t lhs, uint32_t rhs) {
+                return mPrimitives[lhs].center[axis] < mPrimitives[rhs].center[axis];
+            });
+
+    uint32_t const left = build(primitives, half, index);
+    uint32_t const right = build(primitives + half, count - half, index);
+    // note: mNodes may have been reallocated
+    Node& node = mNodes[index];
+    node.items[0] = left;
+    node.items[1] = right;
+    computeBounds(node);
+    return index;
+}
+
+void CullingHierarchy::computeBounds(Node& node) const noexcept {
+    if (!node.isLeaf()) {
+        Node const& left = mNodes[node.items[0]];
+        Node const& right = mNodes[node.items[1]];
+        node.min = min(left.min, right.min);
+        node.max = max(left.max, right.max);
+        return;
+    }
+    float3 bmin{ std::numeric_limits<float>::max() };
+    float3 bmax{ std::numeric_limits<float>::lowest() };
+    for (uint32_t i = 0; i < node.count; i++) {
+        Primitive const& prim = mPrimitives[node.items[i]];
+        bmin = min(bmin, prim.center - prim.extent);
+        bmax = max(bmax, prim.center + prim.extent);
+    }
+    node.min = bmin;
+    node.max = bmax;
+}
+
+void CullingHierarchy::setVisible(Culler::result_type* UTILS_RESTRICT results,
+        uint32_t node, size_t bit) const noexcept {
+    Culler::result_type const mask = Culler::result_type(1u << bit);
+    uint32_t stack[MAX_DEPTH + 2];
+    size_t top = 0;
+    stack[top++] = node;
+    while (top) {
+        Node const& n = mNodes[stack[--top]];
+        if (n.isLeaf()) {
+            for (uint32_t i = 0; i < n.count; i++) {
+                results[n.indices[i]] |= mask;
+            }
+        } else {
+            assert_invariant(top + 2 <= MAX_DEPTH + 2);
+            stack[top++] = n.items[1];
+            stack[top++] = n.items[0];
+        }
+    }
+}
+
+void CullingHierarchy::cullLeaf(Culler::result_type* UTILS_RESTRICT results,
+        Frustum const& frustum, Node const& node, size_t bit) const noexcept {
+    static_assert(LEAF_SIZE % Culler::MODULO == 0);
+    // gather the leaf's primitives so we can use the regular culling kernels
+    float3 centers[LEAF_SIZE] = {};
+    float3 extents[LEAF_SIZE] = {};
+    Culler::result_type visibles[LEAF_SIZE] = {};
+    for (uint32_t i = 0; i < node.count; i++) {
+        centers[i] = mPrimitives[node.items[i]].center;
+        extents[i] = mPrimitives[node.items[i]].extent;
+    }
+    Culler::intersects(visibles, frustum, centers, extents, node.count, 0);
+    Culler::result_type const mask = Culler::result_type(1u << bit);
+    for (uint32_t i = 0; i < node.count; i++) {
+        Culler::result_type& r = results[node.indices[i]];
+        r = Culler::result_type((r & ~mask) | (visibles[i] << bit));
+    }
+}
+
+void CullingHierarchy::cull(Culler::result_type* UTILS_RESTRICT results,
+        Frustum const& frustum, size_t bit) const noexcept {
+    SYSTRACE_CALL();
+
+    if (UTILS_UNLIKELY(mRoot == NONE)) {
+        return;
+    }
+
+    // Clear the bit of all primitives at once, this is much cheaper than walking the rejected
+    // subtrees, which are usually most of the scene. Only the visible subtrees are visited.
+    Culler::result_type const mask = Culler::result_type(1u << bit);
+    for (size_t i = 0, c = mPrimitiveMap.size(); i < c; i++) {
+        results[i] &= Culler::result_type(~mask);
+    }
+
+    float4 const* const planes = frustum.getNormalizedPlanes();
+
+    // the depth of the tree is bounded by MAX_DEPTH
+    uint32_t stack[MAX_DEPTH + 2];
+    size_t top = 0;
+    stack[top++] = mRoot;
+
+    while (top) {
+        uint32_t const index = stack[--top];
+        Node const& node = mNodes[index];
+
+        // Planes point outward. For each plane we find the signed distance of the box corner
+        // the furthest inside (near) and the furthest outside (far).
+        bool outside = false;
+        bool inside = true;
+        for (size_t j = 0; j < 6; j++) {
+            float4 const p = planes[j];
+            float3 const n{
+                    p.x > 0 ? node.min.x : node.max.x,
+                    p.y > 0 ? node.min.y : node.max.y,
+                    p.z > 0 ? node.min.z : node.max.z };
+            float3 const f{
+                    p.x > 0 ? node.max.x : node.min.x,
+                    p.y > 0 ? node.max.y : node.min.y,
+                    p.z > 0 ? node.max.z : node.min.z };
+            float const near = dot(p.xyz, n) + p.w;
+            float const far  = dot(p.xyz, f) + p.w;
+            outside = outside || near >= 0;
+            inside = inside && far < 0;
+        }
+
+        if (outside) {
+            // nothing to do, the bit was cleared above
+        } else if (inside) {
+            setVisible(results, index, bit);
+        } else if (node.isLeaf()) {
+            cullLeaf(results, frustum, node, bit);
+        } else {
+            assert_invariant(top + 2 <= MAX_DEPTH + 2);
+            stack[top++] = node.items[1];
+            stack[top++] = node.items[0];
+        }
+    }
+}
+
+} // namespace filament
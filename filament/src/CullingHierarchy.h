@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_CULLINGHIERARCHY_H
+#define TNT_FILAMENT_CULLINGHIERARCHY_H
+
+#include "Culler.h"
+
+#include <filament/Frustum.h>
+
+#include <utils/compiler.h>
+
+#include <math/vec3.h>
+
+#include <tsl/robin_map.h>
+
+#include <atomic>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+
+/*
+ * A bounding volume hierarchy of axis-aligned boxes used to accelerate frustum culling.
+ *
+ * Primitives are identified by a stable key (e.g. an entity), and each frame they are reported
+ * with their index in the arrays given to cull(), which can change from frame to frame.
+ *
+ * The hierarchy is maintained incrementally: new primitives are inserted into the leaf that
+ * grows the least, primitives that disappeared are removed from their leaf, and the nodes above
+ * primitives that moved are refit. Only the nodes on the paths to the changed primitives are
+ * touched. Refitting and greedy insertion degrade the quality of the tree over time though,
+ * so we rebuild it anyway when a large part of the scene changed at once.
+ *
+ * Leaves hold up to LEAF_SIZE primitives; internal nodes always have two children.
+ */
+class CullingHierarchy {
+public:
+    // maximum number of primitives per leaf, this matches the culling kernels batch size
+    static constexpr size_t LEAF_SIZE = Culler::MODULO;
+
+    enum class Update : uint8_t {
+        NONE,       // nothing changed
+        REFIT,      // primitives were inserted, removed or moved, the hierarchy was updated
+        REBUILD     // too much changed, the hierarchy was rebuilt
+    };
+
+    CullingHierarchy() noexcept;
+    ~CullingHierarchy() noexcept;
+
+    CullingHierarchy(CullingHierarchy const&) = delete;
+    CullingHierarchy& operator=(CullingHierarchy const&) = delete;
+
+    /*
+     * Starts a new update, `count` is the number of primitives that will be reported with
+     * updatePrimitive() before endUpdate() is called.
+     */
+    void beginUpdate(size_t count);
+
+    /*
+     * Reports the primitive `key`, which is at `index` in the arrays given to cull(), with
+     * its current box. Indices must be in [0, count). This can be called concurrently for
+     * different keys.
+     */
+    void updatePrimitive(uint32_t key, uint32_t index,
+            math::float3 const& center, math::float3 const& extent) noexcept;
+
+    /*
+     * Applies the changes reported since beginUpdate(): primitives that weren't seen before are
+     * inserted, primitives that weren't reported are removed, and moved primitives are refit.
+     */
+    Update endUpdate();
+
+    /*
+     * Convenience that reports all primitives at once, primitive i has key keys[i].
+     */
+    Update update(uint32_t const* keys,
+            math::float3 const* center, math::float3 const* extent, size_t count);
+
+    /*
+     * Sets or clears `bit` of results[i] for each primitive, depending on whether it intersects
+     * the frustum. The result is the same as Culler::intersects(), but whole subtrees are
+     * rejected or accepted at once. `results` must have at least getPrimitiveCount() entries.
+     */
+    void cull(Culler::result_type* results, Frustum const& frustum, size_t bit) const noexcept;
+
+    // drops the hierarchy and frees all memory
+    void clear() noexcept;
+
+    size_t getPrimitiveCount() const noexcept { return mPrimitiveMap.size(); }
+
+    size_t getNodeCount() const noexcept { return mNodes.size() - mFreeNodes.size(); }
+
+private:
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+
+    // Trees built by rebuild() are balanced, this only limits how deep insertions can go
+    // before forcing a rebuild, so that cull() can use a fixed-size stack.
+    static constexpr size_t MAX_DEPTH = 48;
+
+    struct Node {
+        math::float3 min;
+        uint32_t parent;                // NONE for the root
+        math::float3 max;
+        uint32_t count;                 // number of primitives of a leaf, 0 for internal nodes
+        uint32_t items[LEAF_SIZE];      // primitives of a leaf, or the two children
+        uint32_t indices[LEAF_SIZE];    // index of each primitive of a leaf in the cull() arrays
+        bool isLeaf() const noexcept { return count != 0; }
+    };
+
+    struct Primitive {
+        math::float3 center;
+        uint32_t index;                 // index in the arrays given to cull()
+        math::float3 extent;
+        uint32_t leaf;                  // leaf holding this primitive, NONE if the slot is free
+        uint32_t key;
+        uint32_t frame;                 // last update this primitive was reported in
+        uint32_t slot;                  // position of this primitive in its leaf
+    };
+
+    struct Added {
+        math::float3 center;
+        uint32_t key;
+        math::float3 extent;
+        uint32_t index;
+    };
+
+    uint32_t allocateNode(uint32_t parent) noexcept;
+    uint32_t allocatePrimitive() noexcept;
+    void insert(uint32_t p) noexcept;
+    void remove(uint32_t p) noexcept;
+    void split(uint32_t leaf, uint32_t p) noexcept;
+    void place(uint32_t leaf, uint32_t slot, uint32_t p) noexcept;
+    void refitPath(uint32_t node) noexcept;
+    void refitDirty(uint32_t node) noexcept;
+    void rebuild();
+    uint32_t build(uint32_t* primitives, uint32_t count, uint32_t parent);
+    void computeBounds(Node& node) const noexcept;
+    void setVisible(Culler::result_type* results, uint32_t node, size_t bit) const noexcept;
+    void cullLeaf(Culler::result_type* results, Frustum const& frustum, Node const& node,
+            size_t bit) const noexcept;
+
+    std::vector<Node> mNodes;
+    std::vector<uint8_t> mDirty;            // per node, set when the node must be refit
+    std::vector<uint32_t> mFreeNodes;
+    std::vector<Primitive> mPrimitives;
+    std::vector<uint32_t> mFreePrimitives;
+    tsl::robin_map<uint32_t, uint32_t> mPrimitiveMap;   // key -> index in mPrimitives
+    uint32_t mRoot = NONE;
+    uint32_t mFrame = 0;
+    bool mTooDeep = false;
+
+    // changes reported by updatePrimitive(), possibly from several threads
+    std::vector<Added> mAdded;
+    std::vector<uint32_t> mMoved;
+    std::atomic<uint32_t> mAddedCount = 0;
+    std::atomic<uint32_t> mMovedCount = 0;
+    uint32_t mReportedCount = 0;
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_CULLINGHIERARCHY_H
@@ -311,6 +311,42 @@ bool Engine::isAutomaticInstancingEnabled() const noexcept {
     return downcast(this)->isAutomaticInstancingEnabled();
 }
 
+void Engine::setCommandStreamProfilingEnabled(bool enable) {
+    downcast(this)->setCommandStreamProfilingEnabled(enable);
+}
+
+bool Engine::isCommandStreamProfilingEnabled() const noexcept {
+    return downcast(this)->isCommandStreamProfilingEnabled();
+}
+
+void Engine::writeCommandStreamHistogram(utils::io::ostream& out) const {
+    downcast(this)->writeCommandStreamHistogram(out);
+}
+
+void Engine::writeCommandStreamTrace(utils::io::ostream& out) const {
+    downcast(this)->writeCommandStreamTrace(out);
+}
+
+void Engine::writeMaterialVariantManifest(utils::io::ostream& out) const {
+    downcast(this)->writeMaterialVariantManifest(out);
+}
+
+bool Engine::loadMaterialVariantManifest(const void* data, size_t size) {
+    return downcast(this)->loadMaterialVariantManifest(data, size);
+}
+
+void Engine::setResourceAllocatorCacheBudget(size_t budget) noexcept {
+    downcast(this)->setResourceAllocatorCacheBudget(budget);
+}
+
+size_t Engine::getResourceAllocatorCacheBudget() const noexcept {
+    return downcast(this)->getResourceAllocatorCacheBudget();
+}
+
+Engine::ResourceAllocatorStats Engine::getResourceAllocatorStats() const noexcept {
+    return downcast(this)->getResourceAllocatorStats();
+}
+
 FeatureLevel Engine::getSupportedFeatureLevel() const noexcept {
     return downcast(this)->getSupportedFeatureLevel();
 }
@@ -22,6 +22,8 @@
 
 #include <math/mat4.h>
 
+#include <vector>
+
 namespace filament {
 
 // This is where we store all the history of a frame
@@ -40,6 +42,12 @@ struct FrameHistoryEntry {
         FrameGraphTexture::Descriptor desc;
         math::mat4 projection;
     } ssr;
+    struct MotionVectors {
+        // world transform of the renderables, indexed by their RenderableManager instance.
+        // A zero matrix means the renderable wasn't rendered in that frame.
+        std::vector<math::mat4f> transforms;
+        math::mat4 worldTransform;  // world origin transform the above are relative to
+    } motion;
 };
 
 /*
@@ -26,7 +26,9 @@
 #include <filament/Viewport.h>
 
 #include <utils/BinaryTreeArray.h>
+#include <utils/JobSystem.h>
 #include <utils/Systrace.h>
+#include <utils/algorithm.h>
 #include <utils/debug.h>
 
 #include <math/mat4.h>
@@ -34,8 +36,11 @@
 #include <math/scalar.h>
 
 #include <algorithm>
+#include <functional>
+#include <limits>
 
 #include <stddef.h>
+#include <string.h>
 
 using namespace filament::math;
 using namespace utils;
@@ -45,42 +50,27 @@ namespace filament {
 using namespace backend;
 
 // TODO: these should come from a configuration object on View or Camera
-static constexpr size_t FROXEL_SLICE_COUNT = 16;
 static constexpr float FROXEL_FIRST_SLICE_DEPTH = 5;
 static constexpr float FROXEL_LAST_SLICE_DISTANCE = 100;
 
-// The record buffer is limited by both the UBO size and our use of 16-bits indices.
-constexpr size_t RECORD_BUFFER_ENTRY_COUNT  = CONFIG_MINSPEC_UBO_SIZE;    // 16 KiB UBO minspec
-
 // Buffer needed for Froxelizer internal data structures (~256 KiB)
 constexpr size_t PER_FROXELDATA_ARENA_SIZE = sizeof(float4) *
                                                  (FROXEL_BUFFER_MAX_ENTRY_COUNT +
                                                   FROXEL_BUFFER_MAX_ENTRY_COUNT + 3 +
                                                   FROXEL_SLICE_COUNT / 4 + 1);
 
-// number of lights processed by one group (e.g. 32)
-static constexpr size_t LIGHT_PER_GROUP = sizeof(Froxelizer::LightGroupType) * 8;
-
-// number of groups (i.e. jobs) to use for froxelization (e.g. 8)
-static constexpr size_t GROUP_COUNT =
-        (CONFIG_MAX_LIGHT_COUNT + LIGHT_PER_GROUP - 1) / LIGHT_PER_GROUP;
+// number of lights prepared by one job
+static constexpr size_t LIGHTS_PER_JOB = 64;
 
-// This depends on the maximum number of lights (currently 256)
+// This depends on the maximum number of lights (currently 1024)
 static_assert(CONFIG_MAX_LIGHT_INDEX <= std::numeric_limits<Froxelizer::RecordBufferType>::max(),
-        "can't have more than 256 lights");
+        "can't have more than 65536 lights");
 
 // Record buffer cannot be larger than 65K entries because froxels use uint16_t to store indices
 // to it.
-static_assert(RECORD_BUFFER_ENTRY_COUNT <= 65536,
+static_assert(FROXEL_RECORD_BUFFER_MAX_HEIGHT * 16 / sizeof(Froxelizer::RecordBufferType) <= 65536,
         "RecordBuffer cannot be larger than 65536 entries");
 
-static_assert(RECORD_BUFFER_ENTRY_COUNT <= CONFIG_MINSPEC_UBO_SIZE,
-        "RecordBuffer cannot be larger than the UBO minspec (16KiB)");
-
-struct Froxelizer::FroxelThreadData :
-        public std::array<LightGroupType, FROXEL_BUFFER_MAX_ENTRY_COUNT> {
-};
-
 
 // Returns false if the two matrices are different. May return false if they're the
 // same, with some elements only differing by +0 or -0. Behaviour is undefined with NaNs.
@@ -101,8 +91,8 @@ Froxelizer::Froxelizer(FEngine& engine)
           mZLightNear(FROXEL_FIRST_SLICE_DEPTH),
           mZLightFar(FROXEL_LAST_SLICE_DISTANCE)
 {
-    static_assert(std::is_same_v<RecordBufferType, uint8_t>,
-            "Record Buffer must use bytes");
+    static_assert(std::is_same_v<RecordBufferType, uint16_t>,
+            "Record Buffer must use 16-bits indices");
 
     DriverApi& driverApi = engine.getDriverApi();
 
@@ -114,7 +104,13 @@ Froxelizer::Froxelizer(FEngine& engine)
             FROXEL_BUFFER_MAX_ENTRY_COUNT,
             engine.getDriverApi().getMaxUniformBufferSize() / 16u);
 
-    mRecordsBuffer = driverApi.createBufferObject(RECORD_BUFFER_ENTRY_COUNT,
+    // this must match CONFIG_FROXEL_RECORD_BUFFER_HEIGHT, see FMaterial
+    mRecordBufferEntryCount = std::min(
+            FROXEL_RECORD_BUFFER_MAX_HEIGHT,
+            engine.getDriverApi().getMaxUniformBufferSize() / 16u) * 16u / sizeof(RecordBufferType);
+
+    mRecordsBuffer = driverApi.createBufferObject(
+            mRecordBufferEntryCount * sizeof(RecordBufferType),
             BufferObjectBinding::UNIFORM, BufferUsage::DYNAMIC);
 
     mFroxelsBuffer = driverApi.createBufferObject(getFroxelBufferEntryCount() * 16u,
@@ -170,7 +166,10 @@ void Froxelizer::setProjection(const mat4f& projection,
 bool Froxelizer::prepare(
         FEngine::DriverApi& driverApi, RootArenaScope& rootArenaScope,
         filament::Viewport const& viewport,
-        const mat4f& projection, float projectionNear, float projectionFar) noexcept {
+        const mat4f& projection, float projectionNear, float projectionFar,
+        size_t lightCount) noexcept {
+    assert_invariant(lightCount <= std::numeric_limits<RecordBufferType>::max() + 1u);
+
     setViewport(viewport);
     setProjection(projection, projectionNear, projectionFar);
 
@@ -189,33 +188,37 @@ bool Froxelizer::prepare(
             driverApi.allocatePod<FroxelEntry>(getFroxelBufferEntryCount()),
             getFroxelBufferEntryCount() };
 
-    // record buffer (~16 KiB)
+    // record buffer (~32 KiB)
     mRecordBufferUser = {
-            driverApi.allocatePod<RecordBufferType>(RECORD_BUFFER_ENTRY_COUNT),
-            RECORD_BUFFER_ENTRY_COUNT };
+            driverApi.allocatePod<RecordBufferType>(mRecordBufferEntryCount),
+            mRecordBufferEntryCount };
 
     /*
-     * Temporary allocations for processing all froxel data
+     * Temporary allocations for processing all froxel data, these scale with the number of
+     * lights.
      */
 
-    // light records per froxel (~256 KiB)
+    // light records per froxel (64 KiB per 64 lights), plus one for all the lights
+    mLightRecordWordCount = std::max(size_t(1), (lightCount + 63) / 64);
+    size_t const lightRecordsSize = (getFroxelBufferEntryCount() + 1) * mLightRecordWordCount;
     mLightRecords = {
-            rootArenaScope.allocate<LightRecord>(getFroxelBufferEntryCount(), CACHELINE_SIZE),
-            getFroxelBufferEntryCount() };
+            rootArenaScope.allocate<LightRecordWord>(lightRecordsSize, CACHELINE_SIZE),
+            lightRecordsSize };
 
-    // froxel thread data (~256 KiB)
-    mFroxelShardedData = {
-            rootArenaScope.allocate<FroxelThreadData>(GROUP_COUNT, CACHELINE_SIZE),
-            uint32_t(GROUP_COUNT)
-    };
+    // per light data (~64 bytes / light)
+    mLightParams = {
+            rootArenaScope.allocate<LightParams>(lightCount, CACHELINE_SIZE), lightCount };
+    mLightBounds = {
+            rootArenaScope.allocate<LightBounds>(lightCount, CACHELINE_SIZE), lightCount };
+
+    // lights binned by z-slice, a light can be in all slices (32 bytes / light)
+    mSliceLights = {
+            rootArenaScope.allocate<uint16_t>(lightCount * FROXEL_SLICE_COUNT, CACHELINE_SIZE),
+            lightCount * FROXEL_SLICE_COUNT };
 
     assert_invariant(mFroxelBufferUser.begin());
     assert_invariant(mRecordBufferUser.begin());
     assert_invariant(mLightRecords.begin());
-    assert_invariant(mFroxelShardedData.begin());
-
-    // initialize buffers that need to be
-    memset(mLightRecords.data(), 0, mLightRecords.sizeInBytes());
 
     return uniformsNeedUpdating;
 }
@@ -507,12 +510,15 @@ void Froxelizer::commit(backend::DriverApi& driverApi) {
             { mFroxelBufferUser.data(), getFroxelBufferEntryCount() * 16u }, 0);
 
     driverApi.updateBufferObject(mRecordsBuffer,
-            { mRecordBufferUser.data(), RECORD_BUFFER_ENTRY_COUNT }, 0);
+            { mRecordBufferUser.data(), mRecordBufferUser.sizeInBytes() }, 0);
 
 #ifndef NDEBUG
     mFroxelBufferUser.clear();
     mRecordBufferUser.clear();
-    mFroxelShardedData.clear();
+    mLightRecords.clear();
+    mLightParams.clear();
+    mLightBounds.clear();
+    mSliceLights.clear();
 #endif
 }
 
@@ -534,10 +540,9 @@ void Froxelizer::froxelizeLights(FEngine& engine,
             // go through every light for that froxel
             for (size_t i = 0; i < entry.count(); i++) {
                 // get the light index
-                assert_invariant(entry.offset() + i < RECORD_BUFFER_ENTRY_COUNT);
+                assert_invariant(entry.offset() + i < mRecordBufferEntryCount);
 
                 size_t const lightIndex = recordBufferUser[entry.offset() + i];
-                assert_invariant(lightIndex <= CONFIG_MAX_LIGHT_INDEX);
 
                 // make sure it corresponds to an existing light
                 assert_invariant(lightIndex < lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT);
@@ -547,26 +552,45 @@ void Froxelizer::froxelizeLights(FEngine& engine,
 #endif
 }
 
+static inline float2 project(mat4f const& p, float3 const& v) noexcept {
+    const float vx = v[0];
+    const float vy = v[1];
+    const float vz = v[2];
+    const float x = p[0].x * vx + p[1].x * vy + p[2].x * vz + p[3].x;
+    const float y = p[0].y * vx + p[1].y * vy + p[2].y * vz + p[3].y;
+    const float w = p[0].w * vx + p[1].w * vy + p[2].w * vz + p[3].w;
+    return float2{ x, y } * (1.0f / w);
+}
+
 void Froxelizer::froxelizeLoop(FEngine& engine,
         const mat4f& UTILS_RESTRICT viewMatrix,
         const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
     SYSTRACE_CALL();
 
-    Slice<FroxelThreadData> froxelThreadData = mFroxelShardedData;
-    memset(froxelThreadData.data(), 0, froxelThreadData.sizeInBytes());
+    size_t const lightCount = lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT;
+    assert_invariant(lightCount <= mLightParams.size());
+    assert_invariant(mFroxelCountZ <= FROXEL_SLICE_COUNT);
+
+    memset(mLightRecords.data(), 0, mLightRecords.sizeInBytes());
 
     auto& lcm = engine.getLightManager();
     auto const* UTILS_RESTRICT spheres      = lightData.data<FScene::POSITION_RADIUS>();
     auto const* UTILS_RESTRICT directions   = lightData.data<FScene::DIRECTION>();
     auto const* UTILS_RESTRICT instances    = lightData.data<FScene::LIGHT_INSTANCE>();
 
-    auto process = [ this, &froxelThreadData,
-                     spheres, directions, instances, &viewMatrix, &lcm ]
-            (size_t count, size_t offset, size_t stride) {
+    LightParams* const UTILS_RESTRICT lightParams = mLightParams.data();
+    LightBounds* const UTILS_RESTRICT lightBounds = mLightBounds.data();
 
-        SYSTRACE_NAME("FroxelizeLoop Job");
+    /*
+     * 1. Transform the lights to view-space and find the froxels covered by their bounding box.
+     */
+
+    auto prepareLights = [ this, lightParams, lightBounds,
+                           spheres, directions, instances, &viewMatrix, &lcm ]
+            (uint32_t start, uint32_t count) {
+
+        SYSTRACE_NAME("FroxelizePrepareLights Job");
 
-        const mat4f& projection = mProjection;
         const mat3f& vn = viewMatrix.upperLeft();
 
         // We use minimum cone angle of 0.5 degrees because too small angles cause issues in the
@@ -574,7 +598,7 @@ void Froxelizer::froxelizeLoop(FEngine& engine,
         constexpr float maxInvSin = 114.59301f;         // 1 / sin(0.5 degrees)
         constexpr float maxCosSquared = 0.99992385f;    // cos(0.5 degrees)^2
 
-        for (size_t i = offset; i < count; i += stride) {
+        for (size_t i = start, e = start + count; i < e; i++) {
             const size_t j = i + FScene::DIRECTIONAL_LIGHTS_COUNT;
             FLightManager::Instance const li = instances[j];
             LightParams light = {
@@ -588,31 +612,69 @@ void Froxelizer::froxelizeLoop(FEngine& engine,
             if (light.invSin != std::numeric_limits<float>::infinity()) {
                 light.invSin = std::min(maxInvSin, light.invSin);
             }
-
-            const size_t group = i % GROUP_COUNT;
-            const size_t bit   = i / GROUP_COUNT;
-            assert_invariant(bit < LIGHT_PER_GROUP);
-
-            FroxelThreadData& threadData = froxelThreadData[group];
-            froxelizePointAndSpotLight(threadData, bit, projection, light);
+            lightParams[i] = light;
+            lightBounds[i] = computeLightBounds(light);
         }
     };
 
-    // we do 64 lights per job
     JobSystem& js = engine.getJobSystem();
 
+    if (lightCount <= LIGHTS_PER_JOB) {
+        prepareLights(0, uint32_t(lightCount));
+    } else {
+        js.runAndWait(jobs::parallel_for(js, nullptr, 0, uint32_t(lightCount),
+                std::cref(prepareLights), jobs::CountSplitter<LIGHTS_PER_JOB, 5>()));
+    }
+
+    /*
+     * 2. Bin the lights by z-slice (counting sort), so that each slice only considers the
+     *    lights overlapping it instead of all of them.
+     */
+
+    uint32_t* const UTILS_RESTRICT sliceOffsets = mSliceLightOffsets;
+    uint16_t* const UTILS_RESTRICT sliceLights = mSliceLights.data();
+    std::fill_n(sliceOffsets, FROXEL_SLICE_COUNT + 1, 0);
+    for (size_t i = 0; i < lightCount; i++) {
+        for (size_t iz = lightBounds[i].z0, z1 = lightBounds[i].z1; iz <= z1; iz++) {
+            sliceOffsets[iz + 1]++;
+        }
+    }
+    for (size_t iz = 0; iz < FROXEL_SLICE_COUNT; iz++) {
+        sliceOffsets[iz + 1] += sliceOffsets[iz];
+    }
+    uint32_t cursors[FROXEL_SLICE_COUNT];
+    std::copy_n(sliceOffsets, FROXEL_SLICE_COUNT, cursors);
+    for (size_t i = 0; i < lightCount; i++) {
+        for (size_t iz = lightBounds[i].z0, z1 = lightBounds[i].z1; iz <= z1; iz++) {
+            sliceLights[cursors[iz]++] = uint16_t(i);
+        }
+    }
+
+    /*
+     * 3. Froxelize each slice with its lights. Slices don't share any froxel, so they're
+     *    processed in parallel without synchronization.
+     */
+
+    auto froxelizeSlices = [ this, lightParams, lightBounds, sliceOffsets, sliceLights ]
+            (uint32_t start, uint32_t count) {
+
+        SYSTRACE_NAME("FroxelizeLoop Job");
+
+        LightRecordWord* const records = mLightRecords.data();
+        for (size_t iz = start, e = start + count; iz < e; iz++) {
+            for (size_t k = sliceOffsets[iz], c = sliceOffsets[iz + 1]; k < c; k++) {
+                size_t const l = sliceLights[k];
+                froxelizePointAndSpotLight(records, l, iz, lightParams[l], lightBounds[l]);
+            }
+        }
+    };
+
     constexpr bool SINGLE_THREADED = false;
     if (!SINGLE_THREADED) {
-        auto *parent = js.createJob();
-        for (size_t i = 0; i < GROUP_COUNT; i++) {
-            js.run(jobs::createJob(js, parent, std::cref(process),
-                    lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, i, GROUP_COUNT));
-        }
-        js.runAndWait(parent);
+        js.runAndWait(jobs::parallel_for(js, nullptr, 0, uint32_t(mFroxelCountZ),
+                std::cref(froxelizeSlices), jobs::CountSplitter<1, 4>()));
     } else {
-        js.runAndWait(jobs::createJob(js, nullptr, std::cref(process),
-                lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, 0, 1)
-        );
+        froxelizeSlices(0, mFroxelCountZ);
     }
 }
 
@@ -620,69 +682,77 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
 
     SYSTRACE_CALL();
 
-    Slice<FroxelThreadData> const froxelThreadData = mFroxelShardedData;
+    size_t const wordCount = mLightRecordWordCount;
+    LightRecordWord* const UTILS_RESTRICT records = mLightRecords.data();
+
+    auto const recordAt = [records, wordCount](size_t i) {
+        return records + i * wordCount;
+    };
+
+    auto const isEmpty = [wordCount](LightRecordWord const* record) {
+        LightRecordWord bits = 0;
+        for (size_t w = 0; w < wordCount; w++) {
+            bits |= record[w];
+        }
+        return bits == 0;
+    };
 
-    // convert froxel data from N groups of M bits to LightRecord::bitset, so we can
-    // easily compare adjacent froxels, for compaction. The conversion loops below get
-    // inlined and vectorized in release builds.
+    auto const isEqual = [wordCount](LightRecordWord const* lhs, LightRecordWord const* rhs) {
+        return std::equal(lhs, lhs + wordCount, rhs);
+    };
 
-    // this gets very well vectorized...
+    auto const lightCount = [wordCount](LightRecordWord const* record) {
+        size_t count = 0;
+        for (size_t w = 0; w < wordCount; w++) {
+            count += utils::popcount(record[w]);
+        }
+        return count;
+    };
 
-    utils::Slice<LightRecord> records(mLightRecords);
-    for (size_t j = 0, jc = getFroxelBufferEntryCount(); j < jc; j++) {
-        for (size_t i = 0; i < LightRecord::bitset::WORLD_COUNT; i++) {
-            using container_type = LightRecord::bitset::container_type;
-            constexpr size_t r = sizeof(container_type) / sizeof(LightGroupType);
-            container_type b = froxelThreadData[i * r][j];
-            for (size_t k = 0; k < r; k++) {
-                b |= (container_type(froxelThreadData[i * r + k][j]) << (LIGHT_PER_GROUP * k));
+    // writes the indices of the lights set in the record, at most maxCount
+    auto const writeIndices = [wordCount](LightRecordWord const* record,
+            RecordBufferType* UTILS_RESTRICT out, size_t maxCount) {
+        size_t count = 0;
+        for (size_t w = 0; w < wordCount; w++) {
+            LightRecordWord bits = record[w];
+            while (bits && count < maxCount) {
+                out[count++] = RecordBufferType(w * 64 + utils::ctz(bits));
+                bits &= bits - 1;
             }
-            records[j].lights.getBitsAt(i) = b;
         }
-    }
+        return count;
+    };
 
-    LightRecord::bitset allLights{};
+    // the extra record at the end holds all the lights in the scene
+    LightRecordWord* const allLights = recordAt(getFroxelBufferEntryCount());
     for (size_t j = 0, jc = getFroxelBufferEntryCount(); j < jc; j++) {
-        allLights |= records[j].lights;
+        LightRecordWord const* const record = recordAt(j);
+        for (size_t w = 0; w < wordCount; w++) {
+            allLights[w] |= record[w];
+        }
     }
 
-    uint16_t offset = 0;
     FroxelEntry* const UTILS_RESTRICT froxels = mFroxelBufferUser.data();
 
     const size_t froxelCountX = mFroxelCountX;
+    const size_t recordBufferEntryCount = mRecordBufferEntryCount;
     RecordBufferType* const UTILS_RESTRICT froxelRecords = mRecordBufferUser.data();
 
     // initialize the first record with all lights in the scene -- this will be used only if
     // we run out of record space.
-    const uint8_t allLightsCount = (uint8_t)std::min(size_t(255), allLights.count());
-    offset += allLightsCount;
-    allLights.forEachSetBit([point = froxelRecords, froxelRecords](size_t l) mutable {
-        // make sure to keep this code branch-less
-        const size_t word = l / LIGHT_PER_GROUP;
-        const size_t bit  = l % LIGHT_PER_GROUP;
-        l = (bit * GROUP_COUNT) | (word % GROUP_COUNT);
-        *point = (RecordBufferType)l;
-        // we need to "cancel" the write operation if we have more than 255 spot or point lights
-        // (this is a limitation of the data type used to store the light counts per froxel)
-        point += (point - froxelRecords < 255) ? 1 : 0;
-    });
-
-    // how many froxel record entries were reused (for debugging)
-    UTILS_UNUSED size_t reused = 0;
+    const uint16_t allLightsCount = uint16_t(writeIndices(allLights, froxelRecords,
+            std::min(recordBufferEntryCount, size_t(std::numeric_limits<uint16_t>::max()))));
+    size_t offset = allLightsCount;
 
     for (size_t i = 0, c = mFroxelCount; i < c;) {
-        LightRecord b = records[i];
-        if (b.lights.none()) {
+        LightRecordWord const* b = recordAt(i);
+        if (isEmpty(b)) {
             froxels[i++].u32 = 0;
             continue;
         }
 
-        // We have a limitation of 255 spot + 255 point lights per froxel.
-        // note: initializer list for union cannot have more than one element
-        FroxelEntry entry{ offset, uint8_t(std::min(size_t(255), b.lights.count())) };
-        const size_t lightCount = entry.count();
-
-        if (UTILS_UNLIKELY(offset + lightCount >= RECORD_BUFFER_ENTRY_COUNT)) {
+        const size_t count = lightCount(b);
+        if (UTILS_UNLIKELY(offset + count >= recordBufferEntryCount)) {
 #ifndef NDEBUG
             slog.d << "out of space: " << i << ", at " << offset << io::endl;
 #endif
@@ -690,76 +760,46 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
             // filed up.
             do {
                 froxels[i] = { 0u, allLightsCount };
-                if (records[i].lights.none()) {
+                if (isEmpty(recordAt(i))) {
                     froxels[i].u32 = 0;
                 }
             } while(++i < c);
-            goto out_of_memory;
+            break;
         }
 
-        // iterate the bitfield
-        auto * const beginPoint = froxelRecords + offset;
-        b.lights.forEachSetBit([point = beginPoint, beginPoint](size_t l) mutable {
-            // make sure to keep this code branch-less
-            const size_t word = l / LIGHT_PER_GROUP;
-            const size_t bit  = l % LIGHT_PER_GROUP;
-            l = (bit * GROUP_COUNT) | (word % GROUP_COUNT);
-            *point = (RecordBufferType)l;
-            // we need to "cancel" the write operation if we have more than 255 spot or point lights
-            // (this is a limitation of the data type used to store the light counts per froxel)
-            point += (point - beginPoint < 255) ? 1 : 0;
-        });
-
-        offset += lightCount;
+        // note: initializer list for union cannot have more than one element
+        FroxelEntry entry{ uint16_t(offset), uint16_t(count) };
+        writeIndices(b, froxelRecords + offset, count);
+        offset += count;
 
-#ifndef NDEBUG
-        if (lightCount) { reused--; }
-#endif
         do {
-#ifndef NDEBUG
-            if (lightCount) { reused++; }
-#endif
             froxels[i++].u32 = entry.u32;
             if (i >= c) break;
 
-            if (records[i].lights != b.lights && i >= froxelCountX) {
+            if (!isEqual(recordAt(i), b) && i >= froxelCountX) {
                 // if this froxel record doesn't match the previous one on its left,
                 // we re-try with the record above it, which saves many froxel records
                 // (north of 10% in practice).
-                b = records[i - froxelCountX];
+                b = recordAt(i - froxelCountX);
                 entry.u32 = froxels[i - froxelCountX].u32;
             }
-        } while(records[i].lights == b.lights);
+        } while(isEqual(recordAt(i), b));
     }
-out_of_memory:
-    // FIXME: on big-endian systems we need to change the endianness of the record buffer
-    ;
-}
 
-static inline float2 project(mat4f const& p, float3 const& v) noexcept {
-    const float vx = v[0];
-    const float vy = v[1];
-    const float vz = v[2];
-    const float x = p[0].x * vx + p[1].x * vy + p[2].x * vz + p[3].x;
-    const float y = p[0].y * vx + p[1].y * vy + p[2].y * vz + p[3].y;
-    const float w = p[0].w * vx + p[1].w * vy + p[2].w * vz + p[3].w;
-    return float2{ x, y } * (1.0f / w);
+    // FIXME: on big-endian systems we need to change the endianness of the record buffer
 }
 
-void Froxelizer::froxelizePointAndSpotLight(
-        FroxelThreadData& froxelThread, size_t bit,
-        mat4f const& UTILS_RESTRICT p,
+Froxelizer::LightBounds Froxelizer::computeLightBounds(
         const Froxelizer::LightParams& UTILS_RESTRICT light) const noexcept {
 
     if (UTILS_UNLIKELY(light.position.z + light.radius < -mZLightFar)) { // z values are negative
         // This light is fully behind LightFar, it doesn't light anything
         // (we could avoid this check if we culled lights using LightFar instead of the
         // culling camera's far plane)
-        return;
+        return { 0, 0, 0, 0, 1, 0, 0 };
     }
 
-    // the code below works with radius^2
-    const float4 s = { light.position, light.radius * light.radius };
+    const size_t zcenter = findSliceZ(light.position.z);
 
 #ifdef DEBUG_FROXEL
     const size_t x0 = 0;
@@ -769,6 +809,8 @@ void Froxelizer::froxelizePointAndSpotLight(
     const size_t z0 = 0;
     const size_t z1 = mFroxelCountZ - 1;
 #else
+    mat4f const& UTILS_RESTRICT p = mProjection;
+
     // find a reasonable bounding-box in froxel space for the sphere by projecting
     // its (clipped) bounding-box to clip-space and converting to froxel indices.
     Box const aabb = { light.position, light.radius };
@@ -807,84 +849,108 @@ void Froxelizer::froxelizePointAndSpotLight(
     assert_invariant(z0 <= z1);
 #endif
 
-    const size_t zcenter = findSliceZ(s.z);
+    return {
+            uint16_t(x0), uint16_t(x1),
+            uint16_t(y0), uint16_t(y1),
+            uint16_t(z0), uint16_t(z1),
+            uint16_t(zcenter) };
+}
+
+void Froxelizer::froxelizePointAndSpotLight(
+        LightRecordWord* UTILS_RESTRICT records, size_t lightIndex, size_t iz,
+        const Froxelizer::LightParams& UTILS_RESTRICT light,
+        const Froxelizer::LightBounds& UTILS_RESTRICT bounds) const noexcept {
+
+    mat4f const& UTILS_RESTRICT p = mProjection;
+
+    // the code below works with radius^2
+    const float4 s = { light.position, light.radius * light.radius };
+
+    const size_t zcenter = bounds.zcenter;
     float4 const * const UTILS_RESTRICT planesX = mPlanesX;
     float4 const * const UTILS_RESTRICT planesY = mPlanesY;
     float const * const UTILS_RESTRICT planesZ = mDistancesZ;
     float4 const * const UTILS_RESTRICT boundingSpheres = mBoundingSpheres;
-    for (size_t iz = z0 ; iz <= z1; ++iz) {
-        float4 cz(s);
-        // froxel that contain the center of the sphere is special, we don't even need to do the
-        // intersection check, it's always true.
-        if (UTILS_LIKELY(iz != zcenter)) {
-            cz = spherePlaneIntersection(s, (iz < zcenter) ? planesZ[iz + 1] : planesZ[iz]);
-        }
 
-        if (cz.w > 0) { // intersection of light with this plane (slice)
-            // the sphere (light) intersects this slice's plane, and we now have a new smaller
-            // sphere centered there. Now, find x & y slices that contain the sphere's center
-            // (note: this changes with the Z slices)
-            const float2 clip = project(p, cz.xyz);
-            auto const [xcenter, ycenter] = clipToIndices(clip);
-
-            for (size_t iy = y0; iy <= y1; ++iy) {
-                float4 cy(cz);
-                // froxel that contain the center of the sphere is special, we don't even need to
-                // do the intersection check, it's always true.
-                if (UTILS_LIKELY(iy != ycenter)) {
-                    float4 const& plane = iy < ycenter ? planesY[iy + 1] : planesY[iy];
-                    cy = spherePlaneIntersection(cz, plane);
-                }
+    // each froxel's record has wordCount words, this light is a bit in one of them
+    const size_t wordCount = mLightRecordWordCount;
+    const size_t bit = lightIndex % 64;
+    records += lightIndex / 64;
+
+    float4 cz(s);
+    // froxel that contain the center of the sphere is special, we don't even need to do the
+    // intersection check, it's always true.
+    if (UTILS_LIKELY(iz != zcenter)) {
+        cz = spherePlaneIntersection(s, (iz < zcenter) ? planesZ[iz + 1] : planesZ[iz]);
+    }
 
-                if (cy.w > 0) {
-                    // The reduced sphere from the previous stage intersects this horizontal plane,
-                    // and we now have new smaller sphere centered on these two previous planes
-                    size_t bx = std::numeric_limits<size_t>::max(); // horizontal begin index
-                    size_t ex = 0; // horizontal end index
-
-                    // find the "begin" index (left side)
-                    for (size_t ix = x0; ix < x1 + 1; ++ix) {
-                        // The froxel that contains the center of the sphere is special,
-                        // we don't even need to do the intersection check, it's always true.
-                        if (UTILS_LIKELY(ix != xcenter)) {
-                            float4 const& plane = ix < xcenter ? planesX[ix + 1] : planesX[ix];
-                            if (spherePlaneIntersection(cy, plane).w > 0) {
-                                // The reduced sphere from the previous stage intersects this
-                                // vertical plane, we record the min/max froxel indices
-                                bx = std::min(bx, ix);
-                                ex = std::max(ex, ix);
-                            }
-                        } else {
-                            // this is the froxel containing the center of the sphere, it is
-                            // definitely participating
+    if (cz.w > 0) { // intersection of light with this plane (slice)
+        // the sphere (light) intersects this slice's plane, and we now have a new smaller
+        // sphere centered there. Now, find x & y slices that contain the sphere's center
+        // (note: this changes with the Z slices)
+        const float2 clip = project(p, cz.xyz);
+        auto const [xcenter, ycenter] = clipToIndices(clip);
+
+        const size_t x0 = bounds.x0;
+        const size_t x1 = bounds.x1;
+        for (size_t iy = bounds.y0, y1 = bounds.y1; iy <= y1; ++iy) {
+            float4 cy(cz);
+            // froxel that contain the center of the sphere is special, we don't even need to
+            // do the intersection check, it's always true.
+            if (UTILS_LIKELY(iy != ycenter)) {
+                float4 const& plane = iy < ycenter ? planesY[iy + 1] : planesY[iy];
+                cy = spherePlaneIntersection(cz, plane);
+            }
+
+            if (cy.w > 0) {
+                // The reduced sphere from the previous stage intersects this horizontal plane,
+                // and we now have new smaller sphere centered on these two previous planes
+                size_t bx = std::numeric_limits<size_t>::max(); // horizontal begin index
+                size_t ex = 0; // horizontal end index
+
+                // find the "begin" index (left side)
+                for (size_t ix = x0; ix < x1 + 1; ++ix) {
+                    // The froxel that contains the center of the sphere is special,
+                    // we don't even need to do the intersection check, it's always true.
+                    if (UTILS_LIKELY(ix != xcenter)) {
+                        float4 const& plane = ix < xcenter ? planesX[ix + 1] : planesX[ix];
+                        if (spherePlaneIntersection(cy, plane).w > 0) {
+                            // The reduced sphere from the previous stage intersects this
+                            // vertical plane, we record the min/max froxel indices
                             bx = std::min(bx, ix);
                             ex = std::max(ex, ix);
                         }
+                    } else {
+                        // this is the froxel containing the center of the sphere, it is
+                        // definitely participating
+                        bx = std::min(bx, ix);
+                        ex = std::max(ex, ix);
                     }
+                }
 
-                    if (UTILS_UNLIKELY(bx > ex)) {
-                        continue;
-                    }
+                if (UTILS_UNLIKELY(bx > ex)) {
+                    continue;
+                }
 
-                    // the loops below assume 1-past the end for the right side of the range
-                    ex++;
-                    assert_invariant(bx <= mFroxelCountX && ex <= mFroxelCountX);
-
-                    size_t fi = getFroxelIndex(bx, iy, iz);
-                    if (light.invSin != std::numeric_limits<float>::infinity()) {
-                        // This is a spotlight (common case)
-                        // this loops gets vectorized (on arm64) w/ clang
-                        while (bx++ != ex) {
-                            // see if this froxel intersects the cone
-                            bool const intersect = sphereConeIntersectionFast(boundingSpheres[fi],
-                                    light.position, light.axis, light.invSin, light.cosSqr);
-                            froxelThread[fi++] |= LightGroupType(intersect) << bit;
-                        }
-                    } else {
-                        // this loops gets vectorized (on arm64) w/ clang
-                        while (bx++ != ex) {
-                            froxelThread[fi++] |= LightGroupType(1) << bit;
-                        }
+                // the loops below assume 1-past the end for the right side of the range
+                ex++;
+                assert_invariant(bx <= mFroxelCountX && ex <= mFroxelCountX);
+
+                size_t fi = getFroxelIndex(bx, iy, iz);
+                LightRecordWord* UTILS_RESTRICT record = records + fi * wordCount;
+                if (light.invSin != std::numeric_limits<float>::infinity()) {
+                    // This is a spotlight (common case)
+                    while (bx++ != ex) {
+                        // see if this froxel intersects the cone
+                        bool const intersect = sphereConeIntersectionFast(boundingSpheres[fi++],
+                                light.position, light.axis, light.invSin, light.cosSqr);
+                        *record |= LightRecordWord(intersect) << bit;
+                        record += wordCount;
+                    }
+                } else {
+                    while (bx++ != ex) {
+                        *record |= LightRecordWord(1) << bit;
+                        record += wordCount;
                     }
                 }
             }
@@ -39,11 +39,18 @@ namespace filament {
 //   - max ubo size [min 16KiB]
 //
 // Also, increasing the number of froxels adds more pressure on the "record buffer" which stores
-// the light indices per froxel. The record buffer is limited to min(16K[ubo], 64K[uint16]) entries,
-// so with 8192 froxels, we can store 2 lights per froxels assuming they're all used. In practice,
-// some froxels are not used, so we can store more.
+// the light indices per froxel. The record buffer is limited to min(32K[ubo], 64K[uint16]) bytes
+// of 16-bits entries, so with 8192 froxels, we can store 2 lights per froxels assuming they're all
+// used. In practice, some froxels are not used, so we can store more.
 constexpr size_t FROXEL_BUFFER_MAX_ENTRY_COUNT = 8192;
 
+// Number of froxels in the z direction
+constexpr size_t FROXEL_SLICE_COUNT = 16;
+
+// Max height of the record buffer in uint4 (32 KiB, i.e. 16384 light indices), the actual height
+// is limited by the max ubo size.
+constexpr size_t FROXEL_RECORD_BUFFER_MAX_HEIGHT = 2048;
+
 class FEngine;
 class FCamera;
 class FTexture;
@@ -58,9 +65,9 @@ public:
 
 //
 // Light UBO           Froxel Record UBO      per-froxel light list texture
-// {4 x float4}            {index into        RG_U16 {offset, point-count, spot-count}
+// {4 x float4}            {index into        RG_U16 {offset, light-count}
 // (spot/point            light texture}
-//                     {uint4 -> 16 indices}
+//                     {uint4 -> 8 indices}
 //
 //  +----+                     +-+                     +----+
 // 0|....| <------------+     0| |         +-----------|0230| (e.g. offset=02, 3-lights)
@@ -72,11 +79,11 @@ public:
 //  :    :                     | |                     |    |
 //  :    :                     | |                     |    |
 //  :    :                     +-+                     |    |
-//  :    :                  65536 max                  +----+
+//  :    :                  16384 max                  +----+
 //  |....|                                          h = num froxels
 //  |....|
 //  +----+
-// 256 lights max
+// 1024 lights max
 //
 
 class Froxelizer {
@@ -107,11 +114,13 @@ public:
      * projection        camera projection matrix
      * projectionNear    near plane
      * projectionFar     far plane
+     * lightCount        max number of point and spot lights given to froxelizeLights()
      *
      * return true if updateUniforms() needs to be called
      */
     bool prepare(backend::DriverApi& driverApi, RootArenaScope& rootArenaScope, Viewport const& viewport,
-            const math::mat4f& projection, float projectionNear, float projectionFar) noexcept;
+            const math::mat4f& projection, float projectionNear, float projectionFar,
+            size_t lightCount) noexcept;
 
     Froxel getFroxelAt(size_t x, size_t y, size_t z) const noexcept;
     size_t getFroxelCountX() const noexcept { return mFroxelCountX; }
@@ -140,32 +149,27 @@ public:
      */
 
     struct FroxelEntry {
-        inline FroxelEntry(uint16_t offset, uint8_t count) noexcept
+        inline FroxelEntry(uint16_t offset, uint16_t count) noexcept
             : u32((offset << 16) | count) { }
-        inline uint8_t count() const noexcept { return u32 & 0xFFu; }
+        inline uint16_t count() const noexcept { return u32 & 0xFFFFu; }
         inline uint16_t offset() const noexcept { return u32 >> 16u; }
         uint32_t u32 = 0;
     };
 
-    // we can't change this easily because the shader expects 16 indices per uint4
-    using RecordBufferType = uint8_t;
+    // we can't change this easily because the shader expects 8 indices per uint4
+    using RecordBufferType = uint16_t;
 
     const utils::Slice<FroxelEntry>& getFroxelBufferUser() const { return mFroxelBufferUser; }
     const utils::Slice<RecordBufferType>& getRecordBufferUser() const { return mRecordBufferUser; }
 
-    // this is chosen so froxelizePointAndSpotLight() vectorizes 4 froxel tests / spotlight
-    // with 256 lights this implies 8 jobs (256 / 32) for froxelization.
-    using LightGroupType = uint32_t;
-
 private:
     size_t getFroxelBufferEntryCount() const noexcept {
         return mFroxelBufferEntryCount;
     }
 
-    struct LightRecord {
-        using bitset = utils::bitset<uint64_t, (CONFIG_MAX_LIGHT_COUNT + 63) / 64>;
-        bitset lights;
-    };
+    // Each froxel has a bitset of the lights intersecting it, made of mLightRecordWordCount words
+    // so that it scales with the number of lights.
+    using LightRecordWord = uint64_t;
 
     struct LightParams {
         math::float3 position;
@@ -177,6 +181,15 @@ private:
         float radius;
     };
 
+    // froxels covered by the bounding box of a light, the z range is empty (z0 > z1) if the
+    // light is beyond LightFar
+    struct LightBounds {
+        uint16_t x0, x1;
+        uint16_t y0, y1;
+        uint16_t z0, z1;
+        uint16_t zcenter;   // slice containing the center of the light
+    };
+
     struct LightTreeNode {
         float min;          // lights z-range min
         float max;          // lights z-range max
@@ -189,8 +202,6 @@ private:
         uint16_t reserved;
     };
 
-    struct FroxelThreadData;
-
     inline void setViewport(Viewport const& viewport) noexcept;
     inline void setProjection(const math::mat4f& projection, float near, float far) noexcept;
     bool update() noexcept;
@@ -200,8 +211,10 @@ private:
 
     void froxelizeAssignRecordsCompress() noexcept;
 
-    void froxelizePointAndSpotLight(FroxelThreadData& froxelThread, size_t bit,
-            math::mat4f const& projection, const LightParams& light) const noexcept;
+    LightBounds computeLightBounds(const LightParams& light) const noexcept;
+
+    void froxelizePointAndSpotLight(LightRecordWord* records, size_t lightIndex, size_t iz,
+            const LightParams& light, const LightBounds& bounds) const noexcept;
 
     static void computeLightTree(LightTreeNode* lightTree,
             utils::Slice<RecordBufferType> const& lightList,
@@ -243,13 +256,20 @@ private:
     math::float4* mPlanesY = nullptr;
     math::float4* mBoundingSpheres = nullptr;           // 128 KiB w/ 8192 froxels
 
+    // 16384 light indices fit in a 32KiB buffer
+    size_t mRecordBufferEntryCount = 8192;
+
     // allocations in the per frame arena
-    utils::Slice<FroxelThreadData> mFroxelShardedData;  // 256 KiB w/  256 lights and 8192 froxels
-    utils::Slice<FroxelEntry> mFroxelBufferUser;        //  32 KiB w/ 8192 froxels
-    utils::Slice<LightRecord> mLightRecords;            // 256 KiB w/  256 lights
+    utils::Slice<LightRecordWord> mLightRecords;        //  64 KiB w/ 8192 froxels, per 64 lights
+    utils::Slice<LightParams> mLightParams;             //  48 KiB w/ 1024 lights
+    utils::Slice<LightBounds> mLightBounds;             //  16 KiB w/ 1024 lights
+    utils::Slice<uint16_t> mSliceLights;                //  32 KiB w/ 1024 lights
+    size_t mLightRecordWordCount = 0;
+    uint32_t mSliceLightOffsets[FROXEL_SLICE_COUNT + 1] = {};
 
     // allocations in the command stream
-    utils::Slice<RecordBufferType> mRecordBufferUser;   //  16 KiB
+    utils::Slice<FroxelEntry> mFroxelBufferUser;        //  32 KiB w/ 8192 froxels
+    utils::Slice<RecordBufferType> mRecordBufferUser;   //  32 KiB
 
     uint16_t mFroxelCountX = 0;
     uint16_t mFroxelCountY = 0;
@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OcclusionCuller.h"
+
+#include <utils/debug.h>
+#include <utils/Systrace.h>
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include <math.h>
+
+using namespace filament::math;
+
+namespace filament {
+
+static_assert(OcclusionCuller::MAX_DIMENSION % OcclusionCuller::TILE_SIZE == 0);
+static_assert(OcclusionCuller::PIXEL_COUNT / OcclusionCuller::MAX_DIMENSION >=
+        OcclusionCuller::TILE_SIZE);
+static_assert(1u << (OcclusionCuller::MAX_LEVELS - 1) >= OcclusionCuller::MAX_DIMENSION);
+
+// Levels above 0 have at most a third of the pixels of level 0, plus a row and a column per
+// level because dimensions are rounded up.
+static constexpr uint32_t PYRAMID_SIZE = OcclusionCuller::PIXEL_COUNT +
+        OcclusionCuller::PIXEL_COUNT / 3 +
+        OcclusionCuller::MAX_LEVELS * (OcclusionCuller::MAX_DIMENSION + 1);
+
+// the 6 faces of a box, using the corner numbering below (bit 0: x, bit 1: y, bit 2: z)
+static constexpr uint8_t sBoxFaces[6][4] = {
+        { 0, 1, 3, 2 },     // -z
+        { 4, 6, 7, 5 },     // +z
+        { 0, 4, 5, 1 },     // -y
+        { 2, 3, 7, 6 },     // +y
+        { 0, 2, 6, 4 },     // -x
+        { 1, 5, 7, 3 },     // +x
+};
+
+// Vertices are snapped to a sub-pixel grid so that the edge functions can be evaluated exactly
+// with integers.
+static constexpr float SUBPIXEL = 256.0f;
+static constexpr float MAX_COORDINATE = float(1u << 20u);
+
+static constexpr float FAR_DEPTH = std::numeric_limits<float>::infinity();
+
+OcclusionCuller::OcclusionCuller() noexcept = default;
+
+OcclusionCuller::~OcclusionCuller() noexcept = default;
+
+void OcclusionCuller::beginOccluders(mat4f const& viewProjection, float aspectRatio) noexcept {
+    SYSTRACE_CALL();
+    if (UTILS_UNLIKELY(!mDepth)) {
+        // the dimensions below never exceed PIXEL_COUNT pixels
+        mDepth.reset(new float[PYRAMID_SIZE]);
+    }
+
+    // pick the dimensions, in tiles, closest to the viewport's aspect ratio
+    if (!(aspectRatio > 0.0f && aspectRatio < std::numeric_limits<float>::infinity())) {
+        aspectRatio = 1.0f;
+    }
+    uint32_t const maxTileCount = MAX_DIMENSION / TILE_SIZE;
+    uint32_t const tileCount = PIXEL_COUNT / (TILE_SIZE * TILE_SIZE);
+    uint32_t const tileCountY = std::clamp(
+            uint32_t(std::lround(std::sqrt(float(tileCount) / aspectRatio))), 1u, maxTileCount);
+    uint32_t const tileCountX = std::clamp(tileCount / tileCountY, 1u, maxTileCount);
+    mWidth = tileCountX * TILE_SIZE;
+    mHeight = tileCountY * TILE_SIZE;
+
+    // each level halves the dimensions of the previous one, rounding up, down to 1x1
+    uint32_t offset = 0;
+    uint32_t width = mWidth;
+    uint32_t height = mHeight;
+    mLevelCount = 0;
+    while (true) {
+        assert_invariant(mLevelCount < MAX_LEVELS);
+        mLevels[mLevelCount++] = { offset, width, height };
+        offset += width * height;
+        if (width == 1 && height == 1) {
+            break;
+        }
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    assert_invariant(offset <= PYRAMID_SIZE);
+
+    mViewProjection = viewProjection;
+    mHasOccluders = false;
+    std::fill_n(mDepth.get(), mWidth * mHeight, FAR_DEPTH);
+}
+
+void OcclusionCuller::endOccluders() noexcept {
+    SYSTRACE_CALL();
+    if (!mHasOccluders) {
+        return;
+    }
+    // each texel of a level is the farthest depth of the (up to) 2x2 texels below it, odd
+    // dimensions are handled by clamping to the last row or column.
+    for (uint32_t l = 1; l < mLevelCount; l++) {
+        Level const& src = mLevels[l - 1];
+        Level const& dst = mLevels[l];
+        float const* const UTILS_RESTRICT in = mDepth.get() + src.offset;
+        float* const UTILS_RESTRICT out = mDepth.get() + dst.offset;
+        for (uint32_t y = 0; y < dst.height; y++) {
+            float const* const row0 = in + (2 * y) * src.width;
+            float const* const row1 = in + std::min(2 * y + 1, src.height - 1) * src.width;
+            for (uint32_t x = 0; x < dst.width; x++) {
+                uint32_t const x0 = 2 * x;
+                uint32_t const x1 = std::min(2 * x + 1, src.width - 1);
+                out[y * dst.width + x] = std::max(
+                        std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+            }
+        }
+    }
+}
+
+void OcclusionCuller::rasterize(mat4f const& worldTransform, Box const& box) noexcept {
+    mat4f const m = mViewProjection * worldTransform;
+    float4 corners[8];
+    bool inFront = true;
+    for (size_t i = 0; i < 8; i++) {
+        float3 const sign{ (i & 1u) ? 1.0f : -1.0f, (i & 2u) ? 1.0f : -1.0f, (i & 4u) ? 1.0f : -1.0f };
+        corners[i] = m * float4{ box.center + sign * box.halfExtent, 1.0f };
+        inFront = inFront && corners[i].z + corners[i].w > 0.0f && corners[i].w > 0.0f;
+    }
+
+    if (UTILS_UNLIKELY(!inFront)) {
+        // the box crosses the near plane, its faces are clipped and rasterized individually
+        for (auto const& face : sBoxFaces) {
+            float4 const clip[4] = {
+                    corners[face[0]], corners[face[1]], corners[face[2]], corners[face[3]] };
+            rasterizeClipped(clip, 4);
+        }
+        return;
+    }
+
+    // Otherwise, the box is rasterized as a whole, so there are no gaps between its faces. Its
+    // coverage is the convex hull of its projected corners, and since it is convex, the depth of
+    // its visible surface is the farthest of its front faces' depth.
+    // A face is facing the camera when the camera and the center of the box are on opposite sides
+    // of its plane, the camera is the point (0, 0, -1, 0) in clip space.
+    float4 const center = m * float4{ box.center, 1.0f };
+    float3 screen[8];
+    for (size_t i = 0; i < 8; i++) {
+        screen[i] = toScreen(corners[i]);
+    }
+    DepthPlane planes[3];
+    size_t planeCount = 0;
+    for (auto const& face : sBoxFaces) {
+        float4 const& a = corners[face[0]];
+        float4 const& b = corners[face[1]];
+        float4 const& c = corners[face[2]];
+        float const eyeSide = det(mat4f{ a, b, c, float4{ 0, 0, -1, 0 }});
+        float const centerSide = det(mat4f{ a, b, c, center });
+        if (eyeSide * centerSide < 0.0f && planeCount < 3) {
+            planeCount += computePlane(screen[face[0]], screen[face[1]], screen[face[2]],
+                    &planes[planeCount]);
+        }
+    }
+    if (planeCount) {
+        rasterizeConvex(screen, 8, planes, planeCount);
+    }
+}
+
+void OcclusionCuller::rasterize(float3 const* vertices, uint32_t const* indices,
+        size_t triangleCount) noexcept {
+    float4 clip[3];
+    for (size_t i = 0; i < triangleCount; i++) {
+        for (size_t j = 0; j < 3; j++) {
+            clip[j] = mViewProjection * float4{ vertices[indices[i * 3 + j]], 1.0f };
+        }
+        rasterizeClipped(clip, 3);
+    }
+}
+
+float3 OcclusionCuller::toScreen(float4 const& c) const noexcept {
+    float const iw = 1.0f / c.w;
+    return {
+            (c.x * iw * 0.5f + 0.5f) * float(mWidth),
+            (c.y * iw * 0.5f + 0.5f) * float(mHeight),
+            c.z * iw };
+}
+
+size_t OcclusionCuller::computePlane(float3 const& a, float3 const& b, float3 const& c,
+        DepthPlane* out) noexcept {
+    float3 const u = b - a;
+    float3 const v = c - a;
+    float const area = u.x * v.y - u.y * v.x;
+    if (!(std::abs(area) > 0.0f)) {
+        return 0;
+    }
+    float const ia = 1.0f / area;
+    *out = { a, (u.z * v.y - u.y * v.z) * ia, (u.x * v.z - u.z * v.x) * ia };
+    return 1;
+}
+
+void OcclusionCuller::rasterizeClipped(float4 const* clip, size_t count) noexcept {
+    // clip the convex polygon against the near plane (z + w >= 0), this adds at most one vertex
+    assert_invariant(count <= MAX_POLYGON_SIZE - 1);
+    float3 out[MAX_POLYGON_SIZE];
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        float4 const& cur = clip[i];
+        float4 const& next = clip[(i + 1) % count];
+        float const dc = cur.z + cur.w;
+        float const dn = next.z + next.w;
+        if (dc >= 0) {
+            out[n++] = toScreen(cur);
+        }
+        if ((dc >= 0) != (dn >= 0)) {
+            out[n++] = toScreen(cur + (next - cur) * (dc / (dc - dn)));
+        }
+    }
+    if (n < 3) {
+        return;
+    }
+
+    // the polygon is planar, its depth plane is computed from its largest triangle
+    DepthPlane plane;
+    size_t best = 1;
+    float bestArea = 0.0f;
+    for (size_t i = 1; i < n - 1; i++) {
+        float3 const u = out[i] - out[0];
+        float3 const v = out[i + 1] - out[0];
+        float const area = std::abs(u.x * v.y - u.y * v.x);
+        if (area > bestArea) {
+            bestArea = area;
+            best = i;
+        }
+    }
+    if (computePlane(out[0], out[best], out[best + 1], &plane)) {
+        rasterizeConvex(out, n, &plane, 1);
+    }
+}
+
+void OcclusionCuller::rasterizeConvex(float3 const* points, size_t count,
+        DepthPlane const* planes, size_t planeCount) noexcept {
+    assert_invariant(count <= MAX_POLYGON_SIZE);
+    assert_invariant(planeCount <= 3);
+
+    struct Vertex {
+        int64_t x, y;
+    };
+    Vertex vertices[MAX_POLYGON_SIZE];
+    for (size_t i = 0; i < count; i++) {
+        float3 const& v = points[i];
+        if (!(std::abs(v.x) < MAX_COORDINATE && std::abs(v.y) < MAX_COORDINATE)) {
+            // this can only happen for huge polygons very close to the near plane, skipping them
+            // is conservative.
+            return;
+        }
+        vertices[i] = { int64_t(std::lround(v.x * SUBPIXEL)), int64_t(std::lround(v.y * SUBPIXEL)) };
+    }
+
+    // counter-clockwise convex hull of the snapped vertices (monotone chain), collinear vertices
+    // are dropped.
+    std::sort(vertices, vertices + count, [](Vertex const& lhs, Vertex const& rhs) {
+        return lhs.x < rhs.x || (lhs.x == rhs.x && lhs.y < rhs.y);
+    });
+    auto cross = [](Vertex const& o, Vertex const& p, Vertex const& q) {
+        return (p.x - o.x) * (q.y - o.y) - (p.y - o.y) * (q.x - o.x);
+    };
+    Vertex hull[MAX_POLYGON_SIZE * 2];
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        while (n >= 2 && cross(hull[n - 2], hull[n - 1], vertices[i]) <= 0) {
+            n--;
+        }
+        hull[n++] = vertices[i];
+    }
+    for (size_t i = count - 1, lower = n + 1; i-- > 0;) {
+        while (n >= lower && cross(hull[n - 2], hull[n - 1], vertices[i]) <= 0) {
+            n--;
+        }
+        hull[n++] = vertices[i];
+    }
+    n--; // the last vertex is the first one
+    if (n < 3) {
+        return;
+    }
+    mHasOccluders = true;
+
+    // bounding box, clamped to the depth buffer
+    int64_t const S = int64_t(SUBPIXEL);
+    int64_t minX = hull[0].x, minY = hull[0].y, maxX = hull[0].x, maxY = hull[0].y;
+    for (size_t i = 1; i < n; i++) {
+        minX = std::min(minX, hull[i].x);
+        minY = std::min(minY, hull[i].y);
+        maxX = std::max(maxX, hull[i].x);
+        maxY = std::max(maxY, hull[i].y);
+    }
+    int32_t const x0 = int32_t(std::max(int64_t(0), minX / S));
+    int32_t const y0 = int32_t(std::max(int64_t(0), minY / S));
+    int32_t const x1 = int32_t(std::min(int64_t(mWidth - 1), maxX / S));
+    int32_t const y1 = int32_t(std::min(int64_t(mHeight - 1), maxY / S));
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+
+    // Setup: edge functions evaluated at the center of the first pixel, and their derivatives in
+    // x and y. Edge functions are positive inside the polygon.
+    // Each edge is pulled in by the half-extent of a pixel: the edge function is linear, so its
+    // minimum over a pixel is its value at the center minus (|dx| + |dy|) / 2. One more sub-pixel
+    // accounts for the snapping of the vertices. A pixel passes all the tests only if it is
+    // entirely inside the polygon.
+    // Note: pixels straddling an edge shared by two polygons are written by neither, this is the
+    // price of never overestimating the coverage, and why boxes are rasterized as a whole.
+    int64_t const px = int64_t(x0) * S + S / 2;
+    int64_t const py = int64_t(y0) * S + S / 2;
+    int64_t edgeValue[MAX_POLYGON_SIZE * 2], edgeDx[MAX_POLYGON_SIZE * 2], edgeDy[MAX_POLYGON_SIZE * 2];
+    for (size_t i = 0; i < n; i++) {
+        Vertex const& p = hull[i];
+        Vertex const& q = hull[(i + 1) % n];
+        int64_t const ex = q.x - p.x;
+        int64_t const ey = q.y - p.y;
+        int64_t const halfPixel = (std::abs(ex) + std::abs(ey)) * (S / 2 + 1);
+        edgeValue[i] = ex * (py - p.y) - ey * (px - p.x) - halfPixel;
+        edgeDx[i] = -ey * S;
+        edgeDy[i] = ex * S;
+    }
+
+    // Depth planes evaluated at the farthest corner of the first pixel, since they're linear this
+    // is their value at the center plus (|dx| + |dy|) / 2.
+    // Unused planes are at -infinity with no slope, so that the span loop below always evaluates
+    // all three and has no branches.
+    float planeValue[3] = { -FAR_DEPTH, -FAR_DEPTH, -FAR_DEPTH };
+    float planeDx[3] = {};
+    float planeDy[3] = {};
+    for (size_t i = 0; i < planeCount; i++) {
+        DepthPlane const& plane = planes[i];
+        float const cx = float(x0) + 0.5f - plane.origin.x;
+        float const cy = float(y0) + 0.5f - plane.origin.y;
+        planeValue[i] = plane.origin.z + plane.dx * cx + plane.dy * cy +
+                0.5f * (std::abs(plane.dx) + std::abs(plane.dy));
+        planeDx[i] = plane.dx;
+        planeDy[i] = plane.dy;
+    }
+
+    // floor(a / b), for b > 0
+    auto floorDiv = [](int64_t a, int64_t b) {
+        int64_t const q = a / b;
+        return (a % b != 0 && a < 0) ? q - 1 : q;
+    };
+
+    float* const UTILS_RESTRICT depth = mDepth.get();
+    for (int32_t y = y0; y <= y1; y++) {
+        int64_t const dy = y - y0;
+
+        // The edge functions are linear in x, so the pixels where all of them are positive form a
+        // single span [first, last] of the row (relative to x0), found without visiting pixels.
+        int64_t first = 0;
+        int64_t last = x1 - x0;
+        for (size_t i = 0; i < n; i++) {
+            int64_t const value = edgeValue[i] + edgeDy[i] * dy;
+            int64_t const slope = edgeDx[i];
+            if (slope > 0) {
+                first = std::max(first, -floorDiv(value, slope));
+            } else if (slope < 0) {
+                last = std::min(last, floorDiv(value, -slope));
+            } else if (value < 0) {
+                last = -1;
+            }
+        }
+
+        float const z0 = planeValue[0] + planeDy[0] * float(dy);
+        float const z1 = planeValue[1] + planeDy[1] * float(dy);
+        float const z2 = planeValue[2] + planeDy[2] * float(dy);
+        float* const UTILS_RESTRICT row = depth + y * mWidth + x0;
+        for (int64_t dx = first; dx <= last; dx++) {
+            float const fx = float(dx);
+            float const z = std::max(std::max(z0 + planeDx[0] * fx, z1 + planeDx[1] * fx),
+                    z2 + planeDx[2] * fx);
+            row[dx] = std::min(row[dx], z);
+        }
+    }
+}
+
+bool OcclusionCuller::isOccluded(Box const& box) const noexcept {
+    if (!mHasOccluders) {
+        return false;
+    }
+
+    // project the box and compute its screen-space bounds and nearest depth
+    float minX = std::numeric_limits<float>::max();
+    float minY = std::numeric_limits<float>::max();
+    float maxX = std::numeric_limits<float>::lowest();
+    float maxY = std::numeric_limits<float>::lowest();
+    float nearest = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < 8; i++) {
+        float3 const sign{ (i & 1u) ? 1.0f : -1.0f, (i & 2u) ? 1.0f : -1.0f, (i & 4u) ? 1.0f : -1.0f };
+        float4 const c = mViewProjection * float4{ box.center + sign * box.halfExtent, 1.0f };
+        if (!(c.z + c.w > 0.0f && c.w > 0.0f)) {
+            // the box crosses the near plane (or is behind the camera), consider it visible
+            return false;
+        }
+        float3 const s = toScreen(c);
+        minX = std::min(minX, s.x);
+        minY = std::min(minY, s.y);
+        maxX = std::max(maxX, s.x);
+        maxY = std::max(maxY, s.y);
+        nearest = std::min(nearest, s.z);
+    }
+
+    if (!(maxX >= 0.0f && maxY >= 0.0f && minX < float(mWidth) && minY < float(mHeight))) {
+        // off-screen, this is not our call
+        return false;
+    }
+
+    int32_t const x0 = int32_t(std::max(0.0f, minX));
+    int32_t const y0 = int32_t(std::max(0.0f, minY));
+    int32_t const x1 = int32_t(std::min(float(mWidth - 1), maxX));
+    int32_t const y1 = int32_t(std::min(float(mHeight - 1), maxY));
+
+    // start at the finest level where the box covers at most 2x2 texels
+    uint32_t level = 0;
+    while (level + 1 < mLevelCount &&
+            ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+        level++;
+    }
+
+    // Texels in front of the box hide it, otherwise we look at their children. The box is
+    // visible as soon as a texel of level 0 is not in front of it.
+    struct Texel {
+        uint32_t level;
+        int32_t x, y;
+    };
+    // at most 4 texels per level are pending
+    Texel stack[4 * MAX_LEVELS];
+    size_t top = 0;
+    for (int32_t y = y0 >> level; y <= (y1 >> level); y++) {
+        for (int32_t x = x0 >> level; x <= (x1 >> level); x++) {
+            stack[top++] = { level, x, y };
+        }
+    }
+
+    float const* const UTILS_RESTRICT depth = mDepth.get();
+    while (top) {
+        Texel const t = stack[--top];
+        Level const& l = mLevels[t.level];
+        if (depth[l.offset + t.y * l.width + t.x] < nearest) {
+            continue;
+        }
+        if (t.level == 0) {
+            return false;
+        }
+        // the children of this texel that the box covers
+        uint32_t const cl = t.level - 1;
+        int32_t const cx0 = std::max(2 * t.x, x0 >> cl);
+        int32_t const cy0 = std::max(2 * t.y, y0 >> cl);
+        int32_t const cx1 = std::min(2 * t.x + 1, x1 >> cl);
+        int32_t const cy1 = std::min(2 * t.y + 1, y1 >> cl);
+        for (int32_t y = cy0; y <= cy1; y++) {
+            for (int32_t x = cx0; x <= cx1; x++) {
+                assert_invariant(top < 4 * MAX_LEVELS);
+                stack[top++] = { cl, x, y };
+            }
+        }
+    }
+    return true;
+}
+
+void OcclusionCuller::cull(Culler::result_type* UTILS_RESTRICT results,
+        float3 const* UTILS_RESTRICT center, float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) const noexcept {
+    SYSTRACE_CALL();
+    if (!mHasOccluders) {
+        return;
+    }
+    Culler::result_type const mask = Culler::result_type(1u << bit);
+    for (size_t i = 0; i < count; i++) {
+        if ((results[i] & mask) && isOccluded({ center[i], extent[i] })) {
+            results[i] &= ~mask;
+        }
+    }
+}
+
+} // namespace filament
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_OCCLUSIONCULLER_H
+#define TNT_FILAMENT_OCCLUSIONCULLER_H
+
+#include "Culler.h"
+
+#include <filament/Box.h>
+
+#include <utils/compiler.h>
+
+#include <math/mat4.h>
+#include <math/vec3.h>
+#include <math/vec4.h>
+
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+
+/*
+ * A CPU occlusion culler.
+ *
+ * Occluders are rasterized into a low resolution depth buffer, from which a hierarchical depth
+ * buffer is built: a full mip pyramid where each texel holds the farthest depth of the 2x2
+ * texels below it. A bounding box is first tested at the level where its screen-space bounds
+ * cover at most 2x2 texels, and the test is refined at the finer levels only where it is
+ * inconclusive.
+ *
+ * Rasterization is conservative: only pixels entirely covered by an occluder are written, with
+ * the farthest depth of the occluder over the pixel. This way, a box can only be reported as
+ * occluded if it is hidden at any resolution.
+ *
+ * The depth buffer has a fixed number of pixels, its shape follows the aspect ratio of the
+ * viewport so that pixels stay roughly square.
+ *
+ * Depth is stored as clip-space z/w (which is affine in screen space), larger values are
+ * farther from the camera. Geometry is clipped against the near plane only, since what's
+ * outside of the other planes is simply not rasterized.
+ *
+ * Typical use:
+ *      culler.beginOccluders(viewProjection, aspectRatio);
+ *      culler.rasterize(...);  // for each occluder
+ *      culler.endOccluders();
+ *      culler.isOccluded(box); // or cull()
+ */
+class OcclusionCuller {
+public:
+    // maximum number of pixels of the depth buffer, its dimensions are multiples of TILE_SIZE
+    static constexpr uint32_t PIXEL_COUNT = 256 * 128;
+    static constexpr uint32_t MAX_DIMENSION = 1024;
+    static constexpr uint32_t TILE_SIZE = 8;
+    // number of levels of the depth pyramid, down to 1x1 from MAX_DIMENSION
+    static constexpr uint32_t MAX_LEVELS = 11;
+
+    OcclusionCuller() noexcept;
+    ~OcclusionCuller() noexcept;
+
+    OcclusionCuller(OcclusionCuller const&) = delete;
+    OcclusionCuller& operator=(OcclusionCuller const&) = delete;
+
+    // clears the depth buffer and sets the world-to-clip transform used for the next operations,
+    // aspectRatio is the width over the height of the viewport.
+    void beginOccluders(math::mat4f const& viewProjection, float aspectRatio) noexcept;
+
+    // rasterizes an oriented box, e.g.: an occluder's local AABB and its world transform
+    void rasterize(math::mat4f const& worldTransform, Box const& box) noexcept;
+
+    // rasterizes world-space triangles
+    void rasterize(math::float3 const* vertices, uint32_t const* indices,
+            size_t triangleCount) noexcept;
+
+    // builds the depth pyramid, must be called before any occlusion test
+    void endOccluders() noexcept;
+
+    // returns whether a world-space axis-aligned bounding box is entirely hidden by occluders
+    bool isOccluded(Box const& box) const noexcept;
+
+    /*
+     * Clears `bit` of results[i] for each box that has this bit set and is hidden by occluders.
+     * Boxes that don't have the bit set are not tested.
+     */
+    void cull(Culler::result_type* results,
+            math::float3 const* center, math::float3 const* extent,
+            size_t count, size_t bit) const noexcept;
+
+    // returns whether at least one occluder was rasterized
+    bool hasOccluders() const noexcept { return mHasOccluders; }
+
+    // dimensions of the depth buffer, valid after beginOccluders()
+    uint32_t getWidth() const noexcept { return mWidth; }
+    uint32_t getHeight() const noexcept { return mHeight; }
+
+    // number of levels of the depth pyramid, valid after beginOccluders()
+    uint32_t getLevelCount() const noexcept { return mLevelCount; }
+
+    // For testing... returns the depth at a given texel of a level of the pyramid
+    float getDepth(uint32_t x, uint32_t y, uint32_t level = 0) const noexcept {
+        Level const& l = mLevels[level];
+        return mDepth[l.offset + y * l.width + x];
+    }
+
+private:
+    // a box has at most 6 vertices in its silhouette, but its 8 corners are given to the hull
+    static constexpr size_t MAX_POLYGON_SIZE = 8;
+
+    // screen-space depth: z(x, y) = origin.z + dx * (x - origin.x) + dy * (y - origin.y)
+    struct DepthPlane {
+        math::float3 origin;
+        float dx, dy;
+    };
+
+    static size_t computePlane(math::float3 const& a, math::float3 const& b,
+            math::float3 const& c, DepthPlane* out) noexcept;
+
+    // clips a convex clip-space polygon against the near plane and rasterizes it
+    void rasterizeClipped(math::float4 const* clip, size_t count) noexcept;
+
+    // rasterizes the convex hull of the given screen-space points, the depth is the farthest of
+    // the given planes. Each row is rasterized as a span computed from the edge functions.
+    void rasterizeConvex(math::float3 const* points, size_t count,
+            DepthPlane const* planes, size_t planeCount) noexcept;
+
+    math::float3 toScreen(math::float4 const& c) const noexcept;
+
+    // a level of the depth pyramid, level 0 is the depth buffer itself
+    struct Level {
+        uint32_t offset;    // in mDepth
+        uint32_t width;
+        uint32_t height;
+    };
+
+    math::mat4f mViewProjection;
+    std::unique_ptr<float[]> mDepth;        // all levels of the pyramid
+    Level mLevels[MAX_LEVELS] = {};
+    uint32_t mLevelCount = 0;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    bool mHasOccluders = false;
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_OCCLUSIONCULLER_H
@@ -280,6 +280,11 @@ void PerViewUniforms::prepareHistorySSR(Handle<HwTexture> ssr,
     s.ssrStride = ssrOptions.stride;
 }
 
+void PerViewUniforms::prepareMotionVectors(math::mat4f const& previousClipFromWorld) noexcept {
+    auto& s = mUniforms.edit();
+    s.previousClipFromWorldMatrix = previousClipFromWorld;
+}
+
 void PerViewUniforms::prepareStructure(Handle<HwTexture> structure) noexcept {
     // sampler must be NEAREST
     mSamplers.setSampler(PerViewSib::STRUCTURE, { structure, {}});
@@ -104,6 +104,9 @@ public:
             math::mat4f const& uvFromViewMatrix,
             ScreenSpaceReflectionsOptions const& ssrOptions) noexcept;
 
+    // motion vectors, the projection must not be jittered
+    void prepareMotionVectors(math::mat4f const& previousClipFromWorld) noexcept;
+
     void prepareShadowMapping(bool highPrecision) noexcept;
 
     void prepareDirectionalLight(FEngine& engine, float exposure,
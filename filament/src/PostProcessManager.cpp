@@ -277,6 +277,7 @@ static const PostProcessManager::MaterialInfo sMaterialList[] = {
         { "dofMedian",                  MATERIAL(DOFMEDIAN) },
         { "dofMipmap",                  MATERIAL(DOFMIPMAP) },
         { "dofTiles",                   MATERIAL(DOFTILES) },
+        { "dofTiles4x",                 MATERIAL(DOFTILES4X) },
         { "dofTilesSwizzle",            MATERIAL(DOFTILESSWIZZLE) },
         { "flare",                      MATERIAL(FLARE) },
         { "fxaa",                       MATERIAL(FXAA) },
@@ -412,6 +413,16 @@ void PostProcessManager::commitAndRender(FrameGraphResources::RenderPassInfo con
     commitAndRender(out, material, 0, driver);
 }
 
+size_t PostProcessManager::prepareParallelDraws(PostProcessMaterial const& material,
+        uint8_t variant, size_t drawCount) noexcept {
+    material.getPipelineState(mEngine, variant);
+    // a draw updates at most all the uniforms and samplers, the remaining commands are small
+    FMaterialInstance const* const mi = material.getMaterialInstance(mEngine);
+    size_t const drawSize = mi->getUniformBuffer().getSize() +
+            mi->getSamplerGroup().getSize() * sizeof(SamplerDescriptor) + 1024;
+    return drawSize * drawCount;
+}
+
 // ------------------------------------------------------------------------------------------------
 
 PostProcessManager::StructurePassOutput PostProcessManager::structure(FrameGraph& fg,
@@ -525,6 +536,58 @@ PostProcessManager::StructurePassOutput PostProcessManager::structure(FrameGraph
 
 // ------------------------------------------------------------------------------------------------
 
+FrameGraphId<FrameGraphTexture> PostProcessManager::velocity(FrameGraph& fg,
+        RenderPassBuilder const& passBuilder, uint8_t velocityRenderFlags,
+        uint32_t width, uint32_t height) noexcept {
+
+    // Velocity pass -- a depth pass at the resolution of the color pass, which also writes the
+    // screen-space motion of the objects relative to the camera's own motion. It's cleared to
+    // zero for static objects and materials without the velocity variant.
+    // This is independent of the structure pass, which runs at a lower resolution and whose
+    // color attachment is used for picking.
+    struct VelocityPassData {
+        FrameGraphId<FrameGraphTexture> depth;
+        FrameGraphId<FrameGraphTexture> velocity;
+    };
+
+    auto& velocityPass = fg.addPass<VelocityPassData>("Velocity Pass",
+            [&](FrameGraph::Builder& builder, auto& data) {
+                data.depth = builder.createTexture("Velocity Depth Buffer", {
+                        .width = width, .height = height,
+                        .format = TextureFormat::DEPTH32F });
+
+                data.depth = builder.write(data.depth,
+                        FrameGraphTexture::Usage::DEPTH_ATTACHMENT);
+
+                data.velocity = builder.createTexture("Velocity Buffer", {
+                        .width = width, .height = height,
+                        .format = TextureFormat::RG16F });
+
+                data.velocity = builder.write(data.velocity,
+                        FrameGraphTexture::Usage::COLOR_ATTACHMENT);
+
+                builder.declareRenderPass("Velocity Target", {
+                        .attachments = { .color = { data.velocity }, .depth = data.depth },
+                        .clearFlags = TargetBufferFlags::COLOR0 | TargetBufferFlags::DEPTH
+                });
+            },
+            [=, passBuilder = passBuilder](FrameGraphResources const& resources,
+                    auto const&, DriverApi&) mutable {
+                auto out = resources.getRenderPassInfo();
+
+                passBuilder.renderFlags(velocityRenderFlags);
+                passBuilder.variant(Variant{ Variant::SPECIAL_VELOCITY });
+                passBuilder.commandTypeFlags(RenderPass::CommandTypeFlags::SSAO);
+
+                RenderPass const pass{ passBuilder.build(mEngine) };
+                RenderPass::execute(pass, mEngine, resources.getPassName(), out.target, out.params);
+            });
+
+    return velocityPass->velocity;
+}
+
+// ------------------------------------------------------------------------------------------------
+
 FrameGraphId<FrameGraphTexture> PostProcessManager::ssr(FrameGraph& fg,
         RenderPassBuilder const& passBuilder,
         FrameHistory const& frameHistory,
@@ -800,6 +863,12 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::screenSpaceAmbientOcclusion(
                         .clearColor = { 1.0f },
                         .clearFlags = TargetBufferFlags::COLOR0 | TargetBufferFlags::COLOR1
                 });
+
+                // this pass is the only user of its material, so it can record on a worker
+                // thread, e.g. while the shadow maps are recorded.
+                size_t const commandStreamSize = prepareParallelDraws(computeBentNormals ?
+                        getPostProcessMaterial("saoBentNormals") : getPostProcessMaterial("sao"));
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources,
                     auto const& data, DriverApi& driver) {
@@ -956,6 +1025,12 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::bilateralBlurPass(FrameGraph
                         .clearColor = { 1.0f },
                         .clearFlags = TargetBufferFlags::COLOR0 | TargetBufferFlags::COLOR1
                 });
+
+                auto const& material = config.bentNormals ?
+                        getPostProcessMaterial("bilateralBlurBentNormals") :
+                        getPostProcessMaterial("bilateralBlur");
+                size_t const commandStreamSize = prepareParallelDraws(material);
+                builder.parallel([commandStreamSize]() { return commandStreamSize; }, &material);
             },
             [=](FrameGraphResources const& resources,
                     auto const& data, DriverApi& driver) {
@@ -1085,6 +1160,18 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::gaussianBlurPass(FrameGraph&
         return m;
     };
 
+    auto getMaterialName = [](FrameGraphTexture::Descriptor const& inDesc,
+            FrameGraphTexture::Descriptor const& outDesc) -> std::string_view {
+        using namespace std::literals;
+        const bool is2dArray = inDesc.type == SamplerType::SAMPLER_2D_ARRAY;
+        switch (backend::getFormatComponentCount(outDesc.format)) {
+            case 1:  return is2dArray ? "separableGaussianBlur1L"sv : "separableGaussianBlur1"sv;
+            case 2:  return is2dArray ? "separableGaussianBlur2L"sv : "separableGaussianBlur2"sv;
+            case 3:  return is2dArray ? "separableGaussianBlur3L"sv : "separableGaussianBlur3"sv;
+            default: return is2dArray ? "separableGaussianBlur4L"sv : "separableGaussianBlur4"sv;
+        }
+    };
+
     struct BlurPassData {
         FrameGraphId<FrameGraphTexture> in;
         FrameGraphId<FrameGraphTexture> out;
@@ -1118,6 +1205,12 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::gaussianBlurPass(FrameGraph&
                 data.temp = builder.sample(data.temp);
                 data.temp = builder.declareRenderPass(data.temp);
                 data.out = builder.declareRenderPass(output);
+
+                // the blurs using the same material are recorded one after the other, but they
+                // can overlap other passes, e.g. the shadow maps they blur.
+                auto const& material = getPostProcessMaterial(getMaterialName(inDesc, outDesc));
+                size_t const commandStreamSize = prepareParallelDraws(material, 0, 2);
+                builder.parallel([commandStreamSize]() { return commandStreamSize; }, &material);
             },
             [=](FrameGraphResources const& resources,
                     auto const& data, DriverApi& driver) {
@@ -1136,19 +1229,9 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::gaussianBlurPass(FrameGraph&
                 FGTD const& tempDesc = resources.getDescriptor(data.temp);
 
                 using namespace std::literals;
-                std::string_view materialName;
                 const bool is2dArray = inDesc.type == SamplerType::SAMPLER_2D_ARRAY;
-                switch (backend::getFormatComponentCount(outDesc.format)) {
-                    case 1: materialName  = is2dArray ?
-                            "separableGaussianBlur1L"sv : "separableGaussianBlur1"sv;   break;
-                    case 2: materialName  = is2dArray ?
-                            "separableGaussianBlur2L"sv : "separableGaussianBlur2"sv;   break;
-                    case 3: materialName  = is2dArray ?
-                            "separableGaussianBlur3L"sv : "separableGaussianBlur3"sv;   break;
-                    default: materialName = is2dArray ?
-                            "separableGaussianBlur4L"sv : "separableGaussianBlur4"sv;   break;
-                }
-                auto const& separableGaussianBlur = getPostProcessMaterial(materialName);
+                auto const& separableGaussianBlur = getPostProcessMaterial(
+                        getMaterialName(inDesc, outDesc));
                 FMaterialInstance* const mi = separableGaussianBlur.getMaterialInstance(mEngine);
                 const size_t kernelStorageSize = mi->getMaterial()->reflect("kernel")->size;
 
@@ -1585,6 +1668,12 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
                                 .color = { data.outColor, data.outCoc }
                         }
                 });
+
+                // the DoF materials are only used by the DoF passes
+                size_t const commandStreamSize = prepareParallelDraws((dofResolution == 1) ?
+                        getPostProcessMaterial("dofCoc") :
+                        getPostProcessMaterial("dofDownsample"));
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources, auto const& data, DriverApi& driver) {
                 auto const& out = resources.getRenderPassInfo();
@@ -1640,6 +1729,10 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
                         }
                     });
                 }
+
+                size_t const commandStreamSize = prepareParallelDraws(
+                        getPostProcessMaterial("dofMipmap"), variant, mipmapCount - 1u);
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources,
                     auto const& data, DriverApi& driver) {
@@ -1695,44 +1788,58 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
         FrameGraphId<FrameGraphTexture> outTilesCocMinMax;
     };
 
+    // Two consecutive reductions are fused into a single 4x4 reduction whenever possible, which
+    // saves a pass and its intermediate buffer. When swizzling is not supported the first
+    // reduction needs dofTilesSwizzle and therefore is always done separately.
     const bool textureSwizzleSupported = Texture::isTextureSwizzleSupported(mEngine);
-    for (size_t i = 0; i < tileReductionCount; i++) {
+    for (size_t i = 0; i < tileReductionCount;) {
+        const bool fused = (tileReductionCount - i >= 2) && (textureSwizzleSupported || i > 0);
+        const size_t reductionCount = fused ? 2 : 1;
         auto& ppDoFTiling = fg.addPass<PostProcessDofTiling1>("DoF Tiling",
                 [&](FrameGraph::Builder& builder, auto& data) {
 
                     // this must be true by construction
-                    assert_invariant(((tileBufferWidth  >> i) & 1u) == 0);
-                    assert_invariant(((tileBufferHeight >> i) & 1u) == 0);
+                    UTILS_UNUSED_IN_RELEASE uint32_t const mask = (1u << reductionCount) - 1u;
+                    assert_invariant(((tileBufferWidth  >> i) & mask) == 0);
+                    assert_invariant(((tileBufferHeight >> i) & mask) == 0);
 
                     data.inCocMinMax = builder.sample(inTilesCocMinMax);
                     data.outTilesCocMinMax = builder.createTexture("dof tiles output", {
-                            .width  = tileBufferWidth  >> (i + 1u),
-                            .height = tileBufferHeight >> (i + 1u),
+                            .width  = tileBufferWidth  >> (i + reductionCount),
+                            .height = tileBufferHeight >> (i + reductionCount),
                             .format = TextureFormat::RG16F
                     });
                     data.outTilesCocMinMax = builder.declareRenderPass(data.outTilesCocMinMax);
+
+                    auto const& material = fused ? getPostProcessMaterial("dofTiles4x") :
+                            (!textureSwizzleSupported && (i == 0)) ?
+                            getPostProcessMaterial("dofTilesSwizzle") :
+                            getPostProcessMaterial("dofTiles");
+                    size_t const commandStreamSize = prepareParallelDraws(material);
+                    builder.parallel([commandStreamSize]() { return commandStreamSize; },
+                            &material);
                 },
                 [=](FrameGraphResources const& resources,
                         auto const& data, DriverApi& driver) {
-                    auto const& inputDesc = resources.getDescriptor(data.inCocMinMax);
                     auto const& out = resources.getRenderPassInfo();
                     auto inCocMinMax = resources.getTexture(data.inCocMinMax);
-                    auto const& material = (!textureSwizzleSupported && (i == 0)) ?
+                    auto const& material = fused ? getPostProcessMaterial("dofTiles4x") :
+                            (!textureSwizzleSupported && (i == 0)) ?
                             getPostProcessMaterial("dofTilesSwizzle") :
                             getPostProcessMaterial("dofTiles");
                     FMaterialInstance* const mi = material.getMaterialInstance(mEngine);
                     mi->setParameter("cocMinMax", inCocMinMax, { .filterMin = SamplerMinFilter::NEAREST });
-                    mi->setParameter("texelSize", float2{ 1.0f / inputDesc.width, 1.0f / inputDesc.height });
                     commitAndRender(out, material, driver);
                 });
         inTilesCocMinMax = ppDoFTiling->outTilesCocMinMax;
+        i += reductionCount;
     }
 
     /*
      * Dilate tiles
      */
 
-    // This is a small helper that does one round of dilate
+    // This is a small helper that does the dilate rounds
     auto dilate = [&](FrameGraphId<FrameGraphTexture> input) -> FrameGraphId<FrameGraphTexture> {
 
         struct PostProcessDofDilate {
@@ -1746,6 +1853,11 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
                     data.inTilesCocMinMax = builder.sample(input);
                     data.outTilesCocMinMax = builder.createTexture("dof dilated tiles output", inputDesc);
                     data.outTilesCocMinMax = builder.declareRenderPass(data.outTilesCocMinMax );
+
+                    auto const& material = getPostProcessMaterial("dofDilate");
+                    size_t const commandStreamSize = prepareParallelDraws(material);
+                    builder.parallel([commandStreamSize]() { return commandStreamSize; },
+                            &material);
                 },
                 [=](FrameGraphResources const& resources,
                         auto const& data, DriverApi& driver) {
@@ -1762,8 +1874,8 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
     // Tiles of 16 full-resolution pixels requires two dilate rounds to accommodate our max Coc of 32 pixels
     // (note: when running at half-res, the tiles are 8 half-resolution pixels, and still need two
     //  dilate rounds to accommodate the mac CoC pf 16 half-resolution pixels)
+    // Both rounds are done by a single pass, see dofDilate.mat.
     auto dilated = dilate(inTilesCocMinMax);
-    dilated = dilate(dilated);
 
     /*
      * DoF blur pass
@@ -1799,6 +1911,10 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
                 builder.declareRenderPass("DoF Target", {
                         .attachments = { .color = { data.outColor, data.outAlpha }}
                 });
+
+                size_t const commandStreamSize = prepareParallelDraws(
+                        getPostProcessMaterial("dof"));
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources, auto const& data, DriverApi& driver) {
                 auto const& out = resources.getRenderPassInfo();
@@ -1861,6 +1977,10 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
                 builder.declareRenderPass("DoF Target", {
                         .attachments = { .color = { data.outColor, data.outAlpha }}
                 });
+
+                size_t const commandStreamSize = prepareParallelDraws(
+                        getPostProcessMaterial("dofMedian"));
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources, auto const& data, DriverApi& driver) {
                 auto const& out = resources.getRenderPassInfo();
@@ -1906,6 +2026,10 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
                 auto const& inputDesc = fg.getDescriptor(data.color);
                 data.output = builder.createTexture("DoF output", inputDesc);
                 data.output = builder.declareRenderPass(data.output);
+
+                size_t const commandStreamSize = prepareParallelDraws(
+                        getPostProcessMaterial("dofCombine"));
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources,
                     auto const& data, DriverApi& driver) {
@@ -2069,6 +2193,13 @@ PostProcessManager::BloomPassOutput PostProcessManager::bloom(FrameGraph& fg,
                     }
                     builder.declareRenderPass(out, &data.outRT[i]);
                 }
+
+                // the bloom passes are the only users of their materials
+                size_t const commandStreamSize =
+                        prepareParallelDraws(getPostProcessMaterial("bloomDownsample9"), 0,
+                                inoutBloomOptions.levels) +
+                        prepareParallelDraws(getPostProcessMaterial("bloomDownsample"));
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources,
                     auto const& data, DriverApi& driver) {
@@ -2133,6 +2264,10 @@ PostProcessManager::BloomPassOutput PostProcessManager::bloom(FrameGraph& fg,
                             { .level = uint8_t(i) });
                     builder.declareRenderPass(out, &data.outRT[i]);
                 }
+
+                size_t const commandStreamSize = prepareParallelDraws(
+                        getPostProcessMaterial("bloomUpsample"), 0, inoutBloomOptions.levels);
+                builder.parallel([commandStreamSize]() { return commandStreamSize; });
             },
             [=](FrameGraphResources const& resources, auto const& data, DriverApi& driver) {
                 auto hwOut = resources.getTexture(data.out);
@@ -2630,6 +2765,7 @@ void PostProcessManager::configureTemporalAntiAliasingMaterial(
 
     setConstantParameter(ma, "upscaling", taaOptions.upscaling);
     setConstantParameter(ma, "historyReprojection", taaOptions.historyReprojection);
+    setConstantParameter(ma, "motionVectors", taaOptions.motionVectors);
     setConstantParameter(ma, "filterHistory", taaOptions.filterHistory);
     setConstantParameter(ma, "filterInput", taaOptions.filterInput);
     setConstantParameter(ma, "useYCoCg", taaOptions.useYCoCg);
@@ -2647,11 +2783,13 @@ void PostProcessManager::configureTemporalAntiAliasingMaterial(
 FrameGraphId<FrameGraphTexture> PostProcessManager::taa(FrameGraph& fg,
         FrameGraphId<FrameGraphTexture> input,
         FrameGraphId<FrameGraphTexture> depth,
+        FrameGraphId<FrameGraphTexture> velocity,
         FrameHistory& frameHistory,
         FrameHistoryEntry::TemporalAA FrameHistoryEntry::*pTaa,
         TemporalAntiAliasingOptions const& taaOptions,
         ColorGradingConfig const& colorGradingConfig) noexcept {
     assert_invariant(depth);
+    assert_invariant(!taaOptions.motionVectors || velocity);
 
     auto const& previous = frameHistory.getPrevious().*pTaa;
     auto& current = frameHistory.getCurrent().*pTaa;
@@ -2669,6 +2807,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::taa(FrameGraph& fg,
     struct TAAData {
         FrameGraphId<FrameGraphTexture> color;
         FrameGraphId<FrameGraphTexture> depth;
+        FrameGraphId<FrameGraphTexture> velocity;
         FrameGraphId<FrameGraphTexture> history;
         FrameGraphId<FrameGraphTexture> output;
         FrameGraphId<FrameGraphTexture> tonemappedOutput;
@@ -2682,6 +2821,9 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::taa(FrameGraph& fg,
                 }
                 data.color = builder.sample(input);
                 data.depth = builder.sample(depth);
+                if (taaOptions.motionVectors) {
+                    data.velocity = builder.sample(velocity);
+                }
                 data.history = builder.sample(colorHistory);
                 data.output = builder.createTexture("TAA output", desc);
                 data.output = builder.write(data.output);
@@ -2748,6 +2890,9 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::taa(FrameGraph& fg,
                 FMaterialInstance* mi = material.getMaterialInstance(mEngine);
                 mi->setParameter("color",  color, {});  // nearest
                 mi->setParameter("depth",  depth, {});  // nearest
+                // the velocity buffer is unused without motion vectors, but must still be bound
+                mi->setParameter("velocity",
+                        data.velocity ? resources.getTexture(data.velocity) : depth, {});
                 mi->setParameter("alpha", taaOptions.feedback);
                 mi->setParameter("history", history, {
                         .filterMag = SamplerMagFilter::LINEAR,
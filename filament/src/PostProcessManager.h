@@ -103,6 +103,11 @@ public:
             RenderPassBuilder const& passBuilder, uint8_t structureRenderFlags,
             uint32_t width, uint32_t height, StructurePassConfig const& config) noexcept;
 
+    // velocity (motion vectors) pass, at the color pass resolution
+    FrameGraphId<FrameGraphTexture> velocity(FrameGraph& fg,
+            RenderPassBuilder const& passBuilder, uint8_t velocityRenderFlags,
+            uint32_t width, uint32_t height) noexcept;
+
     // reflections pass
     FrameGraphId<FrameGraphTexture> ssr(FrameGraph& fg,
             RenderPassBuilder const& passBuilder,
@@ -226,6 +231,7 @@ public:
     FrameGraphId<FrameGraphTexture> taa(FrameGraph& fg,
             FrameGraphId<FrameGraphTexture> input,
             FrameGraphId<FrameGraphTexture> depth,
+            FrameGraphId<FrameGraphTexture> velocity,
             FrameHistory& frameHistory,
             FrameHistoryEntry::TemporalAA FrameHistoryEntry::*pTaa,
             TemporalAntiAliasingOptions const& taaOptions,
@@ -348,6 +354,12 @@ public:
         render(out, combo.first, combo.second, driver);
     }
 
+    // Loads the material and creates its program, so that a pass can draw with it on a worker
+    // thread, see FrameGraph::Builder::parallel(). Returns an upper bound of the space used in
+    // the CommandStream by `drawCount` commitAndRender() with this material.
+    size_t prepareParallelDraws(PostProcessMaterial const& material, uint8_t variant = 0,
+            size_t drawCount = 1) noexcept;
+
 private:
     FEngine& mEngine;
 
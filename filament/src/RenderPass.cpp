@@ -49,8 +49,11 @@
 
 #include <algorithm>
 #include <functional>
+#include <iterator>
 #include <limits>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #include <stddef.h>
 #include <stdint.h>
@@ -99,12 +102,28 @@ RenderPass::RenderPass(FEngine& engine, RenderPassBuilder const& builder) noexce
           mScissorViewport(builder.mScissorViewport),
           mCustomCommands(engine.getPerRenderPassArena()) {
 
-    // compute the number of commands we need
-    updateSummedPrimitiveCounts(
-            const_cast<FScene::RenderableSoa&>(mRenderableSoa), mVisibleRenderables);
+    FScene::RenderableSoa const& soa = mRenderableSoa;
+    Range<uint32_t> const vr = mVisibleRenderables;
+
+    // A deferred pass is generated by a job while other passes are being built, which can
+    // change the visibility and level of detail of the renderables, so it uses a copy.
+    Renderables renderables;
+    if (builder.mDeferred) {
+        renderables = snapshotRenderables(builder.mArena, soa, vr);
+    } else {
+        auto& renderableData = const_cast<FScene::RenderableSoa&>(soa);
+        updateSummedPrimitiveCounts(renderableData.data<FScene::PRIMITIVES>() + vr.first,
+                renderableData.data<FScene::SUMMED_PRIMITIVE_COUNT>() + vr.first, vr.size());
+        renderables = {
+                .soa = &soa,
+                .visibleMask = soa.data<FScene::VISIBLE_MASK>(),
+                .primitives = soa.data<FScene::PRIMITIVES>(),
+                .summedPrimitiveCount = soa.data<FScene::SUMMED_PRIMITIVE_COUNT>(),
+                .offset = 0 };
+    }
 
-    uint32_t commandCount =
-            FScene::getPrimitiveCount(mRenderableSoa, mVisibleRenderables.last);
+    // compute the number of commands we need
+    uint32_t commandCount = renderables.getPrimitiveCount(vr.last);
     const bool colorPass  = bool(builder.mCommandTypeFlags & CommandTypeFlags::COLOR);
     const bool depthPass  = bool(builder.mCommandTypeFlags & CommandTypeFlags::DEPTH);
     commandCount *= uint32_t(colorPass * 2 + depthPass);
@@ -128,8 +147,6 @@ RenderPass::RenderPass(FEngine& engine, RenderPassBuilder const& builder) noexce
     mCommandBegin = curr;
     mCommandEnd = curr + commandCount + customCommandCount;
 
-    appendCommands(engine, { curr, commandCount }, builder.mCommandTypeFlags);
-
     if (builder.mCustomCommands.has_value()) {
         Command* p = curr + commandCount;
         for (auto [channel, passId, command, order, fn]: builder.mCustomCommands.value()) {
@@ -137,30 +154,145 @@ RenderPass::RenderPass(FEngine& engine, RenderPassBuilder const& builder) noexce
         }
     }
 
-    // sort commands once we're done adding commands
-    sortCommands(builder.mArena);
+    const RenderFlags renderFlags = mFlags |
+            (engine.isAutomaticInstancingEnabled() ? HAS_AUTOMATIC_INSTANCING : 0);
+    GenerateInfo const info{
+            .renderables = renderables,
+            .range = vr,
+            .commandTypeFlags = builder.mCommandTypeFlags,
+            .renderFlags = renderFlags,
+            .variant = mVariant,
+            .visibilityMask = mVisibilityMask,
+            .instancedStereoEyeCount = uint8_t(renderFlags & IS_STEREOSCOPIC ?
+                    engine.getConfig().stereoscopicEyeCount : 1),
+            .cameraPosition = mCameraPosition,
+            .cameraForward = mCameraForwardVector };
+
+    JobSystem& js = engine.getJobSystem();
+    FRenderableManager const& rcm = engine.getRenderableManager();
+
+    if (builder.mDeferred) {
+        // The commands are generated and sorted in a job, which can't access the arena, so
+        // everything it needs is allocated here. finish() takes care of the rest.
+        struct DeferredWork {
+            GenerateInfo info;
+            Command* begin;
+            Command* end;
+            uint32_t commandCount;
+            SortKey* scratch;
+        };
+        mArena = &builder.mArena;
+        size_t const count = mCommandEnd - mCommandBegin;
+        if (count >= RADIX_SORT_MIN_COMMAND_COUNT) {
+            mSortScratch = builder.mArena.alloc<SortKey>(count * 2);
+        }
+        DeferredWork* const work = builder.mArena.make<DeferredWork>(DeferredWork{
+                info, mCommandBegin, mCommandEnd, commandCount, mSortScratch });
+        mDeferredJob = js.runAndRetain(js.createJob(nullptr,
+                [work, &rcm](JobSystem& js, JobSystem::Job*) {
+                    appendCommands(js, rcm, work->info, { work->begin, work->commandCount });
+                    sortCommands(work->scratch, work->begin, work->end);
+                }));
+        return;
+    }
+
+    CommandCache* const cache = builder.mCommandCache;
+    if (cache) {
+        cache->prepare(engine, {
+                        uint32_t(info.commandTypeFlags),
+                        uint32_t(info.variant.key) | (uint32_t(renderFlags) << 8u) |
+                                (uint32_t(info.instancedStereoEyeCount) << 16u),
+                        uint32_t(info.visibilityMask),
+                        vr.first },
+                vr.last);
+    }
+
+    appendCommands(js, rcm, info, { curr, commandCount }, cache);
+
+    if (cache) {
+        // this also prepares the programs
+        mergeCachedCommands(engine, builder.mArena, *cache);
+    } else {
+        prepareCommands(curr, curr + commandCount);
+        // sort commands once we're done adding commands
+        sortCommands(builder.mArena);
+    }
 
     if (engine.isAutomaticInstancingEnabled()) {
         instanceify(engine, builder.mArena);
     }
 }
 
+void RenderPass::finish(FEngine& engine) noexcept {
+    if (!mDeferredJob) {
+        return;
+    }
+
+    SYSTRACE_CALL();
+
+    engine.getJobSystem().waitAndRelease(mDeferredJob);
+    assert_invariant(!mDeferredJob);
+
+    // give the scratch buffer back if nothing was allocated after it
+    Arena& arena = *mArena;
+    if (mSortScratch) {
+        size_t const count = mCommandEnd - mCommandBegin;
+        if (arena.getCurrent() == mSortScratch + count * 2) {
+            arena.rewind(mSortScratch);
+        }
+        mSortScratch = nullptr;
+    }
+
+    trimCommands(arena);
+
+    // the sentinels are gone, this only leaves the commands that were actually generated
+    prepareCommands(mCommandBegin, mCommandEnd);
+
+    if (engine.isAutomaticInstancingEnabled()) {
+        instanceify(engine, arena);
+    }
+}
+
 // this destructor is actually heavy because it inlines ~vector<>
 RenderPass::~RenderPass() noexcept = default;
 
 void RenderPass::resize(Arena& arena, size_t count) noexcept {
     if (mCommandBegin) {
-        mCommandEnd = mCommandBegin + count;
-        arena.rewind(mCommandEnd);
+        Command* const end = mCommandBegin + count;
+        // we can only give memory back if we're the last allocation of the arena, which is
+        // not the case when other passes were built while this one was being generated.
+        if (arena.getCurrent() == mCommandEnd) {
+            arena.rewind(end);
+        }
+        mCommandEnd = end;
     }
 }
 
-void RenderPass::appendCommands(FEngine& engine,
-        Slice<Command> commands, CommandTypeFlags const commandTypeFlags) noexcept {
+RenderPass::Renderables RenderPass::snapshotRenderables(Arena& arena,
+        FScene::RenderableSoa const& soa, Range<uint32_t> vr) noexcept {
+    SYSTRACE_CALL();
+
+    uint32_t const count = vr.size();
+    auto* const visibleMask = arena.alloc<FScene::VisibleMaskType>(count);
+    auto* const primitives = arena.alloc<Slice<FRenderPrimitive>>(count);
+    auto* const summedPrimitiveCount = arena.alloc<uint32_t>(count + 1);
+    std::uninitialized_copy_n(soa.data<FScene::VISIBLE_MASK>() + vr.first, count, visibleMask);
+    std::uninitialized_copy_n(soa.data<FScene::PRIMITIVES>() + vr.first, count, primitives);
+    updateSummedPrimitiveCounts(primitives, summedPrimitiveCount, count);
+    return {
+            .soa = &soa,
+            .visibleMask = visibleMask,
+            .primitives = primitives,
+            .summedPrimitiveCount = summedPrimitiveCount,
+            .offset = vr.first };
+}
+
+void RenderPass::appendCommands(JobSystem& js, FRenderableManager const& rcm,
+        GenerateInfo const& info, Slice<Command> commands, CommandCache* const cache) noexcept {
     SYSTRACE_CALL();
     SYSTRACE_CONTEXT();
 
-    utils::Range<uint32_t> const vr = mVisibleRenderables;
+    utils::Range<uint32_t> const vr = info.range;
     // trace the number of visible renderables
     SYSTRACE_VALUE32("visibleRenderables", vr.size());
     if (UTILS_UNLIKELY(vr.empty())) {
@@ -172,28 +304,21 @@ void RenderPass::appendCommands(FEngine& engine,
         return;
     }
 
-    JobSystem& js = engine.getJobSystem();
-    const RenderFlags renderFlags = mFlags;
-    const Variant variant = mVariant;
-    const FScene::VisibleMaskType visibilityMask = mVisibilityMask;
-
-    // up-to-date summed primitive counts needed for generateCommands()
-    FScene::RenderableSoa const& soa = mRenderableSoa;
-
     Command* curr = commands.data();
     size_t const commandCount = commands.size();
 
-    auto stereoscopicEyeCount =
-            renderFlags & IS_STEREOSCOPIC ? engine.getConfig().stereoscopicEyeCount : 1;
-
-    const float3 cameraPosition(mCameraPosition);
-    const float3 cameraForwardVector(mCameraForwardVector);
-    auto work = [commandTypeFlags, curr, &soa, variant, renderFlags, visibilityMask, cameraPosition,
-                 cameraForwardVector, stereoscopicEyeCount]
-            (uint32_t startIndex, uint32_t indexCount) {
-        RenderPass::generateCommands(commandTypeFlags, curr,
-                soa, { startIndex, startIndex + indexCount }, variant, renderFlags, visibilityMask,
-                cameraPosition, cameraForwardVector, stereoscopicEyeCount);
+    auto work = [&info, curr, &rcm, cache](uint32_t startIndex, uint32_t indexCount) {
+        Range<uint32_t> const range{ startIndex, startIndex + indexCount };
+        if (cache) {
+            cache->generateCommands(info.commandTypeFlags, curr, rcm,
+                    info.renderables, range, info.variant, info.renderFlags,
+                    info.visibilityMask, info.cameraPosition, info.cameraForward,
+                    info.instancedStereoEyeCount);
+            return;
+        }
+        RenderPass::generateCommands(info.commandTypeFlags, curr,
+                info.renderables, range, info.variant, info.renderFlags, info.visibilityMask,
+                info.cameraPosition, info.cameraForward, info.instancedStereoEyeCount);
     };
 
     if (vr.size() <= JOBS_PARALLEL_FOR_COMMANDS_COUNT) {
@@ -208,10 +333,12 @@ void RenderPass::appendCommands(FEngine& engine,
     // "eof" command. these commands are guaranteed to be sorted last in the
     // command buffer.
     curr[commandCount - 1].key = uint64_t(Pass::SENTINEL);
+}
 
+void RenderPass::prepareCommands(Command const* first, Command const* last) noexcept {
     // Go over all the commands and call prepareProgram().
     // This must be done from the main thread.
-    for (Command const* first = curr, *last = curr + commandCount ; first != last ; ++first) {
+    for (; first != last ; ++first) {
         if (UTILS_LIKELY((first->key & CUSTOM_MASK) == uint64_t(CustomCommand::PASS))) {
             auto ma = first->primitive.primitive->getMaterialInstance()->getMaterial();
             ma->prepareProgram(first->primitive.materialVariant);
@@ -242,8 +369,25 @@ void RenderPass::appendCustomCommand(Command* commands,
 void RenderPass::sortCommands(Arena& arena) noexcept {
     SYSTRACE_NAME("sort and trim commands");
 
-    std::sort(mCommandBegin, mCommandEnd);
+    if (size_t(mCommandEnd - mCommandBegin) >= RADIX_SORT_MIN_COMMAND_COUNT) {
+        radixSortCommands(arena, mCommandBegin, mCommandEnd);
+    } else {
+        std::sort(mCommandBegin, mCommandEnd);
+    }
 
+    trimCommands(arena);
+}
+
+void RenderPass::sortCommands(SortKey* scratch, Command* begin, Command* end) noexcept {
+    SYSTRACE_NAME("sort commands");
+    if (scratch) {
+        radixSortCommands(scratch, begin, end);
+    } else {
+        std::sort(begin, end);
+    }
+}
+
+void RenderPass::trimCommands(Arena& arena) noexcept {
     // find the last command
     Command const* const last = std::partition_point(mCommandBegin, mCommandEnd,
             [](Command const& c) {
@@ -253,6 +397,88 @@ void RenderPass::sortCommands(Arena& arena) noexcept {
     resize(arena, uint32_t(last - mCommandBegin));
 }
 
+void RenderPass::radixSortCommands(Arena& arena,
+        Command* const begin, Command* const end) noexcept {
+    // all temporary allocations are freed when we return
+    void* const mark = arena.getCurrent();
+    radixSortCommands(arena.alloc<SortKey>((end - begin) * 2), begin, end);
+    arena.rewind(mark);
+}
+
+void RenderPass::radixSortCommands(SortKey* const scratch,
+        Command* const begin, Command* const end) noexcept {
+    SYSTRACE_CALL();
+
+    constexpr size_t RADIX_BITS = 8;
+    constexpr size_t BUCKET_COUNT = 1u << RADIX_BITS;
+    constexpr size_t PASS_COUNT = (sizeof(CommandKey) * 8) / RADIX_BITS;
+
+    size_t const count = end - begin;
+    assert_invariant(count <= std::numeric_limits<uint32_t>::max());
+    if (UTILS_UNLIKELY(count < 2)) {
+        return;
+    }
+
+    SortKey* UTILS_RESTRICT src = scratch;
+    SortKey* UTILS_RESTRICT dst = scratch + count;
+
+    // Extract the keys and compute the histograms of all digits at once, so we only need to
+    // touch the (large) commands once.
+    uint32_t histograms[PASS_COUNT][BUCKET_COUNT] = {};
+    for (size_t i = 0; i < count; i++) {
+        CommandKey const key = begin[i].key;
+        src[i] = { key, uint32_t(i) };
+        UTILS_UNROLL
+        for (size_t pass = 0; pass < PASS_COUNT; pass++) {
+            histograms[pass][(key >> (pass * RADIX_BITS)) & (BUCKET_COUNT - 1)]++;
+        }
+    }
+
+    for (size_t pass = 0; pass < PASS_COUNT; pass++) {
+        uint32_t* const histogram = histograms[pass];
+        size_t const shift = pass * RADIX_BITS;
+
+        // Many bits of the key are the same for all commands (e.g. the pass), when all keys
+        // have the same digit, this pass wouldn't change the order.
+        if (histogram[(src[0].key >> shift) & (BUCKET_COUNT - 1)] == count) {
+            continue;
+        }
+
+        // turn the histogram into the offset of each bucket
+        uint32_t offset = 0;
+        for (size_t b = 0; b < BUCKET_COUNT; b++) {
+            uint32_t const c = histogram[b];
+            histogram[b] = offset;
+            offset += c;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            SortKey const e = src[i];
+            dst[histogram[(e.key >> shift) & (BUCKET_COUNT - 1)]++] = e;
+        }
+        std::swap(src, dst);
+    }
+
+    // Now src[i].index is the current position of the command that goes to position i.
+    // Permute the commands in place by following the cycles of the permutation, so that each
+    // command is moved exactly once (plus one move per cycle).
+    for (size_t i = 0; i < count; i++) {
+        if (src[i].index == i) {
+            continue;
+        }
+        Command const temp = begin[i];
+        size_t j = i;
+        while (src[j].index != i) {
+            size_t const k = src[j].index;
+            begin[j] = begin[k];
+            src[j].index = uint32_t(j);
+            j = k;
+        }
+        begin[j] = temp;
+        src[j].index = uint32_t(j);
+    }
+}
+
 void RenderPass::execute(RenderPass const& pass,
         FEngine& engine, const char* name,
         backend::Handle<backend::HwRenderTarget> renderTarget,
@@ -269,12 +495,12 @@ void RenderPass::instanceify(FEngine& engine, Arena& arena) noexcept {
     // instanceify works by scanning the **sorted** command stream, looking for repeat draw
     // commands. When one is found, it is replaced by an instanced command.
     // A "repeat" draw is one that ends-up using the same draw parameters and state.
-    // Currently, this relies somewhat on luck that "repeat draws" are found consecutively,
-    // we could improve this by including some or all of these "repeat" parameters in the
-    // sorting key (e.g. raster state, primitive handle, etc...), the key could even use a small
-    // hash of those parameters.
+    // When automatic instancing is enabled, the sorting key contains a hash of these parameters
+    // (see makeInstancingHash()), which guarantees that "repeat draws" are consecutive
+    // (unless there is a hash collision, in which case we just instance less).
 
-    UTILS_UNUSED uint32_t drawCallsSavedCount = 0;
+    uint32_t drawCallsSavedCount = 0;
+    uint32_t batchCount = 0;
 
     Command* curr = mCommandBegin;
     Command* const last = mCommandEnd;
@@ -285,8 +511,10 @@ void RenderPass::instanceify(FEngine& engine, Arena& arena) noexcept {
     uint32_t stagingBufferSize = 0;
     uint32_t instancedPrimitiveOffset = 0;
 
-    // TODO: for the case of instancing we could actually use 128 instead of 64 instances
-    constexpr size_t maxInstanceCount = CONFIG_MAX_INSTANCES;
+    // The per-renderable data is declared as an array of CONFIG_MAX_INSTANCES in the
+    // materials' uniform block, longer runs are split in several instanced draws.
+    size_t const maxInstanceCount = engine.getMaxAutomaticInstances();
+    assert_invariant(maxInstanceCount <= CONFIG_MAX_INSTANCES);
 
     while (curr != last) {
 
@@ -310,6 +538,7 @@ void RenderPass::instanceify(FEngine& engine, Arena& arena) noexcept {
 
         if (UTILS_UNLIKELY(instanceCount > 1)) {
             drawCallsSavedCount += instanceCount - 1;
+            batchCount++;
 
             // allocate our staging buffer only if needed
             if (UTILS_UNLIKELY(!stagingBuffer)) {
@@ -344,9 +573,11 @@ void RenderPass::instanceify(FEngine& engine, Arena& arena) noexcept {
         curr = const_cast<Command*>(e);
     }
 
+    mInstancedDrawCallsSaved = drawCallsSavedCount;
+    engine.debug.instancing.draw_calls_saved += int(drawCallsSavedCount);
+    engine.debug.instancing.instanced_draw_calls += int(batchCount);
+
     if (UTILS_UNLIKELY(firstSentinel)) {
-        //slog.d << "auto-instancing, saving " << drawCallsSavedCount << " draw calls, out of "
-        //       << mCommandEnd - mCommandBegin << io::endl;
 
         // we have instanced primitives
         DriverApi& driver = engine.getDriverApi();
@@ -431,7 +662,7 @@ void RenderPass::setupColorCommand(Command& cmdDraw, Variant variant,
 /* static */
 UTILS_NOINLINE
 void RenderPass::generateCommands(CommandTypeFlags commandTypeFlags, Command* const commands,
-        FScene::RenderableSoa const& soa, Range<uint32_t> range,
+        Renderables const& renderables, Range<uint32_t> range,
         Variant variant, RenderFlags renderFlags,
         FScene::VisibleMaskType visibilityMask, float3 cameraPosition, float3 cameraForward,
         uint8_t instancedStereoEyeCount) noexcept {
@@ -448,8 +679,8 @@ void RenderPass::generateCommands(CommandTypeFlags commandTypeFlags, Command* co
     const bool colorPass  = bool(commandTypeFlags & CommandTypeFlags::COLOR);
     const bool depthPass  = bool(commandTypeFlags & CommandTypeFlags::DEPTH);
     const size_t commandsPerPrimitive = uint32_t(colorPass * 2 + depthPass);
-    const size_t offsetBegin = FScene::getPrimitiveCount(soa, range.first) * commandsPerPrimitive;
-    const size_t offsetEnd   = FScene::getPrimitiveCount(soa, range.last) * commandsPerPrimitive;
+    const size_t offsetBegin = renderables.getPrimitiveCount(range.first) * commandsPerPrimitive;
+    const size_t offsetEnd   = renderables.getPrimitiveCount(range.last) * commandsPerPrimitive;
     Command* curr = commands + offsetBegin;
     Command* const last = commands + offsetEnd;
 
@@ -465,12 +696,12 @@ void RenderPass::generateCommands(CommandTypeFlags commandTypeFlags, Command* co
     switch (commandTypeFlags & (CommandTypeFlags::COLOR | CommandTypeFlags::DEPTH)) {
         case CommandTypeFlags::COLOR:
             curr = generateCommandsImpl<CommandTypeFlags::COLOR>(commandTypeFlags, curr,
-                    soa, range, variant, renderFlags, visibilityMask, cameraPosition, cameraForward,
+                    renderables, range, variant, renderFlags, visibilityMask, cameraPosition, cameraForward,
                     instancedStereoEyeCount);
             break;
         case CommandTypeFlags::DEPTH:
             curr = generateCommandsImpl<CommandTypeFlags::DEPTH>(commandTypeFlags, curr,
-                    soa, range, variant, renderFlags, visibilityMask, cameraPosition, cameraForward,
+                    renderables, range, variant, renderFlags, visibilityMask, cameraPosition, cameraForward,
                     instancedStereoEyeCount);
             break;
         default:
@@ -492,7 +723,7 @@ template<RenderPass::CommandTypeFlags commandTypeFlags>
 UTILS_NOINLINE
 RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFlags extraFlags,
         Command* UTILS_RESTRICT curr,
-        FScene::RenderableSoa const& UTILS_RESTRICT soa, Range<uint32_t> range,
+        Renderables const& UTILS_RESTRICT renderables, Range<uint32_t> range,
         Variant const variant, RenderFlags renderFlags, FScene::VisibleMaskType visibilityMask,
         float3 cameraPosition, float3 cameraForward, uint8_t instancedStereoEyeCount) noexcept {
 
@@ -510,17 +741,18 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
     const bool depthFilterAlphaMaskedObjects    = bool(extraFlags & CommandTypeFlags::DEPTH_FILTER_ALPHA_MASKED_OBJECTS);
     const bool filterTranslucentObjects         = bool(extraFlags & CommandTypeFlags::FILTER_TRANSLUCENT_OBJECTS);
 
+    FScene::RenderableSoa const& UTILS_RESTRICT soa = *renderables.soa;
     auto const* const UTILS_RESTRICT soaWorldAABBCenter     = soa.data<FScene::WORLD_AABB_CENTER>();
     auto const* const UTILS_RESTRICT soaVisibility          = soa.data<FScene::VISIBILITY_STATE>();
-    auto const* const UTILS_RESTRICT soaPrimitives          = soa.data<FScene::PRIMITIVES>();
     auto const* const UTILS_RESTRICT soaSkinning            = soa.data<FScene::SKINNING_BUFFER>();
     auto const* const UTILS_RESTRICT soaMorphing            = soa.data<FScene::MORPHING_BUFFER>();
-    auto const* const UTILS_RESTRICT soaVisibilityMask      = soa.data<FScene::VISIBLE_MASK>();
     auto const* const UTILS_RESTRICT soaInstanceInfo        = soa.data<FScene::INSTANCES>();
 
     const bool hasShadowing = renderFlags & HAS_SHADOWING;
     const bool viewInverseFrontFaces = renderFlags & HAS_INVERSE_FRONT_FACES;
     const bool hasInstancedStereo = renderFlags & IS_STEREOSCOPIC;
+    const bool hasAutomaticInstancing = renderFlags & HAS_AUTOMATIC_INSTANCING;
+    const bool isVelocityPass = Variant::isVelocityVariant(variant);
 
     Command cmdColor;
 
@@ -528,7 +760,8 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
     if constexpr (isDepthPass) {
         cmdDepth.primitive.materialVariant = variant;
         cmdDepth.primitive.rasterState = {};
-        cmdDepth.primitive.rasterState.colorWrite = Variant::isPickingVariant(variant) || Variant::isVSMVariant(variant);
+        cmdDepth.primitive.rasterState.colorWrite = Variant::isPickingVariant(variant) ||
+                Variant::isVSMVariant(variant) || Variant::isVelocityVariant(variant);
         cmdDepth.primitive.rasterState.depthWrite = true;
         cmdDepth.primitive.rasterState.depthFunc = RasterState::DepthFunc::GE;
         cmdDepth.primitive.rasterState.alphaToCoverage = false;
@@ -538,7 +771,7 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
 
     for (uint32_t i = range.first; i < range.last; ++i) {
         // Check if this renderable passes the visibilityMask.
-        if (UTILS_UNLIKELY(!(soaVisibilityMask[i] & visibilityMask))) {
+        if (UTILS_UNLIKELY(!(renderables.getVisibleMask(i) & visibilityMask))) {
             continue;
         }
 
@@ -606,7 +839,9 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
             cmdDepth.key |= uint64_t(CustomCommand::PASS);
             cmdDepth.key |= makeField(soaVisibility[i].priority, PRIORITY_MASK, PRIORITY_SHIFT);
             cmdDepth.key |= makeField(soaVisibility[i].channel, CHANNEL_MASK, CHANNEL_SHIFT);
-            cmdDepth.key |= makeField(distanceBits >> 22u, Z_BUCKET_MASK, Z_BUCKET_SHIFT);
+            // with automatic instancing, the Z-bucket is replaced by the instancing hash below
+            cmdDepth.key |= makeField(hasAutomaticInstancing ? 0u : distanceBits >> 22u,
+                    Z_BUCKET_MASK, Z_BUCKET_SHIFT);
             cmdDepth.primitive.index = i;
             cmdDepth.primitive.instanceCount =
                     soaInstanceInfo[i].count | PrimitiveInfo::USER_INSTANCE_MASK;
@@ -627,7 +862,7 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
         const bool shadowCaster = soaVisibility[i].castShadows & hasShadowing;
         const bool writeDepthForShadowCasters = depthContainsShadowCasters & shadowCaster;
 
-        const Slice<FRenderPrimitive>& primitives = soaPrimitives[i];
+        const Slice<FRenderPrimitive>& primitives = renderables.getPrimitives(i);
         const FRenderableManager::SkinningBindingInfo& skinning = soaSkinning[i];
         const FRenderableManager::MorphingBindingInfo& morphing = soaMorphing[i];
 
@@ -725,8 +960,13 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
                     // This will bucket objects by Z, front-to-back and then sort by material
                     // in each buckets. We use the top 10 bits of the distance, which
                     // bucketizes the depth by its log2 and in 4 linear chunks in each bucket.
-                    cmdColor.key &= ~Z_BUCKET_MASK;
-                    cmdColor.key |= makeField(distanceBits >> 22u, Z_BUCKET_MASK, Z_BUCKET_SHIFT);
+                    // With automatic instancing, we instead sort by the instancing hash so that
+                    // identical draws are always consecutive.
+                    cmdColor.key &= ~INSTANCING_HASH_MASK;
+                    cmdColor.key |= hasAutomaticInstancing ?
+                            makeField(makeInstancingHash(cmdColor.primitive),
+                                    INSTANCING_HASH_MASK, INSTANCING_HASH_SHIFT) :
+                            makeField(distanceBits >> 22u, Z_BUCKET_MASK, Z_BUCKET_SHIFT);
                 }
 
                 *curr = cmdColor;
@@ -766,6 +1006,18 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
 
                 *curr = cmdDepth;
 
+                // Materials without the velocity variant only write depth, the velocity buffer
+                // is left cleared, i.e. only the camera's motion is accounted for.
+                if (UTILS_UNLIKELY(isVelocityPass && !ma->hasVelocityVariant())) {
+                    curr->primitive.materialVariant.key &= ~(Variant::VSM | Variant::PCK);
+                    curr->primitive.rasterState.colorWrite = false;
+                }
+
+                if (hasAutomaticInstancing) {
+                    curr->key |= makeField(makeInstancingHash(curr->primitive),
+                            INSTANCING_HASH_MASK, INSTANCING_HASH_SHIFT);
+                }
+
                 // cancel command if both front and back faces are culled
                 curr->key |= select(mi->getCullingMode() == CullingMode::FRONT_AND_BACK);
 
@@ -777,16 +1029,223 @@ RenderPass::Command* RenderPass::generateCommandsImpl(RenderPass::CommandTypeFla
 }
 
 void RenderPass::updateSummedPrimitiveCounts(
-        FScene::RenderableSoa& renderableData, Range<uint32_t> vr) noexcept {
-    auto const* const UTILS_RESTRICT primitives = renderableData.data<FScene::PRIMITIVES>();
-    uint32_t* const UTILS_RESTRICT summedPrimitiveCount = renderableData.data<FScene::SUMMED_PRIMITIVE_COUNT>();
-    uint32_t count = 0;
-    for (uint32_t const i : vr) {
-        summedPrimitiveCount[i] = count;
-        count += primitives[i].size();
+        Slice<FRenderPrimitive> const* const UTILS_RESTRICT primitives,
+        uint32_t* const UTILS_RESTRICT summedPrimitiveCount, uint32_t const count) noexcept {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        summedPrimitiveCount[i] = sum;
+        sum += primitives[i].size();
+    }
+    // the RenderableSoa is guaranteed to have enough space at the end of the visible range
+    summedPrimitiveCount[count] = sum;
+}
+
+RenderPass::Command* RenderPass::mergeCommands(Command* const first, Command* const last,
+        Command* const end, Command const* cachedFirst, Command const* const cachedLast,
+        uint8_t const* const cached, size_t const cachedCount) noexcept {
+    // Move the generated commands to the end of the storage and merge them with the cached
+    // commands from the front. The cached commands of a renderable are exactly the ones it would
+    // have generated, so they fit in the slots that were canceled and the merge never overwrites
+    // a generated command it hasn't read yet.
+    Command const* generated = std::move_backward(first, last, end);
+    Command* out = first;
+    while (cachedFirst != cachedLast) {
+        uint32_t const index = cachedFirst->primitive.index;
+        if (UTILS_UNLIKELY(index >= cachedCount || !cached[index])) {
+            ++cachedFirst;
+            continue;
+        }
+        if (generated != end && generated->key < cachedFirst->key) {
+            *out++ = *generated++;
+        } else {
+            assert_invariant(out < generated);
+            *out++ = *cachedFirst++;
+        }
+    }
+    if (out != generated) {
+        out = std::copy(generated, static_cast<Command const*>(end), out);
+    } else {
+        out = end;
+    }
+    return out;
+}
+
+void RenderPass::mergeCachedCommands(FEngine&, Arena& arena, CommandCache& cache) noexcept {
+    SYSTRACE_NAME("merge cached commands");
+    SYSTRACE_CONTEXT();
+
+    Command* const begin = mCommandBegin;
+    Command* const end = mCommandEnd;
+
+    // Remove the canceled commands, which include the slots of the cached renderables.
+    // Only the commands that were actually generated are moved.
+    Command* const last = std::remove_if(begin, end, [](Command const& command) {
+        return command.key == uint64_t(Pass::SENTINEL);
+    });
+
+    // sort the generated commands
+    if (size_t(last - begin) >= RADIX_SORT_MIN_COMMAND_COUNT) {
+        radixSortCommands(arena, begin, last);
+    } else {
+        std::sort(begin, last);
+    }
+
+    // the programs of the cached commands were prepared when they were generated
+    prepareCommands(begin, last);
+
+    Command* const out = cache.mValid ?
+            mergeCommands(begin, last, end,
+                    cache.mCommands.data(), cache.mCommands.data() + cache.mCommands.size(),
+                    cache.mCached.data(), cache.mCached.size()) : last;
+
+    cache.mCachedCount = uint32_t(std::count(cache.mCached.begin(), cache.mCached.end(), 1));
+    cache.mGeneratedCount = mVisibleRenderables.size() - cache.mCachedCount;
+
+    // Remember the sorted commands for the next frame, without the custom commands. When
+    // nothing was generated and no cached command was dropped, they're already in the cache.
+    size_t const commandCount = size_t(out - begin) - mCustomCommands.size();
+    if (!cache.mValid || cache.mGeneratedCount || commandCount != cache.mCommands.size()) {
+        cache.mCommands.clear();
+        std::copy_if(begin, out, std::back_inserter(cache.mCommands), [](Command const& command) {
+            return (command.key & CUSTOM_MASK) == uint64_t(CustomCommand::PASS);
+        });
+    }
+    cache.mValid = true;
+
+    SYSTRACE_VALUE32("generatedRenderables", cache.mGeneratedCount);
+    SYSTRACE_VALUE32("cachedRenderables", cache.mCachedCount);
+
+    resize(arena, uint32_t(out - begin));
+}
+
+// ------------------------------------------------------------------------------------------------
+
+RenderPass::CommandCache::CommandCache() noexcept = default;
+
+RenderPass::CommandCache::~CommandCache() noexcept = default;
+
+void RenderPass::CommandCache::clear() noexcept {
+    std::vector<Entry>().swap(mEntries);
+    std::vector<uint8_t>().swap(mCached);
+    std::vector<Command>().swap(mCommands);
+    mValid = false;
+}
+
+void RenderPass::CommandCache::prepare(FEngine const& engine, Config const& config,
+        uint32_t renderableCount) {
+    if (config != mConfig) {
+        // commands generated with other parameters can't be reused
+        mConfig = config;
+        mValid = false;
+    }
+    if (engine.getProgramVersion() > mVersion) {
+        // the programs of the cached commands may have to be prepared again
+        mValid = false;
+    }
+    mMaterialInstancesChanged = engine.getMaterialInstanceVersion() > mVersion;
+    mPreviousVersion = mVersion;
+    mVersion = engine.getRenderStateVersion();
+
+    // renderables past the end of the previous update have no cached commands, their entries
+    // are default-initialized when the range grows.
+    if (!mValid) {
+        mEntries.clear();
+    }
+    mEntries.resize(renderableCount);
+    mCached.resize(renderableCount);
+    // renderables outside the visible range are never cached
+    std::fill(mCached.begin(), mCached.end(), 0);
+}
+
+bool RenderPass::CommandCache::update(FRenderableManager const& rcm,
+        Renderables const& renderables, uint32_t i, FScene::VisibleMaskType visibilityMask,
+        float cameraPositionDotCameraForward, float3 cameraForward) noexcept {
+
+    // this must match what generateCommandsImpl() computes
+    FScene::RenderableSoa const& soa = *renderables.soa;
+    float distance = dot(soa.elementAt<FScene::WORLD_AABB_CENTER>(i), cameraForward)
+            - cameraPositionDotCameraForward;
+    distance = -distance;
+    uint32_t const distanceBits = reinterpret_cast<uint32_t&>(distance);
+
+    auto const ri = soa.elementAt<FScene::RENDERABLE_INSTANCE>(i);
+    auto const& visibility = soa.elementAt<FScene::VISIBILITY_STATE>(i);
+    auto const& primitives = renderables.getPrimitives(i);
+    bool const visible = renderables.getVisibleMask(i) & visibilityMask;
+    uint32_t const visibilityBits =
+            uint32_t(reinterpret_cast<uint16_t const&>(visibility)) | (uint32_t(visible) << 16u);
+
+    Entry& entry = mEntries[i];
+    bool cached = entry.instance == ri.asValue() &&
+            entry.visibility == visibilityBits &&
+            entry.distance == (entry.blended ? distanceBits : distanceBits >> 22u) &&
+            rcm.getRenderStateVersion(ri) <= mPreviousVersion;
+
+    if (cached && UTILS_UNLIKELY(mMaterialInstancesChanged)) {
+        uint64_t const version = mPreviousVersion;
+        cached = std::none_of(primitives.begin(), primitives.end(),
+                [version](FRenderPrimitive const& primitive) {
+                    return primitive.getMaterialInstance()->getRenderStateVersion() > version;
+                });
+    }
+
+    if (!cached) {
+        // blended commands are sorted by their exact distance
+        bool const blended = std::any_of(primitives.begin(), primitives.end(),
+                [](FRenderPrimitive const& primitive) {
+                    BlendingMode const blendingMode =
+                            primitive.getMaterialInstance()->getMaterial()->getBlendingMode();
+                    return blendingMode != BlendingMode::OPAQUE &&
+                            blendingMode != BlendingMode::MASKED;
+                });
+        entry = { ri.asValue(), visibilityBits,
+                  blended ? distanceBits : distanceBits >> 22u, blended };
+    }
+    return cached;
+}
+
+void RenderPass::CommandCache::generateCommands(CommandTypeFlags commandTypeFlags,
+        Command* const commands, FRenderableManager const& rcm,
+        Renderables const& renderables, Range<uint32_t> range,
+        Variant variant, RenderFlags renderFlags, FScene::VisibleMaskType visibilityMask,
+        float3 cameraPosition, float3 cameraForward, uint8_t instancedStereoEyeCount) noexcept {
+    SYSTRACE_CALL();
+
+    float const cameraPositionDotCameraForward = dot(cameraPosition, cameraForward);
+    uint8_t* const UTILS_RESTRICT cached = mCached.data();
+    for (uint32_t i = range.first; i < range.last; ++i) {
+        cached[i] = update(rcm, renderables, i, visibilityMask,
+                cameraPositionDotCameraForward, cameraForward);
+    }
+
+    bool const colorPass = bool(commandTypeFlags & CommandTypeFlags::COLOR);
+    bool const depthPass = bool(commandTypeFlags & CommandTypeFlags::DEPTH);
+    size_t const commandsPerPrimitive = uint32_t(colorPass * 2 + depthPass);
+
+    // generate the commands of consecutive renderables that are not cached, and cancel the
+    // slots of the cached ones.
+    uint32_t i = range.first;
+    while (i < range.last) {
+        uint32_t j = i;
+        while (j < range.last && !cached[j]) {
+            j++;
+        }
+        if (j != i) {
+            RenderPass::generateCommands(commandTypeFlags, commands, renderables, { i, j },
+                    variant, renderFlags, visibilityMask, cameraPosition, cameraForward,
+                    instancedStereoEyeCount);
+        }
+        uint32_t k = j;
+        while (k < range.last && cached[k]) {
+            k++;
+        }
+        Command* curr = commands + renderables.getPrimitiveCount(j) * commandsPerPrimitive;
+        Command* const last = commands + renderables.getPrimitiveCount(k) * commandsPerPrimitive;
+        for (; curr != last; ++curr) {
+            curr->key = uint64_t(Pass::SENTINEL);
+        }
+        i = k;
     }
-    // we're guaranteed to have enough space at the end of vr
-    summedPrimitiveCount[vr.last] = count;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -809,7 +1268,18 @@ void RenderPass::Executor::overrideScissor(backend::Viewport const& scissor) noe
 }
 
 void RenderPass::Executor::execute(FEngine& engine, const char*) const noexcept {
-    execute(engine, mCommands.begin(), mCommands.end());
+    execute(engine, engine.getDriverApi(), mCommands.begin(), mCommands.end());
+}
+
+void RenderPass::Executor::execute(FEngine& engine, DriverApi& driver) const noexcept {
+    execute(engine, driver, mCommands.begin(), mCommands.end());
+}
+
+size_t RenderPass::Executor::getCommandStreamSize() const noexcept {
+    // custom commands can record anything, we can't bound their size
+    assert_invariant(mCustomCommands.empty());
+    // the scissor override is recorded before the commands
+    return (mCommands.size() + 1) * MAX_COMMAND_SIZE_IN_BYTES;
 }
 
 UTILS_NOINLINE // no need to be inlined
@@ -835,15 +1305,16 @@ backend::Viewport RenderPass::Executor::applyScissorViewport(
 }
 
 UTILS_NOINLINE // no need to be inlined
-void RenderPass::Executor::execute(FEngine& engine,
+void RenderPass::Executor::execute(FEngine& engine, DriverApi& driver,
         const Command* first, const Command* last) const noexcept {
 
     SYSTRACE_CALL();
     SYSTRACE_CONTEXT();
 
-    DriverApi& driver = engine.getDriverApi();
-    size_t const capacity = engine.getMinCommandBufferSize();
+    // only the engine's stream can be flushed, other streams must be large enough
+    bool const canFlush = &driver == &engine.getDriverApi();
     CircularBuffer const& circularBuffer = driver.getCircularBuffer();
+    size_t const capacity = canFlush ? engine.getMinCommandBufferSize() : circularBuffer.size();
 
     if (first != last) {
         SYSTRACE_VALUE32("commandCount", last - first);
@@ -864,11 +1335,8 @@ void RenderPass::Executor::execute(FEngine& engine,
         FMaterial const* UTILS_RESTRICT ma = nullptr;
         auto const* UTILS_RESTRICT pCustomCommands = mCustomCommands.data();
 
-        // Maximum space occupied in the CircularBuffer by a single `Command`. This must be
-        // reevaluated when the inner loop below adds DriverApi commands or when we change the
-        // CommandStream protocol. Currently, the maximum is 240 bytes, and we use 256 to be on
-        // the safer side.
-        size_t const maxCommandSizeInBytes = 256;
+        // Maximum space occupied in the CircularBuffer by a single `Command`.
+        size_t const maxCommandSizeInBytes = MAX_COMMAND_SIZE_IN_BYTES;
 
         // Number of Commands that can be issued and guaranteed to fit in the current
         // CircularBuffer allocation. In practice, we'll have tons of headroom especially if
@@ -885,6 +1353,9 @@ void RenderPass::Executor::execute(FEngine& engine,
             // check we have enough capacity to write these commandCount commands, if not,
             // request a new CircularBuffer allocation of `capacity` bytes.
             if (UTILS_UNLIKELY(circularBuffer.getUsed() > capacity - commandSizeInBytes)) {
+                ASSERT_PRECONDITION(canFlush,
+                        "CommandStream too small for %u commands, see getCommandStreamSize()",
+                        unsigned(last - first));
                 engine.flush(); // TODO: we should use a "fast" flush if possible
             }
 
@@ -1005,7 +1476,7 @@ void RenderPass::Executor::execute(FEngine& engine,
 
         // If the remaining space is less than half the capacity, we flush right away to
         // allow some headroom for commands that might come later.
-        if (UTILS_UNLIKELY(circularBuffer.getUsed() > capacity / 2)) {
+        if (UTILS_UNLIKELY(canFlush && circularBuffer.getUsed() > capacity / 2)) {
             engine.flush();
         }
     }
@@ -29,6 +29,8 @@
 #include <backend/Handle.h>
 
 #include <utils/Allocator.h>
+#include <utils/Hash.h>
+#include <utils/JobSystem.h>
 #include <utils/Range.h>
 #include <utils/Slice.h>
 #include <utils/architecture.h>
@@ -36,6 +38,7 @@
 
 #include <math/mathfwd.h>
 
+#include <array>
 #include <functional>
 #include <limits>
 #include <optional>
@@ -70,9 +73,6 @@ public:
      *   0     = reserved, must be zero
      *
      *
-     * TODO: we need to add a "primitive id" in the low-bits of material-id, so that
-     *       auto-instancing can work better
-     *
      *   DEPTH command (b00)
      *   |  |  | 2| 2| 2|1| 3 | 2|  6   |   10     |               32               |
      *   +--+--+--+--+--+-+---+--+------+----------+--------------------------------+
@@ -90,6 +90,17 @@ public:
      *   | correctness        |      optimizations (truncation allowed)             |
      *
      *
+     *   DEPTH, COLOR and REFRACT commands with automatic instancing
+     *   | 2| 2| 2| 2| 2|1| 3 | 2|       16        |               32               |
+     *   +--+--+--+--+--+-+---+--+-----------------+--------------------------------+
+     *   |CC|00|PP|01|00|a|ppp|00| instancing-hash |          material-id           |
+     *   +--+--+--+--+--+-+---+--+-----------------+--------------------------------+
+     *   | correctness        |      optimizations (truncation allowed)             |
+     *
+     *   The instancing hash replaces the Z-bucket so that identical draws (same primitive,
+     *   skinning, morphing and winding) always sort next to each other and can be instanced.
+     *
+     *
      *   BLENDED command (b11)
      *   | 2| 2| 2| 2| 2|1| 3 | 2|              32                |         15    |1|
      *   +--+--+--+--+--+-+---+--+--------------------------------+---------------+-+
@@ -146,6 +157,9 @@ public:
     static constexpr uint64_t Z_BUCKET_MASK                 = 0x3FF00000000llu;
     static constexpr unsigned Z_BUCKET_SHIFT                = 32;
 
+    static constexpr uint64_t INSTANCING_HASH_MASK          = 0xFFFF00000000llu;
+    static constexpr unsigned INSTANCING_HASH_SHIFT         = 32;
+
     static constexpr uint64_t PRIORITY_MASK                 = 0x001C000000000000llu;
     static constexpr unsigned PRIORITY_SHIFT                = 50;
 
@@ -260,6 +274,23 @@ public:
     };
     static_assert(sizeof(PrimitiveInfo) == 56);
 
+    // Hash of the draw state that instanceify() requires to be identical, used in the sort key
+    // so these draws end up next to each other. The material instance is not included since
+    // it's implied by the primitive.
+    static uint16_t makeInstancingHash(PrimitiveInfo const& info) noexcept {
+        uint64_t const primitive = info.padding;
+        uint32_t const words[] = {
+                uint32_t(primitive), uint32_t(primitive >> 32u),
+                info.rasterState.u,
+                info.skinningHandle.getId(),
+                info.skinningTexture.getId(),
+                info.skinningOffset,
+                info.morphWeightBuffer.getId(),
+                info.morphTargetBuffer.getId() };
+        uint32_t const h = utils::hash::murmur3(words, sizeof(words) / sizeof(uint32_t), 0);
+        return uint16_t(h ^ (h >> 16u));
+    }
+
     struct alignas(8) Command {     // 64 bytes
         CommandKey key = 0;         //  8 bytes
         PrimitiveInfo primitive;    // 56 bytes
@@ -278,6 +309,7 @@ public:
     static constexpr RenderFlags HAS_SHADOWING           = 0x01;
     static constexpr RenderFlags HAS_INVERSE_FRONT_FACES = 0x02;
     static constexpr RenderFlags IS_STEREOSCOPIC         = 0x04;
+    static constexpr RenderFlags HAS_AUTOMATIC_INSTANCING = 0x08;
 
     // Arena used for commands
     using Arena = utils::Arena<
@@ -301,6 +333,152 @@ public:
     Command const* end() const noexcept { return mCommandEnd; }
     bool empty() const noexcept { return begin() == end(); }
 
+    // number of draw calls removed by automatic instancing in this pass
+    uint32_t getInstancedDrawCallsSavedCount() const noexcept { return mInstancedDrawCallsSaved; }
+
+    // Waits for the commands to be generated and sorted when the pass was built with
+    // RenderPassBuilder::deferred(), and finishes preparing them. This must be called
+    // from the main thread before the commands are accessed. No-op otherwise.
+    void finish(FEngine& engine) noexcept;
+
+    // Sorts commands by key using a (stable) LSD radix sort on key/index pairs, commands are
+    // then moved only once. The temporary storage is allocated from, and returned to, the arena.
+    static void radixSortCommands(Arena& arena, Command* begin, Command* end) noexcept;
+
+    // key/index pair used by radixSortCommands()
+    struct SortKey {
+        CommandKey key;
+        uint32_t index;
+    };
+
+    // Below this many commands, radixSortCommands() isn't faster than std::sort()
+    static constexpr size_t RADIX_SORT_MIN_COMMAND_COUNT = 512;
+
+    // What generating commands reads from the renderables. The visibility masks, primitives
+    // and summed primitive counts are either the RenderableSoa's (offset is 0), or a copy made
+    // for the pass (see RenderPassBuilder::deferred()) indexed from `offset`.
+    struct Renderables {
+        FScene::RenderableSoa const* soa;
+        FScene::VisibleMaskType const* visibleMask;
+        utils::Slice<FRenderPrimitive> const* primitives;
+        uint32_t const* summedPrimitiveCount;
+        uint32_t offset;
+
+        FScene::VisibleMaskType getVisibleMask(uint32_t i) const noexcept {
+            return visibleMask[i - offset];
+        }
+        utils::Slice<FRenderPrimitive> const& getPrimitives(uint32_t i) const noexcept {
+            return primitives[i - offset];
+        }
+        // number of primitives of the pass's renderables before i, i can be the last one
+        uint32_t getPrimitiveCount(uint32_t i) const noexcept {
+            return summedPrimitiveCount[i - offset];
+        }
+    };
+
+    // the parameters of appendCommands()
+    struct GenerateInfo {
+        Renderables renderables;
+        utils::Range<uint32_t> range;
+        CommandTypeFlags commandTypeFlags;
+        RenderFlags renderFlags;
+        Variant variant;
+        FScene::VisibleMaskType visibilityMask;
+        uint8_t instancedStereoEyeCount;
+        math::float3 cameraPosition;
+        math::float3 cameraForward;
+    };
+
+    // Merges the sorted commands [first, last) with the sorted cached commands of the
+    // renderables flagged in `cached`, in the storage [first, end), which must be large enough
+    // for both. Returns the end of the merged commands.
+    static Command* mergeCommands(Command* first, Command* last, Command* end,
+            Command const* cachedFirst, Command const* cachedLast,
+            uint8_t const* cached, size_t cachedCount) noexcept;
+
+    /*
+     * Keeps the sorted commands of a pass from one frame to the next.
+     *
+     * Changes to renderables and material instances that affect their commands are stamped
+     * with a version by FRenderableManager and FMaterialInstance (see
+     * FEngine::getRenderStateVersion()). A renderable's previous commands are reused (they're
+     * already sorted) when it's still at the same index in the RenderableSoa, none of its
+     * state changed since the last update, and its visibility and depth bucket (or exact
+     * distance for blended commands) are the same. Only the commands of the other
+     * renderables are generated and sorted, then merged with the cached ones.
+     *
+     * Generating and sorting commands, which is the bulk of the cost, is therefore
+     * proportional to what changed. Checking a renderable takes a few loads and compares
+     * (material instances are only looked at when one of them changed), and the merge
+     * copies the cached commands, which remains linear in the number of visible commands.
+     *
+     * Cached commands are only valid for the renderable at the same index in the
+     * RenderableSoa, so a cache must always be used with the same pass, e.g. a View's color
+     * pass. Custom commands are never cached.
+     */
+    class CommandCache {
+    public:
+        CommandCache() noexcept;
+        ~CommandCache() noexcept;
+
+        CommandCache(CommandCache const&) = delete;
+        CommandCache& operator=(CommandCache const&) = delete;
+
+        // drops all cached commands
+        void clear() noexcept;
+
+        // number of renderables whose commands were generated during the last update
+        uint32_t getGeneratedRenderableCount() const noexcept { return mGeneratedCount; }
+
+        // number of renderables whose commands were reused during the last update
+        uint32_t getCachedRenderableCount() const noexcept { return mCachedCount; }
+
+    private:
+        friend class RenderPass;
+
+        // the parameters of the pass
+        using Config = std::array<uint32_t, 4>;
+
+        // what a renderable's cached commands were generated with, besides its versioned state
+        struct Entry {
+            uint32_t instance = 0;      // renderable instance, 0 if there are no commands
+            uint32_t visibility = 0;    // visibility state and visible bit
+            uint32_t distance = 0;      // exact distance if blended, depth bucket otherwise
+            bool blended = false;       // whether some of the commands are blended
+        };
+
+        void prepare(FEngine const& engine, Config const& config, uint32_t renderableCount);
+
+        void generateCommands(CommandTypeFlags commandTypeFlags, Command* commands,
+                FRenderableManager const& rcm, Renderables const& renderables,
+                utils::Range<uint32_t> range,
+                Variant variant, RenderFlags renderFlags,
+                FScene::VisibleMaskType visibilityMask,
+                math::float3 cameraPosition, math::float3 cameraForward,
+                uint8_t instancedStereoEyeCount) noexcept;
+
+        // returns whether the cached commands of renderable i can be reused, updates its
+        // entry otherwise.
+        bool update(FRenderableManager const& rcm, Renderables const& renderables,
+                uint32_t i, FScene::VisibleMaskType visibilityMask,
+                float cameraPositionDotCameraForward, math::float3 cameraForward) noexcept;
+
+        Config mConfig{};
+        // indexed by renderable
+        std::vector<Entry> mEntries;
+        // whether a renderable's cached commands are valid this frame
+        std::vector<uint8_t> mCached;
+        // commands of the previous frame, sorted and without custom commands
+        std::vector<Command> mCommands;
+        // render state version of the previous and of this update
+        uint64_t mPreviousVersion = 0;
+        uint64_t mVersion = 0;
+        bool mMaterialInstancesChanged = false;
+        bool mValid = false;
+        uint32_t mGeneratedCount = 0;
+        uint32_t mCachedCount = 0;
+    };
+
     // Helper to execute all the commands generated by this RenderPass
     static void execute(RenderPass const& pass,
             FEngine& engine, const char* name,
@@ -315,6 +493,12 @@ public:
         friend class RenderPass;
         friend class RenderPassBuilder;
 
+        // Maximum space occupied in a CommandStream by a single `Command`. This must be
+        // reevaluated when execute() adds DriverApi commands or when we change the
+        // CommandStream protocol. Currently, the maximum is 240 bytes, and we use 256 to be on
+        // the safer side.
+        static constexpr size_t MAX_COMMAND_SIZE_IN_BYTES = 256;
+
         // these fields are constant after creation
         utils::Slice<Command> mCommands;
         utils::Slice<CustomCommandFn> mCustomCommands;
@@ -329,7 +513,8 @@ public:
 
         Executor(RenderPass const* pass, Command const* b, Command const* e) noexcept;
 
-        void execute(FEngine& engine, const Command* first, const Command* last) const noexcept;
+        void execute(FEngine& engine, backend::DriverApi& driver,
+                const Command* first, const Command* last) const noexcept;
 
         static backend::Viewport applyScissorViewport(
                 backend::Viewport const& scissorViewport,
@@ -349,6 +534,15 @@ public:
         void overrideScissor(backend::Viewport const& scissor) noexcept;
 
         void execute(FEngine& engine, const char* name) const noexcept;
+
+        // Records the commands into the given stream, which doesn't need to be the engine's.
+        // When it's not, the commands are never flushed, so the stream must be able to hold
+        // getCommandStreamSize() bytes, e.g. a SecondaryCommandStream recording on a worker
+        // thread. This requires all the programs to be prepared, which appendCommands() does.
+        void execute(FEngine& engine, backend::DriverApi& driver) const noexcept;
+
+        // upper bound of the space used in a CommandStream by execute()
+        size_t getCommandStreamSize() const noexcept;
     };
 
     // returns a new executor for this pass
@@ -366,9 +560,20 @@ private:
     RenderPass(FEngine& engine, RenderPassBuilder const& builder) noexcept;
 
     // This is the main function of this class, this appends commands to the pass using
-    // the current camera, geometry and flags set. This can be called multiple times if needed.
-    void appendCommands(FEngine& engine,
-            utils::Slice<Command> commands, CommandTypeFlags commandTypeFlags) noexcept;
+    // the given camera, geometry and flags. This can be called multiple times if needed.
+    // When a cache is given, only the commands of renderables that are not in the cache are
+    // generated, mergeCachedCommands() must then be called instead of sortCommands().
+    // This doesn't access the arena nor prepare the programs (see prepareCommands()), so
+    // without a cache it can be called from any thread.
+    static void appendCommands(utils::JobSystem& js, FRenderableManager const& rcm,
+            GenerateInfo const& info, utils::Slice<Command> commands,
+            CommandCache* cache = nullptr) noexcept;
+
+    // calls prepareProgram() for the material of each command, must be called on the main thread
+    static void prepareCommands(Command const* first, Command const* last) noexcept;
+
+    // sorts the generated commands, merges them with the cached ones and updates the cache
+    void mergeCachedCommands(FEngine& engine, Arena& arena, CommandCache& cache) noexcept;
 
     // Appends a custom command.
     void appendCustomCommand(Command* commands,
@@ -380,6 +585,15 @@ private:
     // sorts commands then trims sentinels
     void sortCommands(Arena& arena) noexcept;
 
+    // sorts commands using `scratch` (2 * count entries) as temporary storage if not null,
+    // this doesn't access the arena, so it can be called from any thread.
+    static void sortCommands(SortKey* scratch, Command* begin, Command* end) noexcept;
+
+    static void radixSortCommands(SortKey* scratch, Command* begin, Command* end) noexcept;
+
+    // trims sentinels
+    void trimCommands(Arena& arena) noexcept;
+
     // instanceify commands then trims sentinels
     void instanceify(FEngine& engine, Arena& arena) noexcept;
 
@@ -393,7 +607,7 @@ private:
             "Size of Commands jobs must be multiple of a cache-line size");
 
     static inline void generateCommands(CommandTypeFlags commandTypeFlags, Command* commands,
-            FScene::RenderableSoa const& soa, utils::Range<uint32_t> range,
+            Renderables const& renderables, utils::Range<uint32_t> range,
             Variant variant, RenderFlags renderFlags,
             FScene::VisibleMaskType visibilityMask,
             math::float3 cameraPosition, math::float3 cameraForward,
@@ -401,7 +615,7 @@ private:
 
     template<RenderPass::CommandTypeFlags commandTypeFlags>
     static inline Command* generateCommandsImpl(RenderPass::CommandTypeFlags extraFlags, Command* curr,
-            FScene::RenderableSoa const& soa, utils::Range<uint32_t> range,
+            Renderables const& renderables, utils::Range<uint32_t> range,
             Variant variant, RenderFlags renderFlags, FScene::VisibleMaskType visibilityMask,
             math::float3 cameraPosition, math::float3 cameraForward,
             uint8_t instancedStereoEyeCount) noexcept;
@@ -409,8 +623,14 @@ private:
     static void setupColorCommand(Command& cmdDraw, Variant variant,
             FMaterialInstance const* mi, bool inverseFrontFaces) noexcept;
 
-    static void updateSummedPrimitiveCounts(
-            FScene::RenderableSoa& renderableData, utils::Range<uint32_t> vr) noexcept;
+    // writes the number of primitives before each of the `count` renderables, and the total
+    // after them, in summedPrimitiveCount (count + 1 entries)
+    static void updateSummedPrimitiveCounts(utils::Slice<FRenderPrimitive> const* primitives,
+            uint32_t* summedPrimitiveCount, uint32_t count) noexcept;
+
+    // copies the per-pass state of the renderables in `vr` to the arena
+    static Renderables snapshotRenderables(Arena& arena,
+            FScene::RenderableSoa const& soa, utils::Range<uint32_t> vr) noexcept;
 
 
     FScene::RenderableSoa const& mRenderableSoa;
@@ -433,6 +653,12 @@ private:
     using CustomCommandVector = std::vector<Executor::CustomCommandFn,
             utils::STLAllocator<Executor::CustomCommandFn, LinearAllocatorArena>>;
     mutable CustomCommandVector mCustomCommands;
+    // the following are only used with RenderPassBuilder::deferred()
+    Arena* mArena = nullptr;
+    SortKey* mSortScratch = nullptr;
+    utils::JobSystem::Job* mDeferredJob = nullptr;
+    // number of draw calls removed by instanceify()
+    uint32_t mInstancedDrawCallsSaved = 0;
 };
 
 class RenderPassBuilder {
@@ -449,6 +675,8 @@ class RenderPassBuilder {
     RenderPass::RenderFlags mFlags{};
     Variant mVariant{};
     FScene::VisibleMaskType mVisibilityMask = std::numeric_limits<FScene::VisibleMaskType>::max();
+    bool mDeferred = false;
+    RenderPass::CommandCache* mCommandCache = nullptr;
 
     using CustomCommandRecord = std::tuple<
             uint8_t,
@@ -520,6 +748,24 @@ public:
         return *this;
     }
 
+    // When enabled, commands are generated and sorted by a job and build() returns right
+    // away, RenderPass::finish() must then be called before using the pass. This allows the
+    // passes of a frame to be built concurrently. The visibility, level of detail and primitive
+    // counts of the renderables are copied when the pass is built, so they can be changed for
+    // the next pass right away. All passes must be built and finished on the main thread, and
+    // the arena must outlive the job.
+    RenderPassBuilder& deferred(bool enabled) noexcept {
+        mDeferred = enabled;
+        return *this;
+    }
+
+    // Reuses the commands of renderables that didn't change since the last time this cache
+    // was used, see RenderPass::CommandCache. Ignored with deferred().
+    RenderPassBuilder& commandCache(RenderPass::CommandCache* cache) noexcept {
+        mCommandCache = cache;
+        return *this;
+    }
+
     RenderPassBuilder& customCommand(FEngine& engine,
             uint8_t channel,
             RenderPass::Pass pass,
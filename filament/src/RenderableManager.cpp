@@ -88,6 +88,14 @@ void RenderableManager::setScreenSpaceContactShadows(Instance instance, bool ena
     downcast(this)->setScreenSpaceContactShadows(instance, enable);
 }
 
+void RenderableManager::setOccluder(Instance instance, bool enable) noexcept {
+    downcast(this)->setOccluder(instance, enable);
+}
+
+bool RenderableManager::isOccluder(Instance instance) const noexcept {
+    return downcast(this)->isOccluder(instance);
+}
+
 bool RenderableManager::isShadowCaster(Instance instance) const noexcept {
     return downcast(this)->isShadowCaster(instance);
 }
@@ -32,6 +32,7 @@
 #include <utils/FixedCapacityVector.h>
 #include <utils/Log.h>
 #include <utils/ostream.h>
+#include <utils/Systrace.h>
 
 #include <array>
 #include <algorithm>
@@ -164,6 +165,7 @@ backend::TextureHandle ResourceAllocator::createTexture(const char* name,
             handle = it->second.handle;
             mCacheSize -= it->second.size;
             textureCache.erase(it);
+            mHitCount++;
         } else {
             // we don't, allocate a new texture and populate the in-use list
             if (swizzle == defaultSwizzle) {
@@ -174,8 +176,10 @@ backend::TextureHandle ResourceAllocator::createTexture(const char* name,
                         target, levels, format, samples, width, height, depth, usage,
                         swizzle[0], swizzle[1], swizzle[2], swizzle[3]);
             }
+            mMissCount++;
         }
         mInUseTextures.emplace(handle, key);
+        mInUseSize += key.getSize();
     } else {
         if (swizzle == defaultSwizzle) {
             handle = mBackend.createTexture(
@@ -195,15 +199,23 @@ void ResourceAllocator::destroyTexture(TextureHandle h) noexcept {
         auto it = mInUseTextures.find(h);
         assert_invariant(it != mInUseTextures.end());
 
-        // move it to the cache
         const TextureKey key = it->second;
         uint32_t const size = key.getSize();
-
-        mTextureCache.emplace(key, TextureCachePayload{ h, mAge, size });
-        mCacheSize += size;
+        mInUseSize -= size;
 
         // remove it from the in-use list
         mInUseTextures.erase(it);
+
+        if (UTILS_UNLIKELY(size > mCacheCapacity)) {
+            // the texture would be evicted by the next gc() anyway
+            mBackend.destroyTexture(h);
+            mEvictionCount++;
+            return;
+        }
+
+        // move it to the cache
+        mTextureCache.emplace(key, TextureCachePayload{ h, mAge, size });
+        mCacheSize += size;
     } else {
         mBackend.destroyTexture(h);
     }
@@ -226,7 +238,7 @@ void ResourceAllocator::gc() noexcept {
         const size_t ageDiff = age - it->second.age;
         if (ageDiff >= mCacheMaxAge) {
             it = purge(it);
-            if (mCacheSize < mCacheCapacity) {
+            if (mCacheSize <= mCacheCapacity) {
                 // if we're not at capacity, only purge a single entry per gc, trying to
                 // avoid a burst of work.
                 break;
@@ -236,20 +248,25 @@ void ResourceAllocator::gc() noexcept {
         }
     }
 
-    if (UTILS_UNLIKELY(mCacheSize >= mCacheCapacity)) {
+    if (UTILS_UNLIKELY(mCacheSize > mCacheCapacity)) {
         // make a copy of our CacheContainer to a vector
         using Vector = FixedCapacityVector<std::pair<TextureKey, TextureCachePayload>>;
         auto cache = Vector::with_capacity(textureCache.size());
         std::copy(textureCache.begin(), textureCache.end(), std::back_insert_iterator<Vector>(cache));
 
-        // sort by least recently used
+        // sort by least recently used, textures released during the same frame are sorted
+        // largest first, so that we destroy as few textures as possible.
         std::sort(cache.begin(), cache.end(), [](auto const& lhs, auto const& rhs) {
-            return lhs.second.age < rhs.second.age;
+            if (lhs.second.age != rhs.second.age) {
+                return lhs.second.age < rhs.second.age;
+            }
+            return lhs.second.size > rhs.second.size;
         });
 
-        // now remove entries until we're at capacity
+        // now remove entries until we're within capacity
         auto curr = cache.begin();
-        while (mCacheSize >= mCacheCapacity) {
+        while (mCacheSize > mCacheCapacity) {
+            assert_invariant(curr != cache.end());
             // by construction this entry must exist
             purge(textureCache.find(curr->first));
             ++curr;
@@ -262,9 +279,25 @@ void ResourceAllocator::gc() noexcept {
         }
         mAge -= oldestAge;
     }
+
+    SYSTRACE_CONTEXT();
+    SYSTRACE_VALUE32("resourceAllocatorCacheKB", mCacheSize / 1024);
+    SYSTRACE_VALUE32("resourceAllocatorInUseKB", mInUseSize / 1024);
+
     //if (mAge % 60 == 0) dump();
 }
 
+Engine::ResourceAllocatorStats ResourceAllocator::getStats() const noexcept {
+    return {
+            .hits = mHitCount,
+            .misses = mMissCount,
+            .evictions = mEvictionCount,
+            .cachedSize = mCacheSize,
+            .inUseSize = mInUseSize,
+            .cachedCount = uint32_t(mTextureCache.size()),
+            .inUseCount = uint32_t(mInUseTextures.size()) };
+}
+
 UTILS_NOINLINE
 void ResourceAllocator::dump(bool brief) const noexcept {
     slog.d << "# entries=" << mTextureCache.size() << ", sz=" << mCacheSize / float(1u << 20u)
@@ -285,6 +318,7 @@ ResourceAllocator::CacheContainer::iterator ResourceAllocator::purge(
     //slog.d << "purging " << pos->second.handle.getId() << ", age=" << pos->second.age << io::endl;
     mBackend.destroyTexture(pos->second.handle);
     mCacheSize -= pos->second.size;
+    mEvictionCount++;
     return mTextureCache.erase(pos);
 }
 
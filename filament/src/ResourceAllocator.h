@@ -93,8 +93,14 @@ public:
 
     void gc() noexcept;
 
+    // maximum size in bytes of the textures kept in the cache, enforced by gc()
+    void setCacheCapacity(size_t capacity) noexcept { mCacheCapacity = capacity; }
+    size_t getCacheCapacity() const noexcept { return mCacheCapacity; }
+
+    Engine::ResourceAllocatorStats getStats() const noexcept;
+
 private:
-    size_t const mCacheCapacity;
+    size_t mCacheCapacity;
     size_t const mCacheMaxAge;
 
     struct TextureKey {
@@ -200,7 +206,11 @@ private:
     CacheContainer mTextureCache;
     InUseContainer mInUseTextures;
     size_t mAge = 0;
-    uint32_t mCacheSize = 0;
+    size_t mCacheSize = 0;
+    size_t mInUseSize = 0;
+    uint64_t mHitCount = 0;
+    uint64_t mMissCount = 0;
+    uint64_t mEvictionCount = 0;
     static constexpr bool mEnabled = true;
 };
 
@@ -71,6 +71,14 @@ bool Scene::hasEntity(Entity entity) const noexcept {
     return downcast(this)->hasEntity(entity);
 }
 
+void Scene::setHierarchicalCullingEnabled(bool enabled) noexcept {
+    downcast(this)->setHierarchicalCullingEnabled(enabled);
+}
+
+bool Scene::isHierarchicalCullingEnabled() const noexcept {
+    return downcast(this)->isHierarchicalCullingEnabled();
+}
+
 void Scene::forEach(Invocable<void(utils::Entity)>&& functor) const noexcept {
     downcast(this)->forEach(std::move(functor));
 }
@@ -262,7 +262,7 @@ ShadowMap::ShaderParameters ShadowMap::updatePunctual(
     const mat4f Mp = mat4f::perspective(
             outerConeAngle * f::RAD_TO_DEG * 2.0f, 1.0f, nearPlane, farPlane);
 
-    assert_invariant(shadowMapInfo.textureDimension == mOptions->mapSize);
+    assert_invariant(shadowMapInfo.textureDimension == mDimension);
 
     // Final shadow transform
     const mat4f S = math::highPrecisionMultiply(Mp, Mv);
@@ -1279,15 +1279,22 @@ void ShadowMap::updateSceneInfoSpot(mat4f const& Mv, FScene const& scene,
     );
 }
 
+void ShadowMap::setAllocation(uint8_t layer, backend::Viewport const& viewport) noexcept {
+    assert_invariant(viewport.width == viewport.height);
+    mLayer = layer;
+    mOffset = { uint16_t(viewport.left), uint16_t(viewport.bottom) };
+    mDimension = uint16_t(viewport.width);
+}
+
 backend::Viewport ShadowMap::getViewport() const noexcept {
     // We set a viewport with a 1-texel border for when we index outside the texture.
     // This happens only for directional lights when "focus shadow casters" is used,
     // or when shadowFar is smaller than the camera far.
     // For spot- and point-lights we also use a 1-texel border, so that bilinear filtering
     // can work properly if the shadowmap is in an atlas (and we can't rely on h/w clamp).
-    const uint32_t dim = mOptions->mapSize;
+    const uint32_t dim = mDimension;
     const uint16_t border = 1u;
-    return { border, border, dim - 2u * border, dim - 2u * border };
+    return { mOffset.x + border, mOffset.y + border, dim - 2u * border, dim - 2u * border };
 }
 
 backend::Viewport ShadowMap::getScissor() const noexcept {
@@ -1297,14 +1304,14 @@ backend::Viewport ShadowMap::getScissor() const noexcept {
     // For spot- and point-lights we also use a 1-texel border, so that bilinear filtering
     // can work properly if the shadowmap is in an atlas (and we can't rely on h/w clamp), so we
     // don't scissor the border, so it gets filled with correct neighboring texels.
-    const uint32_t dim = mOptions->mapSize;
+    const uint32_t dim = mDimension;
     const uint16_t border = 1u;
     switch (mShadowType) {
         case ShadowType::DIRECTIONAL:
-            return { border, border, dim - 2u * border, dim - 2u * border };
+            return { mOffset.x + border, mOffset.y + border, dim - 2u * border, dim - 2u * border };
         case ShadowType::SPOT:
         case ShadowType::POINT:
-            return { 0, 0, dim, dim };
+            return { mOffset.x, mOffset.y, dim, dim };
     }
 }
 
@@ -1326,9 +1333,9 @@ math::float4 ShadowMap::getClampToEdgeCoords(ShadowMapInfo const& shadowMapInfo)
     }
 
     float const texel = 1.0f / float(shadowMapInfo.atlasDimension);
-    float const dim = float(mOptions->mapSize);
-    float const l = border;
-    float const b = border;
+    float const dim = float(mDimension);
+    float const l = float(mOffset.x) + border;
+    float const b = float(mOffset.y) + border;
     float const w = dim - 2.0f * border;
     float const h = dim - 2.0f * border;
     float4 const v = float4{ l, b, l + w, b + h } * texel;
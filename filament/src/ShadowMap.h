@@ -33,6 +33,7 @@
 #include <utils/compiler.h>
 
 #include <math/mathfwd.h>
+#include <math/vec2.h>
 #include <math/vec3.h>
 #include <math/vec4.h>
 #include <math/mat4.h>
@@ -185,8 +186,12 @@ public:
     LightManager::ShadowOptions const* getShadowOptions() const noexcept { return mOptions; }
     size_t getLightIndex() const { return mLightIndex; }
     uint16_t getShadowIndex() const { return mShadowIndex; }
+    // sets the region of the atlas this shadow map is rendered into
+    void setAllocation(uint8_t layer, backend::Viewport const& viewport) noexcept;
     void setLayer(uint8_t layer) noexcept { mLayer = layer; }
     uint8_t getLayer() const noexcept { return mLayer; }
+    // dimension in texels of this shadow map's region in the atlas, border included
+    uint16_t getDimension() const noexcept { return mDimension; }
     backend::Viewport getViewport() const noexcept;
     backend::Viewport getScissor() const noexcept;
 
@@ -357,6 +362,8 @@ private:
     uint32_t mLightIndex = 0;   // which light are we shadowing             // 4
     uint16_t mShadowIndex = 0;  // our index in the shadowMap vector        // 2
     uint8_t mLayer = 0;         // our layer in the shadowMap texture       // 1
+    math::ushort2 mOffset{};    // our position in the layer                // 4
+    uint16_t mDimension = 0;    // our size in the layer                    // 2
     ShadowType mShadowType  : 2;                                            // :2
     bool mHasVisibleShadows : 2;                                            // :2
     uint8_t mFace           : 3;                                            // :3
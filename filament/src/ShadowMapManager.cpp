@@ -15,9 +15,13 @@
  */
 
 #include "ShadowMapManager.h"
+
+#include "AtlasAllocator.h"
 #include "RenderPass.h"
+#include "RenderPrimitive.h"
 #include "ShadowMap.h"
 
+#include <filament/Box.h>
 #include <filament/Frustum.h>
 #include <filament/LightManager.h>
 #include <filament/Options.h>
@@ -28,6 +32,7 @@
 
 #include "details/Camera.h"
 #include "details/DebugRegistry.h"
+#include "details/MaterialInstance.h"
 #include "details/Texture.h"
 #include "details/View.h"
 
@@ -40,8 +45,11 @@
 #include <backend/DriverEnums.h>
 
 #include <utils/FixedCapacityVector.h>
+#include <utils/Hash.h>
 #include <utils/Range.h>
 #include <utils/Slice.h>
+#include <utils/Systrace.h>
+#include <utils/algorithm.h>
 #include <utils/compiler.h>
 #include <utils/debug.h>
 
@@ -50,6 +58,7 @@
 #include <math/vec4.h>
 #include <math/scalar.h>
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <new>
@@ -100,6 +109,10 @@ void ShadowMapManager::terminate(FEngine& engine) {
     if (UTILS_UNLIKELY(mInitialized)) {
         DriverApi& driver = engine.getDriverApi();
         driver.destroyBufferObject(mShadowUbh);
+        if (mShadowTexture) {
+            driver.destroyTexture(mShadowTexture);
+            mShadowTexture.clear();
+        }
         UTILS_NOUNROLL
         for (auto& entry: mShadowMapCache) {
             std::launder(reinterpret_cast<ShadowMap*>(&entry))->terminate(engine);
@@ -118,6 +131,34 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::update(
         return ShadowTechnique::NONE;
     }
 
+    initializeShadowMaps(engine, builder);
+
+    ShadowTechnique shadowTechnique = {};
+
+    // cached shadow maps are sampled with the same uniforms they were rendered with, which
+    // doesn't work with VSM's filtering (e.g. blurring and mipmapping)
+    mCachingOptions = view.getShadowMapCachingOptions();
+    mCachingEnabled = mCachingOptions.enabled && !view.hasVSM();
+
+    calculateTextureRequirements(engine, view, cameraInfo, lightData);
+
+    updateShadowTexture(engine);
+
+    // Compute scene-dependent values shared across all shadow maps
+    ShadowMap::SceneInfo const info{ *view.getScene(), view.getVisibleLayers(), cameraInfo.view };
+
+    shadowTechnique |= updateCascadeShadowMaps(
+            engine, view, cameraInfo, renderableData, lightData, info);
+
+    shadowTechnique |= updateSpotShadowMaps(
+            engine, lightData);
+
+    mSceneInfo = info;
+
+    return shadowTechnique;
+}
+
+void ShadowMapManager::initializeShadowMaps(FEngine& engine, Builder const& builder) noexcept {
     // initialize the shadowmap array the first time
     if (UTILS_UNLIKELY(!mInitialized)) {
         mInitialized = true;
@@ -142,23 +183,6 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::update(
                 entry.face,
                 entry.options);
     }
-
-    ShadowTechnique shadowTechnique = {};
-
-    calculateTextureRequirements(engine, view, lightData);
-
-    // Compute scene-dependent values shared across all shadow maps
-    ShadowMap::SceneInfo const info{ *view.getScene(), view.getVisibleLayers(), cameraInfo.view };
-
-    shadowTechnique |= updateCascadeShadowMaps(
-            engine, view, cameraInfo, renderableData, lightData, info);
-
-    shadowTechnique |= updateSpotShadowMaps(
-            engine, lightData);
-
-    mSceneInfo = info;
-
-    return shadowTechnique;
 }
 
 ShadowMapManager::Builder& ShadowMapManager::Builder::directionalShadowMap(size_t lightIndex,
@@ -232,6 +256,7 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
             ShadowMap* shadowMap;
             utils::Range<uint32_t> range;
             FScene::VisibleMaskType visibilityMask;
+            mutable bool cached = false;    // the shadow map is reused from a previous frame
         };
         // the actual shadow map atlas (currently a 2D texture array)
         FrameGraphId<FrameGraphTexture> shadows;
@@ -241,16 +266,33 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
 
     VsmShadowOptions const& vsmShadowOptions = view.getVsmShadowOptions();
 
+    // With caching, the shadow maps are rendered into our own texture which persists across frames
+    FrameGraphId<FrameGraphTexture> cachedShadows;
+    if (mCachingEnabled) {
+        cachedShadows = fg.import("Cached Shadowmap", {
+                .width = textureRequirements.size, .height = textureRequirements.size,
+                .depth = textureRequirements.layers,
+                .levels = textureRequirements.levels,
+                .type = SamplerType::SAMPLER_2D_ARRAY,
+                .format = textureRequirements.format
+        }, FrameGraphTexture::Usage::DEPTH_ATTACHMENT | FrameGraphTexture::Usage::SAMPLEABLE,
+                FrameGraphTexture{ .handle = mShadowTexture });
+    }
+
     auto& prepareShadowPass = fg.addPass<PrepareShadowPassData>("Prepare Shadow Pass",
             [&](FrameGraph::Builder& builder, auto& data) {
                 data.passList.reserve(CONFIG_MAX_SHADOWMAPS);
-                data.shadows = builder.createTexture("Shadowmap", {
-                        .width = textureRequirements.size, .height = textureRequirements.size,
-                        .depth = textureRequirements.layers,
-                        .levels = textureRequirements.levels,
-                        .type = SamplerType::SAMPLER_2D_ARRAY,
-                        .format = textureRequirements.format
-                });
+                if (cachedShadows) {
+                    data.shadows = cachedShadows;
+                } else {
+                    data.shadows = builder.createTexture("Shadowmap", {
+                            .width = textureRequirements.size, .height = textureRequirements.size,
+                            .depth = textureRequirements.layers,
+                            .levels = textureRequirements.levels,
+                            .type = SamplerType::SAMPLER_2D_ARRAY,
+                            .format = textureRequirements.format
+                    });
+                }
 
                 // these loops create a list of the shadow maps that might need to be rendered
                 auto& passList = data.passList;
@@ -279,21 +321,31 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
                     }
                 }
 
-                assert_invariant(passList.size() <= textureRequirements.layers);
+                assert_invariant(passList.size() <= CONFIG_MAX_SHADOWMAPS);
 
                 // This pass must be declared as having a side effect because it never gets a
                 // "read" from one of its resource (only writes), so the FrameGraph culls it.
                 builder.sideEffect();
             },
-            [this, &engine, &view, vsmShadowOptions,
+            [this, &engine, &view, vsmShadowOptions, textureRequirements,
                 scene, mainCameraInfo, userTime, passBuilder = passBuilder](
                     FrameGraphResources const&, auto const& data, DriverApi& driver) mutable {
 
                 // Note: we could almost parallel_for the loop below, the problem currently is
                 // that updatePrimitivesLod() updates temporary global state.
                 // prepareSpotShadowMap() also update the visibility of renderable. These two
-                // pieces of state are needed only until shadowMap.render() returns.
-                // Conceptually, we could store this out-of-band.
+                // pieces of state are needed only until the pass is built, which copies them,
+                // so each pass's commands are generated and sorted in a job while the next one
+                // is prepared, and all the jobs are joined below.
+
+                utils::FixedCapacityVector<RenderPass> passes;
+                passes.reserve(data.passList.size());
+                utils::FixedCapacityVector<PrepareShadowPassData::ShadowPass const*> passEntries;
+                passEntries.reserve(data.passList.size());
+
+                mStats = {
+                        .atlasDimension = textureRequirements.size,
+                        .atlasLayerCount = textureRequirements.layers };
 
                 // Generate a RenderPass for each shadow map
                 for (auto const& entry : data.passList) {
@@ -316,6 +368,16 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
                     }
 
                     if (shadowMap.hasVisibleShadows()) {
+                        if (mCachingEnabled && prepareCachedShadowMap(engine, shadowMap,
+                                scene->getLightData(), scene->getRenderableData(),
+                                entry.range, entry.visibilityMask)) {
+                            // the shadow map's layer already has the right content
+                            entry.cached = true;
+                            mStats.cachedCount++;
+                            continue;
+                        }
+                        mStats.renderedCount++;
+
                         // Note: this loop can generate a lot of commands that come out of the
                         //       "per frame command arena". The allocation persists until the
                         //       end of the frame.
@@ -341,26 +403,40 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
                         view.updatePrimitivesLod(engine,
                                 cameraInfo, scene->getRenderableData(), entry.range);
 
-                        // generate and sort the commands for rendering the shadow map
+                        // generate the commands for rendering the shadow map, they're
+                        // generated and sorted asynchronously.
 
-                        RenderPass const pass = passBuilder
+                        passes.push_back(passBuilder
                             .camera(cameraInfo)
                             .visibilityMask(entry.visibilityMask)
                             .geometry(scene->getRenderableData(),
                                     entry.range, scene->getRenderableUBO())
                             .commandTypeFlags(RenderPass::CommandTypeFlags::SHADOW)
-                            .build(engine);
-
-                        entry.executor = pass.getExecutor();
+                            .deferred(true)
+                            .build(engine));
+                        passEntries.push_back(&entry);
+                    }
+                }
 
-                        if (!view.hasVSM()) {
-                            auto const* options = shadowMap.getShadowOptions();
-                            PolygonOffset const polygonOffset = { // handle reversed Z
-                                    .slope    = -options->polygonOffsetSlope,
-                                    .constant = -options->polygonOffsetConstant
-                            };
-                            entry.executor.overridePolygonOffset(&polygonOffset);
-                        }
+                SYSTRACE_CONTEXT();
+                SYSTRACE_VALUE32("renderedShadowMaps", mStats.renderedCount);
+                SYSTRACE_VALUE32("cachedShadowMaps", mStats.cachedCount);
+
+                // wait for all the passes to be generated
+                for (size_t i = 0, c = passes.size(); i < c; i++) {
+                    RenderPass& pass = passes[i];
+                    auto const& entry = *passEntries[i];
+                    pass.finish(engine);
+
+                    entry.executor = pass.getExecutor();
+
+                    if (!view.hasVSM()) {
+                        auto const* options = entry.shadowMap->getShadowOptions();
+                        PolygonOffset const polygonOffset = { // handle reversed Z
+                                .slope    = -options->polygonOffsetSlope,
+                                .constant = -options->polygonOffsetConstant
+                        };
+                        entry.executor.overridePolygonOffset(&polygonOffset);
                     }
                 }
 
@@ -383,6 +459,9 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
         uint32_t rt{};
     };
 
+    // the last version of each layer of the atlas, when several shadow maps share a layer
+    std::array<FrameGraphId<FrameGraphTexture>, CONFIG_MAX_SHADOW_LAYERS> layerOutputs{};
+
     auto const& passList = prepareShadowPass.getData().passList;
     for (auto const& entry: passList) {
         if (!entry.shadowMap->hasVisibleShadows()) {
@@ -399,8 +478,18 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
 
                     FrameGraphRenderPass::Descriptor renderTargetDesc{};
 
-                    data.output = builder.createSubresource(prepareShadowPass->shadows,
-                            "Shadowmap Layer", { .layer = layer });
+                    // the first shadow map rendered in a layer clears it
+                    FrameGraphId<FrameGraphTexture>& layerOutput = layerOutputs[layer];
+                    const bool firstInLayer = !layerOutput;
+                    if (firstInLayer) {
+                        data.output = builder.createSubresource(prepareShadowPass->shadows,
+                                "Shadowmap Layer", { .layer = layer });
+                    } else {
+                        // VSM shadow maps never share a layer
+                        assert_invariant(!view.hasVSM());
+                        data.output = builder.read(layerOutput,
+                                FrameGraphTexture::Usage::DEPTH_ATTACHMENT);
+                    }
 
                     if (view.hasVSM()) {
                         // Each shadow pass has its own sample count, but textures are created with
@@ -450,12 +539,15 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
                             });
                         }
                     } else {
-                        // the shadowmap layer
+                        // the shadowmap layer, the following shadow maps in the same layer
+                        // keep its content
                         data.output = builder.write(data.output,
                                 FrameGraphTexture::Usage::DEPTH_ATTACHMENT);
                         renderTargetDesc.attachments.depth = data.output;
-                        renderTargetDesc.clearFlags = TargetBufferFlags::DEPTH;
+                        renderTargetDesc.clearFlags =
+                                firstInLayer ? TargetBufferFlags::DEPTH : TargetBufferFlags::NONE;
                     }
+                    layerOutput = data.output;
 
                     // finally, create the shadowmap render target -- one per layer.
                     auto rt = builder.declareRenderPass("Shadow RT", renderTargetDesc);
@@ -463,6 +555,12 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
                     // render either directly into the shadowmap, or to the temporary texture for
                     // blurring.
                     data.rt = blur ? data.rt : rt;
+
+                    // the commands were generated by the prepare pass, recording them doesn't
+                    // touch any shared state.
+                    builder.parallel([&entry]() {
+                        return entry.executor.getCommandStreamSize() + 1024;
+                    });
                 },
                 [=, &engine, &entry](FrameGraphResources const& resources,
                         auto const& data, DriverApi& driver) {
@@ -474,13 +572,24 @@ FrameGraphId<FrameGraphTexture> ShadowMapManager::render(FEngine& engine, FrameG
                     // It wouldn't work to capture by copy because entry.executor wouldn't be
                     // initialized, as this happens in an `execute` block.
 
+                    if (entry.cached) {
+                        // don't even begin the render pass, so the layer isn't cleared
+                        return;
+                    }
+
                     auto rt = resources.getRenderPassInfo(data.rt);
 
                     driver.beginRenderPass(rt.target, rt.params);
                     entry.shadowMap->bind(driver);
                     entry.executor.overrideScissor(entry.shadowMap->getScissor());
-                    entry.executor.execute(engine, "Shadow Pass");
+                    entry.executor.execute(engine, driver);
                     driver.endRenderPass();
+
+                    if (mCachingEnabled) {
+                        // the layer now has the content recorded by prepareCachedShadowMap()
+                        CachedShadowMap& cached = mCachedShadowMaps[layer];
+                        cached.valid = cached.cacheable;
+                    }
                 });
 
 
@@ -588,17 +697,21 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::updateCascadeShadowMaps(FEng
         p[3].z = (sf * F.w - sn * N.w) * 0.5f;
     }
 
+    utils::Slice<ShadowMap> cascadedShadowMaps = getCascadedShadowMap();
+
+    // all the cascades have the same dimension
+    uint16_t const dimension =
+            cascadedShadowMaps.empty() ? 0 : cascadedShadowMaps[0].getDimension();
     const ShadowMap::ShadowMapInfo shadowMapInfo{
             .atlasDimension      = mTextureAtlasRequirements.size,
-            .textureDimension    = uint16_t(options.mapSize),
-            .shadowDimension     = uint16_t(options.mapSize - 2u),
+            .textureDimension    = dimension,
+            .shadowDimension     = uint16_t(dimension - 2u),
             .textureSpaceFlipped = engine.getBackend() == Backend::METAL ||
                                    engine.getBackend() == Backend::VULKAN,
             .vsm                 = view.hasVSM()
     };
 
     bool hasVisibleShadows = false;
-    utils::Slice<ShadowMap> cascadedShadowMaps = getCascadedShadowMap();
     if (!cascadedShadowMaps.empty()) {
         // Even if we have more than one cascade, we cull directional shadow casters against the
         // entire camera frustum, as if we only had a single cascade.
@@ -622,8 +735,8 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::updateCascadeShadowMaps(FEng
 
         if (hasVisibleShadows) {
             Frustum const& frustum = shadowMap.getCamera().getCullingFrustum();
-            FView::cullRenderables(engine.getJobSystem(), renderableData, frustum,
-                    VISIBLE_DIR_SHADOW_RENDERABLE_BIT);
+            FView::cullRenderables(engine.getJobSystem(), renderableData,
+                    scene->getCullingHierarchy(), frustum, VISIBLE_DIR_SHADOW_RENDERABLE_BIT);
         }
     }
 
@@ -806,8 +919,8 @@ void ShadowMapManager::prepareSpotShadowMap(ShadowMap& shadowMap,
     // update the shadow map frustum/camera
     const ShadowMap::ShadowMapInfo shadowMapInfo{
             .atlasDimension      = mTextureAtlasRequirements.size,
-            .textureDimension    = uint16_t(options->mapSize),
-            .shadowDimension     = uint16_t(options->mapSize - 2u),
+            .textureDimension    = shadowMap.getDimension(),
+            .shadowDimension     = uint16_t(shadowMap.getDimension() - 2u),
             .textureSpaceFlipped = engine.getBackend() == Backend::METAL ||
                                    engine.getBackend() == Backend::VULKAN,
             .vsm                 = view.hasVSM()
@@ -887,8 +1000,8 @@ void ShadowMapManager::preparePointShadowMap(ShadowMap& shadowMap,
     // update the shadow map frustum/camera
     const ShadowMap::ShadowMapInfo shadowMapInfo{
             .atlasDimension      = mTextureAtlasRequirements.size,
-            .textureDimension    = uint16_t(options->mapSize),
-            .shadowDimension     = uint16_t(options->mapSize), // point-lights don't have a border
+            .textureDimension    = shadowMap.getDimension(),
+            .shadowDimension     = shadowMap.getDimension(), // point-lights don't have a border
             .textureSpaceFlipped = engine.getBackend() == Backend::METAL ||
                                    engine.getBackend() == Backend::VULKAN,
             .vsm                 = view.hasVSM()
@@ -964,30 +1077,16 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::updateSpotShadowMaps(FEngine
 }
 
 void ShadowMapManager::calculateTextureRequirements(FEngine& engine, FView& view,
-        FScene::LightSoa const&) noexcept {
+        CameraInfo const& cameraInfo, FScene::LightSoa const& lightData) noexcept {
 
-    // Lay out the shadow maps. For now, we take the largest requested dimension and allocate a
-    // texture of that size. Each cascade / shadow map gets its own layer in the array texture.
-    // The directional shadow cascades start on layer 0, followed by spotlights.
-    uint8_t layer = 0;
-    uint32_t maxDimension = 0;
     bool elvsm = false;
     for (ShadowMap& shadowMap : getCascadedShadowMap()) {
-        // Shadow map size should be the same for all cascades.
-        auto const& options = shadowMap.getShadowOptions();
-        maxDimension = std::max(maxDimension, options->mapSize);
-        elvsm = elvsm || options->vsm.elvsm;
-        shadowMap.setLayer(layer++);
+        elvsm = elvsm || shadowMap.getShadowOptions()->vsm.elvsm;
     }
     for (ShadowMap& shadowMap : getSpotShadowMaps()) {
-        auto const& options = shadowMap.getShadowOptions();
-        maxDimension = std::max(maxDimension, options->mapSize);
-        elvsm = elvsm || options->vsm.elvsm;
-        shadowMap.setLayer(layer++);
+        elvsm = elvsm || shadowMap.getShadowOptions()->vsm.elvsm;
     }
 
-    const uint8_t layersNeeded = layer;
-
     // Generate mipmaps for VSM when anisotropy is enabled or when requested
     auto const& vsmShadowOptions = view.getVsmShadowOptions();
     const bool useMipmapping = view.hasVSM() &&
@@ -1017,12 +1116,37 @@ void ShadowMapManager::calculateTextureRequirements(FEngine& engine, FView& view
 
     mSoftShadowOptions = view.getSoftShadowOptions();
 
-    uint8_t mipLevels = 1u;
-    if (useMipmapping) {
-        // Limit the lowest mipmap level to 256x256.
-        // This avoids artifacts on high derivative tangent surfaces.
-        int const lowMipmapLevel = 7;    // log2(256) - 1
-        mipLevels = std::max(1, FTexture::maxLevelCount(maxDimension) - lowMipmapLevel);
+    // Lay out the shadow maps
+    bool const shareLayers = canShareLayers(view.hasVSM(), mCachingEnabled);
+
+    ShadowMapAtlasOptions const& atlasOptions = view.getShadowMapAtlasOptions();
+    ShadowMapDimensions dimensions{};
+    chooseShadowMapDimensions(atlasOptions, cameraInfo, lightData, dimensions);
+
+    uint32_t maxDimension;
+    uint8_t layersNeeded;
+    uint8_t mipLevels;
+    while (true) {
+        maxDimension = allocateShadowMaps(engine, lightData, dimensions, shareLayers,
+                &layersNeeded);
+
+        mipLevels = 1u;
+        if (useMipmapping) {
+            // Limit the lowest mipmap level to 256x256.
+            // This avoids artifacts on high derivative tangent surfaces.
+            int const lowMipmapLevel = 7;    // log2(256) - 1
+            mipLevels = std::max(1, FTexture::maxLevelCount(maxDimension) - lowMipmapLevel);
+        }
+
+        // size of the atlas, mipmaps add up to a third of the base level
+        size_t size = FTexture::getFormatSize(format) * maxDimension * maxDimension * layersNeeded;
+        if (mipLevels > 1) {
+            size += size / 3;
+        }
+        if (!atlasOptions.memoryBudget || size <= atlasOptions.memoryBudget ||
+                !reduceShadowMapDimensions(dimensions)) {
+            break;
+        }
     }
 
     // publish the debugging data
@@ -1038,6 +1162,396 @@ void ShadowMapManager::calculateTextureRequirements(FEngine& engine, FView& view
     };
 }
 
+static uint32_t roundUpToPowerOfTwo(uint32_t v) noexcept {
+    return v <= 1u ? 1u : 1u << (32u - utils::clz(v - 1u));
+}
+
+// Smallest dimension a shadow map can be lowered to. The atlas allocator can only place shadow
+// maps up to 8 times smaller than the largest one.
+static uint32_t getMinDimension(LightManager::ShadowOptions const* options) noexcept {
+    return std::max(8u, roundUpToPowerOfTwo(options->mapSize) / 8u);
+}
+
+float ShadowMapManager::computeScreenSpaceCoverage(CameraInfo const& cameraInfo,
+        float4 const& sphere) noexcept {
+    // This estimates the fraction of the screen covered by the light's sphere of influence, from
+    // the sphere's projected radius at the distance of its center.
+    mat4f const& p = cameraInfo.projection;
+    float3 const center = (cameraInfo.view * float4{ sphere.xyz, 1.0f }).xyz;
+    if (length(center) <= sphere.w) {
+        // the camera is inside the light's sphere
+        return 1.0f;
+    }
+    // the clip-space w is the distance along the view direction, or 1 with an ortho projection
+    float const w = p[2][3] * center.z + p[3][3];
+    if (w <= 0.0f) {
+        return 1.0f;
+    }
+    float const radius = sphere.w * std::max(p[0][0], p[1][1]) / w;
+    return std::min(1.0f, radius);
+}
+
+void ShadowMapManager::chooseShadowMapDimensions(ShadowMapAtlasOptions const& options,
+        CameraInfo const& cameraInfo, FScene::LightSoa const& lightData,
+        ShadowMapDimensions& dimensions) noexcept {
+    for (ShadowMap const& shadowMap : getCascadedShadowMap()) {
+        dimensions[shadowMap.getShadowIndex()] = uint16_t(shadowMap.getShadowOptions()->mapSize);
+    }
+
+    auto const* const spheres = lightData.data<FScene::POSITION_RADIUS>();
+    for (ShadowMap const& shadowMap : getSpotShadowMaps()) {
+        auto const* const shadowOptions = shadowMap.getShadowOptions();
+        uint32_t dimension = shadowOptions->mapSize;
+        if (options.screenSpaceResolution) {
+            // a light covering the whole screen gets the full resolution
+            float const coverage = computeScreenSpaceCoverage(cameraInfo,
+                    spheres[shadowMap.getLightIndex()]);
+            uint32_t const texels = uint32_t(std::ceil(float(dimension) * coverage));
+            dimension = std::min(dimension, std::max(getMinDimension(shadowOptions),
+                    roundUpToPowerOfTwo(texels)));
+        }
+        dimensions[shadowMap.getShadowIndex()] = uint16_t(dimension);
+    }
+}
+
+bool ShadowMapManager::reduceShadowMapDimensions(ShadowMapDimensions& dimensions) noexcept {
+    // Halve the resolution of the largest shadow map, this is what reduces the size of the atlas.
+    // At equal resolution, spot and point lights go before the directional light, and since
+    // lights are sorted by distance to the camera, the farthest ones go first.
+    utils::Slice<ShadowMap> const cascadedShadowMaps = getCascadedShadowMap();
+    utils::Slice<ShadowMap> const spotShadowMaps = getSpotShadowMaps();
+
+    ShadowMap const* candidate = nullptr;
+    auto const findCandidate = [&dimensions, &candidate](ShadowMap const& shadowMap) {
+        uint16_t const dimension = dimensions[shadowMap.getShadowIndex()];
+        if (dimension > getMinDimension(shadowMap.getShadowOptions()) &&
+                (!candidate || dimension >= dimensions[candidate->getShadowIndex()])) {
+            candidate = &shadowMap;
+        }
+    };
+    std::for_each(cascadedShadowMaps.begin(), cascadedShadowMaps.end(), findCandidate);
+    std::for_each(spotShadowMaps.begin(), spotShadowMaps.end(), findCandidate);
+    if (!candidate) {
+        return false;
+    }
+
+    // all the cascades of the directional light, or all the faces of a point light, have the
+    // same resolution
+    size_t const light = candidate->getLightIndex();
+    auto const halve = [&dimensions, light](ShadowMap const& shadowMap) {
+        if (shadowMap.getLightIndex() == light) {
+            uint16_t& dimension = dimensions[shadowMap.getShadowIndex()];
+            dimension = uint16_t(std::max(getMinDimension(shadowMap.getShadowOptions()),
+                    roundUpToPowerOfTwo(dimension) / 2u));
+        }
+    };
+    std::for_each(cascadedShadowMaps.begin(), cascadedShadowMaps.end(), halve);
+    std::for_each(spotShadowMaps.begin(), spotShadowMaps.end(), halve);
+    return true;
+}
+
+uint32_t ShadowMapManager::allocateShadowMaps(FEngine& engine,
+        FScene::LightSoa const& lightData, ShadowMapDimensions const& dimensions, bool shareLayers,
+        uint8_t* outLayerCount) noexcept {
+    utils::Slice<ShadowMap> cascadedShadowMaps = getCascadedShadowMap();
+    utils::Slice<ShadowMap> spotShadowMaps = getSpotShadowMaps();
+
+    uint32_t maxDimension = 0;
+    for (ShadowMap const& shadowMap : cascadedShadowMaps) {
+        maxDimension = std::max(maxDimension, uint32_t(dimensions[shadowMap.getShadowIndex()]));
+    }
+    for (ShadowMap const& shadowMap : spotShadowMaps) {
+        maxDimension = std::max(maxDimension, uint32_t(dimensions[shadowMap.getShadowIndex()]));
+    }
+
+    if (!shareLayers) {
+        // each shadow map gets its own layer in the array texture
+        assignShadowMapLayers(engine, lightData);
+        uint8_t layerCount = 0;
+        for (ShadowMap& shadowMap : cascadedShadowMaps) {
+            uint32_t const dimension = dimensions[shadowMap.getShadowIndex()];
+            shadowMap.setAllocation(shadowMap.getLayer(), { 0, 0, dimension, dimension });
+            layerCount = std::max(layerCount, uint8_t(shadowMap.getLayer() + 1));
+        }
+        for (ShadowMap& shadowMap : spotShadowMaps) {
+            uint32_t const dimension = dimensions[shadowMap.getShadowIndex()];
+            shadowMap.setAllocation(shadowMap.getLayer(), { 0, 0, dimension, dimension });
+            layerCount = std::max(layerCount, uint8_t(shadowMap.getLayer() + 1));
+        }
+        *outLayerCount = layerCount;
+        return maxDimension;
+    }
+
+    // The shadow maps are packed in the atlas, each one in a square power-of-two region, which
+    // needs to be at least 1/8th of the atlas.
+    uint32_t const atlasDimension = roundUpToPowerOfTwo(maxDimension);
+    uint32_t const minRegionDimension = std::max(1u, atlasDimension / 8u);
+
+    ShadowMap* shadowMaps[CONFIG_MAX_SHADOWMAPS];
+    size_t count = 0;
+    for (ShadowMap& shadowMap : cascadedShadowMaps) {
+        shadowMaps[count++] = &shadowMap;
+    }
+    for (ShadowMap& shadowMap : spotShadowMaps) {
+        shadowMaps[count++] = &shadowMap;
+    }
+
+    auto const regionDimension = [&dimensions, minRegionDimension](ShadowMap const* shadowMap) {
+        return std::max(minRegionDimension,
+                roundUpToPowerOfTwo(dimensions[shadowMap->getShadowIndex()]));
+    };
+
+    // allocating the largest shadow maps first gives the tightest packing
+    std::stable_sort(shadowMaps, shadowMaps + count,
+            [&regionDimension](ShadowMap const* lhs, ShadowMap const* rhs) {
+                return regionDimension(lhs) > regionDimension(rhs);
+            });
+
+    AtlasAllocator allocator(atlasDimension);
+    uint8_t layerCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        ShadowMap& shadowMap = *shadowMaps[i];
+        uint32_t const dimension = dimensions[shadowMap.getShadowIndex()];
+        AtlasAllocator::Allocation const allocation = allocator.allocate(
+                regionDimension(&shadowMap));
+        // there is always enough room for CONFIG_MAX_SHADOWMAPS full layers
+        assert_invariant(allocation.layer >= 0);
+        shadowMap.setAllocation(uint8_t(allocation.layer), {
+                allocation.viewport.left, allocation.viewport.bottom, dimension, dimension });
+        layerCount = std::max(layerCount, uint8_t(allocation.layer + 1));
+    }
+    *outLayerCount = layerCount;
+    return atlasDimension;
+}
+
+void ShadowMapManager::assignShadowMapLayers(FEngine& engine,
+        FScene::LightSoa const& lightData) noexcept {
+    // The directional shadow cascades start on layer 0, followed by spotlights.
+    uint8_t layer = 0;
+    for (ShadowMap& shadowMap : getCascadedShadowMap()) {
+        shadowMap.setLayer(layer++);
+    }
+
+    utils::Slice<ShadowMap> spotShadowMaps = getSpotShadowMaps();
+    if (!mCachingEnabled) {
+        for (ShadowMap& shadowMap : spotShadowMaps) {
+            shadowMap.setLayer(layer++);
+        }
+        return;
+    }
+
+    // With caching, spot and point shadow maps keep the layer they were cached in when possible,
+    // because lights are sorted by distance to the camera and their order changes often.
+    static_assert(CONFIG_MAX_SHADOW_LAYERS <= 64);
+    constexpr uint8_t UNASSIGNED = 0xFF;
+    auto const& lcm = engine.getLightManager();
+    auto const* const instances = lightData.data<FScene::LIGHT_INSTANCE>();
+    size_t const first = layer;
+    size_t const last = first + spotShadowMaps.size();
+    uint64_t used = 0;
+    for (ShadowMap& shadowMap : spotShadowMaps) {
+        shadowMap.setLayer(UNASSIGNED);
+        utils::Entity const light = lcm.getEntity(instances[shadowMap.getLightIndex()]);
+        for (size_t l = first; l < last; l++) {
+            CachedShadowMap const& cached = mCachedShadowMaps[l];
+            if (!(used & (uint64_t(1) << l)) && cached.valid && cached.light == light &&
+                    cached.shadowType == shadowMap.getShadowType() &&
+                    cached.face == shadowMap.getFace()) {
+                shadowMap.setLayer(uint8_t(l));
+                used |= uint64_t(1) << l;
+                break;
+            }
+        }
+    }
+    size_t l = first;
+    for (ShadowMap& shadowMap : spotShadowMaps) {
+        if (shadowMap.getLayer() == UNASSIGNED) {
+            while (used & (uint64_t(1) << l)) {
+                l++;
+            }
+            assert_invariant(l < last);
+            shadowMap.setLayer(uint8_t(l));
+            used |= uint64_t(1) << l;
+        }
+    }
+}
+
+void ShadowMapManager::updateShadowTexture(FEngine& engine) noexcept {
+    DriverApi& driver = engine.getDriverApi();
+    if (!mCachingEnabled) {
+        if (mShadowTexture) {
+            driver.destroyTexture(mShadowTexture);
+            mShadowTexture.clear();
+            mCachedShadowMaps.fill({});
+        }
+        return;
+    }
+
+    TextureAtlasRequirements const& r = mTextureAtlasRequirements;
+    TextureAtlasRequirements const& c = mShadowTextureRequirements;
+    if (!mShadowTexture || r.size != c.size || r.layers != c.layers || r.levels != c.levels ||
+            r.format != c.format) {
+        if (mShadowTexture) {
+            driver.destroyTexture(mShadowTexture);
+        }
+        mShadowTexture = driver.createTexture(SamplerType::SAMPLER_2D_ARRAY,
+                r.levels, r.format, 1, r.size, r.size, r.layers,
+                TextureUsage::DEPTH_ATTACHMENT | TextureUsage::SAMPLEABLE);
+        mShadowTextureRequirements = r;
+        // the content of the new texture is undefined
+        mCachedShadowMaps.fill({});
+    }
+}
+
+bool ShadowMapManager::prepareCachedShadowMap(FEngine& engine, ShadowMap const& shadowMap,
+        FScene::LightSoa const& lightData, FScene::RenderableSoa const& renderableData,
+        utils::Range<uint32_t> range, FScene::VisibleMaskType visibilityMask) noexcept {
+    auto const& lcm = engine.getLightManager();
+    LightManager::ShadowOptions const* const options = shadowMap.getShadowOptions();
+    ShadowUib::ShadowData& shadowData = mShadowUb.edit().shadows[shadowMap.getShadowIndex()];
+
+    // directional shadow casters are culled against the whole camera frustum, only the ones in
+    // this cascade's frustum matter.
+    Frustum const frustum = shadowMap.getCamera().getCullingFrustum();
+
+    bool cacheable = true;
+    uint64_t const casters = hashShadowCasters(renderableData, range, visibilityMask,
+            shadowMap.isDirectionalShadow() ? &frustum : nullptr, &cacheable);
+
+    CachedShadowMap const current{
+            .light = lcm.getEntity(lightData.elementAt<FScene::LIGHT_INSTANCE>(
+                    shadowMap.getLightIndex())),
+            .shadowType = shadowMap.getShadowType(),
+            .face = shadowMap.getFace(),
+            .valid = false,
+            .cacheable = cacheable,
+            .dimension = shadowMap.getDimension(),
+            .polygonOffset = { options->polygonOffsetSlope, options->polygonOffsetConstant },
+            .casters = casters,
+            .shadowData = shadowData };
+
+    CachedShadowMap& cached = mCachedShadowMaps[shadowMap.getLayer()];
+    if (cached.valid && cacheable &&
+            cached.light == current.light &&
+            cached.shadowType == current.shadowType &&
+            cached.face == current.face &&
+            cached.dimension == current.dimension &&
+            cached.polygonOffset == current.polygonOffset &&
+            cached.casters == current.casters) {
+        ShadowUib::ShadowData const& cachedData = cached.shadowData;
+        bool const sameProjection =
+                cachedData.lightFromWorldMatrix == shadowData.lightFromWorldMatrix &&
+                cachedData.lightFromWorldZ == shadowData.lightFromWorldZ;
+        bool const reuse = sameProjection || (shadowMap.isDirectionalShadow() &&
+                mCachingOptions.cascadeThreshold > 0.0f &&
+                cascadeDrift(shadowData.lightFromWorldMatrix, cachedData.lightFromWorldMatrix,
+                        cachedData.scissorNormalized) <= mCachingOptions.cascadeThreshold);
+        if (reuse) {
+            // the cascade must be sampled with the projection it was rendered with
+            shadowData.lightFromWorldMatrix = cachedData.lightFromWorldMatrix;
+            shadowData.lightFromWorldZ = cachedData.lightFromWorldZ;
+            shadowData.nearOverFarMinusNear = cachedData.nearOverFarMinusNear;
+            return true;
+        }
+    }
+
+    // the layer will be rendered, it becomes valid once it is (see render())
+    cached = current;
+    return false;
+}
+
+uint64_t ShadowMapManager::hashShadowCasters(FScene::RenderableSoa const& renderableData,
+        utils::Range<uint32_t> range, FScene::VisibleMaskType visibilityMask,
+        Frustum const* frustum, bool* cacheable) noexcept {
+    auto const* const instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* const transforms = renderableData.data<FScene::WORLD_TRANSFORM>();
+    auto const* const visibility = renderableData.data<FScene::VISIBILITY_STATE>();
+    auto const* const skinning = renderableData.data<FScene::SKINNING_BUFFER>();
+    auto const* const morphing = renderableData.data<FScene::MORPHING_BUFFER>();
+    auto const* const primitives = renderableData.data<FScene::PRIMITIVES>();
+    auto const* const visibleMask = renderableData.data<FScene::VISIBLE_MASK>();
+    auto const* const worldAABBCenter = renderableData.data<FScene::WORLD_AABB_CENTER>();
+    auto const* const worldAABBExtent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
+
+    // The casters are combined with a sum, so that the hash doesn't depend on their order
+    uint64_t hash = 0;
+    for (uint32_t const i : range) {
+        if (!(visibleMask[i] & visibilityMask)) {
+            continue;
+        }
+        if (frustum && !frustum->intersects(Box{ worldAABBCenter[i], worldAABBExtent[i] })) {
+            continue;
+        }
+        // skinned and morphed casters can change every frame without us knowing
+        if (skinning[i].handle || morphing[i].handle) {
+            *cacheable = false;
+        }
+        // The primitives can be changed in place (e.g. setGeometryAt() or
+        // setMaterialInstanceAt()), so their geometry and material instance are part of the key.
+        uint32_t primitivesHash = 0;
+        for (FRenderPrimitive const& primitive : primitives[i]) {
+            FMaterialInstance const* const mi = primitive.getMaterialInstance();
+            uint64_t const miAddress = uint64_t(uintptr_t(mi));
+            uint32_t const primitiveKey[] = {
+                    uint32_t(miAddress),
+                    uint32_t(miAddress >> 32u),
+                    uint32_t(mi->getCullingMode()) |
+                            (uint32_t(mi->isDepthWriteEnabled()) << 4u) |
+                            (uint32_t(mi->getDepthFunc()) << 8u) |
+                            (uint32_t(mi->getTransparencyMode()) << 16u),
+                    primitive.getHwHandle().getId(),
+                    primitive.getIndexOffset(),
+                    primitive.getIndexCount() };
+            primitivesHash = utils::hash::murmur3(primitiveKey,
+                    sizeof(primitiveKey) / sizeof(uint32_t), primitivesHash);
+        }
+        struct {
+            uint32_t instance;
+            FRenderableManager::Visibility visibility;
+            uint16_t reserved;
+            uint64_t primitives;
+            uint32_t primitiveCount;
+            uint32_t primitivesHash;
+            mat4f transform;
+        } key = {
+                .instance = instances[i].asValue(),
+                .visibility = visibility[i],
+                .reserved = 0,
+                .primitives = uint64_t(uintptr_t(primitives[i].data())),
+                .primitiveCount = uint32_t(primitives[i].size()),
+                .primitivesHash = primitivesHash,
+                .transform = transforms[i] };
+        static_assert(sizeof(key) == 88, "the key must not have padding");
+        auto const* const words = reinterpret_cast<uint32_t const*>(&key);
+        size_t const wordCount = sizeof(key) / sizeof(uint32_t);
+        hash += (uint64_t(utils::hash::murmur3(words, wordCount, 0)) << 32u) |
+                utils::hash::murmur3(words, wordCount, 1);
+    }
+    return hash;
+}
+
+void ShadowMapManager::invalidateCachedShadowMaps() noexcept {
+    for (CachedShadowMap& cached : mCachedShadowMaps) {
+        cached.valid = false;
+    }
+}
+
+float ShadowMapManager::cascadeDrift(mat4f const& lightSpace, mat4f const& cachedLightSpace,
+        float4 const& scissorNormalized) noexcept {
+    // This transforms the cached shadow map's texture coordinates into the new ones, it's the
+    // identity when the projection didn't change.
+    mat4f const M = lightSpace * inverse(cachedLightSpace);
+    // express the translation as a fraction of the shadow map, not of the whole atlas
+    float2 const mapSize = scissorNormalized.zw - scissorNormalized.xy;
+    float const translation = std::max(
+            std::abs(M[3].x) / std::max(mapSize.x, std::numeric_limits<float>::min()),
+            std::abs(M[3].y) / std::max(mapSize.y, std::numeric_limits<float>::min()));
+    float const scale = std::max({
+            std::abs(M[0].x - 1.0f), std::abs(M[1].y - 1.0f), std::abs(M[2].z - 1.0f),
+            std::abs(M[0].y), std::abs(M[1].x), std::abs(M[3].z) });
+    return std::max(translation, scale);
+}
+
 ShadowMapManager::CascadeSplits::CascadeSplits(Params const& params) noexcept
         : mSplitCount(params.cascadeCount + 1) {
     for (size_t s = 0; s < mSplitCount; s++) {
@@ -23,6 +23,7 @@
 
 #include <filament/LightManager.h>
 #include <filament/Options.h>
+#include <filament/View.h>
 
 #include <private/filament/EngineEnums.h>
 #include <private/filament/UibStructs.h>
@@ -41,6 +42,7 @@
 #include <utils/BitmaskEnum.h>
 #include <utils/compiler.h>
 #include <utils/debug.h>
+#include <utils/Entity.h>
 #include <utils/Range.h>
 #include <utils/Slice.h>
 
@@ -56,6 +58,11 @@
 #include <stdint.h>
 #include <stddef.h>
 
+class ShadowMapManager_ChooseShadowMapDimensions_Test;
+class ShadowMapManager_ReduceShadowMapDimensions_Test;
+class ShadowMapManager_AllocateSharedLayers_Test;
+class ShadowMapManager_AllocateSeparateLayers_Test;
+
 namespace filament {
 
 class FCamera;
@@ -137,6 +144,12 @@ public:
 
     bool hasSpotShadows() const { return !mSpotShadowMapCount; }
 
+    // number of shadow maps rendered and cached during the last render(), and the atlas size
+    View::ShadowMapStats getStats() const noexcept { return mStats; }
+
+    // the cached shadow maps are all rendered again in the next frame
+    void invalidateCachedShadowMaps() noexcept;
+
     // for debugging only
     FCamera const* getDirectionalShadowCamera() const noexcept {
         if (!mInitialized) return nullptr;
@@ -144,10 +157,18 @@ public:
     }
 
 private:
+    friend ShadowMapManager_ChooseShadowMapDimensions_Test;
+    friend ShadowMapManager_ReduceShadowMapDimensions_Test;
+    friend ShadowMapManager_AllocateSharedLayers_Test;
+    friend ShadowMapManager_AllocateSeparateLayers_Test;
+
     explicit ShadowMapManager(FEngine& engine);
 
     void terminate(FEngine& engine);
 
+    // creates the ShadowMap array the first time and initializes the shadow maps of this frame
+    void initializeShadowMaps(FEngine& engine, Builder const& builder) noexcept;
+
     ShadowMapManager::ShadowTechnique updateCascadeShadowMaps(FEngine& engine,
             FView& view, CameraInfo cameraInfo, FScene::RenderableSoa& renderableData,
             FScene::LightSoa const& lightData, ShadowMap::SceneInfo sceneInfo) noexcept;
@@ -155,7 +176,7 @@ private:
     ShadowMapManager::ShadowTechnique updateSpotShadowMaps(FEngine& engine,
             FScene::LightSoa const& lightData) noexcept;
 
-    void calculateTextureRequirements(FEngine&, FView& view,
+    void calculateTextureRequirements(FEngine&, FView& view, CameraInfo const& cameraInfo,
             FScene::LightSoa const&) noexcept;
 
     void prepareSpotShadowMap(ShadowMap& shadowMap,
@@ -169,6 +190,59 @@ private:
             FScene::LightSoa& lightData,
             ShadowMap::SceneInfo const& sceneInfo) noexcept;
 
+    // The content of a shadow map layer, as it was last rendered. A layer can be reused as long
+    // as all of this is unchanged.
+    struct CachedShadowMap {
+        utils::Entity light;
+        ShadowType shadowType = ShadowType::DIRECTIONAL;
+        uint8_t face = 0;
+        bool valid = false;         // set once the shadow map is actually rendered
+        bool cacheable = false;     // false if a caster changes every frame (e.g. skinned)
+        uint32_t dimension = 0;
+        math::float2 polygonOffset{};
+        uint64_t casters = 0;       // hash of the shadow casters
+        ShadowUib::ShadowData shadowData{}; // uniforms matching the content of the layer
+    };
+
+    // dimension in texels of each shadow map, indexed by shadow index
+    using ShadowMapDimensions = std::array<uint16_t, CONFIG_MAX_SHADOWMAPS>;
+
+    void chooseShadowMapDimensions(ShadowMapAtlasOptions const& options,
+            CameraInfo const& cameraInfo, FScene::LightSoa const& lightData,
+            ShadowMapDimensions& dimensions) noexcept;
+
+    bool reduceShadowMapDimensions(ShadowMapDimensions& dimensions) noexcept;
+
+    // Several shadow maps can share a layer of the array texture, but a layer can only be cleared
+    // as a whole, so cached shadow maps each get their own layer. VSM shadow maps also need their
+    // own layer, because they're blurred and mipmapped per layer.
+    static bool canShareLayers(bool vsm, bool cachingEnabled) noexcept {
+        return !vsm && !cachingEnabled;
+    }
+
+    // lays out the shadow maps in the atlas, returns the dimension of the atlas
+    uint32_t allocateShadowMaps(FEngine& engine, FScene::LightSoa const& lightData,
+            ShadowMapDimensions const& dimensions, bool shareLayers,
+            uint8_t* outLayerCount) noexcept;
+
+    void assignShadowMapLayers(FEngine& engine, FScene::LightSoa const& lightData) noexcept;
+
+    static float computeScreenSpaceCoverage(CameraInfo const& cameraInfo,
+            math::float4 const& sphere) noexcept;
+
+    void updateShadowTexture(FEngine& engine) noexcept;
+
+    bool prepareCachedShadowMap(FEngine& engine, ShadowMap const& shadowMap,
+            FScene::LightSoa const& lightData, FScene::RenderableSoa const& renderableData,
+            utils::Range<uint32_t> range, FScene::VisibleMaskType visibilityMask) noexcept;
+
+    static uint64_t hashShadowCasters(FScene::RenderableSoa const& renderableData,
+            utils::Range<uint32_t> range, FScene::VisibleMaskType visibilityMask,
+            Frustum const* frustum, bool* cacheable) noexcept;
+
+    static float cascadeDrift(math::mat4f const& lightSpace, math::mat4f const& cachedLightSpace,
+            math::float4 const& scissorNormalized) noexcept;
+
     static void updateSpotVisibilityMasks(
             uint8_t visibleLayers,
             uint8_t const* UTILS_RESTRICT layers,
@@ -224,6 +298,14 @@ private:
 
     ShadowMap::SceneInfo mSceneInfo;
 
+    // Shadow map caching: the atlas is kept across frames, with a record of each layer's content
+    ShadowMapCachingOptions mCachingOptions;
+    bool mCachingEnabled = false;
+    backend::Handle<backend::HwTexture> mShadowTexture;
+    TextureAtlasRequirements mShadowTextureRequirements;
+    std::array<CachedShadowMap, CONFIG_MAX_SHADOW_LAYERS> mCachedShadowMaps;
+    View::ShadowMapStats mStats;
+
     // Inline storage for all our ShadowMap objects, we can't easily use a std::array<> directly.
     // Because ShadowMap doesn't have a default ctor, and we avoid out-of-line allocations.
     // Each ShadowMap is currently 40 bytes (total of 2.5KB for 64 shadow maps)
@@ -43,6 +43,22 @@ filament::Viewport const& View::getViewport() const noexcept {
     return downcast(this)->getViewport();
 }
 
+void View::setOcclusionCullingEnabled(bool enabled) noexcept {
+    downcast(this)->setOcclusionCullingEnabled(enabled);
+}
+
+bool View::isOcclusionCullingEnabled() const noexcept {
+    return downcast(this)->isOcclusionCullingEnabled();
+}
+
+void View::setCommandCachingEnabled(bool enabled) noexcept {
+    downcast(this)->setCommandCachingEnabled(enabled);
+}
+
+bool View::isCommandCachingEnabled() const noexcept {
+    return downcast(this)->isCommandCachingEnabled();
+}
+
 void View::setFrustumCullingEnabled(bool culling) noexcept {
     downcast(this)->setFrustumCullingEnabled(culling);
 }
@@ -203,6 +219,30 @@ SoftShadowOptions View::getSoftShadowOptions() const noexcept {
     return downcast(this)->getSoftShadowOptions();
 }
 
+void View::setShadowMapCachingOptions(ShadowMapCachingOptions const& options) noexcept {
+    downcast(this)->setShadowMapCachingOptions(options);
+}
+
+ShadowMapCachingOptions View::getShadowMapCachingOptions() const noexcept {
+    return downcast(this)->getShadowMapCachingOptions();
+}
+
+void View::setShadowMapAtlasOptions(ShadowMapAtlasOptions const& options) noexcept {
+    downcast(this)->setShadowMapAtlasOptions(options);
+}
+
+ShadowMapAtlasOptions View::getShadowMapAtlasOptions() const noexcept {
+    return downcast(this)->getShadowMapAtlasOptions();
+}
+
+void View::invalidateShadowMaps() noexcept {
+    downcast(this)->invalidateShadowMaps();
+}
+
+View::ShadowMapStats View::getShadowMapStats() const noexcept {
+    return downcast(this)->getShadowMapStats();
+}
+
 void View::setAmbientOcclusion(View::AmbientOcclusion ambientOcclusion) noexcept {
     downcast(this)->setAmbientOcclusion(ambientOcclusion);
 }
@@ -58,6 +58,7 @@ struct RenderableManager::BuilderDetails {
     bool mScreenSpaceContactShadows : 1;
     bool mSkinningBufferMode : 1;
     bool mFogEnabled : 1;
+    bool mOccluder : 1;
     size_t mSkinningBoneCount = 0;
     size_t mMorphTargetCount = 0;
     Bone const* mUserBones = nullptr;
@@ -75,7 +76,7 @@ struct RenderableManager::BuilderDetails {
     explicit BuilderDetails(size_t count)
             : mEntries(count), mCulling(true), mCastShadows(false),
               mReceiveShadows(true), mScreenSpaceContactShadows(false),
-              mSkinningBufferMode(false),  mFogEnabled(true), mBonePairs() {
+              mSkinningBufferMode(false),  mFogEnabled(true), mOccluder(false), mBonePairs() {
     }
     // this is only needed for the explicit instantiation below
     BuilderDetails() = default;
@@ -178,6 +179,11 @@ RenderableManager::Builder& RenderableManager::Builder::screenSpaceContactShadow
     return *this;
 }
 
+RenderableManager::Builder& RenderableManager::Builder::occluder(bool enable) noexcept {
+    mImpl->mOccluder = enable;
+    return *this;
+}
+
 RenderableManager::Builder& RenderableManager::Builder::skinning(size_t boneCount) noexcept {
     mImpl->mSkinningBoneCount = boneCount;
     return *this;
@@ -507,6 +513,7 @@ void FRenderableManager::create(
             rp[i].init(factory, driver, entries[i]);
         }
         setPrimitives(ci, { rp, size_type(entryCount) });
+        renderStateChanged(ci);
 
         setAxisAlignedBoundingBox(ci, builder->mAABB);
         setLayerMask(ci, builder->mLayerMask);
@@ -516,6 +523,7 @@ void FRenderableManager::create(
         setReceiveShadows(ci, builder->mReceiveShadows);
         setScreenSpaceContactShadows(ci, builder->mScreenSpaceContactShadows);
         setCulling(ci, builder->mCulling);
+        setOccluder(ci, builder->mOccluder);
         setSkinning(ci, false);
         setMorphing(ci, builder->mMorphTargetCount);
         setFogEnabled(ci, builder->mFogEnabled);
@@ -660,6 +668,10 @@ void FRenderableManager::destroy(utils::Entity e) noexcept {
     if (ci) {
         destroyComponent(ci);
         mManager.removeComponent(e);
+        if (ci.asValue() < mManager.end()) {
+            // the last renderable was moved to this instance
+            renderStateChanged(ci);
+        }
     }
 }
 
@@ -686,6 +698,10 @@ void FRenderableManager::gc(utils::EntityManager& em) noexcept {
     });
 }
 
+void FRenderableManager::renderStateChanged(Instance ci) noexcept {
+    mManager[ci].version = mEngine.nextRenderStateVersion();
+}
+
 // This is basically a Renderable's destructor.
 void FRenderableManager::destroyComponent(Instance ci) noexcept {
     auto& manager = mManager;
@@ -747,6 +763,7 @@ void FRenderableManager::setMaterialInstanceAt(Instance instance, uint8_t level,
                     material->getName().c_str_safe(), (uint8_t)material->getFeatureLevel());
 
             primitives[primitiveIndex].setMaterialInstance(mi);
+            renderStateChanged(instance);
             AttributeBitset const required = material->getRequiredAttributes();
             AttributeBitset const declared = primitives[primitiveIndex].getEnabledAttributes();
             if (UTILS_UNLIKELY((declared & required) != required)) {
@@ -777,6 +794,7 @@ void FRenderableManager::setBlendOrderAt(Instance instance, uint8_t level,
         Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].setBlendOrder(order);
+            renderStateChanged(instance);
         }
     }
 }
@@ -787,6 +805,7 @@ void FRenderableManager::setGlobalBlendOrderEnabledAt(Instance instance, uint8_t
         Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].setGlobalBlendOrderEnabled(enabled);
+            renderStateChanged(instance);
         }
     }
 }
@@ -810,6 +829,7 @@ void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].set(mHwRenderPrimitiveFactory, mEngine.getDriverApi(),
                     type, vertices, indices, offset, count);
+            renderStateChanged(instance);
         }
     }
 }
@@ -876,6 +896,7 @@ void FRenderableManager::setSkinningBuffer(FRenderableManager::Instance ci,
     bones.handle = skinningBuffer->getHwHandle();
     bones.count = uint16_t(count);
     bones.offset = uint16_t(offset);
+    renderStateChanged(ci);
 }
 
 static void updateMorphWeights(FEngine& engine, backend::Handle<backend::HwBufferObject> handle,
@@ -918,6 +939,7 @@ void FRenderableManager::setMorphTargetBufferAt(Instance instance, uint8_t level
         if (primitiveIndex < morphTargets.size()) {
             morphTargets[primitiveIndex] = { morphTargetBuffer, (uint32_t)offset,
                                              (uint32_t)count };
+            renderStateChanged(instance);
         }
     }
 }
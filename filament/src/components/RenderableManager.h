@@ -65,6 +65,7 @@ public:
         bool screenSpaceContactShadows  : 1;
         bool reversedWindingOrder       : 1;
         bool fog                        : 1;
+        bool occluder                   : 1;
     };
 
     static_assert(sizeof(Visibility) == sizeof(uint16_t), "Visibility should be 16 bits");
@@ -131,6 +132,7 @@ public:
     inline void setReceiveShadows(Instance instance, bool enable) noexcept;
     inline void setScreenSpaceContactShadows(Instance instance, bool enable) noexcept;
     inline void setCulling(Instance instance, bool enable) noexcept;
+    inline void setOccluder(Instance instance, bool enable) noexcept;
     inline void setFogEnabled(Instance instance, bool enable) noexcept;
     inline bool getFogEnabled(Instance instance) const noexcept;
 
@@ -155,6 +157,7 @@ public:
     inline bool isShadowCaster(Instance instance) const noexcept;
     inline bool isShadowReceiver(Instance instance) const noexcept;
     inline bool isCullingEnabled(Instance instance) const noexcept;
+    inline bool isOccluder(Instance instance) const noexcept;
 
 
     inline Box const& getAABB(Instance instance) const noexcept;
@@ -208,8 +211,15 @@ public:
     inline utils::Slice<MorphTargets> const& getMorphTargets(Instance instance, uint8_t level) const noexcept;
     inline utils::Slice<MorphTargets>& getMorphTargets(Instance instance, uint8_t level) noexcept;
 
+    // Version of the last change to the primitives, material instances, skinning or morphing
+    // of this renderable, see FEngine::getRenderStateVersion(). Visibility isn't included.
+    uint64_t getRenderStateVersion(Instance instance) const noexcept {
+        return mManager[instance].version;
+    }
+
 private:
     void destroyComponent(Instance ci) noexcept;
+    void renderStateChanged(Instance ci) noexcept;
     static void destroyComponentPrimitives(
             HwRenderPrimitiveFactory& factory, backend::DriverApi& driver,
             utils::Slice<FRenderPrimitive>& primitives) noexcept;
@@ -241,7 +251,8 @@ private:
         VISIBILITY,             // user data
         PRIMITIVES,             // user data
         BONES,                  // filament data, UBO storing a pointer to the bones information
-        MORPH_TARGETS
+        MORPH_TARGETS,
+        VERSION                 // filament data, version of the last change
     };
 
     using Base = utils::SingleInstanceComponentManager<
@@ -253,7 +264,8 @@ private:
             Visibility,                      // VISIBILITY
             utils::Slice<FRenderPrimitive>,  // PRIMITIVES
             Bones,                           // BONES
-            utils::Slice<MorphTargets>       // MORPH_TARGETS
+            utils::Slice<MorphTargets>,      // MORPH_TARGETS
+            uint64_t                         // VERSION
     >;
 
     struct Sim : public Base {
@@ -277,6 +289,7 @@ private:
                 Field<PRIMITIVES>           primitives;
                 Field<BONES>                bones;
                 Field<MORPH_TARGETS>        morphTargets;
+                Field<VERSION>              version;
             };
         };
 
@@ -357,6 +370,13 @@ void FRenderableManager::setCulling(Instance instance, bool enable) noexcept {
     }
 }
 
+void FRenderableManager::setOccluder(Instance instance, bool enable) noexcept {
+    if (instance) {
+        Visibility& visibility = mManager[instance].visibility;
+        visibility.occluder = enable;
+    }
+}
+
 void FRenderableManager::setFogEnabled(Instance instance, bool enable) noexcept {
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
@@ -406,6 +426,10 @@ bool FRenderableManager::isCullingEnabled(Instance instance) const noexcept {
     return getVisibility(instance).culling;
 }
 
+bool FRenderableManager::isOccluder(Instance instance) const noexcept {
+    return getVisibility(instance).occluder;
+}
+
 uint8_t FRenderableManager::getLayerMask(Instance instance) const noexcept {
     return mManager[instance].layers;
 }
@@ -19,16 +19,31 @@
 #include <math/mat4.h>
 
 #include <utils/debug.h>
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
 #include <filament/TransformManager.h>
 
+#include <algorithm>
+#include <vector>
 
 using namespace utils;
 using namespace filament::math;
 
 namespace filament {
 
+// subtrees smaller than this are never split across jobs
+static constexpr size_t MIN_RANGE_SIZE = 256;
+// we don't need more independent ranges than this to keep all threads busy
+static constexpr size_t MAX_RANGE_COUNT = 64;
+// below this many nodes, it's not worth dispatching jobs
+static constexpr size_t PARALLEL_MIN_COUNT = 1024;
+
 FTransformManager::FTransformManager() noexcept = default;
 
+FTransformManager::FTransformManager(JobSystem& js) noexcept
+        : mJobSystem(&js) {
+}
+
 FTransformManager::~FTransformManager() noexcept = default;
 
 void FTransformManager::terminate() noexcept {
@@ -38,8 +53,12 @@ void FTransformManager::setAccurateTranslationsEnabled(bool enable) noexcept {
     if (enable != mAccurateTranslations) {
         mAccurateTranslations = enable;
         // when enabling accurate translations, we have to recompute all world transforms
-        if (enable && !mLocalTransformTransactionOpen) {
-            computeAllWorldTransforms();
+        if (enable) {
+            std::fill_n(mManager.begin<DIRTY>(), mManager.getComponentCount(), true);
+            mHasDirtyNodes = true;
+            if (!mLocalTransformTransactionOpen) {
+                computeDirtyWorldTransforms();
+            }
         }
     }
 }
@@ -104,8 +123,8 @@ void FTransformManager::setParent(Instance i, Instance parent) noexcept {
             updateNodeTransform(i);
             // Note: setParent() doesn't reorder the child after the parent in the array,
             // but that's not a problem because TransformManager doesn't rely on that.
-            // Also note that commitLocalTransformTransaction() does reorder all children after
-            // their parent, as an optimization to calculate the world transform.
+            // Also note that commitLocalTransformTransaction() does sort all nodes depth-first,
+            // as an optimization to calculate the world transform.
         }
     }
 }
@@ -154,6 +173,11 @@ void FTransformManager::destroy(Entity e) noexcept {
         Instance child = manager[i].firstChild;
         while (child) {
             manager[child].parent = 0;
+            if (UTILS_UNLIKELY(mLocalTransformTransactionOpen)) {
+                // their world transform is now their local transform
+                manager[child].dirty = true;
+                mHasDirtyNodes = true;
+            }
             child = manager[child].next;
         }
 
@@ -164,6 +188,8 @@ void FTransformManager::destroy(Entity e) noexcept {
         if (moved != i) {
             updateNode(i);
         }
+
+        mHierarchyChanged = true;
     }
 }
 
@@ -190,14 +216,17 @@ void FTransformManager::setTransform(Instance ci, const mat4& model) noexcept {
 }
 
 void FTransformManager::updateNodeTransform(Instance i) noexcept {
-    if (UTILS_UNLIKELY(mLocalTransformTransactionOpen)) {
-        return;
-    }
-
     validateNode(i);
     auto& manager = mManager;
     assert_invariant(i);
 
+    if (UTILS_UNLIKELY(mLocalTransformTransactionOpen)) {
+        // the world transform of this node and its descendants will be computed on commit
+        manager[i].dirty = true;
+        mHasDirtyNodes = true;
+        return;
+    }
+
     // find our parent's world transform, if any
     // note: by using the raw_array() we don't need to check that parent is valid.
     Instance const parent = manager[i].parent;
@@ -221,32 +250,146 @@ void FTransformManager::openLocalTransformTransaction() noexcept {
 void FTransformManager::commitLocalTransformTransaction() noexcept {
     if (mLocalTransformTransactionOpen) {
         mLocalTransformTransactionOpen = false;
-        computeAllWorldTransforms();
+        computeDirtyWorldTransforms();
     }
 }
 
-void FTransformManager::computeAllWorldTransforms() noexcept {
+void FTransformManager::computeDirtyWorldTransforms() noexcept {
+    SYSTRACE_CALL();
+
+    if (!mHasDirtyNodes) {
+        return;
+    }
+    mHasDirtyNodes = false;
+
+    if (mHierarchyChanged) {
+        sortDepthFirst();
+    }
+
     auto& manager = mManager;
 
+    // the trunk nodes are the ancestors of all ranges, they must be processed first
+    for (Instance const i : mTrunk) {
+        transformRange(manager, i, 1);
+    }
+
+    // ranges are independent of each other
+    JobSystem* const js = mJobSystem;
+    if (js && mRanges.size() > 1 && manager.getComponentCount() >= PARALLEL_MIN_COUNT) {
+        auto work = [this](Range const* ranges, size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                transformRange(mManager, ranges[i].first, ranges[i].count);
+            }
+        };
+        auto* job = jobs::parallel_for(*js, nullptr, mRanges.data(), uint32_t(mRanges.size()),
+                std::cref(work), jobs::CountSplitter<1, 6>());
+        js->runAndWait(job);
+    } else {
+        for (Range const& range : mRanges) {
+            transformRange(manager, range.first, range.count);
+        }
+    }
+
+    auto& soa = manager.getSoA();
+    std::fill_n(soa.data<DIRTY>(), soa.size(), false);
+}
+
+void FTransformManager::sortDepthFirst() noexcept {
+    SYSTRACE_CALL();
+
+    auto& manager = mManager;
+    size_t const count = manager.getComponentCount();
+    size_t const begin = manager.begin();
+    size_t const end = manager.end();
+
+    // 1) find the depth-first order of all nodes, without recursion
+    std::vector<Instance> order;
+    order.reserve(count);
+    for (Instance root = manager.begin(), e = manager.end(); root != e; ++root) {
+        Instance const rootParent = manager[root].parent;
+        if (rootParent) {
+            continue;
+        }
+        Instance i = root;
+        while (true) {
+            order.push_back(i);
+            Instance const child = manager[i].firstChild;
+            if (child) {
+                i = child;
+                continue;
+            }
+            while (i != root && !Instance(manager[i].next)) {
+                i = manager[i].parent;
+            }
+            if (i == root) {
+                break;
+            }
+            i = manager[i].next;
+        }
+    }
+    assert_invariant(order.size() == count);
+
+    // 2) move all nodes to their final position.
     // swapNode() below needs some temporary storage which we provide here
-    const bool accurate = mAccurateTranslations;
     auto& soa = manager.getSoA();
     soa.ensureCapacity(soa.size() + 1);
 
-    for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
-        // Ensure that children are always sorted after their parent.
-        while (UTILS_UNLIKELY(Instance(manager[i].parent) > i)) {
-            swapNode(i, manager[i].parent);
+    // where[n] is the current position of the node initially at n, who[] is its inverse
+    std::vector<Instance> where(end);
+    std::vector<Instance> who(end);
+    for (size_t i = begin; i < end; i++) {
+        where[i] = Instance(i);
+        who[i] = Instance(i);
+    }
+    for (size_t k = 0; k < count; k++) {
+        Instance const dst = Instance(begin + k);
+        Instance const node = order[k];
+        Instance const src = where[node];
+        if (src != dst) {
+            swapNode(dst, src);
+            Instance const other = who[dst];
+            who[src] = other;
+            where[other] = src;
+            who[dst] = node;
+            where[node] = dst;
         }
-        Instance const parent = manager[i].parent;
-        assert_invariant(parent < i);
+    }
 
-        FTransformManager::computeWorldTransform(
-                manager[i].world, manager[i].worldTranslationLo,
-                manager[parent].world, manager[i].local,
-                manager[parent].worldTranslationLo, manager[i].localTranslationLo,
-                accurate);
+    // 3) compute the size of all subtrees, children are now always after their parent
+    std::vector<uint32_t> size(end, 1);
+    for (size_t i = end; i-- > begin;) {
+        Instance const parent = manager[Instance(i)].parent;
+        assert_invariant(parent < Instance(i));
+        if (parent) {
+            size[parent] += size[i];
+        }
+    }
+
+    // 4) Split the hierarchy in independent ranges of whole subtrees. Subtrees too large to
+    // be processed by a single job are split into their children, and their root is put in
+    // the trunk. Small adjacent subtrees (e.g. siblings) are merged into a single range.
+    size_t const maxRangeSize = std::max(MIN_RANGE_SIZE, count / MAX_RANGE_COUNT);
+    mTrunk.clear();
+    mRanges.clear();
+    for (size_t i = begin; i < end;) {
+        Instance const node = Instance(i);
+        Instance const firstChild = manager[node].firstChild;
+        if (size[i] > maxRangeSize && firstChild) {
+            mTrunk.push_back(node);
+            i++;
+            continue;
+        }
+        if (!mRanges.empty() &&
+                mRanges.back().first + mRanges.back().count == i &&
+                mRanges.back().count + size[i] <= maxRangeSize) {
+            mRanges.back().count += size[i];
+        } else {
+            mRanges.push_back({ node, size[i] });
+        }
+        i += size[i];
     }
+
+    mHierarchyChanged = false;
 }
 
 // Inserts a parentless node in the hierarchy
@@ -255,6 +398,7 @@ void FTransformManager::insertNode(Instance i, Instance parent) noexcept {
 
     assert_invariant(manager[i].parent == Instance{});
 
+    mHierarchyChanged = true;
     manager[i].parent = parent;
     manager[i].prev = 0;
     manager[i].next = 0;
@@ -285,6 +429,7 @@ void FTransformManager::swapNode(Instance i, Instance j) noexcept {
     std::swap(manager.elementAt<LOCAL_LO>(i), manager.elementAt<LOCAL_LO>(j));
     std::swap(manager.elementAt<WORLD>(i),    manager.elementAt<WORLD>(j));
     std::swap(manager.elementAt<WORLD_LO>(i), manager.elementAt<WORLD_LO>(j));
+    std::swap(manager.elementAt<DIRTY>(i),    manager.elementAt<DIRTY>(j));
     manager.swap(i, j); // this swaps the data relative to SingleInstanceComponentManager
 
     // now swap the linked-list references, to do that correctly we must use a temporary
@@ -332,6 +477,8 @@ void FTransformManager::removeNode(Instance i) noexcept {
         manager[next].prev = prev;
     }
 
+    mHierarchyChanged = true;
+
 #ifndef NDEBUG
     // we no longer have a parent or siblings. we don't really have to clear those fields
     // so we only do it in DEBUG mode
@@ -393,6 +540,24 @@ void FTransformManager::transformChildren(Sim& manager, Instance i) noexcept {
     }
 }
 
+void FTransformManager::transformRange(Sim& manager, Instance first, size_t count) noexcept {
+    const bool accurate = mAccurateTranslations;
+    for (Instance i = first, e = Instance(first + count); i != e; ++i) {
+        // Nodes are sorted depth-first, so our parent has been processed already. We need to
+        // update our world transform if our local transform changed or if our parent's did.
+        Instance const parent = manager[i].parent;
+        assert_invariant(parent < i);
+        if (manager[i].dirty || manager[parent].dirty) {
+            manager[i].dirty = true;
+            FTransformManager::computeWorldTransform(
+                    manager[i].world, manager[i].worldTranslationLo,
+                    manager[parent].world, manager[i].local,
+                    manager[parent].worldTranslationLo, manager[i].localTranslationLo,
+                    accurate);
+        }
+    }
+}
+
 void FTransformManager::computeWorldTransform(
         mat4f& UTILS_RESTRICT outWorld,
         float3& UTILS_RESTRICT inoutWorldTranslationLo,
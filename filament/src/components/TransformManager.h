@@ -28,6 +28,15 @@
 
 #include <math/mat4.h>
 
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
 namespace filament {
 
 class UTILS_PRIVATE FTransformManager : public TransformManager {
@@ -35,6 +44,8 @@ public:
     using Instance = TransformManager::Instance;
 
     FTransformManager() noexcept;
+    // when a JobSystem is provided, world transforms are computed in parallel when possible
+    explicit FTransformManager(utils::JobSystem& js) noexcept;
     ~FTransformManager() noexcept;
 
     // free-up all resources
@@ -143,8 +154,10 @@ private:
     void insertNode(Instance i, Instance p) noexcept;
     void swapNode(Instance i, Instance j) noexcept;
     void transformChildren(Sim& manager, Instance firstChild) noexcept;
+    void transformRange(Sim& manager, Instance first, size_t count) noexcept;
 
-    void computeAllWorldTransforms() noexcept;
+    void sortDepthFirst() noexcept;
+    void computeDirtyWorldTransforms() noexcept;
 
     static void computeWorldTransform(math::mat4f& outWorld, math::float3& inoutWorldTranslationLo,
             math::mat4f const& pt, math::mat4f const& local,
@@ -162,6 +175,7 @@ private:
         FIRST_CHILD,    // instance to our first child
         NEXT,           // instance to our next sibling
         PREV,           // instance to our previous sibling
+        DIRTY,          // local transform changed during a transaction
     };
 
     using Base = utils::SingleInstanceComponentManager<
@@ -172,7 +186,8 @@ private:
             Instance,       // parent
             Instance,       // firstChild
             Instance,       // next
-            Instance        // prev
+            Instance,       // prev
+            bool            // dirty
     >;
 
     struct Sim : public Base {
@@ -197,6 +212,7 @@ private:
                 Field<FIRST_CHILD>  firstChild;
                 Field<NEXT>         next;
                 Field<PREV>         prev;
+                Field<DIRTY>        dirty;
             };
         };
 
@@ -208,9 +224,22 @@ private:
         }
     };
 
+    // A range of nodes in depth-first order, i.e. one or several whole subtrees
+    struct Range {
+        Instance first;
+        uint32_t count;
+    };
+
     Sim mManager;
+    utils::JobSystem* mJobSystem = nullptr;
+    // nodes above the ranges below, these are processed serially in order
+    std::vector<Instance> mTrunk;
+    // independent subtrees, processed in parallel
+    std::vector<Range> mRanges;
     bool mLocalTransformTransactionOpen = false;
     bool mAccurateTranslations = false;
+    bool mHierarchyChanged = true;      // mManager needs to be sorted depth-first
+    bool mHasDirtyNodes = false;
 };
 
 FILAMENT_DOWNCAST(TransformManager)
@@ -40,6 +40,8 @@
 
 #include <private/backend/PlatformFactory.h>
 
+#include <private/filament/UibStructs.h>
+
 #include <backend/DriverEnums.h>
 
 #include <utils/compiler.h>
@@ -52,6 +54,12 @@
 
 #include <algorithm>
 #include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <inttypes.h>
+#include <stdio.h>
 
 #include "generated/resources/materials.h"
 
@@ -195,7 +203,7 @@ FEngine::FEngine(Engine::Builder const& builder) :
         mPostProcessManager(*this),
         mEntityManager(EntityManager::get()),
         mRenderableManager(*this),
-        mTransformManager(),
+        mTransformManager(mJobSystem),
         mLightManager(*this),
         mCameraManager(*this),
         mCommandBufferQueue(
@@ -254,6 +262,10 @@ void FEngine::init() {
     slog.i << "Backend feature level: " << int(driverApi.getFeatureLevel()) << io::endl;
     slog.i << "FEngine feature level: " << int(mActiveFeatureLevel) << io::endl;
 
+    // the lights UBO must fit in the maximum UBO size
+    mMaxLightCount = std::min(CONFIG_MAX_LIGHT_COUNT,
+            driverApi.getMaxUniformBufferSize() / sizeof(LightsUib));
+
 
     mResourceAllocator = new ResourceAllocator(mConfig, driverApi);
 
@@ -390,6 +402,12 @@ void FEngine::init() {
                 });
             });
 
+    mDebugRegistry.registerProperty("d.instancing.draw_calls_saved",
+            &debug.instancing.draw_calls_saved);
+
+    mDebugRegistry.registerProperty("d.instancing.instanced_draw_calls",
+            &debug.instancing.instanced_draw_calls);
+
     mDebugRegistry.registerProperty("d.lighting.debug_froxel_visualization",
             &debug.lighting.debug_froxel_visualization, [this]() {
                 mMaterials.forEach([this](FMaterial* material) {
@@ -688,7 +706,170 @@ int FEngine::loop() {
     return 0;
 }
 
+void FEngine::setCommandStreamProfilingEnabled(bool enable) {
+    if (enable == mCommandStreamProfilingEnabled) {
+        return;
+    }
+    if (enable) {
+        if (!mCommandStreamProfiler) {
+            mCommandStreamProfiler = std::make_unique<CommandStreamProfiler>(
+                    getDriver().getDispatcher());
+        } else {
+            mCommandStreamProfiler->reset();
+        }
+    }
+    getDriverApi().setProfiler(enable ? mCommandStreamProfiler.get() : nullptr);
+    mCommandStreamProfilingEnabled = enable;
+}
+
+void FEngine::writeCommandStreamHistogram(utils::io::ostream& out) const {
+    if (mCommandStreamProfiler) {
+        mCommandStreamProfiler->writeHistogram(out);
+    }
+}
+
+void FEngine::writeCommandStreamTrace(utils::io::ostream& out) const {
+    if (mCommandStreamProfiler) {
+        mCommandStreamProfiler->writeChromeTrace(out);
+    }
+}
+
+// The manifest is a text file, after the header each line describes one material:
+//   <cache id, 16 hex digits> <variant keys, 2 hex digits each> <material name>
+// Variants are listed in the order they were first used. The name is only informative.
+static constexpr std::string_view MATERIAL_VARIANT_MANIFEST_HEADER = "filament-variants 1";
+
+void FEngine::writeMaterialVariantManifest(utils::io::ostream& out) const {
+    std::vector<FMaterial const*> materials;
+    mMaterials.forEach([&materials](FMaterial const* material) {
+        // materials without a cache id can't be identified in the next run
+        if (material->getCacheId() && !material->getUsedVariants().empty()) {
+            materials.push_back(material);
+        }
+    });
+
+    // the output only depends on the materials used, not on the order they were created
+    std::sort(materials.begin(), materials.end(), [](FMaterial const* lhs, FMaterial const* rhs) {
+        return lhs->getCacheId() < rhs->getCacheId();
+    });
+
+    out << MATERIAL_VARIANT_MANIFEST_HEADER.data() << io::endl;
+    for (FMaterial const* material : materials) {
+        char id[17];
+        snprintf(id, sizeof(id), "%016" PRIx64, material->getCacheId());
+        out << id << ' ';
+        for (Variant const variant : material->getUsedVariants()) {
+            char key[3];
+            snprintf(key, sizeof(key), "%02x", unsigned(variant.key));
+            out << key;
+        }
+        out << ' ' << material->getName().c_str_safe() << io::endl;
+    }
+}
+
+bool FEngine::loadMaterialVariantManifest(const void* data, size_t size) {
+    auto const hexDigit = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    // parses exactly `count` hex digits at the start of `str`
+    auto const parseHex = [&hexDigit](std::string_view str, size_t count, uint64_t* value) {
+        if (str.size() < count) {
+            return false;
+        }
+        uint64_t v = 0;
+        for (size_t i = 0; i < count; i++) {
+            int const d = hexDigit(str[i]);
+            if (d < 0) {
+                return false;
+            }
+            v = (v << 4) | uint64_t(d);
+        }
+        *value = v;
+        return true;
+    };
+
+    std::string_view text(static_cast<const char*>(data), size);
+    auto const nextLine = [&text]() {
+        size_t const eol = std::min(text.find('\n'), text.size());
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(std::min(eol + 1, text.size()));
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        return line;
+    };
+
+    if (nextLine() != MATERIAL_VARIANT_MANIFEST_HEADER) {
+        slog.w << "Invalid material variant manifest" << io::endl;
+        return false;
+    }
+
+    std::unordered_map<uint64_t, std::vector<Variant>> manifest;
+    while (!text.empty()) {
+        std::string_view line = nextLine();
+        if (line.empty()) {
+            continue;
+        }
+        uint64_t cacheId;
+        if (!parseHex(line, 16, &cacheId) || line.size() < 17 || line[16] != ' ') {
+            slog.w << "Invalid material variant manifest entry" << io::endl;
+            return false;
+        }
+        line.remove_prefix(17);
+        std::vector<Variant>& variants = manifest[cacheId];
+        uint64_t key;
+        while (parseHex(line, 2, &key)) {
+            variants.emplace_back(Variant::type_t(key));
+            line.remove_prefix(2);
+        }
+    }
+
+    mMaterialVariantManifest = std::move(manifest);
+
+    // materials that already exist are compiled right away, the others when they're created
+    mMaterials.forEach([this](FMaterial* material) {
+        compileManifestVariants(material);
+    });
+    return true;
+}
+
+void FEngine::setResourceAllocatorCacheBudget(size_t budget) noexcept {
+    getResourceAllocator().setCacheCapacity(budget);
+}
+
+size_t FEngine::getResourceAllocatorCacheBudget() const noexcept {
+    assert_invariant(mResourceAllocator);
+    return mResourceAllocator->getCacheCapacity();
+}
+
+Engine::ResourceAllocatorStats FEngine::getResourceAllocatorStats() const noexcept {
+    assert_invariant(mResourceAllocator);
+    return mResourceAllocator->getStats();
+}
+
+void FEngine::compileManifestVariants(FMaterial* material) noexcept {
+    if (UTILS_LIKELY(mMaterialVariantManifest.empty())) {
+        return;
+    }
+    auto const pos = mMaterialVariantManifest.find(material->getCacheId());
+    if (pos != mMaterialVariantManifest.end()) {
+        auto const& variants = pos->second;
+        material->compileVariants({ variants.data(), variants.size() },
+                CompilerPriorityQueue::HIGH);
+    }
+}
+
 void FEngine::flushCommandBuffer(CommandBufferQueue& commandQueue) {
+    if (UTILS_UNLIKELY(mFlushCallback)) {
+        mFlushCallback();
+    }
+    // commands recorded from other threads must be complete before they're handed to the driver
+    ASSERT_PRECONDITION(!getDriverApi().getPendingReservationCount(),
+            "All SecondaryCommandStreams must be finished before flushing the CommandStream");
     getDriver().purge();
     commandQueue.flush();
 }
@@ -752,7 +933,11 @@ FIndirectLight* FEngine::createIndirectLight(const IndirectLight::Builder& build
 }
 
 FMaterial* FEngine::createMaterial(const Material::Builder& builder) noexcept {
-    return create(mMaterials, builder);
+    FMaterial* const material = create(mMaterials, builder);
+    if (material) {
+        compileManifestVariants(material);
+    }
+    return material;
 }
 
 FSkybox* FEngine::createSkybox(const Skybox::Builder& builder) noexcept {
@@ -44,10 +44,12 @@
 
 #include "private/backend/CommandBufferQueue.h"
 #include "private/backend/CommandStream.h"
+#include "private/backend/CommandStreamProfiler.h"
 #include "private/backend/DriverApi.h"
 
 #include <private/filament/EngineEnums.h>
 #include <private/filament/BufferInterfaceBlock.h>
+#include <private/filament/Variant.h>
 
 #include <filament/ColorGrading.h>
 #include <filament/Engine.h>
@@ -65,12 +67,14 @@
 #include <utils/CountDownLatch.h>
 
 #include <chrono>
+#include <functional>
 #include <memory>
 #include <new>
 #include <random>
 #include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #if FILAMENT_ENABLE_MATDBG
 #include <matdbg/DebugServer.h>
@@ -183,6 +187,11 @@ public:
         return CONFIG_MAX_INSTANCES;
     }
 
+    // maximum number of point and spot lights, this depends on the maximum UBO size
+    size_t getMaxLightCount() const noexcept {
+        return mMaxLightCount;
+    }
+
     bool isStereoSupported(StereoscopicType stereoscopicType) const noexcept {
         return getDriver().isStereoSupported(stereoscopicType);
     }
@@ -345,6 +354,12 @@ public:
     // flush the current buffer
     void flush();
 
+    // Sets a function called on this thread before the commands are handed to the driver, e.g.
+    // to finish the SecondaryCommandStreams recorded by other threads, or nullptr.
+    void setFlushCallback(std::function<void()> callback) noexcept {
+        mFlushCallback = std::move(callback);
+    }
+
     // flush the current buffer based on some heuristics
     void flushIfNeeded() {
         auto counter = mFlushCounter + 1;
@@ -406,6 +421,58 @@ public:
         return mAutomaticInstancingEnabled;
     }
 
+    // Changes to renderables and material instances that affect the commands generated for
+    // them are stamped with a new version, so that RenderPass::CommandCache can find the
+    // renderables that changed since it was last updated.
+    uint64_t getRenderStateVersion() const noexcept {
+        return mRenderStateVersion;
+    }
+
+    uint64_t nextRenderStateVersion() noexcept {
+        return ++mRenderStateVersion;
+    }
+
+    // stamps a change to the state of a material instance
+    uint64_t materialInstanceChanged() noexcept {
+        return mMaterialInstanceVersion = nextRenderStateVersion();
+    }
+
+    // version of the last change to any material instance
+    uint64_t getMaterialInstanceVersion() const noexcept {
+        return mMaterialInstanceVersion;
+    }
+
+    // stamps the destruction of some material programs
+    void programsInvalidated() noexcept {
+        mProgramVersion = nextRenderStateVersion();
+    }
+
+    // version of the last destruction of material programs
+    uint64_t getProgramVersion() const noexcept {
+        return mProgramVersion;
+    }
+
+    void setCommandStreamProfilingEnabled(bool enable);
+
+    bool isCommandStreamProfilingEnabled() const noexcept {
+        return mCommandStreamProfilingEnabled;
+    }
+
+    // the command stream profiler, or nullptr if profiling was never enabled
+    backend::CommandStreamProfiler const* getCommandStreamProfiler() const noexcept {
+        return mCommandStreamProfiler.get();
+    }
+
+    void writeCommandStreamHistogram(utils::io::ostream& out) const;
+    void writeCommandStreamTrace(utils::io::ostream& out) const;
+
+    void writeMaterialVariantManifest(utils::io::ostream& out) const;
+    bool loadMaterialVariantManifest(const void* data, size_t size);
+
+    void setResourceAllocatorCacheBudget(size_t budget) noexcept;
+    size_t getResourceAllocatorCacheBudget() const noexcept;
+    ResourceAllocatorStats getResourceAllocatorStats() const noexcept;
+
     HwVertexBufferInfoFactory& getVertexBufferInfoFactory() noexcept {
         return mHwVertexBufferInfoFactory;
     }
@@ -453,6 +520,9 @@ private:
     template<typename T>
     void cleanupResourceList(ResourceList<T>&& list);
 
+    // compiles the variants listed for this material in the manifest, if any
+    void compileManifestVariants(FMaterial* material) noexcept;
+
     template<typename T, typename Lock>
     void cleanupResourceListLocked(Lock& lock, ResourceList<T>&& list);
 
@@ -461,9 +531,14 @@ private:
 
     Backend mBackend;
     FeatureLevel mActiveFeatureLevel = FeatureLevel::FEATURE_LEVEL_1;
+    size_t mMaxLightCount = 0;
     Platform* mPlatform = nullptr;
     bool mOwnPlatform = false;
     bool mAutomaticInstancingEnabled = false;
+    bool mCommandStreamProfilingEnabled = false;
+    uint64_t mRenderStateVersion = 0;
+    uint64_t mMaterialInstanceVersion = 0;
+    uint64_t mProgramVersion = 0;
     void* mSharedGLContext = nullptr;
     backend::Handle<backend::HwRenderPrimitive> mFullScreenTriangleRph;
     FVertexBuffer* mFullScreenTriangleVb = nullptr;
@@ -504,6 +579,9 @@ private:
 
     mutable uint32_t mMaterialId = 0;
 
+    // variants to compile when a material is created, keyed by the material's cache id
+    std::unordered_map<uint64_t, std::vector<Variant>> mMaterialVariantManifest;
+
     // FMaterialInstance are handled directly by FMaterial
     std::unordered_map<const FMaterial*, ResourceList<FMaterialInstance>> mMaterialInstances;
 
@@ -511,10 +589,13 @@ private:
 
     std::thread mDriverThread;
     backend::CommandBufferQueue mCommandBufferQueue;
+    // must outlive the CommandStream
+    std::unique_ptr<backend::CommandStreamProfiler> mCommandStreamProfiler;
     std::aligned_storage<sizeof(DriverApi), alignof(DriverApi)>::type mDriverApiStorage;
     static_assert( sizeof(mDriverApiStorage) >= sizeof(DriverApi) );
 
     uint32_t mFlushCounter = 0;
+    std::function<void()> mFlushCallback;
 
     RootArenaScope::Arena mPerRenderPassArena;
     HeapAllocatorArena mHeapAllocator;
@@ -588,6 +669,12 @@ public:
         struct {
             bool debug_froxel_visualization = false;
         } lighting;
+        struct {
+            // Automatic instancing statistics for the current frame, these are reset by
+            // Renderer::beginFrame().
+            int draw_calls_saved = 0;       // draw calls merged into instanced draws
+            int instanced_draw_calls = 0;   // instanced draws created
+        } instancing;
         matdbg::DebugServer* server = nullptr;
     } debug;
 };
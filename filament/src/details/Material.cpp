@@ -240,6 +240,11 @@ FMaterial::FMaterial(FEngine& engine, const Material::Builder& builder)
             FROXEL_BUFFER_MAX_ENTRY_COUNT / 4,
             engine.getDriverApi().getMaxUniformBufferSize() / 16u);
 
+    // this must match Froxelizer's record buffer
+    int const maxFroxelRecordBufferHeight = std::min(
+            FROXEL_RECORD_BUFFER_MAX_HEIGHT,
+            engine.getDriverApi().getMaxUniformBufferSize() / 16u);
+
     bool const staticTextureWorkaround =
             engine.getDriverApi().isWorkaroundNeeded(Workaround::A8X_STATIC_TEXTURE_TARGET_ERROR);
 
@@ -256,6 +261,12 @@ FMaterial::FMaterial(FEngine& engine, const Material::Builder& builder)
     mSpecializationConstants.push_back({
                     +ReservedSpecializationConstants::CONFIG_FROXEL_BUFFER_HEIGHT,
                     (int)maxFroxelBufferHeight });
+    mSpecializationConstants.push_back({
+                    +ReservedSpecializationConstants::CONFIG_MAX_LIGHT_COUNT,
+                    (int)engine.getMaxLightCount() });
+    mSpecializationConstants.push_back({
+                    +ReservedSpecializationConstants::CONFIG_FROXEL_RECORD_BUFFER_HEIGHT,
+                    (int)maxFroxelRecordBufferHeight });
     mSpecializationConstants.push_back({
                     +ReservedSpecializationConstants::CONFIG_DEBUG_DIRECTIONAL_SHADOWMAP,
                     engine.debug.shadowmap.debug_directional_shadowmap });
@@ -432,10 +443,16 @@ FMaterial::FMaterial(FEngine& engine, const Material::Builder& builder)
             FMaterial const* const pDefaultMaterial = engine.getDefaultMaterial();
             auto& cachedPrograms = mCachedPrograms;
             for (Variant const variant: pDefaultMaterial->mDepthVariants) {
-                pDefaultMaterial->prepareProgram(variant);
+                pDefaultMaterial->cacheProgram(variant, CompilerPriorityQueue::HIGH);
                 cachedPrograms[variant.key] = pDefaultMaterial->getProgram(variant);
             }
         }
+
+        // Materials compiled without the velocity variant (e.g. because the VSM variant was
+        // filtered out) don't render motion vectors.
+        mHasVelocityVariant = (mIsDefaultMaterial || mHasCustomDepthShader) ?
+                hasVariant(Variant{ Variant::SPECIAL_VELOCITY }) :
+                engine.getDefaultMaterial()->hasVelocityVariant();
     }
 
     bool colorWrite = false;
@@ -468,6 +485,7 @@ FMaterial::~FMaterial() noexcept {
 }
 
 void FMaterial::invalidate(Variant::type_t variantMask, Variant::type_t variantValue) noexcept {
+    mEngine.programsInvalidated();
     if (mMaterialDomain == MaterialDomain::SURFACE) {
         DriverApi& driverApi = mEngine.getDriverApi();
         auto& cachedPrograms = mCachedPrograms;
@@ -492,7 +510,7 @@ void FMaterial::invalidate(Variant::type_t variantMask, Variant::type_t variantV
          if (UTILS_UNLIKELY(!mIsDefaultMaterial && !mHasCustomDepthShader)) {
             FMaterial const* const pDefaultMaterial = mEngine.getDefaultMaterial();
             for (Variant const variant: pDefaultMaterial->mDepthVariants) {
-                pDefaultMaterial->prepareProgram(variant);
+                pDefaultMaterial->cacheProgram(variant, CompilerPriorityQueue::HIGH);
                 if (!cachedPrograms[variant.key]) {
                     cachedPrograms[variant.key] = pDefaultMaterial->getProgram(variant);
                 }
@@ -546,7 +564,7 @@ void FMaterial::compile(CompilerPriorityQueue priority,
         for (auto const variant: variants) {
             if (!variantFilter || variant == Variant::filterUserVariant(variant, variantFilter)) {
                 if (hasVariant(variant)) {
-                    prepareProgram(variant, priority);
+                    cacheProgram(variant, priority);
                 }
             }
         }
@@ -569,6 +587,28 @@ void FMaterial::compile(CompilerPriorityQueue priority,
     }
 }
 
+void FMaterial::compileVariants(Slice<const Variant> variants,
+        CompilerPriorityQueue priorityQueue) noexcept {
+    for (Variant const variant : variants) {
+        if (getMaterialDomain() == MaterialDomain::SURFACE) {
+            // the variants may come from a different version of this material
+            if (variant != Variant::filterVariant(variant, isVariantLit()) ||
+                    Variant::isReserved(variant)) {
+                continue;
+            }
+        }
+        if (hasVariant(variant)) {
+            cacheProgram(variant, priorityQueue);
+        }
+    }
+}
+
+void FMaterial::recordVariantUsage(Variant variant) const noexcept {
+    assert_invariant(mUsedVariantCount < VARIANT_COUNT);
+    mUsedVariants.set(variant.key);
+    mUsedVariantOrder[mUsedVariantCount++] = variant;
+}
+
 FMaterialInstance* FMaterial::createInstance(const char* name) const noexcept {
     return FMaterialInstance::duplicate(&mDefaultInstance, name);
 }
@@ -820,6 +860,7 @@ void FMaterial::onQueryCallback(void* userdata, VariantList* pVariants) {
 /** @}*/
 
 void FMaterial::destroyPrograms(FEngine& engine) {
+    engine.programsInvalidated();
     DriverApi& driverApi = engine.getDriverApi();
     auto& cachedPrograms = mCachedPrograms;
     for (size_t k = 0, n = VARIANT_COUNT; k < n; ++k) {
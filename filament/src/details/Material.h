@@ -31,6 +31,7 @@
 
 #include <utils/compiler.h>
 #include <utils/Mutex.h>
+#include <utils/Slice.h>
 
 #include <atomic>
 #include <optional>
@@ -95,11 +96,23 @@ public:
     void prepareProgram(Variant variant,
             backend::CompilerPriorityQueue priorityQueue = CompilerPriorityQueue::HIGH) const noexcept {
         // prepareProgram() is called for each RenderPrimitive in the scene, so it must be efficient.
-        if (UTILS_UNLIKELY(!isCached(variant))) {
-            prepareProgramSlow(variant, priorityQueue);
+        if (UTILS_UNLIKELY(!mUsedVariants[variant.key])) {
+            recordVariantUsage(variant);
         }
+        cacheProgram(variant, priorityQueue);
+    }
+
+    // Variants used by this material so far (i.e. passed to prepareProgram()), in the order
+    // they were first used.
+    utils::Slice<const Variant> getUsedVariants() const noexcept {
+        return { mUsedVariantOrder.data(), mUsedVariantCount };
     }
 
+    // Creates the programs of the given variants ahead of their first use, in the given order.
+    // Variants this material doesn't have are ignored. This doesn't mark the variants as used.
+    void compileVariants(utils::Slice<const Variant> variants,
+            backend::CompilerPriorityQueue priorityQueue) noexcept;
+
     // getProgram returns the backend program for the material's given variant.
     // Must be called after prepareProgram().
     [[nodiscard]] backend::Handle<backend::HwProgram> getProgram(Variant variant) const noexcept {
@@ -119,6 +132,7 @@ public:
     backend::FeatureLevel getFeatureLevel() const noexcept { return mFeatureLevel; }
     backend::RasterState getRasterState() const noexcept  { return mRasterState; }
     uint32_t getId() const noexcept { return mMaterialId; }
+    uint64_t getCacheId() const noexcept { return mCacheId; }
 
     UserVariantFilterMask getSupportedVariants() const noexcept {
         return UserVariantFilterMask(UserVariantFilterBit::ALL) & ~mVariantFilterMask;
@@ -142,6 +156,7 @@ public:
     bool isAlphaToCoverageEnabled() const noexcept { return mRasterState.alphaToCoverage; }
     float getMaskThreshold() const noexcept { return mMaskThreshold; }
     bool hasShadowMultiplier() const noexcept { return mHasShadowMultiplier; }
+    bool hasVelocityVariant() const noexcept { return mHasVelocityVariant; }
     AttributeBitset getRequiredAttributes() const noexcept { return mRequiredAttributes; }
     RefractionMode getRefractionMode() const noexcept { return mRefractionMode; }
     RefractionType getRefractionType() const noexcept { return mRefractionType; }
@@ -208,6 +223,15 @@ public:
 
 private:
     bool hasVariant(Variant variant) const noexcept;
+
+    // same as prepareProgram(), but the variant isn't recorded as used
+    void cacheProgram(Variant variant, CompilerPriorityQueue priorityQueue) const noexcept {
+        if (UTILS_UNLIKELY(!isCached(variant))) {
+            prepareProgramSlow(variant, priorityQueue);
+        }
+    }
+
+    void recordVariantUsage(Variant variant) const noexcept;
     void prepareProgramSlow(Variant variant,
             CompilerPriorityQueue priorityQueue) const noexcept;
     void getSurfaceProgramSlow(Variant variant,
@@ -222,6 +246,11 @@ private:
     // try to order by frequency of use
     mutable std::array<backend::Handle<backend::HwProgram>, VARIANT_COUNT> mCachedPrograms;
 
+    // variants used so far, see getUsedVariants()
+    mutable VariantList mUsedVariants;
+    mutable std::array<Variant, VARIANT_COUNT> mUsedVariantOrder;
+    mutable uint32_t mUsedVariantCount = 0;
+
     backend::RasterState mRasterState;
     BlendingMode mRenderBlendingMode = BlendingMode::OPAQUE;
     TransparencyMode mTransparencyMode = TransparencyMode::DEFAULT;
@@ -250,6 +279,7 @@ private:
     bool mHasShadowMultiplier = false;
     bool mHasCustomDepthShader = false;
     bool mIsDefaultMaterial = false;
+    bool mHasVelocityVariant = false;
     bool mSpecularAntiAliasing = false;
 
     FMaterialInstance mDefaultInstance;
@@ -94,6 +94,8 @@ FMaterialInstance::FMaterialInstance(FEngine& engine,
 
     mMaterialSortingKey = RenderPass::makeMaterialSortingKey(
             material->getId(), material->generateMaterialInstanceId());
+
+    renderStateChanged();
 }
 
 FMaterialInstance* FMaterialInstance::duplicate(
@@ -137,6 +139,8 @@ void FMaterialInstance::initDefaultInstance(FEngine& engine, FMaterial const* ma
     mMaterialSortingKey = RenderPass::makeMaterialSortingKey(
             material->getId(), material->generateMaterialInstanceId());
 
+    renderStateChanged();
+
     if (material->getBlendingMode() == BlendingMode::MASKED) {
         setMaskThreshold(material->getMaskThreshold());
     }
@@ -254,10 +258,37 @@ bool FMaterialInstance::isDoubleSided() const noexcept {
 
 void FMaterialInstance::setTransparencyMode(TransparencyMode mode) noexcept {
     mTransparencyMode = mode;
+    renderStateChanged();
+}
+
+void FMaterialInstance::setCullingMode(CullingMode culling) noexcept {
+    mCulling = culling;
+    renderStateChanged();
+}
+
+void FMaterialInstance::setColorWrite(bool enable) noexcept {
+    mColorWrite = enable;
+    renderStateChanged();
+}
+
+void FMaterialInstance::setDepthWrite(bool enable) noexcept {
+    mDepthWrite = enable;
+    renderStateChanged();
+}
+
+void FMaterialInstance::setDepthFunc(RasterState::DepthFunc depthFunc) noexcept {
+    mDepthFunc = depthFunc;
+    renderStateChanged();
 }
 
 void FMaterialInstance::setDepthCulling(bool enable) noexcept {
     mDepthFunc = enable ? RasterState::DepthFunc::GE : RasterState::DepthFunc::A;
+    renderStateChanged();
+}
+
+void FMaterialInstance::renderStateChanged() noexcept {
+    // cached commands that use this material instance must be generated again
+    mRenderStateVersion = mMaterial->getEngine().materialInstanceChanged();
 }
 
 bool FMaterialInstance::isDepthCullingEnabled() const noexcept {
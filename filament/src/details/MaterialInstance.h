@@ -67,6 +67,10 @@ public:
 
     uint64_t getSortingKey() const noexcept { return mMaterialSortingKey; }
 
+    // version of the last change to the state that's used to generate commands, see
+    // FEngine::getRenderStateVersion()
+    uint64_t getRenderStateVersion() const noexcept { return mRenderStateVersion; }
+
     UniformBuffer const& getUniformBuffer() const noexcept { return mUniforms; }
     backend::SamplerGroup const& getSamplerGroup() const noexcept { return mSamplers; }
 
@@ -101,9 +105,7 @@ public:
 
     backend::RasterState::DepthFunc getDepthFunc() const noexcept { return mDepthFunc; }
 
-    void setDepthFunc(backend::RasterState::DepthFunc depthFunc) noexcept {
-        mDepthFunc = depthFunc;
-    }
+    void setDepthFunc(backend::RasterState::DepthFunc depthFunc) noexcept;
 
     void setPolygonOffset(float scale, float constant) noexcept {
         // handle reversed Z
@@ -130,11 +132,11 @@ public:
 
     void setTransparencyMode(TransparencyMode mode) noexcept;
 
-    void setCullingMode(CullingMode culling) noexcept { mCulling = culling; }
+    void setCullingMode(CullingMode culling) noexcept;
 
-    void setColorWrite(bool enable) noexcept { mColorWrite = enable; }
+    void setColorWrite(bool enable) noexcept;
 
-    void setDepthWrite(bool enable) noexcept { mDepthWrite = enable; }
+    void setDepthWrite(bool enable) noexcept;
 
     void setStencilWrite(bool enable) noexcept { mStencilState.stencilWrite = enable; }
 
@@ -236,6 +238,8 @@ private:
 
     void commitSlow(FEngine::DriverApi& driver) const;
 
+    void renderStateChanged() noexcept;
+
     // keep these grouped, they're accessed together in the render-loop
     FMaterial const* mMaterial = nullptr;
 
@@ -260,6 +264,7 @@ private:
     TransparencyMode mTransparencyMode : 2;
 
     uint64_t mMaterialSortingKey = 0;
+    uint64_t mRenderStateVersion = 0;
 
     // Scissor rectangle is specified as: Left Bottom Width Height.
     backend::Viewport mScissorRect = { 0, 0,
@@ -248,6 +248,9 @@ bool FRenderer::beginFrame(FSwapChain* swapChain, uint64_t vsyncSteadyClockTimeN
         driver.startCapture();
     }
 
+    // automatic instancing statistics are per-frame
+    engine.debug.instancing = {};
+
     // latch the frame time
     std::chrono::duration<double> const time(appVsync - mUserEpoch);
     float const h = float(time.count());
@@ -878,6 +881,14 @@ void FRenderer::renderJob(RootArenaScope& rootArenaScope, FView& view) {
                 &cameraInfo, view.getPerViewUniforms());
     }
 
+    // --------------------------------------------------------------------------------------------
+    // velocity pass -- rendered after the TAA jitter is applied, so it matches the color pass
+
+    FrameGraphId<FrameGraphTexture> velocity;
+    if (UTILS_UNLIKELY(taaOptions.enabled && taaOptions.motionVectors)) {
+        velocity = ppm.velocity(fg, passBuilder, renderFlags, svp.width, svp.height);
+    }
+
     // --------------------------------------------------------------------------------------------
     // SSAO pass
 
@@ -952,6 +963,7 @@ void FRenderer::renderJob(RootArenaScope& rootArenaScope, FView& view) {
     }
 
     passBuilder.commandTypeFlags(RenderPass::CommandTypeFlags::COLOR);
+    passBuilder.commandCache(view.getCommandCache());
 
     RenderPass const pass{ passBuilder.build(engine) };
 
@@ -1055,7 +1067,8 @@ void FRenderer::renderJob(RootArenaScope& rootArenaScope, FView& view) {
 
     // TAA for color pass
     if (taaOptions.enabled) {
-        input = ppm.taa(fg, input, depth, view.getFrameHistory(), &FrameHistoryEntry::taa,
+        input = ppm.taa(fg, input, depth, velocity,
+                view.getFrameHistory(), &FrameHistoryEntry::taa,
                 taaOptions, colorGradingConfig);
         if (taaOptions.upscaling) {
             scale = 1.0f;
@@ -1193,7 +1206,7 @@ void FRenderer::renderJob(RootArenaScope& rootArenaScope, FView& view) {
 
     //fg.export_graphviz(slog.d, view.getName());
 
-    fg.execute(driver);
+    fg.execute(driver, &engine);
 
     // save the current history entry and destroy the oldest entry
     view.commitFrameHistory(engine);
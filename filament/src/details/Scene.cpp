@@ -170,8 +170,17 @@ void FScene::prepare(utils::JobSystem& js,
      * Fill the SoA with the JobSystem
      */
 
+    // The culling hierarchy is updated incrementally from the world AABBs computed below. It
+    // refers to renderables by their index in the SoA, so it's only valid until the SoA is
+    // reordered.
+    CullingHierarchy* const hierarchy =
+            mHierarchicalCullingEnabled ? &mCullingHierarchy : nullptr;
+    if (hierarchy) {
+        hierarchy->beginUpdate(renderableInstances.size());
+    }
+
     auto renderableWork = [first = renderableInstances.data(), &rcm, &tcm, &worldTransform,
-                 &sceneData, shadowReceiversAreCasters](auto* p, auto c) {
+                 &sceneData, shadowReceiversAreCasters, hierarchy](auto* p, auto c) {
         SYSTRACE_NAME("renderableWork");
 
         for (size_t i = 0; i < c; i++) {
@@ -215,6 +224,11 @@ void FScene::prepare(utils::JobSystem& js,
             sceneData.elementAt<SUMMED_PRIMITIVE_COUNT>(index) = 0;
             //sceneData.elementAt<UBO>(index)                 = {}; // not needed here
             sceneData.elementAt<USER_DATA>(index)           = scale;
+
+            if (hierarchy) {
+                hierarchy->updatePrimitive(rcm.getEntity(ri).getId(), uint32_t(index),
+                        worldAABB.center, worldAABB.halfExtent);
+            }
         }
     };
 
@@ -324,6 +338,10 @@ void FScene::prepare(utils::JobSystem& js,
     js.runAndWait(rootJob);
 
     SYSTRACE_NAME_END();
+
+    if (hierarchy) {
+        hierarchy->endUpdate();
+    }
 }
 
 void FScene::prepareVisibleRenderables(Range<uint32_t> visibleRenderables) noexcept {
@@ -556,6 +574,13 @@ void FScene::removeEntities(const Entity* entities, size_t count) {
     }
 }
 
+void FScene::setHierarchicalCullingEnabled(bool enabled) noexcept {
+    mHierarchicalCullingEnabled = enabled;
+    if (!enabled) {
+        mCullingHierarchy.clear();
+    }
+}
+
 UTILS_NOINLINE
 size_t FScene::getRenderableCount() const noexcept {
     FEngine& engine = mEngine;
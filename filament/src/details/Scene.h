@@ -21,6 +21,7 @@
 
 #include "Allocators.h"
 #include "Culler.h"
+#include "CullingHierarchy.h"
 
 #include "components/LightManager.h"
 #include "components/RenderableManager.h"
@@ -191,6 +192,12 @@ public:
 
     bool hasContactShadows() const noexcept;
 
+    // Returns the culling hierarchy matching the current RenderableSoa, or nullptr if
+    // hierarchical culling is disabled. Only valid until the RenderableSoa is reordered.
+    CullingHierarchy const* getCullingHierarchy() const noexcept {
+        return mHierarchicalCullingEnabled ? &mCullingHierarchy : nullptr;
+    }
+
 private:
     friend class Scene;
     void setSkybox(FSkybox* skybox) noexcept;
@@ -203,6 +210,8 @@ private:
     size_t getRenderableCount() const noexcept;
     size_t getLightCount() const noexcept;
     bool hasEntity(utils::Entity entity) const noexcept;
+    void setHierarchicalCullingEnabled(bool enabled) noexcept;
+    bool isHierarchicalCullingEnabled() const noexcept { return mHierarchicalCullingEnabled; }
     void forEach(utils::Invocable<void(utils::Entity)>&& functor) const noexcept;
 
     static inline void computeLightRanges(math::float2* zrange,
@@ -230,6 +239,10 @@ private:
     LightSoa mLightData;
     backend::Handle<backend::HwBufferObject> mRenderableViewUbh; // This is actually owned by the view.
     bool mHasContactShadows = false;
+    bool mHierarchicalCullingEnabled = false;
+
+    // bounding volume hierarchy of the renderables world AABBs, persists across frames
+    CullingHierarchy mCullingHierarchy;
 
     // State shared between Scene and driver callbacks.
     struct SharedState {
@@ -95,7 +95,7 @@ FView::FView(FEngine& engine)
 #endif
 
     // allocate UBOs
-    mLightUbh = driver.createBufferObject(CONFIG_MAX_LIGHT_COUNT * sizeof(LightsUib),
+    mLightUbh = driver.createBufferObject(engine.getMaxLightCount() * sizeof(LightsUib),
             BufferObjectBinding::UNIFORM, BufferUsage::DYNAMIC);
 
     mIsDynamicResolutionSupported = driver.isFrameTimeSupported();
@@ -369,7 +369,7 @@ void FView::prepareLighting(FEngine& engine, CameraInfo const& cameraInfo) noexc
         scene->prepareDynamicLights(cameraInfo, mLightUbh);
     }
 
-    // here the array of visible lights has been shrunk to CONFIG_MAX_LIGHT_COUNT
+    // here the array of visible lights has been shrunk to FEngine::getMaxLightCount()
     SYSTRACE_VALUE32("visibleLights", lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT);
 
     /*
@@ -453,11 +453,11 @@ void FView::prepare(FEngine& engine, DriverApi& driver, RootArenaScope& rootAren
      * and in particular their world-space AABB.
      */
 
-    auto getFrustum = [this, &cameraInfo]() -> Frustum {
+    auto getCullingViewProjection = [this, &cameraInfo]() -> mat4f {
         if (UTILS_LIKELY(mViewingCamera == nullptr)) {
             // In the common case when we don't have a viewing camera, cameraInfo.view is
             // already the culling view matrix
-            return Frustum{ mat4f{ highPrecisionMultiply(cameraInfo.cullingProjection, cameraInfo.view) }};
+            return mat4f{ highPrecisionMultiply(cameraInfo.cullingProjection, cameraInfo.view) };
         } else {
             // Otherwise, we need to recalculate it from the culling camera.
             // Note: it is correct to always do the math from mCullingCamera, but it hides the
@@ -465,11 +465,12 @@ void FView::prepare(FEngine& engine, DriverApi& driver, RootArenaScope& rootAren
             // This is an extremely uncommon case.
             const mat4 projection = mCullingCamera->getCullingProjectionMatrix();
             const mat4 view = inverse(cameraInfo.worldTransform * mCullingCamera->getModelMatrix());
-            return Frustum{ mat4f{ projection * view }};
+            return mat4f{ projection * view };
         }
     };
 
-    const Frustum cullingFrustum = getFrustum();
+    const mat4f cullingViewProjection = getCullingViewProjection();
+    const Frustum cullingFrustum{ cullingViewProjection };
 
     FScene* const scene = getScene();
 
@@ -503,7 +504,7 @@ void FView::prepare(FEngine& engine, DriverApi& driver, RootArenaScope& rootAren
                         (JobSystem&, JobSystem::Job*) {
                     FView::prepareVisibleLights(engine.getLightManager(),
                             { distances, distances + positionalLightCount },
-                            viewMatrix, cullingFrustum, lightData);
+                            viewMatrix, cullingFrustum, lightData, engine.getMaxLightCount());
                 }));
     }
 
@@ -525,6 +526,15 @@ void FView::prepare(FEngine& engine, DriverApi& driver, RootArenaScope& rootAren
 
         prepareVisibleRenderables(js, cullingFrustum, renderableData);
 
+        /*
+         * Occlusion culling: renderables hidden by occluders lose their VISIBLE_RENDERABLE bit
+         */
+
+        if (UTILS_UNLIKELY(isOcclusionCullingEnabled() && isFrustumCullingEnabled())) {
+            prepareOccludedRenderables(engine, cullingViewProjection,
+                    float(viewport.width) / float(viewport.height), renderableData);
+        }
+
 
         /*
          * Shadowing: compute the shadow camera and cull shadow casters
@@ -551,7 +561,8 @@ void FView::prepare(FEngine& engine, DriverApi& driver, RootArenaScope& rootAren
         if (hasDynamicLighting()) {
             auto& froxelizer = mFroxelizer;
             if (froxelizer.prepare(driver, rootArenaScope, viewport,
-                    cameraInfo.projection, cameraInfo.zn, cameraInfo.zf)) {
+                    cameraInfo.projection, cameraInfo.zn, cameraInfo.zf,
+                    lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT)) {
                 // TODO: might be more consistent to do this in prepareLighting(), but it's not
                 //       strictly necessary
                 mPerViewUniforms.prepareDynamicLights(mFroxelizer);
@@ -641,6 +652,12 @@ void FView::prepare(FEngine& engine, DriverApi& driver, RootArenaScope& rootAren
         //       e.g. could we deffer some of the prepareVisibleRenderables() to later?
         scene->prepareVisibleRenderables(merged);
 
+        if (UTILS_UNLIKELY(hasMotionVectors())) {
+            prepareMotionVectors(mFrameHistory.getPrevious().motion,
+                    mFrameHistory.getCurrent().motion,
+                    renderableData, merged, cameraInfo.worldTransform);
+        }
+
         // update those UBOs
         const size_t size = merged.size() * sizeof(PerRenderableData);
         if (size) {
@@ -769,6 +786,16 @@ void FView::prepareUpscaler(float2 scale,
 void FView::prepareCamera(FEngine& engine, const CameraInfo& cameraInfo) const noexcept {
     SYSTRACE_CALL();
     mPerViewUniforms.prepareCamera(engine, cameraInfo);
+
+    if (UTILS_UNLIKELY(hasMotionVectors())) {
+        // The previous frame's projection is recorded by PostProcessManager::prepareTaa() before
+        // it's jittered. Without history, the camera is assumed not to move.
+        auto const& previous = mFrameHistory.getPrevious().taa;
+        mat4 const previousClipFromUserWorld = previous.color.handle ?
+                previous.projection : cameraInfo.projection * cameraInfo.getUserViewMatrix();
+        mPerViewUniforms.prepareMotionVectors(
+                mat4f{ previousClipFromUserWorld * inverse(cameraInfo.worldTransform) });
+    }
 }
 
 void FView::prepareViewport(
@@ -845,17 +872,107 @@ void FView::prepareVisibleRenderables(JobSystem& js,
         Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept {
     SYSTRACE_CALL();
     if (UTILS_LIKELY(isFrustumCullingEnabled())) {
-        FView::cullRenderables(js, renderableData, frustum, VISIBLE_RENDERABLE_BIT);
+        FView::cullRenderables(js, renderableData, getScene()->getCullingHierarchy(),
+                frustum, VISIBLE_RENDERABLE_BIT);
     } else {
         std::uninitialized_fill(renderableData.begin<FScene::VISIBLE_MASK>(),
                   renderableData.end<FScene::VISIBLE_MASK>(), VISIBLE_RENDERABLE);
     }
 }
 
+void FView::prepareOccludedRenderables(FEngine& engine,
+        mat4f const& viewProjection, float aspectRatio,
+        FScene::RenderableSoa& renderableData) const noexcept {
+    SYSTRACE_CALL();
+
+    FRenderableManager const& rcm = engine.getRenderableManager();
+    auto const* const instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* const transforms = renderableData.data<FScene::WORLD_TRANSFORM>();
+    auto const* const visibility = renderableData.data<FScene::VISIBILITY_STATE>();
+    auto const* const instancesInfo = renderableData.data<FScene::INSTANCES>();
+    uint8_t const* const layers = renderableData.data<FScene::LAYERS>();
+    Culler::result_type* const visibleMask = renderableData.data<FScene::VISIBLE_MASK>();
+    uint8_t const visibleLayers = getVisibleLayers();
+
+    OcclusionCuller& culler = *mOcclusionCuller;
+    culler.beginOccluders(viewProjection, aspectRatio);
+    for (size_t i = 0, c = renderableData.size(); i < c; i++) {
+        FRenderableManager::Visibility const v = visibility[i];
+        bool const visible = (layers[i] & visibleLayers) &&
+                (!v.culling || (visibleMask[i] & VISIBLE_RENDERABLE));
+        if (v.occluder && visible && instancesInfo[i].count <= 1) {
+            culler.rasterize(transforms[i], rcm.getAABB(instances[i]));
+        }
+    }
+    culler.endOccluders();
+
+    culler.cull(visibleMask,
+            renderableData.data<FScene::WORLD_AABB_CENTER>(),
+            renderableData.data<FScene::WORLD_AABB_EXTENT>(),
+            renderableData.size(), VISIBLE_RENDERABLE_BIT);
+}
+
+void FView::prepareMotionVectors(FrameHistoryEntry::MotionVectors const& previous,
+        FrameHistoryEntry::MotionVectors& current,
+        FScene::RenderableSoa& renderableData, Range visibleRenderables,
+        mat4 const& worldTransform) noexcept {
+    SYSTRACE_CALL();
+
+    auto const* const instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* const transforms = renderableData.data<FScene::WORLD_TRANSFORM>();
+    PerRenderableData* const uboData = renderableData.data<FScene::UBO>();
+
+    // The world transforms are relative to the world origin, which can change between frames.
+    // Everything below is expressed relative to the current one.
+    mat4 const worldFromPreviousWorld{ worldTransform * inverse(previous.worldTransform) };
+
+    current.worldTransform = worldTransform;
+    current.transforms.reserve(previous.transforms.size());
+    for (uint32_t const i : visibleRenderables) {
+        uint32_t const index = instances[i].asValue();
+        if (UTILS_UNLIKELY(index >= current.transforms.size())) {
+            current.transforms.resize(index + 1, mat4f{ 0.0f });
+        }
+        mat4f const& model = transforms[i];
+        current.transforms[index] = model;
+
+        // renderables that weren't rendered in the previous frame are assumed not to move
+        mat4f previousWorldFromWorld;
+        if (index < previous.transforms.size() && previous.transforms[index][3][3] != 0.0f) {
+            mat4 const previousModel{ worldFromPreviousWorld * mat4{ previous.transforms[index] }};
+            previousWorldFromWorld = mat4f{ previousModel * inverse(mat4{ model }) };
+        }
+        uboData[i].previousWorldFromWorldMatrix = previousWorldFromWorld;
+    }
+}
+
+void FView::setOcclusionCullingEnabled(bool enabled) noexcept {
+    if (enabled && !mOcclusionCuller) {
+        mOcclusionCuller = std::make_unique<OcclusionCuller>();
+    } else if (!enabled) {
+        mOcclusionCuller.reset();
+    }
+}
+
+void FView::setCommandCachingEnabled(bool enabled) noexcept {
+    if (enabled && !mCommandCache) {
+        mCommandCache = std::make_unique<RenderPass::CommandCache>();
+    } else if (!enabled) {
+        mCommandCache.reset();
+    }
+}
+
 void FView::cullRenderables(JobSystem&,
-        FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit) noexcept {
+        FScene::RenderableSoa& renderableData, CullingHierarchy const* hierarchy,
+        Frustum const& frustum, size_t bit) noexcept {
     SYSTRACE_CALL();
 
+    if (hierarchy) {
+        assert_invariant(hierarchy->getPrimitiveCount() == renderableData.size());
+        hierarchy->cull(renderableData.data<FScene::VISIBLE_MASK>(), frustum, bit);
+        return;
+    }
+
     float3 const* worldAABBCenter = renderableData.data<FScene::WORLD_AABB_CENTER>();
     float3 const* worldAABBExtent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
     FScene::VisibleMaskType* visibleArray = renderableData.data<FScene::VISIBLE_MASK>();
@@ -881,7 +998,7 @@ void FView::cullRenderables(JobSystem&,
 void FView::prepareVisibleLights(FLightManager const& lcm,
         utils::Slice<float> scratch,
         mat4f const& viewMatrix, Frustum const& frustum,
-        FScene::LightSoa& lightData) noexcept {
+        FScene::LightSoa& lightData, size_t maxLightCount) noexcept {
     SYSTRACE_CALL();
     assert_invariant(lightData.size() > FScene::DIRECTIONAL_LIGHTS_COUNT);
 
@@ -937,7 +1054,8 @@ void FView::prepareVisibleLights(FLightManager const& lcm,
 
 
     /*
-     * Some lights might be left out if there are more than the GPU buffer allows (i.e. 256).
+     * Some lights might be left out if there are more than the GPU buffer allows (i.e. 256 to
+     * 1024, depending on the maximum UBO size).
      *
      * We always sort lights by distance to the camera so that:
      * - we can build light trees later
@@ -965,7 +1083,7 @@ void FView::prepareVisibleLights(FLightManager const& lcm,
 
     // drop excess lights
     lightData.resize(std::min(visibleLightCount,
-            CONFIG_MAX_LIGHT_COUNT + FScene::DIRECTIONAL_LIGHTS_COUNT));
+            maxLightCount + FScene::DIRECTIONAL_LIGHTS_COUNT));
 }
 
 // These methods need to exist so clang honors the __restrict__ keyword, which in turn
@@ -1129,6 +1247,23 @@ void FView::setSoftShadowOptions(SoftShadowOptions options) noexcept {
     mSoftShadowOptions = options;
 }
 
+void FView::setShadowMapCachingOptions(ShadowMapCachingOptions options) noexcept {
+    options.cascadeThreshold = std::max(0.0f, options.cascadeThreshold);
+    mShadowMapCachingOptions = options;
+}
+
+void FView::invalidateShadowMaps() noexcept {
+    if (mShadowMapManager) {
+        mShadowMapManager->invalidateCachedShadowMaps();
+    }
+}
+
+View::ShadowMapStats FView::getShadowMapStats() const noexcept {
+    // the stats are only updated when shadow maps are rendered
+    if (!mShadowMapManager || !mNeedsShadowMap) return {};
+    return mShadowMapManager->getStats();
+}
+
 void FView::setBloomOptions(BloomOptions options) noexcept {
     options.dirtStrength = math::saturate(options.dirtStrength);
     options.resolution = math::clamp(options.resolution, 2u, 2048u);
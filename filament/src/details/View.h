@@ -27,8 +27,10 @@
 #include "FrameHistory.h"
 #include "FrameInfo.h"
 #include "Froxelizer.h"
+#include "OcclusionCuller.h"
 #include "PerViewUniforms.h"
 #include "PIDController.h"
+#include "RenderPass.h"
 #include "ShadowMap.h"
 #include "ShadowMapManager.h"
 #include "TypedUniformBuffer.h"
@@ -118,6 +120,13 @@ public:
     void setFrustumCullingEnabled(bool culling) noexcept { mCulling = culling; }
     bool isFrustumCullingEnabled() const noexcept { return mCulling; }
 
+    void setOcclusionCullingEnabled(bool enabled) noexcept;
+    bool isOcclusionCullingEnabled() const noexcept { return mOcclusionCuller != nullptr; }
+
+    void setCommandCachingEnabled(bool enabled) noexcept;
+    bool isCommandCachingEnabled() const noexcept { return mCommandCache != nullptr; }
+    RenderPass::CommandCache* getCommandCache() const noexcept { return mCommandCache.get(); }
+
     void setFrontFaceWindingInverted(bool inverted) noexcept { mFrontFaceWindingInverted = inverted; }
     bool isFrontFaceWindingInverted() const noexcept { return mFrontFaceWindingInverted; }
 
@@ -173,6 +182,10 @@ public:
     bool hasDPCF() const noexcept { return mShadowType == ShadowType::DPCF; }
     bool hasPCSS() const noexcept { return mShadowType == ShadowType::PCSS; }
     bool hasPicking() const noexcept { return mActivePickingQueriesList != nullptr; }
+    bool hasMotionVectors() const noexcept {
+        return mHasPostProcessPass && mTemporalAntiAliasingOptions.enabled &&
+               mTemporalAntiAliasingOptions.motionVectors;
+    }
     bool hasInstancedStereo() const noexcept {
         return mIsStereoSupported && mStereoscopicOptions.enabled;
     }
@@ -337,6 +350,24 @@ public:
         return mSoftShadowOptions;
     }
 
+    void setShadowMapCachingOptions(ShadowMapCachingOptions options) noexcept;
+
+    ShadowMapCachingOptions getShadowMapCachingOptions() const noexcept {
+        return mShadowMapCachingOptions;
+    }
+
+    void invalidateShadowMaps() noexcept;
+
+    void setShadowMapAtlasOptions(ShadowMapAtlasOptions options) noexcept {
+        mShadowMapAtlasOptions = options;
+    }
+
+    ShadowMapAtlasOptions getShadowMapAtlasOptions() const noexcept {
+        return mShadowMapAtlasOptions;
+    }
+
+    ShadowMapStats getShadowMapStats() const noexcept;
+
     AmbientOcclusionOptions const& getAmbientOcclusionOptions() const noexcept {
         return mAmbientOcclusionOptions;
     }
@@ -402,8 +433,16 @@ public:
         }
     }
 
+    // `hierarchy` is optional, when provided it must match `renderableData`
     static void cullRenderables(utils::JobSystem& js, FScene::RenderableSoa& renderableData,
-            Frustum const& frustum, size_t bit) noexcept;
+            CullingHierarchy const* hierarchy, Frustum const& frustum, size_t bit) noexcept;
+
+    // Records the world transforms of the visible renderables into `current` and sets their
+    // previousWorldFromWorld matrix from `previous`, worldTransform is the current world origin.
+    static void prepareMotionVectors(FrameHistoryEntry::MotionVectors const& previous,
+            FrameHistoryEntry::MotionVectors& current,
+            FScene::RenderableSoa& renderableData, utils::Range<uint32_t> visibleRenderables,
+            math::mat4 const& worldTransform) noexcept;
 
     PerViewUniforms const& getPerViewUniforms() const noexcept { return mPerViewUniforms; }
     PerViewUniforms& getPerViewUniforms() noexcept { return mPerViewUniforms; }
@@ -464,10 +503,14 @@ private:
     void prepareVisibleRenderables(utils::JobSystem& js,
             Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept;
 
+    void prepareOccludedRenderables(FEngine& engine,
+            math::mat4f const& viewProjection, float aspectRatio,
+            FScene::RenderableSoa& renderableData) const noexcept;
+
     static void prepareVisibleLights(FLightManager const& lcm,
             utils::Slice<float> scratch,
             math::mat4f const& viewMatrix, Frustum const& frustum,
-            FScene::LightSoa& lightData) noexcept;
+            FScene::LightSoa& lightData, size_t maxLightCount) noexcept;
 
     static inline void computeLightCameraDistances(float* distances,
             math::mat4f const& viewMatrix, const math::float4* spheres, size_t count) noexcept;
@@ -500,6 +543,9 @@ private:
     FCamera* mViewingCamera = nullptr;
 
     mutable Froxelizer mFroxelizer;
+    // only allocated when occlusion culling is enabled
+    std::unique_ptr<OcclusionCuller> mOcclusionCuller;
+    std::unique_ptr<RenderPass::CommandCache> mCommandCache;
     utils::JobSystem::Job* mFroxelizerSync = nullptr;
 
     Viewport mViewport;
@@ -519,6 +565,8 @@ private:
     ShadowType mShadowType = ShadowType::PCF;
     VsmShadowOptions mVsmShadowOptions; // FIXME: this should probably be per-light
     SoftShadowOptions mSoftShadowOptions;
+    ShadowMapCachingOptions mShadowMapCachingOptions;
+    ShadowMapAtlasOptions mShadowMapAtlasOptions;
     BloomOptions mBloomOptions;
     FogOptions mFogOptions;
     DepthOfFieldOptions mDepthOfFieldOptions;
@@ -21,12 +21,17 @@
 
 #include "details/Engine.h"
 
+#include "private/backend/CommandStream.h"
+
 #include <backend/DriverEnums.h>
 #include <backend/Handle.h>
 
+#include <utils/JobSystem.h>
 #include <utils/Panic.h>
 #include <utils/Systrace.h>
 
+#include <algorithm>
+
 namespace filament {
 
 inline FrameGraph::Builder::Builder(FrameGraph& fg, PassNode* passNode) noexcept
@@ -37,6 +42,12 @@ void FrameGraph::Builder::sideEffect() noexcept {
     mPassNode->makeTarget();
 }
 
+void FrameGraph::Builder::parallel(std::function<size_t()> commandStreamSize,
+        void const* sharedState) noexcept {
+    mPassNode->commandStreamSize = std::move(commandStreamSize);
+    mPassNode->sharedState = sharedState;
+}
+
 const char* FrameGraph::Builder::getName(FrameGraphHandle handle) const noexcept {
     return mFrameGraph.getResource(handle)->name;
 }
@@ -98,11 +109,13 @@ void FrameGraph::reset() noexcept {
     mResourceNodes.clear();
     mResources.clear();
     mResourceSlots.clear();
+    mTransientMemoryPeak = 0;
 }
 
 FrameGraph& FrameGraph::compile() noexcept {
 
     SYSTRACE_CALL();
+    SYSTRACE_CONTEXT();
 
     DependencyGraph& dependencyGraph = mGraph;
 
@@ -147,6 +160,9 @@ FrameGraph& FrameGraph::compile() noexcept {
         passNode->resolve();
     }
 
+    // share concrete resources between transient resources that are never alive together
+    aliasTransientResources();
+
     // add resource to de-virtualize or destroy to the corresponding list for each active pass
     for (auto* pResource : mResources) {
         VirtualResource* resource = pResource;
@@ -174,48 +190,366 @@ FrameGraph& FrameGraph::compile() noexcept {
         pNode->resolveResourceUsage(dependencyGraph);
     }
 
+    mTransientMemoryPeak = computeTransientMemoryPeak();
+    SYSTRACE_VALUE32("transientMemoryPeakKB", mTransientMemoryPeak / 1024);
+
+    // the dependencies are only needed to schedule the parallel passes
+    if (std::any_of(mPassNodes.begin(), mActivePassNodesEnd,
+            [](PassNode const* node) { return node->isParallel(); })) {
+        computeDependencies();
+    }
+
     return *this;
 }
 
-void FrameGraph::execute(backend::DriverApi& driver) noexcept {
+void FrameGraph::computeDependencies() noexcept {
+    DependencyGraph const& dependencyGraph = mGraph;
+    auto const& nodes = dependencyGraph.getNodes();
+    auto const& edges = dependencyGraph.getEdges();
+
+    // sort the edges by the node they point to, so we can walk them backwards
+    Vector<uint32_t> firstIncoming(mArena);
+    firstIncoming.resize(nodes.size() + 1, 0);
+    for (DependencyGraph::Edge const* edge : edges) {
+        firstIncoming[edge->to + 1]++;
+    }
+    for (size_t i = 1; i < firstIncoming.size(); i++) {
+        firstIncoming[i] += firstIncoming[i - 1];
+    }
+    Vector<DependencyGraph::NodeID> incoming(mArena);
+    incoming.resize(edges.size());
+    Vector<uint32_t> cursor(firstIncoming.begin(), firstIncoming.end() - 1, mArena);
+    for (DependencyGraph::Edge const* edge : edges) {
+        incoming[cursor[edge->to]++] = edge->from;
+    }
+
+    Vector<PassNode*> passNodes(mArena);
+    passNodes.resize(nodes.size(), nullptr);
+    for (PassNode* passNode : mPassNodes) {
+        passNodes[passNode->getId()] = passNode;
+    }
+
+    // A pass depends on the passes that wrote the resources it uses, which we find by walking
+    // the graph backwards through the resource nodes, stopping at the first pass of each path.
+    Vector<uint32_t> visited(mArena);
+    visited.resize(nodes.size(), 0);
+    Vector<DependencyGraph::NodeID> stack(mArena);
+    uint32_t generation = 0;
+    for (auto it = mPassNodes.begin(); it != mActivePassNodesEnd; ++it) {
+        PassNode* const passNode = *it;
+        generation++;
+        stack.push_back(passNode->getId());
+        while (!stack.empty()) {
+            DependencyGraph::NodeID const id = stack.back();
+            stack.pop_back();
+            for (uint32_t i = firstIncoming[id]; i < firstIncoming[id + 1]; i++) {
+                DependencyGraph::NodeID const from = incoming[i];
+                if (visited[from] == generation) {
+                    continue;
+                }
+                visited[from] = generation;
+                if (PassNode* const dependency = passNodes[from]) {
+                    if (!dependency->isCulled()) {
+                        passNode->dependencies.push_back(dependency);
+                    }
+                } else {
+                    stack.push_back(from);
+                }
+            }
+        }
+    }
+}
+
+void FrameGraph::aliasTransientResources() noexcept {
+    // Only transient resources that we create can be aliased, subresources always use the
+    // concrete resource of their parent, whose lifetime covers theirs.
+    Vector<VirtualResource*> candidates(mArena);
+    candidates.reserve(mResources.size());
+    for (VirtualResource* resource : mResources) {
+        if (resource->refcount && resource->first &&
+                !resource->isImported() && !resource->isSubResource()) {
+            candidates.push_back(resource);
+        }
+    }
+
+    // Passes are executed in the order of their creation, so their id gives the execution order.
+    std::stable_sort(candidates.begin(), candidates.end(),
+            [](VirtualResource const* lhs, VirtualResource const* rhs) {
+        return lhs->first->getId() < rhs->first->getId();
+    });
+
+    // Greedily assign each resource to a concrete resource that's no longer in use. Because
+    // resources are visited in the order they're created, this yields the smallest number of
+    // concrete resources for each descriptor.
+    // A resource is destroyed after its last pass executes and created before its first pass
+    // executes, so a concrete resource can be reused as soon as the next pass.
+    Vector<VirtualResource*> tails(mArena);
+    for (VirtualResource* resource : candidates) {
+        auto pos = std::find_if(tails.begin(), tails.end(),
+                [resource](VirtualResource const* tail) {
+            return tail->last->getId() < resource->first->getId() &&
+                    tail->isCompatible(*resource);
+        });
+        if (pos != tails.end()) {
+            (*pos)->aliasNext = resource;
+            resource->aliasPrevious = *pos;
+            *pos = resource;
+        } else {
+            tails.push_back(resource);
+        }
+    }
+}
+
+size_t FrameGraph::computeTransientMemoryPeak() const noexcept {
+    size_t current = 0;
+    size_t peak = 0;
+    for (auto it = mPassNodes.begin(); it != mActivePassNodesEnd; ++it) {
+        PassNode const* const node = *it;
+        for (VirtualResource const* resource : node->devirtualize) {
+            if (!resource->isImported() && !resource->isSubResource() &&
+                    !resource->aliasPrevious) {
+                current += resource->getMemorySize();
+            }
+        }
+        peak = std::max(peak, current);
+        for (VirtualResource const* resource : node->destroy) {
+            if (!resource->isImported() && !resource->isSubResource() &&
+                    !resource->aliasNext) {
+                current -= resource->getMemorySize();
+            }
+        }
+    }
+    return peak;
+}
+
+void FrameGraph::execute(backend::DriverApi& driver, FEngine* engine) noexcept {
+
+    SYSTRACE_CALL();
+
+    driver.pushGroupMarker("FrameGraph");
+
+    if (engine && std::any_of(mPassNodes.begin(), mActivePassNodesEnd,
+            [](PassNode const* node) { return node->isParallel(); })) {
+        assert_invariant(&driver == &engine->getDriverApi());
+        executeConcurrently(driver, *engine);
+    } else {
+        for (auto it = mPassNodes.begin(); it != mActivePassNodesEnd; ++it) {
+            assert_invariant(!(*it)->isCulled());
+            executePass(*it, driver);
+        }
+    }
+
+    driver.popGroupMarker();
+}
+
+void FrameGraph::executePass(PassNode* node, backend::DriverApi& driver) noexcept {
+    auto& resourceAllocator = mResourceAllocator;
+
+    SYSTRACE_NAME(node->getName());
+
+    driver.pushGroupMarker(node->getName());
+
+    // devirtualize resourcesList
+    for (VirtualResource* resource : node->devirtualize) {
+        assert_invariant(resource->first == node);
+        resource->devirtualize(resourceAllocator);
+    }
+
+    // call execute
+    node->devirtualizeRenderTargets();
+    FrameGraphResources const resources(*this, *node);
+    node->execute(resources, driver);
+    node->destroyRenderTargets();
+
+    // destroy concrete resources
+    for (VirtualResource* resource : node->destroy) {
+        assert_invariant(resource->last == node);
+        resource->destroy(resourceAllocator);
+    }
+
+    driver.popGroupMarker();
+}
+
+void FrameGraph::executeConcurrently(backend::DriverApi& driver, FEngine& engine) noexcept {
 
     SYSTRACE_CALL();
 
-    auto const& passNodes = mPassNodes;
     auto& resourceAllocator = mResourceAllocator;
+    utils::JobSystem& js = engine.getJobSystem();
+    size_t const capacity = engine.getMinCommandBufferSize();
+    size_t const reservationSize = backend::CommandBase::align(sizeof(backend::JumpCommand));
+
+    // The passes are visited in order on this thread, which creates their concrete resources
+    // and render targets and executes the passes that are not parallel. Each parallel pass
+    // reserves its position in the command stream and is recorded by a job into its own buffer,
+    // so the commands are executed in pass order regardless of when they're recorded.
+    // A parallel pass's job is started by the last job it waits on, i.e. those of the passes it
+    // depends on and of the previous pass with the same shared state. This thread waits on the
+    // jobs of the passes a serial pass depends on, before executing it.
+
+    Vector<PassNode*> inFlight(mArena);        // parallel passes we hold a job reference of
+    Vector<PassNode*> pendingDestroy(mArena);  // passes whose resources may still be in use
+    Vector<PassNode*> sharedStateUsers(mArena);  // last parallel pass of each shared state
+
+    auto* parent = js.createJob();
+
+    auto const join = [&]() {
+        js.runAndWait(parent);
+        for (PassNode* node : inFlight) {
+            if (node->job) {
+                js.release(node->job);
+            }
+        }
+        inFlight.clear();
+    };
+
+    // release the jobs that have completed, once there are none left, the resources of the
+    // passes that have executed can be destroyed.
+    auto const retire = [&]() {
+        {
+            std::lock_guard<utils::Mutex> const lock(mJobLock);
+            inFlight.erase(std::remove_if(inFlight.begin(), inFlight.end(),
+                    [&js](PassNode* node) {
+                if (node->job && !node->recorded) {
+                    return false;
+                }
+                if (node->job) {
+                    js.release(node->job);
+                }
+                return true;
+            }), inFlight.end());
+        }
+        if (inFlight.empty()) {
+            for (PassNode* node : pendingDestroy) {
+                node->destroyRenderTargets();
+                for (VirtualResource* resource : node->destroy) {
+                    assert_invariant(resource->last == node);
+                    resource->destroy(resourceAllocator);
+                }
+            }
+            pendingDestroy.clear();
+        }
+    };
 
-    driver.pushGroupMarker("FrameGraph");
+    // The command stream can't be flushed while passes are recording into it, this can happen
+    // when a serial pass runs out of space, or below.
+    engine.setFlushCallback([&]() {
+        join();
+        parent = js.createJob();
+    });
 
-    auto first = passNodes.begin();
-    const auto activePassNodesEnd = mActivePassNodesEnd;
-    while (first != activePassNodesEnd) {
-        PassNode* const node = *first;
-        first++;
+    for (auto it = mPassNodes.begin(); it != mActivePassNodesEnd; ++it) {
+        PassNode* const node = *it;
         assert_invariant(!node->isCulled());
 
-        SYSTRACE_NAME(node->getName());
+        if (!node->isParallel()) {
+            for (PassNode* dependency : node->dependencies) {
+                if (dependency->job) {
+                    js.waitAndRelease(dependency->job);
+                }
+            }
 
-        driver.pushGroupMarker(node->getName());
+            SYSTRACE_NAME(node->getName());
+            driver.pushGroupMarker(node->getName());
+            for (VirtualResource* resource : node->devirtualize) {
+                assert_invariant(resource->first == node);
+                resource->devirtualize(resourceAllocator);
+            }
+            node->devirtualizeRenderTargets();
+            FrameGraphResources const resources(*this, *node);
+            node->execute(resources, driver);
+            driver.popGroupMarker();
+
+            pendingDestroy.push_back(node);
+            retire();
+            continue;
+        }
+
+        if (UTILS_UNLIKELY(driver.getCircularBuffer().getUsed() + reservationSize > capacity)) {
+            engine.flush();
+        }
 
-        // devirtualize resourcesList
         for (VirtualResource* resource : node->devirtualize) {
             assert_invariant(resource->first == node);
             resource->devirtualize(resourceAllocator);
         }
+        node->devirtualizeRenderTargets();
+
+        backend::CommandStream::Reservation const reservation = driver.reserve();
+
+        auto* job = utils::jobs::createJob(js, parent, [this, node, &js, &driver, reservation]() {
+            {
+                SYSTRACE_NAME(node->getName());
+                // leave room for the group markers
+                backend::SecondaryCommandStream secondary(driver, reservation,
+                        node->commandStreamSize() + 256);
+                backend::DriverApi& stream = secondary.getStream();
+                stream.pushGroupMarker(node->getName());
+                FrameGraphResources const resources(*this, *node);
+                node->execute(resources, stream);
+                stream.popGroupMarker();
+                secondary.finish();
+            }
+            // start the passes that were waiting on this one
+            std::lock_guard<utils::Mutex> const lock(mJobLock);
+            node->recorded = true;
+            for (PassNode* successor : node->successors) {
+                assert_invariant(successor->blockers);
+                if (--successor->blockers == 0) {
+                    // successor->job stays valid, execute() holds a reference to it
+                    utils::JobSystem::Job* job = successor->job;
+                    js.run(job);
+                }
+            }
+        });
+
+        // the previous parallel pass with the same shared state, if any
+        auto const previous = !node->sharedState ? sharedStateUsers.end() :
+                std::find_if(sharedStateUsers.begin(), sharedStateUsers.end(),
+                        [node](PassNode const* user) {
+                    return user->sharedState == node->sharedState;
+                });
+
+        bool ready;
+        {
+            std::lock_guard<utils::Mutex> const lock(mJobLock);
+            node->job = js.retain(job);
+            node->successors.clear();
+            node->blockers = 0;
+            node->recorded = false;
+            auto const waitOn = [node](PassNode* other) {
+                if (other->job && !other->recorded) {
+                    other->successors.push_back(node);
+                    node->blockers++;
+                }
+            };
+            for (PassNode* dependency : node->dependencies) {
+                waitOn(dependency);
+            }
+            if (previous != sharedStateUsers.end()) {
+                waitOn(*previous);
+            }
+            ready = !node->blockers;
+        }
 
-        // call execute
-        FrameGraphResources const resources(*this, *node);
-        node->execute(resources, driver);
-
-        // destroy concrete resources
-        for (VirtualResource* resource : node->destroy) {
-            assert_invariant(resource->last == node);
-            resource->destroy(resourceAllocator);
+        if (node->sharedState) {
+            if (previous != sharedStateUsers.end()) {
+                *previous = node;
+            } else {
+                sharedStateUsers.push_back(node);
+            }
         }
 
-        driver.popGroupMarker();
+        inFlight.push_back(node);
+        pendingDestroy.push_back(node);
+        if (ready) {
+            js.run(job);
+        }
     }
-    driver.popGroupMarker();
+
+    join();
+    engine.setFlushCallback(nullptr);
+    retire();
 }
 
 void FrameGraph::addPresentPass(const std::function<void(FrameGraph::Builder&)>& setup) noexcept {
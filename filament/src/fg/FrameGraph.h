@@ -34,10 +34,13 @@
 #include <backend/DriverEnums.h>
 #include <backend/Handle.h>
 
+#include <utils/Mutex.h>
+
 #include <functional>
 
 namespace filament {
 
+class FEngine;
 class ResourceAllocatorInterface;
 
 class FrameGraphPassExecutor;
@@ -154,6 +157,26 @@ public:
          */
         void sideEffect() noexcept;
 
+        /**
+         * Allows the execute function of this pass to run on a worker thread, concurrently
+         * with the passes it has no path to or from in the graph, whether they're parallel or
+         * not. It starts once the passes it depends on, and all the passes declared before it
+         * that are not parallel, have executed. The commands it records are executed by the
+         * backend in the same order as if the passes had run serially.
+         *
+         * The execute function must only record commands into the DriverApi it's given and
+         * must not modify any state shared with other passes, except through sharedState.
+         *
+         * @param commandStreamSize Returns an upper bound of the space used in the
+         *                          CommandStream by the execute function. It's called right
+         *                          before the pass executes, on the thread calling execute().
+         * @param sharedState       If not null, the parallel passes with the same sharedState
+         *                          execute one after the other, in the order they're declared,
+         *                          e.g. because they use the same MaterialInstance.
+         */
+        void parallel(std::function<size_t()> commandStreamSize,
+                void const* sharedState = nullptr) noexcept;
+
         /**
          * Retrieves the descriptor associated to a resource
          * @tparam RESOURCE Type of the resource
@@ -281,16 +304,29 @@ public:
 
     /**
      * Allocates concrete resources and culls unreferenced passes.
+     * Transient resources that are never alive at the same time and that have compatible
+     * descriptors share the same concrete resource.
      * @return a reference to the FrameGraph, for chaining calls.
      */
     FrameGraph& compile() noexcept;
 
+    /**
+     * Returns the estimated peak memory used by the transient resources of this FrameGraph,
+     * i.e. the largest amount of memory alive at any point during execute().
+     * Only valid after compile().
+     * @return peak memory used by the transient resources in bytes
+     */
+    size_t getTransientMemoryPeak() const noexcept { return mTransientMemoryPeak; }
+
     /**
      * Execute all referenced passes
      *
      * @param driver a reference to the backend to execute the commands
+     * @param engine if not null, the passes declared with Builder::parallel() execute on the
+     *               engine's JobSystem, concurrently with the passes they're independent of.
+     *               driver must be the engine's.
      */
-    void execute(backend::DriverApi& driver) noexcept;
+    void execute(backend::DriverApi& driver, FEngine* engine = nullptr) noexcept;
 
     /**
      * Forwards a resource to another one which gets replaced.
@@ -512,6 +548,11 @@ private:
     }
 
     void destroyInternal() noexcept;
+    void executePass(PassNode* node, backend::DriverApi& driver) noexcept;
+    void executeConcurrently(backend::DriverApi& driver, FEngine& engine) noexcept;
+    void computeDependencies() noexcept;
+    void aliasTransientResources() noexcept;
+    size_t computeTransientMemoryPeak() const noexcept;
 
     Blackboard mBlackboard;
     ResourceAllocatorInterface& mResourceAllocator;
@@ -523,6 +564,8 @@ private:
     Vector<ResourceNode*> mResourceNodes;
     Vector<PassNode*> mPassNodes;
     Vector<PassNode*>::iterator mActivePassNodesEnd;
+    size_t mTransientMemoryPeak = 0;
+    utils::Mutex mJobLock;  // guards the scheduling state of the passes during execute()
 };
 
 template<typename Data, typename Setup, typename Execute>
@@ -18,7 +18,10 @@
 
 #include "ResourceAllocator.h"
 
+#include "details/Texture.h"
+
 #include <algorithm>
+#include <iterator>
 
 namespace filament {
 
@@ -51,4 +54,27 @@ FrameGraphTexture::Descriptor FrameGraphTexture::generateSubResourceDescriptor(
     return descriptor;
 }
 
+bool FrameGraphTexture::isCompatible(Descriptor const& lhs, Descriptor const& rhs) noexcept {
+    return lhs.width == rhs.width &&
+           lhs.height == rhs.height &&
+           lhs.depth == rhs.depth &&
+           lhs.levels == rhs.levels &&
+           lhs.samples == rhs.samples &&
+           lhs.type == rhs.type &&
+           lhs.format == rhs.format &&
+           std::equal(std::begin(lhs.swizzle.channels), std::end(lhs.swizzle.channels),
+                   std::begin(rhs.swizzle.channels));
+}
+
+size_t FrameGraphTexture::getSize(Descriptor const& descriptor) noexcept {
+    // this must match ResourceAllocator's accounting
+    size_t size = size_t(descriptor.width) * descriptor.height * descriptor.depth *
+            FTexture::getFormatSize(descriptor.format);
+    size *= std::max(uint8_t(1), descriptor.samples);
+    if (descriptor.levels > 1) {
+        size += size / 3;
+    }
+    return size;
+}
+
 } // namespace filament
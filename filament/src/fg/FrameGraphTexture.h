@@ -22,6 +22,8 @@
 #include <backend/DriverEnums.h>
 #include <backend/Handle.h>
 
+#include <stddef.h>
+
 namespace filament {
 class ResourceAllocatorInterface;
 } // namespace::filament
@@ -95,6 +97,21 @@ struct FrameGraphTexture {
      */
     static Descriptor generateSubResourceDescriptor(Descriptor descriptor,
             SubResourceDescriptor const& srd) noexcept;
+
+    /**
+     * Whether two resources with these descriptors can share the same concrete resource
+     * @param lhs   descriptor of the first resource
+     * @param rhs   descriptor of the second resource
+     * @return      true if a concrete resource created with lhs can be used in place of rhs
+     */
+    static bool isCompatible(Descriptor const& lhs, Descriptor const& rhs) noexcept;
+
+    /**
+     * Estimates the memory used by the concrete resource
+     * @param descriptor Descriptor to the resource
+     * @return           size of the resource in bytes
+     */
+    static size_t getSize(Descriptor const& descriptor) noexcept;
 };
 
 } // namespace filament
@@ -33,7 +33,9 @@ PassNode::PassNode(FrameGraph& fg) noexcept
         : DependencyGraph::Node(fg.getGraph()),
           mFrameGraph(fg),
           devirtualize(fg.getArena()),
-          destroy(fg.getArena()) {
+          destroy(fg.getArena()),
+          dependencies(fg.getArena()),
+          successors(fg.getArena()) {
 }
 
 PassNode::PassNode(PassNode&& rhs) noexcept = default;
@@ -59,18 +61,19 @@ RenderPassNode::RenderPassNode(RenderPassNode&& rhs) noexcept = default;
 RenderPassNode::~RenderPassNode() noexcept = default;
 
 void RenderPassNode::execute(FrameGraphResources const& resources, DriverApi& driver) noexcept {
+    mPassBase->execute(resources, driver);
+}
 
+void RenderPassNode::devirtualizeRenderTargets() noexcept {
     FrameGraph& fg = mFrameGraph;
     ResourceAllocatorInterface& resourceAllocator = fg.getResourceAllocator();
-
-    // create the render targets
     for (auto& rt : mRenderTargetData) {
         rt.devirtualize(fg, resourceAllocator);
     }
+}
 
-    mPassBase->execute(resources, driver);
-    
-    // destroy the render targets
+void RenderPassNode::destroyRenderTargets() noexcept {
+    ResourceAllocatorInterface& resourceAllocator = mFrameGraph.getResourceAllocator();
     for (auto& rt : mRenderTargetData) {
         rt.destroy(resourceAllocator);
     }
@@ -26,6 +26,9 @@
 
 #include <backend/TargetBufferInfo.h>
 
+#include <utils/JobSystem.h>
+
+#include <functional>
 #include <unordered_set>
 
 namespace utils {
@@ -54,12 +57,28 @@ public:
 
     void registerResource(FrameGraphHandle resourceHandle) noexcept;
 
+    // Records the commands of this pass, this can happen on a worker thread if the pass is
+    // parallel. Render targets are created before and destroyed after, on the FrameGraph's thread.
     virtual void execute(FrameGraphResources const& resources, backend::DriverApi& driver) noexcept = 0;
+    virtual void devirtualizeRenderTargets() noexcept { }
+    virtual void destroyRenderTargets() noexcept { }
     virtual void resolve() noexcept = 0;
     utils::CString graphvizifyEdgeColor() const noexcept override;
 
+    bool isParallel() const noexcept { return bool(commandStreamSize); }
+
     Vector<VirtualResource*> devirtualize;         // resources we need to create before executing
     Vector<VirtualResource*> destroy;              // resources we need to destroy after executing
+    std::function<size_t()> commandStreamSize;     // set by Builder::parallel()
+    void const* sharedState = nullptr;             // set by Builder::parallel()
+    Vector<PassNode*> dependencies;                // closest active passes we depend on
+
+    // state of a parallel pass while FrameGraph::execute() records it on a worker thread,
+    // guarded by the FrameGraph's lock
+    utils::JobSystem::Job* job = nullptr;          // retained until waited on
+    Vector<PassNode*> successors;                  // parallel passes waiting on us
+    uint32_t blockers = 0;                         // passes we're waiting on
+    bool recorded = false;
 };
 
 class RenderPassNode : public PassNode {
@@ -97,6 +116,8 @@ private:
     char const* getName() const noexcept override { return mName; }
     utils::CString graphvizify() const noexcept override;
     void execute(FrameGraphResources const& resources, backend::DriverApi& driver) noexcept override;
+    void devirtualizeRenderTargets() noexcept override;
+    void destroyRenderTargets() noexcept override;
     void resolve() noexcept override;
 
     // constants
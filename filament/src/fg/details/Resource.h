@@ -56,6 +56,11 @@ public:
     PassNode* first = nullptr;  // pass that needs to instantiate the resource
     PassNode* last = nullptr;   // pass that can destroy the resource
 
+    // computed during compile(), transient resources with disjoint lifetimes share the same
+    // concrete resource, they're chained in execution order.
+    VirtualResource* aliasPrevious = nullptr;   // resource we inherit the concrete resource from
+    VirtualResource* aliasNext = nullptr;       // resource we hand the concrete resource over to
+
     explicit VirtualResource(const char* name) noexcept : parent(this), name(name) { }
     VirtualResource(VirtualResource* parent, const char* name) noexcept : parent(parent), name(name) { }
     VirtualResource(VirtualResource const& rhs) noexcept = delete;
@@ -83,6 +88,12 @@ public:
             ResourceEdgeBase const* const* edges, size_t count,
             ResourceEdgeBase const* writer) noexcept = 0;
 
+    /* Whether this resource can use the same concrete resource as another one */
+    virtual bool isCompatible(VirtualResource const& rhs) const noexcept = 0;
+
+    /* Estimated memory size of the concrete resource */
+    virtual size_t getMemorySize() const noexcept = 0;
+
     /* Instantiate the concrete resource */
     virtual void devirtualize(ResourceAllocatorInterface& resourceAllocator) noexcept = 0;
 
@@ -229,9 +240,29 @@ protected:
         delete static_cast<ResourceEdge *>(edge);
     }
 
+    bool isCompatible(VirtualResource const& rhs) const noexcept override {
+        // rhs is guaranteed to be a Resource<RESOURCE> by construction
+        return RESOURCE::isCompatible(descriptor, static_cast<Resource const&>(rhs).descriptor);
+    }
+
+    size_t getMemorySize() const noexcept override {
+        return RESOURCE::getSize(descriptor);
+    }
+
     void devirtualize(ResourceAllocatorInterface& resourceAllocator) noexcept override {
         if (!isSubResource()) {
-            resource.create(resourceAllocator, name, descriptor, usage);
+            Resource const* const previous = static_cast<Resource const*>(aliasPrevious);
+            if (previous && !previous->detached) {
+                // the previous resource is dead by now, we can take over its concrete resource
+                resource = previous->resource;
+            } else {
+                // the concrete resource must be usable by all the resources aliasing it
+                Usage u = usage;
+                for (VirtualResource const* p = aliasNext; p; p = p->aliasNext) {
+                    u |= static_cast<Resource const*>(p)->usage;
+                }
+                resource.create(resourceAllocator, name, descriptor, u);
+            }
         } else {
             // resource is guaranteed to be initialized before we are by construction
             resource = static_cast<Resource const*>(parent)->resource;
@@ -239,7 +270,7 @@ protected:
     }
 
     void destroy(ResourceAllocatorInterface& resourceAllocator) noexcept override {
-        if (detached || isSubResource()) {
+        if (detached || isSubResource() || aliasNext) {
             return;
         }
         resource.destroy(resourceAllocator);
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "ShadowMapManager.h"
+
+#include "details/Camera.h"
+#include "details/Engine.h"
+#include "details/Scene.h"
+
+#include <filament/LightManager.h>
+#include <filament/Options.h>
+
+#include <private/filament/EngineEnums.h>
+
+#include <math/mat4.h>
+#include <math/vec4.h>
+
+#include <memory>
+
+using namespace filament;
+using namespace filament::math;
+
+// shadow index of the n-th spot shadow map
+static constexpr size_t spot(size_t n) {
+    return CONFIG_MAX_SHADOW_CASCADES + n;
+}
+
+static void addLight(FScene::LightSoa& lights, float4 const& sphere) {
+    lights.push_back(sphere, {}, {}, {}, {}, {}, {}, {});
+}
+
+TEST(ShadowMapManager, ChooseShadowMapDimensions) {
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    std::unique_ptr<ShadowMapManager> shadowMapManager;
+    ShadowMapManager::createIfNeeded(*engine, shadowMapManager);
+
+    // with a 90 degrees fov, the coverage is the radius of the light divided by its distance
+    CameraInfo cameraInfo;
+    cameraInfo.projection = mat4f{ mat4::perspective(90.0, 1.0, 0.1, 100.0) };
+    cameraInfo.view = mat4f{};
+
+    LightManager::ShadowOptions directionalOptions;
+    directionalOptions.mapSize = 2048;
+    directionalOptions.shadowCascades = 2;
+    LightManager::ShadowOptions spotOptions;
+    spotOptions.mapSize = 1024;
+    LightManager::ShadowOptions smallSpotOptions;
+    smallSpotOptions.mapSize = 256;
+
+    FScene::LightSoa lights;
+    addLight(lights, {});                       // directional light
+    addLight(lights, { 0, 0, -10, 1 });         // covers 1/10th of the screen
+    addLight(lights, { 0, 0, -10, 4 });         // covers 4/10th of the screen
+    addLight(lights, { 0, 0, -1000, 1 });       // almost invisible
+    addLight(lights, { 0, 0, -2, 5 });          // the camera is inside the light
+    addLight(lights, { 0, 0, 10, 1 });          // behind the camera
+    addLight(lights, { 0, 0, -1000, 1 });       // almost invisible, smaller shadow map
+
+    ShadowMapManager::Builder builder;
+    builder.directionalShadowMap(0, &directionalOptions);
+    for (size_t i = 1; i < 6; i++) {
+        builder.shadowMap(i, true, &spotOptions);
+    }
+    builder.shadowMap(6, true, &smallSpotOptions);
+    shadowMapManager->initializeShadowMaps(*engine, builder);
+
+    ShadowMapManager::ShadowMapDimensions dimensions{};
+
+    // without screen-space resolution, all shadow maps use their mapSize
+    shadowMapManager->chooseShadowMapDimensions({}, cameraInfo, lights, dimensions);
+    EXPECT_EQ(2048, dimensions[0]);
+    EXPECT_EQ(2048, dimensions[1]);
+    for (size_t i = 0; i < 5; i++) {
+        EXPECT_EQ(1024, dimensions[spot(i)]);
+    }
+    EXPECT_EQ(256, dimensions[spot(5)]);
+
+    // with screen-space resolution, the resolution of spot lights follows their coverage,
+    // rounded up to a power-of-two and clamped between 1/8th of mapSize and mapSize
+    shadowMapManager->chooseShadowMapDimensions({ .screenSpaceResolution = true },
+            cameraInfo, lights, dimensions);
+    EXPECT_EQ(2048, dimensions[0]);
+    EXPECT_EQ(2048, dimensions[1]);
+    EXPECT_EQ(128, dimensions[spot(0)]);
+    EXPECT_EQ(512, dimensions[spot(1)]);
+    EXPECT_EQ(128, dimensions[spot(2)]);
+    EXPECT_EQ(1024, dimensions[spot(3)]);
+    EXPECT_EQ(1024, dimensions[spot(4)]);
+    EXPECT_EQ(32, dimensions[spot(5)]);
+
+    ShadowMapManager::terminate(*engine, shadowMapManager);
+    shadowMapManager.reset();
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(ShadowMapManager, ReduceShadowMapDimensions) {
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    std::unique_ptr<ShadowMapManager> shadowMapManager;
+    ShadowMapManager::createIfNeeded(*engine, shadowMapManager);
+
+    LightManager::ShadowOptions directionalOptions;
+    directionalOptions.mapSize = 1024;
+    directionalOptions.shadowCascades = 2;
+    LightManager::ShadowOptions spotOptions;
+    spotOptions.mapSize = 1024;
+    LightManager::ShadowOptions smallSpotOptions;
+    smallSpotOptions.mapSize = 512;
+
+    // spot lights are sorted by distance to the camera, light 3 is the farthest
+    ShadowMapManager::Builder builder;
+    builder.directionalShadowMap(0, &directionalOptions);
+    builder.shadowMap(1, true, &spotOptions);
+    builder.shadowMap(2, true, &smallSpotOptions);
+    builder.shadowMap(3, true, &spotOptions);
+    shadowMapManager->initializeShadowMaps(*engine, builder);
+
+    ShadowMapManager::ShadowMapDimensions dimensions{};
+    dimensions[0] = 1024;
+    dimensions[1] = 1024;
+    dimensions[spot(0)] = 1024;
+    dimensions[spot(1)] = 512;
+    dimensions[spot(2)] = 1024;
+
+    auto const expectDimensions = [&dimensions](uint16_t cascades,
+            uint16_t spot0, uint16_t spot1, uint16_t spot2) {
+        EXPECT_EQ(cascades, dimensions[0]);
+        EXPECT_EQ(cascades, dimensions[1]);
+        EXPECT_EQ(spot0, dimensions[spot(0)]);
+        EXPECT_EQ(spot1, dimensions[spot(1)]);
+        EXPECT_EQ(spot2, dimensions[spot(2)]);
+    };
+
+    // the largest shadow map is halved first, the farthest spot light first at equal size,
+    // and the directional light last
+    EXPECT_TRUE(shadowMapManager->reduceShadowMapDimensions(dimensions));
+    expectDimensions(1024, 1024, 512, 512);
+    EXPECT_TRUE(shadowMapManager->reduceShadowMapDimensions(dimensions));
+    expectDimensions(1024, 512, 512, 512);
+    // all the cascades are halved together
+    EXPECT_TRUE(shadowMapManager->reduceShadowMapDimensions(dimensions));
+    expectDimensions(512, 512, 512, 512);
+    EXPECT_TRUE(shadowMapManager->reduceShadowMapDimensions(dimensions));
+    expectDimensions(512, 512, 512, 256);
+    EXPECT_TRUE(shadowMapManager->reduceShadowMapDimensions(dimensions));
+    expectDimensions(512, 512, 256, 256);
+    EXPECT_TRUE(shadowMapManager->reduceShadowMapDimensions(dimensions));
+    expectDimensions(512, 256, 256, 256);
+    EXPECT_TRUE(shadowMapManager->reduceShadowMapDimensions(dimensions));
+    expectDimensions(256, 256, 256, 256);
+
+    // shadow maps can't go below 1/8th of their mapSize
+    size_t reductions = 0;
+    while (shadowMapManager->reduceShadowMapDimensions(dimensions)) {
+        reductions++;
+    }
+    EXPECT_EQ(5u, reductions);
+    expectDimensions(128, 128, 64, 128);
+
+    ShadowMapManager::terminate(*engine, shadowMapManager);
+    shadowMapManager.reset();
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(ShadowMapManager, AllocateSharedLayers) {
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    std::unique_ptr<ShadowMapManager> shadowMapManager;
+    ShadowMapManager::createIfNeeded(*engine, shadowMapManager);
+
+    LightManager::ShadowOptions options;
+    ShadowMapManager::Builder builder;
+    builder.directionalShadowMap(0, &options);
+    for (size_t i = 1; i < 5; i++) {
+        builder.shadowMap(i, true, &options);
+    }
+    shadowMapManager->initializeShadowMaps(*engine, builder);
+
+    ShadowMapManager::ShadowMapDimensions dimensions{};
+    dimensions[0] = 1024;
+    dimensions[spot(0)] = 64;
+    dimensions[spot(1)] = 512;
+    dimensions[spot(2)] = 512;
+    dimensions[spot(3)] = 512;
+
+    FScene::LightSoa lights;
+    uint8_t layerCount = 0;
+    uint32_t const atlasDimension = shadowMapManager->allocateShadowMaps(*engine, lights,
+            dimensions, ShadowMapManager::canShareLayers(false, false), &layerCount);
+    EXPECT_EQ(1024u, atlasDimension);
+    EXPECT_EQ(2, layerCount);
+
+    auto const expectAllocation = [&](size_t shadowIndex, uint8_t layer,
+            int32_t left, int32_t bottom, uint32_t dimension) {
+        ShadowMap const& shadowMap = shadowMapManager->getShadowMap(shadowIndex);
+        EXPECT_EQ(layer, shadowMap.getLayer());
+        EXPECT_EQ(dimension, shadowMap.getDimension());
+        // the viewport excludes the 1 texel border
+        backend::Viewport const viewport = shadowMap.getViewport();
+        EXPECT_EQ(left + 1, viewport.left);
+        EXPECT_EQ(bottom + 1, viewport.bottom);
+        EXPECT_EQ(dimension - 2, viewport.width);
+    };
+
+    // the largest shadow maps are allocated first, the smallest one gets a region of at least
+    // 1/8th of the atlas, in the first free quadrant of the second layer
+    expectAllocation(0, 0, 0, 0, 1024);
+    expectAllocation(spot(1), 1, 0, 0, 512);
+    expectAllocation(spot(2), 1, 512, 0, 512);
+    expectAllocation(spot(3), 1, 0, 512, 512);
+    expectAllocation(spot(0), 1, 512, 512, 64);
+
+    ShadowMapManager::terminate(*engine, shadowMapManager);
+    shadowMapManager.reset();
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(ShadowMapManager, AllocateSeparateLayers) {
+    // cached and VSM shadow maps each need their own layer
+    EXPECT_TRUE(ShadowMapManager::canShareLayers(false, false));
+    EXPECT_FALSE(ShadowMapManager::canShareLayers(true, false));
+    EXPECT_FALSE(ShadowMapManager::canShareLayers(false, true));
+    EXPECT_FALSE(ShadowMapManager::canShareLayers(true, true));
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    std::unique_ptr<ShadowMapManager> shadowMapManager;
+    ShadowMapManager::createIfNeeded(*engine, shadowMapManager);
+
+    LightManager::ShadowOptions directionalOptions;
+    directionalOptions.shadowCascades = 2;
+    LightManager::ShadowOptions spotOptions;
+    ShadowMapManager::Builder builder;
+    builder.directionalShadowMap(0, &directionalOptions);
+    builder.shadowMap(1, true, &spotOptions);
+    builder.shadowMap(2, true, &spotOptions);
+    shadowMapManager->initializeShadowMaps(*engine, builder);
+
+    ShadowMapManager::ShadowMapDimensions dimensions{};
+    dimensions[0] = 512;
+    dimensions[1] = 512;
+    dimensions[spot(0)] = 256;
+    dimensions[spot(1)] = 128;
+
+    FScene::LightSoa lights;
+    addLight(lights, {});
+    addLight(lights, {});
+    addLight(lights, {});
+
+    for (bool const caching : { false, true }) {
+        shadowMapManager->mCachingEnabled = caching;
+        uint8_t layerCount = 0;
+        uint32_t const atlasDimension = shadowMapManager->allocateShadowMaps(*engine, lights,
+                dimensions, ShadowMapManager::canShareLayers(!caching, caching), &layerCount);
+
+        // the cascades come first, then the spot lights, each in the corner of its own layer
+        EXPECT_EQ(512u, atlasDimension);
+        EXPECT_EQ(4, layerCount);
+        size_t const shadowIndices[] = { 0, 1, spot(0), spot(1) };
+        for (size_t layer = 0; layer < 4; layer++) {
+            ShadowMap const& shadowMap = shadowMapManager->getShadowMap(shadowIndices[layer]);
+            EXPECT_EQ(layer, shadowMap.getLayer());
+            EXPECT_EQ(dimensions[shadowIndices[layer]], shadowMap.getDimension());
+            EXPECT_EQ(1, shadowMap.getViewport().left);
+            EXPECT_EQ(1, shadowMap.getViewport().bottom);
+        }
+    }
+
+    shadowMapManager->mCachingEnabled = false;
+    ShadowMapManager::terminate(*engine, shadowMapManager);
+    shadowMapManager.reset();
+    Engine::destroy((Engine **)&engine);
+}
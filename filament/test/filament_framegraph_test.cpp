@@ -27,8 +27,16 @@
 #include "fg/FrameGraphResources.h"
 #include "fg/details/DependencyGraph.h"
 
+#include "details/Engine.h"
 #include "details/Texture.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 using namespace filament;
 using namespace backend;
 
@@ -942,3 +950,204 @@ TEST_F(FrameGraphTest, WriteResourceReadAsAttachment) {
 
     fg.execute(driverApi);
 }
+
+TEST_F(FrameGraphTest, TransientAliasing) {
+
+    // resources with compatible descriptors that are never alive at the same time should
+    // share their concrete resource.
+
+    struct PassData {
+        FrameGraphId<FrameGraphTexture> input;
+        FrameGraphId<FrameGraphTexture> output;
+    };
+
+    Handle<HwTexture> handles[3];
+
+    auto& pass0 = fg.addPass<PassData>("Pass 0", [&](FrameGraph::Builder& builder, auto& data) {
+                data.output = builder.create<FrameGraphTexture>("Buffer 0", {.width=16, .height=32});
+                data.output = builder.write(data.output, FrameGraphTexture::Usage::COLOR_ATTACHMENT);
+            },
+            [&](FrameGraphResources const& resources, auto const& data, backend::DriverApi&) {
+                handles[0] = resources.get(data.output).handle;
+            });
+
+    auto& pass1 = fg.addPass<PassData>("Pass 1", [&](FrameGraph::Builder& builder, auto& data) {
+                data.input = builder.sample(pass0->output);
+                data.output = builder.create<FrameGraphTexture>("Buffer 1", {.width=16, .height=32});
+                data.output = builder.write(data.output, FrameGraphTexture::Usage::COLOR_ATTACHMENT);
+            },
+            [&](FrameGraphResources const& resources, auto const& data, backend::DriverApi&) {
+                handles[1] = resources.get(data.output).handle;
+            });
+
+    auto& pass2 = fg.addPass<PassData>("Pass 2", [&](FrameGraph::Builder& builder, auto& data) {
+                data.input = builder.sample(pass1->output);
+                data.output = builder.create<FrameGraphTexture>("Buffer 2", {.width=16, .height=32});
+                data.output = builder.write(data.output, FrameGraphTexture::Usage::COLOR_ATTACHMENT);
+            },
+            [&](FrameGraphResources const& resources, auto const& data, backend::DriverApi&) {
+                handles[2] = resources.get(data.output).handle;
+                EXPECT_EQ(resources.getUsage(data.output), FrameGraphTexture::Usage::COLOR_ATTACHMENT);
+            });
+
+    fg.present(pass2->output);
+
+    EXPECT_TRUE(fg.isAcyclic());
+
+    fg.compile();
+
+    // only two RGBA8 16x32 buffers are alive at any given time
+    EXPECT_EQ(fg.getTransientMemoryPeak(), 2 * 16 * 32 * 4);
+
+    fg.execute(driverApi);
+
+    EXPECT_TRUE(handles[0]);
+    EXPECT_TRUE(handles[1]);
+    EXPECT_NE(handles[0], handles[1]);
+    EXPECT_EQ(handles[0], handles[2]);
+}
+
+TEST_F(FrameGraphTest, ParallelPasses) {
+
+    // passes declared parallel record concurrently, but their commands must execute in order.
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    FrameGraph graph{ resourceAllocator };
+    std::vector<int> order;
+
+    struct PassData {
+    };
+    for (int i = 0; i < 4; i++) {
+        graph.addPass<PassData>("Parallel Pass", [&](FrameGraph::Builder& builder, auto&) {
+                    builder.parallel([]() { return size_t(1024); });
+                    builder.sideEffect();
+                },
+                [&order, i](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                    driver.queueCommand([&order, i]() { order.push_back(i); });
+                });
+    }
+
+    graph.compile();
+    graph.execute(engine->getDriverApi(), engine);
+    engine->flushAndWait();
+
+    EXPECT_EQ(std::vector<int>({ 0, 1, 2, 3 }), order);
+
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST_F(FrameGraphTest, ParallelPassesDependencies) {
+
+    // parallel passes record once the passes they depend on have, concurrently with the passes
+    // they're independent of, but their commands must still execute in order.
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    FrameGraph graph{ resourceAllocator };
+    std::vector<int> order;
+
+    std::mutex lock;
+    std::condition_variable condition;
+    bool ssaoStarted = false;
+    bool overlapped = false;
+    std::atomic<bool> shadowRecorded = false;
+    std::atomic<bool> ssaoRecorded = false;
+    std::atomic<bool> firstBlurRecorded = false;
+
+    auto const record = [&order](DriverApi& driver, int i) {
+        driver.queueCommand([&order, i]() { order.push_back(i); });
+    };
+
+    struct PassData {
+        FrameGraphId<FrameGraphTexture> input;
+        FrameGraphId<FrameGraphTexture> output;
+    };
+
+    // the shadow map is still recording when SSAO starts
+    auto& shadow = graph.addPass<PassData>("Shadow", [&](FrameGraph::Builder& builder, auto& data) {
+                data.output = builder.create<FrameGraphTexture>("Shadow map", {.width=16, .height=16});
+                data.output = builder.write(data.output, FrameGraphTexture::Usage::DEPTH_ATTACHMENT);
+                builder.parallel([]() { return size_t(1024); });
+            },
+            [&](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                std::unique_lock<std::mutex> guard(lock);
+                overlapped = condition.wait_for(guard, std::chrono::seconds(10),
+                        [&ssaoStarted]() { return ssaoStarted; });
+                record(driver, 0);
+                shadowRecorded = true;
+            });
+
+    auto& structure = graph.addPass<PassData>("Structure", [&](FrameGraph::Builder& builder, auto& data) {
+                data.output = builder.create<FrameGraphTexture>("Depth", {.width=16, .height=16});
+                data.output = builder.write(data.output, FrameGraphTexture::Usage::DEPTH_ATTACHMENT);
+            },
+            [&](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                record(driver, 1);
+            });
+
+    auto& ssao = graph.addPass<PassData>("SSAO", [&](FrameGraph::Builder& builder, auto& data) {
+                data.input = builder.read(structure->output, FrameGraphTexture::Usage::SAMPLEABLE);
+                data.output = builder.create<FrameGraphTexture>("AO", {.width=16, .height=16});
+                data.output = builder.write(data.output, FrameGraphTexture::Usage::COLOR_ATTACHMENT);
+                builder.parallel([]() { return size_t(1024); });
+            },
+            [&](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                {
+                    std::lock_guard<std::mutex> const guard(lock);
+                    ssaoStarted = true;
+                }
+                condition.notify_all();
+                record(driver, 2);
+                ssaoRecorded = true;
+            });
+
+    // depends on SSAO
+    auto& blur = graph.addPass<PassData>("AO Blur", [&](FrameGraph::Builder& builder, auto& data) {
+                data.input = builder.read(ssao->output, FrameGraphTexture::Usage::SAMPLEABLE);
+                data.output = builder.create<FrameGraphTexture>("Blurred AO", {.width=16, .height=16});
+                data.output = builder.write(data.output, FrameGraphTexture::Usage::COLOR_ATTACHMENT);
+                builder.parallel([]() { return size_t(1024); });
+            },
+            [&](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                EXPECT_TRUE(ssaoRecorded);
+                record(driver, 3);
+            });
+
+    graph.addPass<PassData>("Color", [&](FrameGraph::Builder& builder, auto& data) {
+                builder.read(shadow->output, FrameGraphTexture::Usage::SAMPLEABLE);
+                builder.read(blur->output, FrameGraphTexture::Usage::SAMPLEABLE);
+                builder.sideEffect();
+            },
+            [&](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                EXPECT_TRUE(shadowRecorded);
+                record(driver, 4);
+            });
+
+    // independent passes sharing state record one after the other
+    int const sharedState = 0;
+    graph.addPass<PassData>("First Blur", [&](FrameGraph::Builder& builder, auto& data) {
+                builder.parallel([]() { return size_t(1024); }, &sharedState);
+                builder.sideEffect();
+            },
+            [&](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                record(driver, 5);
+                firstBlurRecorded = true;
+            });
+    graph.addPass<PassData>("Second Blur", [&](FrameGraph::Builder& builder, auto& data) {
+                builder.parallel([]() { return size_t(1024); }, &sharedState);
+                builder.sideEffect();
+            },
+            [&](FrameGraphResources const&, auto const&, DriverApi& driver) {
+                EXPECT_TRUE(firstBlurRecorded);
+                record(driver, 6);
+            });
+
+    graph.compile();
+    graph.execute(engine->getDriverApi(), engine);
+    engine->flushAndWait();
+
+    EXPECT_TRUE(overlapped);
+    EXPECT_EQ(std::vector<int>({ 0, 1, 2, 3, 4, 5, 6 }), order);
+
+    Engine::destroy((Engine **)&engine);
+}
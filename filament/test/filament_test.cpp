@@ -14,11 +14,23 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include <utils/JobSystem.h>
+#include <utils/Path.h>
+#include <utils/sstream.h>
+
 #include <math/vec3.h>
 #include <math/vec4.h>
 #include <math/mat3.h>
@@ -29,18 +41,40 @@
 #include <filament/Camera.h>
 #include <filament/Color.h>
 #include <filament/Frustum.h>
+#include <filament/IndexBuffer.h>
+#include <filament/LightManager.h>
 #include <filament/Material.h>
 #include <filament/Engine.h>
+#include <filament/RenderableManager.h>
+#include <filament/Renderer.h>
+#include <filament/Scene.h>
+#include <filament/TransformManager.h>
+#include <filament/VertexBuffer.h>
+#include <filament/View.h>
+
+#include <backend/DiskBlobCache.h>
+#include <backend/Platform.h>
 
 #include <private/filament/BufferInterfaceBlock.h>
 #include <private/filament/UibStructs.h>
+#include <private/filament/Variant.h>
 #include <private/backend/BackendUtils.h>
 
 #include "Allocators.h"
+#include "Culler.h"
+#include "CullingHierarchy.h"
 #include "details/Material.h"
 #include "details/Camera.h"
 #include "Froxelizer.h"
+#include "OcclusionCuller.h"
+#include "RenderPass.h"
+#include "RenderPrimitive.h"
+#include "ResourceAllocator.h"
 #include "details/Engine.h"
+#include "details/IndexBuffer.h"
+#include "details/Scene.h"
+#include "details/VertexBuffer.h"
+#include "details/View.h"
 #include "components/RenderableManager.h"
 #include "components/TransformManager.h"
 #include "UniformBuffer.h"
@@ -283,6 +317,73 @@ TEST(FilamentTest, TransformManager) {
     EXPECT_EQ(c, tcm.getChildCount(newParent));
 }
 
+TEST(FilamentTest, TransformManagerParallel) {
+    JobSystem js;
+    js.adopt();
+    {
+        filament::FTransformManager tcm(js);
+        EntityManager& em = EntityManager::get();
+
+        // a deep chain and a wide tree, large enough to be processed in parallel
+        constexpr size_t DEPTH = 512;
+        constexpr size_t WIDTH = 4096;
+        std::vector<Entity> entities(DEPTH + WIDTH + 1);
+        em.create(entities.size(), entities.data());
+
+        auto const t = mat4f::translation(float3{ 1, 0, 0 });
+
+        tcm.openLocalTransformTransaction();
+        tcm.create(entities[0], {}, t);
+        for (size_t i = 1; i < DEPTH; i++) {
+            tcm.create(entities[i], tcm.getInstance(entities[i - 1]), t);
+        }
+        tcm.create(entities[DEPTH], {}, t);
+        for (size_t i = DEPTH + 1; i < entities.size(); i++) {
+            tcm.create(entities[i], tcm.getInstance(entities[DEPTH]), t);
+        }
+        tcm.commitLocalTransformTransaction();
+
+        auto worldX = [&](size_t i) {
+            return tcm.getWorldTransform(tcm.getInstance(entities[i]))[3].x;
+        };
+
+        EXPECT_EQ(worldX(DEPTH - 1), float(DEPTH));
+        EXPECT_EQ(worldX(DEPTH), 1.0f);
+        EXPECT_EQ(worldX(entities.size() - 1), 2.0f);
+
+        // children are always stored after their parent
+        for (size_t i = 0; i < entities.size(); i++) {
+            auto const ci = tcm.getInstance(entities[i]);
+            Entity const parent = tcm.getParent(ci);
+            if (parent) {
+                EXPECT_LT(tcm.getInstance(parent), ci);
+            }
+        }
+
+        // only change a node in the middle of the chain, and one leaf of the wide tree
+        tcm.openLocalTransformTransaction();
+        tcm.setTransform(tcm.getInstance(entities[DEPTH / 2]), mat4f::translation(float3{ 2, 0, 0 }));
+        tcm.setTransform(tcm.getInstance(entities.back()), mat4f::translation(float3{ 3, 0, 0 }));
+        tcm.commitLocalTransformTransaction();
+
+        EXPECT_EQ(worldX(DEPTH / 2 - 1), float(DEPTH / 2));
+        EXPECT_EQ(worldX(DEPTH - 1), float(DEPTH + 1));
+        EXPECT_EQ(worldX(entities.size() - 2), 2.0f);
+        EXPECT_EQ(worldX(entities.size() - 1), 4.0f);
+
+        // reparenting the wide tree under the chain
+        tcm.openLocalTransformTransaction();
+        tcm.setParent(tcm.getInstance(entities[DEPTH]), tcm.getInstance(entities[DEPTH - 1]));
+        tcm.commitLocalTransformTransaction();
+
+        EXPECT_EQ(worldX(DEPTH), float(DEPTH + 2));
+        EXPECT_EQ(worldX(entities.size() - 2), float(DEPTH + 3));
+
+        em.destroy(entities.size(), entities.data());
+    }
+    js.emancipate();
+}
+
 TEST(FilamentTest, UniformInterfaceBlock) {
 
     BufferInterfaceBlock::Builder b;
@@ -595,6 +696,1260 @@ TEST(FilamentTest, SphereCulling) {
     EXPECT_TRUE(frustum.intersects({ 0, 200 }));
 }
 
+TEST(FilamentTest, CullingKernels) {
+    // all culling kernels must agree with the scalar implementation
+    constexpr size_t count = 1024;
+    Frustum frustum(mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f));
+
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 25.0f);
+
+    std::vector<float3> centers(count);
+    std::vector<float3> extents(count);
+    std::vector<float4> spheres(count);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { position(gen), position(gen), -std::abs(position(gen)) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+        spheres[i] = { centers[i], size(gen) };
+    }
+
+    std::vector<Culler::result_type> expectedBoxes(count);
+    std::vector<Culler::result_type> expectedSpheres(count);
+    Culler::Test::intersects(Culler::Isa::SCALAR,
+            expectedBoxes.data(), frustum, centers.data(), extents.data(), count);
+    Culler::Test::intersects(Culler::Isa::SCALAR,
+            expectedSpheres.data(), frustum, spheres.data(), count);
+
+    for (auto isa : { Culler::Isa::SSE, Culler::Isa::AVX2, Culler::Isa::NEON }) {
+        if (!Culler::Test::isSupported(isa)) {
+            continue;
+        }
+        std::vector<Culler::result_type> results(count);
+        Culler::Test::intersects(isa, results.data(), frustum, centers.data(), extents.data(), count);
+        EXPECT_EQ(expectedBoxes, results);
+        Culler::Test::intersects(isa, results.data(), frustum, spheres.data(), count);
+        EXPECT_EQ(expectedSpheres, results);
+    }
+
+    // the box kernel must only modify the requested bit
+    std::vector<Culler::result_type> results(count, 0xAA);
+    Culler::intersects(results.data(), frustum, centers.data(), extents.data(), count, 3);
+    for (size_t i = 0; i < count; i++) {
+        EXPECT_EQ((0xAA & ~0x08) | (expectedBoxes[i] << 3), results[i]);
+    }
+}
+
+TEST(FilamentTest, CullingHierarchy) {
+    // the culling hierarchy must produce the same results as flat culling
+    size_t count = 10000;
+    Frustum frustum(mat4f::perspective(45.0f, 1.0f, 0.1f, 500.0f));
+
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+    std::uniform_real_distribution<float> size(0.1f, 5.0f);
+
+    std::vector<float3> centers(Culler::round(count));
+    std::vector<float3> extents(Culler::round(count));
+    std::vector<uint32_t> keys(count);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { position(gen), position(gen), position(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+        keys[i] = uint32_t(i);
+    }
+
+    auto check = [&](CullingHierarchy const& hierarchy) {
+        std::vector<Culler::result_type> expected(Culler::round(count), 0xAA);
+        std::vector<Culler::result_type> results(Culler::round(count), 0xAA);
+        Culler::intersects(expected.data(), frustum, centers.data(), extents.data(), count, 1);
+        hierarchy.cull(results.data(), frustum, 1);
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(expected[i], results[i]);
+        }
+    };
+
+    CullingHierarchy hierarchy;
+    EXPECT_EQ(CullingHierarchy::Update::REBUILD,
+            hierarchy.update(keys.data(), centers.data(), extents.data(), count));
+    EXPECT_EQ(count, hierarchy.getPrimitiveCount());
+    check(hierarchy);
+
+    EXPECT_EQ(CullingHierarchy::Update::NONE,
+            hierarchy.update(keys.data(), centers.data(), extents.data(), count));
+
+    // move a few boxes into the frustum
+    for (size_t i = 0; i < 10; i++) {
+        centers[i * 97] = { 0, 0, -10.0f - float(i) };
+    }
+    EXPECT_EQ(CullingHierarchy::Update::REFIT,
+            hierarchy.update(keys.data(), centers.data(), extents.data(), count));
+    check(hierarchy);
+
+    // primitives are inserted and removed without rebuilding the hierarchy
+    keys[0] = uint32_t(count);
+    EXPECT_EQ(CullingHierarchy::Update::REFIT,
+            hierarchy.update(keys.data(), centers.data(), extents.data(), count));
+    EXPECT_EQ(count, hierarchy.getPrimitiveCount());
+    check(hierarchy);
+
+    for (size_t i = 0; i < 100; i++) {
+        keys[i * 31] = uint32_t(count + 1 + i);
+        centers[i * 31] = { 0, 0, -20.0f - float(i) };
+    }
+    EXPECT_EQ(CullingHierarchy::Update::REFIT,
+            hierarchy.update(keys.data(), centers.data(), extents.data(), count));
+    check(hierarchy);
+
+    // the same primitives can be reported at different indices
+    std::reverse(keys.begin(), keys.begin() + count);
+    std::reverse(centers.begin(), centers.begin() + count);
+    std::reverse(extents.begin(), extents.begin() + count);
+    EXPECT_EQ(CullingHierarchy::Update::NONE,
+            hierarchy.update(keys.data(), centers.data(), extents.data(), count));
+    check(hierarchy);
+
+    // primitives that are not reported anymore are removed
+    size_t const nodeCount = hierarchy.getNodeCount();
+    EXPECT_EQ(CullingHierarchy::Update::REFIT,
+            hierarchy.update(keys.data() + 500, centers.data() + 500, extents.data() + 500,
+                    count - 1000));
+    EXPECT_EQ(count - 1000, hierarchy.getPrimitiveCount());
+    EXPECT_LE(hierarchy.getNodeCount(), nodeCount);
+    keys.erase(keys.begin(), keys.begin() + 500);
+    centers.erase(centers.begin(), centers.begin() + 500);
+    extents.erase(extents.begin(), extents.begin() + 500);
+    count -= 1000;
+    check(hierarchy);
+
+    // replacing most of the scene rebuilds the hierarchy
+    for (size_t i = 0; i < count / 2; i++) {
+        keys[i] += uint32_t(2 * count);
+    }
+    EXPECT_EQ(CullingHierarchy::Update::REBUILD,
+            hierarchy.update(keys.data(), centers.data(), extents.data(), count));
+    check(hierarchy);
+
+    EXPECT_EQ(CullingHierarchy::Update::REBUILD, hierarchy.update(nullptr, nullptr, nullptr, 0));
+    EXPECT_EQ(0, hierarchy.getPrimitiveCount());
+    EXPECT_EQ(0, hierarchy.getNodeCount());
+}
+
+TEST(FilamentTest, OcclusionCulling) {
+    // camera at the origin looking down -z
+    mat4f const viewProjection = mat4f::perspective(60.0f, 2.0f, 0.1f, 100.0f);
+
+    OcclusionCuller culler;
+    EXPECT_FALSE(culler.isOccluded({{ 0, 0, -20 }, { 1, 1, 1 }}));
+
+    // a wall 10 units away, 4 units wide and tall
+    culler.beginOccluders(viewProjection, 2.0f);
+    EXPECT_EQ(256, culler.getWidth());
+    EXPECT_EQ(128, culler.getHeight());
+    culler.rasterize(mat4f::translation(float3{ 0, 0, -10 }), Box{{ 0, 0, 0 }, { 2, 2, 0.5f }});
+    culler.endOccluders();
+    EXPECT_TRUE(culler.hasOccluders());
+
+    // the wall covers the center of the screen
+    EXPECT_LT(culler.getDepth(culler.getWidth() / 2, culler.getHeight() / 2), 1.0f);
+    EXPECT_EQ(culler.getDepth(0, 0), std::numeric_limits<float>::infinity());
+
+    // each level of the pyramid holds the farthest depth of the level below, down to 1x1
+    ASSERT_EQ(9, culler.getLevelCount());
+    for (uint32_t l = 1, w = 128, h = 64; l < 8; l++, w /= 2, h /= 2) {
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                float const farthest = std::max(
+                        std::max(culler.getDepth(2 * x, 2 * y, l - 1),
+                                culler.getDepth(2 * x + 1, 2 * y, l - 1)),
+                        std::max(culler.getDepth(2 * x, 2 * y + 1, l - 1),
+                                culler.getDepth(2 * x + 1, 2 * y + 1, l - 1)));
+                EXPECT_EQ(farthest, culler.getDepth(x, y, l));
+            }
+        }
+    }
+    // level 7 is 2x1
+    EXPECT_EQ(std::max(culler.getDepth(0, 0, 7), culler.getDepth(1, 0, 7)),
+            culler.getDepth(0, 0, 8));
+    EXPECT_EQ(std::numeric_limits<float>::infinity(), culler.getDepth(0, 0, 8));
+
+    // a box behind the wall is occluded
+    EXPECT_TRUE(culler.isOccluded({{ 0, 0, -20 }, { 1, 1, 1 }}));
+
+    // a box in front of the wall is not
+    EXPECT_FALSE(culler.isOccluded({{ 0, 0, -5 }, { 0.5f, 0.5f, 0.5f }}));
+
+    // a box behind the wall, but larger than the wall, is not
+    EXPECT_FALSE(culler.isOccluded({{ 0, 0, -20 }, { 8, 1, 1 }}));
+
+    // a box behind the wall, but off to the side, is not
+    EXPECT_FALSE(culler.isOccluded({{ 10, 0, -20 }, { 1, 1, 1 }}));
+
+    // a box crossing the near plane is never occluded
+    EXPECT_FALSE(culler.isOccluded({{ 0, 0, 0 }, { 1, 1, 1 }}));
+
+    // batched version, only tests the requested bit
+    float3 const centers[3] = {{ 0, 0, -20 }, { 0, 0, -5 }, { 0, 0, -30 }};
+    float3 const extents[3] = {{ 1, 1, 1 }, { 0.5f, 0.5f, 0.5f }, { 1, 1, 1 }};
+    Culler::result_type results[3] = { 0x3, 0x3, 0x1 };
+    culler.cull(results, centers, extents, 3, 1);
+    EXPECT_EQ(0x1, results[0]);
+    EXPECT_EQ(0x3, results[1]);
+    EXPECT_EQ(0x1, results[2]);
+
+    // occluders crossing the near plane are clipped
+    culler.beginOccluders(viewProjection, 2.0f);
+    culler.rasterize(mat4f{}, Box{{ 0, 0, -5 }, { 50, 50, 5 }});
+    culler.endOccluders();
+    EXPECT_TRUE(culler.isOccluded({{ 0, 0, -20 }, { 1, 1, 1 }}));
+    EXPECT_FALSE(culler.isOccluded({{ 0, 0, -5 }, { 1, 1, 1 }}));
+
+    // the depth buffer follows the aspect ratio of the viewport
+    culler.beginOccluders(viewProjection, 1.0f);
+    EXPECT_EQ(176, culler.getWidth());
+    EXPECT_EQ(184, culler.getHeight());
+    culler.beginOccluders(viewProjection, 0.5f);
+    EXPECT_EQ(128, culler.getWidth());
+    EXPECT_EQ(256, culler.getHeight());
+    culler.beginOccluders(viewProjection, 1000.0f);
+    EXPECT_EQ(OcclusionCuller::MAX_DIMENSION, culler.getWidth());
+    EXPECT_EQ(OcclusionCuller::TILE_SIZE, culler.getHeight());
+}
+
+TEST(FilamentTest, OcclusionCullingIsConservative) {
+    // orthographic camera looking down -z, one world unit is one pixel of the 256x128 depth buffer
+    mat4f const viewProjection = mat4f::ortho(-128, 128, -64, 64, 0.1f, 100.0f);
+
+    OcclusionCuller culler;
+    culler.beginOccluders(viewProjection, 2.0f);
+    ASSERT_EQ(256, culler.getWidth());
+    ASSERT_EQ(128, culler.getHeight());
+
+    // a wall whose right edge ends at x = 138.75 in the depth buffer, i.e. past the center of
+    // column 138 but before its end
+    culler.rasterize(mat4f::translation(float3{ 0, 0, -10 }), Box{{ 0, 0, 0 }, { 10.75f, 10, 0.5f }});
+    culler.endOccluders();
+
+    // column 137 is entirely covered by the wall, column 138 isn't
+    EXPECT_LT(culler.getDepth(137, 64), 1.0f);
+    EXPECT_EQ(culler.getDepth(138, 64), std::numeric_limits<float>::infinity());
+
+    // a box behind the wall that ends inside column 137 is occluded
+    EXPECT_TRUE(culler.isOccluded({{ 5, 0, -20 }, { 4.5f, 5, 1 }}));
+
+    // a box behind the wall that extends past its silhouette, but not past the end of column 138,
+    // is visible
+    EXPECT_FALSE(culler.isOccluded({{ 5, 0, -20 }, { 5.9f, 5, 1 }}));
+
+    // a sloped plane, its depth changes by half a unit per pixel: z = -50 - x / 2
+    float3 const vertices[4] = {
+            { -50, -50, -25 }, { 50, -50, -75 }, { 50, 50, -75 }, { -50, 50, -25 }};
+    uint32_t const indices[6] = { 0, 1, 2, 0, 2, 3 };
+    culler.beginOccluders(viewProjection, 2.0f);
+    culler.rasterize(vertices, indices, 2);
+    culler.endOccluders();
+
+    // a thin box in the right half of column 128, in front of the plane but behind the plane's
+    // depth at the center of the pixel, is visible (it stays away from the diagonal shared by
+    // the two triangles, which isn't covered)
+    EXPECT_FALSE(culler.isOccluded({{ 0.85f, -20.5f, -50.45f }, { 0.1f, 0.1f, 0.1f }}));
+
+    // the same box a bit farther is occluded
+    EXPECT_TRUE(culler.isOccluded({{ 0.85f, -20.5f, -51.5f }, { 0.1f, 0.1f, 0.1f }}));
+}
+
+TEST(FilamentTest, RenderPassRadixSort) {
+    using Command = RenderPass::Command;
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<uint64_t> field(0, 0xFF);
+
+    std::vector<uint8_t> storage(1024 * 1024);
+    RenderPass::Arena arena("test", { storage.data(), storage.data() + storage.size() });
+
+    for (size_t count : { 0, 1, 2, 3, 100, 1000, 10000 }) {
+        std::vector<Command> commands(count);
+        for (size_t i = 0; i < count; i++) {
+            // keys with many duplicates and constant bytes
+            commands[i].key = (field(gen) << 56) | (field(gen) << 24) | (field(gen) & 0xF);
+            commands[i].primitive.index = uint32_t(i);
+        }
+        std::vector<Command> expected(commands);
+        std::stable_sort(expected.begin(), expected.end());
+
+        void* const current = arena.getCurrent();
+        RenderPass::radixSortCommands(arena, commands.data(), commands.data() + count);
+        EXPECT_EQ(current, arena.getCurrent());
+
+        // the sort is stable
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(expected[i].key, commands[i].key);
+            EXPECT_EQ(expected[i].primitive.index, commands[i].primitive.index);
+        }
+    }
+}
+
+TEST(FilamentTest, RenderPassMergeCachedCommands) {
+    using Command = RenderPass::Command;
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<uint64_t> keys(0, 1000);
+    std::bernoulli_distribution isCached(0.8);
+
+    // each renderable has two commands
+    constexpr size_t renderableCount = 500;
+    auto makeCommand = [](uint64_t key, uint32_t index) {
+        Command command;
+        command.key = key;
+        command.primitive.index = index;
+        return command;
+    };
+
+    // the previous frame, sorted
+    std::vector<Command> previous;
+    for (uint32_t i = 0; i < renderableCount; i++) {
+        previous.push_back(makeCommand(keys(gen), i));
+        previous.push_back(makeCommand(keys(gen), i));
+    }
+    std::sort(previous.begin(), previous.end());
+
+    // this frame, the cached renderables keep their commands, the others generate new ones
+    std::vector<uint8_t> cached(renderableCount);
+    std::vector<Command> commands(renderableCount * 2);
+    std::vector<Command> expected;
+    size_t generatedCount = 0;
+    for (uint32_t i = 0; i < renderableCount; i++) {
+        cached[i] = isCached(gen);
+        if (!cached[i]) {
+            commands[generatedCount++] = makeCommand(keys(gen), i);
+            commands[generatedCount++] = makeCommand(keys(gen), i);
+        }
+    }
+    for (Command const& command : previous) {
+        if (cached[command.primitive.index]) {
+            expected.push_back(command);
+        }
+    }
+    expected.insert(expected.end(), commands.begin(), commands.begin() + generatedCount);
+    std::sort(expected.begin(), expected.end());
+    std::sort(commands.begin(), commands.begin() + generatedCount);
+
+    Command const* const end = RenderPass::mergeCommands(
+            commands.data(), commands.data() + generatedCount, commands.data() + commands.size(),
+            previous.data(), previous.data() + previous.size(),
+            cached.data(), cached.size());
+
+    ASSERT_EQ(expected.size(), size_t(end - commands.data()));
+    for (size_t i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(expected[i].key, commands[i].key);
+    }
+}
+
+TEST(FilamentTest, RenderPassCommandCache) {
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    FRenderableManager& rcm = engine->getRenderableManager();
+    FVertexBuffer* vb = downcast(VertexBuffer::Builder()
+            .vertexCount(3)
+            .bufferCount(1)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .build(*engine));
+    FIndexBuffer* ib = downcast(IndexBuffer::Builder()
+            .indexCount(3)
+            .bufferType(IndexBuffer::IndexType::USHORT)
+            .build(*engine));
+    FMaterialInstance* mi = engine->getDefaultMaterial()->getDefaultInstance();
+
+    constexpr size_t count = 8;
+    Entity entities[count];
+    EntityManager::get().create(count, entities);
+    FScene::RenderableSoa soa;
+    soa.setCapacity(count + 1);
+    soa.resize(count + 1);
+    for (size_t i = 0; i < count; i++) {
+        RenderableManager::Builder(1)
+                .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+                .material(0, mi)
+                .boundingBox({ {}, { 1, 1, 1 } })
+                .build(*engine, entities[i]);
+        FRenderableManager::Instance const ri = rcm.getInstance(entities[i]);
+        soa.elementAt<FScene::RENDERABLE_INSTANCE>(i) = ri;
+        soa.elementAt<FScene::VISIBILITY_STATE>(i) = rcm.getVisibility(ri);
+        soa.elementAt<FScene::SKINNING_BUFFER>(i) = rcm.getSkinningBufferInfo(ri);
+        soa.elementAt<FScene::MORPHING_BUFFER>(i) = rcm.getMorphingBufferInfo(ri);
+        soa.elementAt<FScene::WORLD_AABB_CENTER>(i) = { 0, 0, -float(i + 1) };
+        soa.elementAt<FScene::VISIBLE_MASK>(i) = 1;
+        soa.elementAt<FScene::PRIMITIVES>(i) = rcm.getRenderPrimitives(ri, 0);
+    }
+
+    std::vector<uint8_t> storage(1024 * 1024);
+    RenderPass::Arena arena("test", { storage.data(), storage.data() + storage.size() });
+    RenderPass::CommandCache cache;
+    auto build = [&]() {
+        RenderPass const pass = RenderPassBuilder(arena)
+                .commandTypeFlags(RenderPass::CommandTypeFlags::COLOR)
+                .geometry(soa, { 0, count }, {})
+                .camera(CameraInfo{})
+                .commandCache(&cache)
+                .build(*engine);
+        arena.reset();
+        return cache.getGeneratedRenderableCount();
+    };
+
+    EXPECT_EQ(count, build());
+    EXPECT_EQ(0u, build());
+    EXPECT_EQ(count, cache.getCachedRenderableCount());
+
+    // renderable changes
+    FRenderableManager::Instance const ri = soa.elementAt<FScene::RENDERABLE_INSTANCE>(1);
+    rcm.setBlendOrderAt(ri, 0, 0, 1);
+    EXPECT_EQ(1u, build());
+    EXPECT_EQ(0u, build());
+
+    // material instance changes
+    mi->setCullingMode(backend::CullingMode::FRONT);
+    EXPECT_EQ(count, build());
+
+    // visibility and depth bucket changes
+    soa.elementAt<FScene::VISIBLE_MASK>(2) = 0;
+    soa.elementAt<FScene::WORLD_AABB_CENTER>(3) = { 0, 0, -1000 };
+    EXPECT_EQ(2u, build());
+
+    // the last renderable moves to the instance of a destroyed one
+    FRenderableManager::Instance const first = soa.elementAt<FScene::RENDERABLE_INSTANCE>(0);
+    rcm.destroy(entities[0]);
+    EXPECT_EQ(first, rcm.getInstance(entities[count - 1]));
+    for (size_t i : { size_t(0), count - 1 }) {
+        soa.elementAt<FScene::RENDERABLE_INSTANCE>(i) = first;
+        soa.elementAt<FScene::MORPHING_BUFFER>(i) = rcm.getMorphingBufferInfo(first);
+        soa.elementAt<FScene::PRIMITIVES>(i) = rcm.getRenderPrimitives(first, 0);
+    }
+    EXPECT_EQ(2u, build());
+
+    mi->setCullingMode(backend::CullingMode::BACK);
+    for (size_t i = 1; i < count; i++) {
+        rcm.destroy(entities[i]);
+    }
+    EntityManager::get().destroy(count, entities);
+    engine->destroy(vb);
+    engine->destroy(ib);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, RenderPassDeferred) {
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    FRenderableManager& rcm = engine->getRenderableManager();
+    FVertexBuffer* vb = downcast(VertexBuffer::Builder()
+            .vertexCount(3)
+            .bufferCount(1)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .build(*engine));
+    FIndexBuffer* ib = downcast(IndexBuffer::Builder()
+            .indexCount(3)
+            .bufferType(IndexBuffer::IndexType::USHORT)
+            .build(*engine));
+    FMaterialInstance* mi = engine->getDefaultMaterial()->getDefaultInstance();
+
+    constexpr size_t count = 8;
+    Entity entities[count];
+    EntityManager::get().create(count, entities);
+    FScene::RenderableSoa soa;
+    soa.setCapacity(count + 1);
+    soa.resize(count + 1);
+    for (size_t i = 0; i < count; i++) {
+        RenderableManager::Builder(1)
+                .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+                .material(0, mi)
+                .boundingBox({ {}, { 1, 1, 1 } })
+                .build(*engine, entities[i]);
+        FRenderableManager::Instance const ri = rcm.getInstance(entities[i]);
+        soa.elementAt<FScene::RENDERABLE_INSTANCE>(i) = ri;
+        soa.elementAt<FScene::VISIBILITY_STATE>(i) = rcm.getVisibility(ri);
+        soa.elementAt<FScene::SKINNING_BUFFER>(i) = rcm.getSkinningBufferInfo(ri);
+        soa.elementAt<FScene::MORPHING_BUFFER>(i) = rcm.getMorphingBufferInfo(ri);
+        soa.elementAt<FScene::WORLD_AABB_CENTER>(i) = { 0, 0, -float(i + 1) };
+        soa.elementAt<FScene::VISIBLE_MASK>(i) = (i % 3) ? 1 : 2;
+        soa.elementAt<FScene::PRIMITIVES>(i) = rcm.getRenderPrimitives(ri, 0);
+    }
+
+    std::vector<uint8_t> storage(1024 * 1024);
+    RenderPass::Arena arena("test", { storage.data(), storage.data() + storage.size() });
+    auto builder = [&]() {
+        return RenderPassBuilder(arena)
+                .commandTypeFlags(RenderPass::CommandTypeFlags::SHADOW)
+                .geometry(soa, { 1, count }, {})
+                .camera(CameraInfo{})
+                .visibilityMask(1);
+    };
+
+    RenderPass const expected = builder().build(*engine);
+    RenderPass deferred = builder().deferred(true).build(*engine);
+
+    // the next pass changes the visibility and primitives of the renderables, this must not
+    // affect the deferred pass
+    for (size_t i = 0; i < count; i++) {
+        soa.elementAt<FScene::VISIBLE_MASK>(i) = 1;
+        soa.elementAt<FScene::PRIMITIVES>(i) = {};
+    }
+    RenderPass empty = builder().deferred(true).build(*engine);
+
+    deferred.finish(*engine);
+    ASSERT_EQ(expected.end() - expected.begin(), deferred.end() - deferred.begin());
+    EXPECT_FALSE(deferred.empty());
+    for (auto const *p = expected.begin(), *q = deferred.begin(); p != expected.end(); ++p, ++q) {
+        EXPECT_EQ(p->key, q->key);
+        EXPECT_EQ(p->primitive.index, q->primitive.index);
+    }
+
+    empty.finish(*engine);
+    EXPECT_TRUE(empty.empty());
+
+    for (size_t i = 0; i < count; i++) {
+        rcm.destroy(entities[i]);
+    }
+    EntityManager::get().destroy(count, entities);
+    engine->destroy(vb);
+    engine->destroy(ib);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, RenderPassInstancingHash) {
+    using PrimitiveInfo = RenderPass::PrimitiveInfo;
+    std::vector<FRenderPrimitive> primitives(1000);
+
+    // identical draws of distinct renderables have the same hash
+    PrimitiveInfo lhs{}, rhs{};
+    lhs.primitive = rhs.primitive = &primitives[0];
+    lhs.index = 1;
+    rhs.index = 2;
+    EXPECT_EQ(RenderPass::makeInstancingHash(lhs), RenderPass::makeInstancingHash(rhs));
+
+    // a different winding can't be instanced
+    rhs.rasterState.inverseFrontFaces = !lhs.rasterState.inverseFrontFaces;
+    EXPECT_NE(RenderPass::makeInstancingHash(lhs), RenderPass::makeInstancingHash(rhs));
+
+    // distinct primitives should rarely collide
+    std::unordered_set<uint16_t> hashes;
+    for (auto const& primitive : primitives) {
+        PrimitiveInfo info{};
+        info.primitive = &primitive;
+        hashes.insert(RenderPass::makeInstancingHash(info));
+    }
+    EXPECT_GT(hashes.size(), primitives.size() * 9 / 10);
+}
+
+TEST(FilamentTest, SecondaryCommandStream) {
+    using namespace filament;
+    using namespace filament::backend;
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    DriverApi& driver = engine->getDriverApi();
+    utils::JobSystem& js = engine->getJobSystem();
+
+    std::vector<int> order;
+
+    driver.queueCommand([&order]() { order.push_back(0); });
+    CommandStream::Reservation const r1 = driver.reserve();
+    driver.queueCommand([&order]() { order.push_back(3); });
+    CommandStream::Reservation const r2 = driver.reserve();
+    CommandStream::Reservation const r3 = driver.reserve(); // left empty
+    driver.queueCommand([&order]() { order.push_back(6); });
+    EXPECT_EQ(3u, driver.getPendingReservationCount());
+
+    // record in the reverse order of the reservations, from worker threads
+    auto* parent = js.createJob();
+    js.run(jobs::createJob(js, parent, [&driver, &order, r2]() {
+        SecondaryCommandStream secondary(driver, r2, 4096);
+        secondary.getStream().queueCommand([&order]() { order.push_back(4); });
+        secondary.getStream().queueCommand([&order]() { order.push_back(5); });
+        secondary.finish();
+    }));
+    js.run(jobs::createJob(js, parent, [&driver, &order, r1]() {
+        SecondaryCommandStream secondary(driver, r1, 4096);
+        secondary.getStream().queueCommand([&order]() { order.push_back(1); });
+        secondary.getStream().queueCommand([&order]() { order.push_back(2); });
+    }));
+    js.run(jobs::createJob(js, parent, [&driver, r3]() {
+        SecondaryCommandStream secondary(driver, r3, 4096);
+    }));
+    js.runAndWait(parent);
+    EXPECT_EQ(0u, driver.getPendingReservationCount());
+
+    engine->flushAndWait();
+
+    EXPECT_EQ(std::vector<int>({ 0, 1, 2, 3, 4, 5, 6 }), order);
+
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, SecondaryCommandStreamFull) {
+    using namespace filament;
+    using namespace filament::backend;
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    DriverApi& driver = engine->getDriverApi();
+
+    // a secondary stream can be filled up to its capacity, the jump back to the primary stream
+    // doesn't take any of it, and its buffer is reused once executed
+    constexpr size_t COMMAND_COUNT = 16;
+    size_t const commandSize = CustomCommand::align(sizeof(CustomCommand));
+    std::vector<int> order;
+    for (int frame = 0; frame < 2; frame++) {
+        CommandStream::Reservation const r = driver.reserve();
+        driver.queueCommand([&order]() { order.push_back(-1); });
+        {
+            SecondaryCommandStream secondary(driver, r, COMMAND_COUNT * commandSize);
+            for (int i = 0; i < int(COMMAND_COUNT); i++) {
+                secondary.getStream().queueCommand([&order, i]() { order.push_back(i); });
+            }
+        }
+        engine->flushAndWait();
+    }
+
+    ASSERT_EQ(2 * (COMMAND_COUNT + 1), order.size());
+    for (size_t frame = 0; frame < 2; frame++) {
+        int const* const commands = order.data() + frame * (COMMAND_COUNT + 1);
+        for (size_t i = 0; i < COMMAND_COUNT; i++) {
+            EXPECT_EQ(int(i), commands[i]);
+        }
+        EXPECT_EQ(-1, commands[COMMAND_COUNT]);
+    }
+
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, SecondaryCommandStreamUpload) {
+    using namespace filament;
+    using namespace filament::backend;
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    DriverApi& driver = engine->getDriverApi();
+    utils::JobSystem& js = engine->getJobSystem();
+
+    // worker threads can upload buffers, the data is released once the upload has executed
+    constexpr uint32_t UPLOAD_COUNT = 4;
+    constexpr uint32_t UPLOAD_SIZE = 256;
+    BufferObjectHandle const bo = driver.createBufferObject(UPLOAD_COUNT * UPLOAD_SIZE,
+            BufferObjectBinding::VERTEX, BufferUsage::STATIC);
+    std::atomic<uint32_t> releasedCount{ 0 };
+
+    CommandStream::Reservation const r = driver.reserve();
+    js.runAndWait(jobs::createJob(js, nullptr, [&driver, &releasedCount, bo, r]() {
+        SecondaryCommandStream secondary(driver, r, 4096);
+        for (uint32_t i = 0; i < UPLOAD_COUNT; i++) {
+            secondary.getStream().updateBufferObject(bo, { malloc(UPLOAD_SIZE), UPLOAD_SIZE,
+                    [](void* buffer, size_t, void* user) {
+                        free(buffer);
+                        static_cast<std::atomic<uint32_t>*>(user)->fetch_add(1);
+                    }, &releasedCount }, i * UPLOAD_SIZE);
+        }
+    }));
+    EXPECT_EQ(0u, releasedCount.load());
+
+    engine->flushAndWait();
+    EXPECT_EQ(UPLOAD_COUNT, releasedCount.load());
+
+    driver.destroyBufferObject(bo);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, CommandStreamProfiler) {
+    using namespace filament;
+    using namespace filament::backend;
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    DriverApi& driver = engine->getDriverApi();
+
+    // profiling starts with the next command buffer executed
+    engine->flushAndWait();
+    engine->setCommandStreamProfilingEnabled(true);
+    EXPECT_TRUE(engine->isCommandStreamProfilingEnabled());
+
+    for (uint32_t frame = 0; frame < 3; frame++) {
+        driver.beginFrame(0, frame);
+        for (uint32_t i = 0; i <= frame; i++) {
+            driver.queueCommand([]() {});
+        }
+        driver.allocate(256);
+        driver.endFrame(frame);
+    }
+    engine->flushAndWait();
+
+    CommandStreamProfiler const* profiler = engine->getCommandStreamProfiler();
+    ASSERT_NE(nullptr, profiler);
+    ASSERT_EQ(3u, profiler->getFrameCount());
+
+    auto getId = [profiler](const char* name) {
+        for (size_t i = 0; i < profiler->getCommandCount(); i++) {
+            if (!strcmp(profiler->getCommandName(i), name)) {
+                return i;
+            }
+        }
+        return profiler->getCommandCount();
+    };
+    size_t const custom = getId("queueCommand");
+    size_t const endFrame = getId("endFrame");
+    size_t const noop = getId("noop");
+    ASSERT_LT(custom, profiler->getCommandCount());
+    ASSERT_LT(endFrame, profiler->getCommandCount());
+    ASSERT_LT(noop, profiler->getCommandCount());
+
+    for (uint32_t frame = 0; frame < 3; frame++) {
+        auto const stats = profiler->getFrameStats(frame);
+        EXPECT_EQ(frame + 1, stats[custom].count);
+        EXPECT_EQ(1u, stats[endFrame].count);
+        EXPECT_GE(stats[custom].bytes, (frame + 1) * sizeof(std::function<void()>));
+        // the memory returned by allocate() is accounted for as a noop
+        EXPECT_GE(stats[noop].bytes, 256u);
+    }
+    // flushAndWait() itself uses custom commands
+    uint32_t const customCount = profiler->getTotalStats()[custom].count;
+    EXPECT_GE(customCount, 6u);
+
+    utils::io::sstream histogram;
+    engine->writeCommandStreamHistogram(histogram);
+    EXPECT_NE(nullptr, strstr(histogram.c_str(), "frame,command,count,bytes,duration_ns"));
+    EXPECT_NE(nullptr, strstr(histogram.c_str(), "2,queueCommand,3,"));
+
+    utils::io::sstream trace;
+    engine->writeCommandStreamTrace(trace);
+    EXPECT_NE(nullptr, strstr(trace.c_str(), "\"traceEvents\""));
+    EXPECT_NE(nullptr, strstr(trace.c_str(), "\"name\":\"endFrame\""));
+
+    // disabling keeps the data around
+    engine->setCommandStreamProfilingEnabled(false);
+    driver.queueCommand([]() {});
+    engine->flushAndWait();
+    EXPECT_EQ(customCount, profiler->getTotalStats()[custom].count);
+
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, MaterialVariantManifest) {
+    using namespace filament;
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    FMaterial const* material = engine->getDefaultMaterial();
+
+    // the default material is unlit
+    Variant const standard{};
+    Variant const skinned{ Variant::SKN };
+    Variant const fog{ Variant::FOG };
+
+    // variants are recorded once, in the order they're first used
+    material->prepareProgram(skinned);
+    material->prepareProgram(standard);
+    material->prepareProgram(skinned);
+    auto used = material->getUsedVariants();
+    ASSERT_EQ(2u, used.size());
+    EXPECT_EQ(skinned, used[0]);
+    EXPECT_EQ(standard, used[1]);
+
+    char id[17];
+    snprintf(id, sizeof(id), "%016" PRIx64, material->getCacheId());
+
+    utils::io::sstream manifest;
+    engine->writeMaterialVariantManifest(manifest);
+    std::string const expected = std::string("filament-variants 1\n") +
+            id + " 0800 " + material->getName().c_str_safe() + "\n";
+    EXPECT_EQ(expected, manifest.c_str());
+
+    EXPECT_FALSE(engine->loadMaterialVariantManifest("garbage", 7));
+
+    // loading a manifest compiles the listed variants of the existing materials...
+    EXPECT_FALSE(material->isCached(fog));
+    std::string const entry = std::string("filament-variants 1\n") + id + " 2000 name\n";
+    EXPECT_TRUE(engine->loadMaterialVariantManifest(entry.data(), entry.size()));
+    EXPECT_TRUE(material->isCached(fog));
+
+    // ...but doesn't count as using them
+    EXPECT_EQ(2u, material->getUsedVariants().size());
+
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, ResourceAllocatorStats) {
+    using namespace filament;
+    using namespace filament::backend;
+
+    FEngine* engine = downcast(Engine::create(Engine::Backend::NOOP));
+    ResourceAllocator& allocator = engine->getResourceAllocator();
+    Engine::ResourceAllocatorStats const initial = engine->getResourceAllocatorStats();
+
+    auto const create = [&](uint32_t size) {
+        return allocator.createTexture("test", SamplerType::SAMPLER_2D, 1,
+                TextureFormat::RGBA8, 1, size, size, 1,
+                { TextureSwizzle::CHANNEL_0, TextureSwizzle::CHANNEL_1,
+                  TextureSwizzle::CHANNEL_2, TextureSwizzle::CHANNEL_3 },
+                TextureUsage::COLOR_ATTACHMENT);
+    };
+
+    // a released texture is kept in the cache and reused
+    allocator.destroyTexture(create(16));
+    TextureHandle const texture = create(16);
+    Engine::ResourceAllocatorStats stats = engine->getResourceAllocatorStats();
+    EXPECT_EQ(initial.misses + 1, stats.misses);
+    EXPECT_EQ(initial.hits + 1, stats.hits);
+    EXPECT_EQ(initial.inUseSize + 16 * 16 * 4, stats.inUseSize);
+    EXPECT_EQ(initial.inUseCount + 1, stats.inUseCount);
+
+    allocator.destroyTexture(texture);
+    stats = engine->getResourceAllocatorStats();
+    EXPECT_EQ(initial.cachedSize + 16 * 16 * 4, stats.cachedSize);
+    EXPECT_EQ(initial.inUseSize, stats.inUseSize);
+
+    // textures are evicted by gc() when the cache exceeds its budget
+    engine->setResourceAllocatorCacheBudget(0);
+    EXPECT_EQ(0u, engine->getResourceAllocatorCacheBudget());
+    allocator.gc();
+    stats = engine->getResourceAllocatorStats();
+    EXPECT_EQ(0u, stats.cachedSize);
+    EXPECT_EQ(0u, stats.cachedCount);
+    EXPECT_EQ(initial.evictions + initial.cachedCount + 1, stats.evictions);
+
+    // and textures larger than the budget are never cached
+    engine->setResourceAllocatorCacheBudget(1024);
+    allocator.destroyTexture(create(32));
+    stats = engine->getResourceAllocatorStats();
+    EXPECT_EQ(0u, stats.cachedCount);
+    EXPECT_EQ(initial.evictions + initial.cachedCount + 2, stats.evictions);
+
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, ShadowMapCaching) {
+    Engine* engine = Engine::create(Engine::Backend::NOOP);
+    SwapChain* swapChain = engine->createSwapChain(64, 64);
+    Renderer* renderer = engine->createRenderer();
+    Scene* scene = engine->createScene();
+    Entity const cameraEntity = EntityManager::get().create();
+    Camera* camera = engine->createCamera(cameraEntity);
+    camera->setProjection(45.0, 1.0, 0.1, 100.0);
+
+    View* view = engine->createView();
+    view->setViewport({ 0, 0, 64, 64 });
+    view->setScene(scene);
+    view->setCamera(camera);
+    view->setShadowMapCachingOptions({ .enabled = true });
+
+    Entity const sun = EntityManager::get().create();
+    LightManager::Builder(LightManager::Type::DIRECTIONAL)
+            .direction({ 0, 0, -1 })
+            .castShadows(true)
+            .build(*engine, sun);
+    scene->addEntity(sun);
+
+    static float3 const positions[3] = {{ -1, -1, 0 }, { 1, -1, 0 }, { 0, 1, 0 }};
+    static uint16_t const indices[3] = { 0, 1, 2 };
+    VertexBuffer* vb = VertexBuffer::Builder()
+            .vertexCount(3)
+            .bufferCount(1)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .build(*engine);
+    vb->setBufferAt(*engine, 0, { positions, sizeof(positions) });
+    IndexBuffer* ibs[2];
+    for (IndexBuffer*& ib : ibs) {
+        ib = IndexBuffer::Builder()
+                .indexCount(3)
+                .bufferType(IndexBuffer::IndexType::USHORT)
+                .build(*engine);
+        ib->setBuffer(*engine, { indices, sizeof(indices) });
+    }
+
+    // a shadow caster in front of a larger receiver
+    TransformManager& tcm = engine->getTransformManager();
+    RenderableManager& rcm = engine->getRenderableManager();
+    Entity renderables[2];
+    EntityManager::get().create(2, renderables);
+    Entity const caster = renderables[0];
+    Entity const receiver = renderables[1];
+    for (Entity const entity : renderables) {
+        tcm.create(entity);
+        RenderableManager::Builder(1)
+                .boundingBox({{ 0, 0, 0 }, { 1, 1, 0.1f }})
+                .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ibs[0])
+                .castShadows(entity == caster)
+                .receiveShadows(entity == receiver)
+                .build(*engine, entity);
+        scene->addEntity(entity);
+    }
+    tcm.setTransform(tcm.getInstance(receiver),
+            mat4f::translation(float3{ 0, 0, -10 }) * mat4f::scaling(float3{ 10, 10, 1 }));
+
+    MaterialInstance* mi = engine->getDefaultMaterial()->createInstance();
+
+    auto renderFrame = [&](float x) -> View::ShadowMapStats {
+        tcm.setTransform(tcm.getInstance(caster), mat4f::translation(float3{ x, 0, -5 }));
+        EXPECT_TRUE(renderer->beginFrame(swapChain));
+        renderer->render(view);
+        renderer->endFrame();
+        return view->getShadowMapStats();
+    };
+
+    // the first frame renders the shadow map, static frames reuse it
+    View::ShadowMapStats stats = renderFrame(0.0f);
+    EXPECT_EQ(1u, stats.renderedCount);
+    EXPECT_EQ(0u, stats.cachedCount);
+    stats = renderFrame(0.0f);
+    EXPECT_EQ(0u, stats.renderedCount);
+    EXPECT_EQ(1u, stats.cachedCount);
+
+    // moving the caster invalidates the shadow map
+    stats = renderFrame(1.0f);
+    EXPECT_EQ(1u, stats.renderedCount);
+    EXPECT_EQ(0u, stats.cachedCount);
+    stats = renderFrame(1.0f);
+    EXPECT_EQ(0u, stats.renderedCount);
+    EXPECT_EQ(1u, stats.cachedCount);
+
+    // so do changing the caster's material instance...
+    rcm.setMaterialInstanceAt(rcm.getInstance(caster), 0, mi);
+    stats = renderFrame(1.0f);
+    EXPECT_EQ(1u, stats.renderedCount);
+    EXPECT_EQ(0u, stats.cachedCount);
+
+    // ...or its geometry, even with the same index count
+    rcm.setGeometryAt(rcm.getInstance(caster), 0, RenderableManager::PrimitiveType::TRIANGLES,
+            vb, ibs[1], 0, 3);
+    stats = renderFrame(1.0f);
+    EXPECT_EQ(1u, stats.renderedCount);
+    EXPECT_EQ(0u, stats.cachedCount);
+
+    // changes to the content of the buffers are only known through invalidateShadowMaps()
+    vb->setBufferAt(*engine, 0, { positions, sizeof(positions) });
+    view->invalidateShadowMaps();
+    stats = renderFrame(1.0f);
+    EXPECT_EQ(1u, stats.renderedCount);
+    EXPECT_EQ(0u, stats.cachedCount);
+    stats = renderFrame(1.0f);
+    EXPECT_EQ(0u, stats.renderedCount);
+    EXPECT_EQ(1u, stats.cachedCount);
+
+    engine->flushAndWait();
+    for (Entity const entity : renderables) {
+        engine->destroy(entity);
+    }
+    engine->destroy(sun);
+    engine->destroy(mi);
+    engine->destroy(vb);
+    for (IndexBuffer* ib : ibs) {
+        engine->destroy(ib);
+    }
+    engine->destroy(view);
+    engine->destroy(scene);
+    engine->destroyCameraComponent(cameraEntity);
+    EntityManager::get().destroy(2, renderables);
+    EntityManager::get().destroy(sun);
+    EntityManager::get().destroy(cameraEntity);
+    engine->destroy(renderer);
+    engine->destroy(swapChain);
+    Engine::destroy(&engine);
+}
+
+TEST(FilamentTest, DiskBlobCache) {
+    using namespace filament::backend;
+
+    // a platform that only provides the blob cache
+    struct FakePlatform : public Platform {
+        int getOSVersion() const noexcept override { return 0; }
+        Driver* createDriver(void*, DriverConfig const&) noexcept override { return nullptr; }
+    };
+
+    Path const dir = Path::getTemporaryDirectory().concat(Path("filament_test_blob_cache"));
+    Path(dir.concat(Path("test.data"))).unlinkFile();
+    Path(dir.concat(Path("test.index"))).unlinkFile();
+
+    DiskBlobCache::Config const config{
+            .path = dir.c_str(), .name = "test", .version = "1", .maxSize = 4096 };
+
+    auto makeValue = [](uint8_t seed, size_t size) {
+        std::vector<uint8_t> value(size);
+        for (size_t i = 0; i < size; i++) {
+            value[i] = uint8_t(seed + i);
+        }
+        return value;
+    };
+    std::vector<uint8_t> const value = makeValue(1, 300);
+    uint64_t const key = 42;
+
+    { // insert and retrieve through a Platform
+        DiskBlobCache cache(config);
+        EXPECT_TRUE(cache.isPersistent());
+        FakePlatform platform;
+        cache.attach(platform);
+        EXPECT_TRUE(platform.hasBlobFunc());
+
+        platform.insertBlob(&key, sizeof(key), value.data(), value.size());
+        EXPECT_EQ(1u, cache.getEntryCount());
+
+        // buffer too small, only the size is returned
+        std::vector<uint8_t> buffer(100, 0);
+        EXPECT_EQ(value.size(), platform.retrieveBlob(&key, sizeof(key), buffer.data(), 100));
+        EXPECT_EQ(std::vector<uint8_t>(100, 0), buffer);
+
+        buffer.resize(value.size());
+        EXPECT_EQ(value.size(),
+                platform.retrieveBlob(&key, sizeof(key), buffer.data(), buffer.size()));
+        EXPECT_EQ(value, buffer);
+
+        uint64_t const otherKey = 43;
+        EXPECT_EQ(0u, platform.retrieveBlob(&otherKey, sizeof(otherKey),
+                buffer.data(), buffer.size()));
+    }
+
+    { // the cache persists
+        DiskBlobCache cache(config);
+        EXPECT_EQ(1u, cache.getEntryCount());
+        std::vector<uint8_t> buffer(value.size());
+        EXPECT_EQ(value.size(), cache.retrieve(&key, sizeof(key), buffer.data(), buffer.size()));
+        EXPECT_EQ(value, buffer);
+    }
+
+    { // the index is rebuilt from the data file if it's missing
+        Path(dir.concat(Path("test.index"))).unlinkFile();
+        DiskBlobCache cache(config);
+        EXPECT_EQ(1u, cache.getEntryCount());
+        std::vector<uint8_t> buffer(value.size());
+        EXPECT_EQ(value.size(), cache.retrieve(&key, sizeof(key), buffer.data(), buffer.size()));
+        EXPECT_EQ(value, buffer);
+    }
+
+    { // corrupted entries are discarded
+        FILE* file = fopen(dir.concat(Path("test.data")).c_str(), "r+b");
+        ASSERT_NE(nullptr, file);
+        fseek(file, -1, SEEK_END);
+        fputc(0xFF, file);
+        fclose(file);
+        DiskBlobCache cache(config);
+        std::vector<uint8_t> buffer(value.size(), 0xAB);
+        EXPECT_EQ(0u, cache.retrieve(&key, sizeof(key), buffer.data(), buffer.size()));
+        EXPECT_EQ(0u, cache.getEntryCount());
+        // the caller's buffer is not overwritten
+        EXPECT_EQ(std::vector<uint8_t>(value.size(), 0xAB), buffer);
+    }
+
+    { // least recently used entries are evicted
+        DiskBlobCache cache(config);
+        std::vector<uint8_t> buffer(value.size());
+        for (uint64_t k = 0; k < 64; k++) {
+            std::vector<uint8_t> const v = makeValue(uint8_t(k), value.size());
+            cache.insert(&k, sizeof(k), v.data(), v.size());
+            // keep the first entry in use
+            uint64_t const first = 0;
+            EXPECT_EQ(value.size(),
+                    cache.retrieve(&first, sizeof(first), buffer.data(), buffer.size()));
+            EXPECT_LE(cache.getSize(), config.maxSize);
+        }
+        EXPECT_LT(cache.getEntryCount(), 64u);
+        uint64_t const oldest = 1;
+        EXPECT_EQ(0u, cache.retrieve(&oldest, sizeof(oldest), buffer.data(), buffer.size()));
+        uint64_t const newest = 63;
+        EXPECT_EQ(value.size(),
+                cache.retrieve(&newest, sizeof(newest), buffer.data(), buffer.size()));
+        EXPECT_EQ(makeValue(63, value.size()), buffer);
+    }
+
+    { // the data file was compacted, check it's still consistent
+        DiskBlobCache cache(config);
+        std::vector<uint8_t> buffer(value.size());
+        uint64_t const newest = 63;
+        EXPECT_EQ(value.size(),
+                cache.retrieve(&newest, sizeof(newest), buffer.data(), buffer.size()));
+        EXPECT_EQ(makeValue(63, value.size()), buffer);
+    }
+
+    { // the cache is discarded when the version changes
+        DiskBlobCache::Config newConfig = config;
+        newConfig.version = "2";
+        DiskBlobCache cache(newConfig);
+        EXPECT_EQ(0u, cache.getEntryCount());
+    }
+
+    Path(dir.concat(Path("test.data"))).unlinkFile();
+    Path(dir.concat(Path("test.index"))).unlinkFile();
+}
+
+TEST(FilamentTest, VelocityVariant) {
+    using namespace filament;
+
+    Variant const velocity{ Variant::SPECIAL_VELOCITY };
+    EXPECT_TRUE(Variant::isValid(velocity));
+    EXPECT_TRUE(Variant::isVelocityVariant(velocity));
+    EXPECT_TRUE(Variant::isVelocityVariant(Variant{ Variant::SPECIAL_VELOCITY | Variant::SKN }));
+    EXPECT_FALSE(Variant::isVSMVariant(velocity));
+    EXPECT_FALSE(Variant::isPickingVariant(velocity));
+
+    // the other depth variants are not velocity variants
+    EXPECT_FALSE(Variant::isVelocityVariant(Variant{ Variant::DEPTH_VARIANT }));
+    EXPECT_FALSE(Variant::isVelocityVariant(Variant{ Variant::DEPTH_VARIANT | Variant::VSM }));
+    EXPECT_FALSE(Variant::isVelocityVariant(Variant{ Variant::DEPTH_VARIANT | Variant::PCK }));
+    EXPECT_TRUE(Variant::isPickingVariant(Variant{ Variant::DEPTH_VARIANT | Variant::PCK }));
+
+    // the vertex shader needs to know about velocity, unlike with picking
+    EXPECT_EQ(velocity, Variant::filterVariantVertex(velocity));
+    EXPECT_EQ(Variant{ Variant::DEPTH_VARIANT },
+            Variant::filterVariantVertex(Variant{ Variant::DEPTH_VARIANT | Variant::PCK }));
+    EXPECT_EQ(velocity, Variant::filterVariantFragment(velocity));
+
+    // unlit materials need the velocity variant too
+    EXPECT_EQ(velocity, Variant::filterVariant(velocity, false));
+
+    // filtering out VSM also filters out velocity
+    EXPECT_EQ(Variant{ Variant::DEPTH_VARIANT },
+            Variant::filterUserVariant(velocity, UserVariantFilterMask(UserVariantFilterBit::VSM)));
+}
+
+static void expectMatrixNear(mat4f const& expected, std140::mat44 const& actual) {
+    for (size_t i = 0; i < 4; i++) {
+        for (size_t j = 0; j < 4; j++) {
+            EXPECT_NEAR(expected[i][j], actual[i][j], 1e-5f) << "column " << i << ", row " << j;
+        }
+    }
+}
+
+TEST(FilamentTest, PrepareMotionVectors) {
+    using Instance = utils::EntityInstance<RenderableManager>;
+    using MotionVectors = FrameHistoryEntry::MotionVectors;
+
+    mat4f const rotation = mat4f::rotation(1.0f, float3{ 0, 1, 0 });
+
+    // renderable 1 moves, renderable 2 doesn't, renderable 3 only becomes visible in frame 2
+    FScene::RenderableSoa soa;
+    soa.setCapacity(3);
+    soa.resize(3);
+    for (size_t i = 0; i < 3; i++) {
+        soa.elementAt<FScene::RENDERABLE_INSTANCE>(i) = Instance(i + 1);
+    }
+    soa.elementAt<FScene::WORLD_TRANSFORM>(0) = mat4f::translation(float3{ 1, 2, 3 });
+    soa.elementAt<FScene::WORLD_TRANSFORM>(1) = rotation;
+    soa.elementAt<FScene::WORLD_TRANSFORM>(2) = mat4f::translation(float3{ -1, 0, 0 });
+    PerRenderableData* const ubo = soa.data<FScene::UBO>();
+
+    // frame 1: without history, nothing moves
+    MotionVectors const none{};
+    MotionVectors frame1;
+    FView::prepareMotionVectors(none, frame1, soa, { 0, 2 }, mat4{});
+    expectMatrixNear(mat4f{}, ubo[0].previousWorldFromWorldMatrix);
+    expectMatrixNear(mat4f{}, ubo[1].previousWorldFromWorldMatrix);
+    ASSERT_EQ(3u, frame1.transforms.size());
+    EXPECT_EQ(0.0f, frame1.transforms[0][3][3]);
+    EXPECT_EQ(mat4f::translation(float3{ 1, 2, 3 }), frame1.transforms[1]);
+    EXPECT_EQ(rotation, frame1.transforms[2]);
+
+    // frame 2: renderable 1 moves by +1 in x, renderable 3 is new
+    soa.elementAt<FScene::WORLD_TRANSFORM>(0) = mat4f::translation(float3{ 2, 2, 3 });
+    MotionVectors frame2;
+    FView::prepareMotionVectors(frame1, frame2, soa, { 0, 3 }, mat4{});
+    expectMatrixNear(mat4f::translation(float3{ -1, 0, 0 }), ubo[0].previousWorldFromWorldMatrix);
+    expectMatrixNear(mat4f{}, ubo[1].previousWorldFromWorldMatrix);
+    expectMatrixNear(mat4f{}, ubo[2].previousWorldFromWorldMatrix);
+    ASSERT_EQ(4u, frame2.transforms.size());
+    EXPECT_EQ(mat4f::translation(float3{ -1, 0, 0 }), frame2.transforms[3]);
+
+    // frame 3: the world origin moves, which moves all the world transforms but isn't a motion
+    mat4 const worldOrigin = mat4::translation(double3{ 10, 0, 0 });
+    for (size_t i = 0; i < 3; i++) {
+        soa.elementAt<FScene::WORLD_TRANSFORM>(i) =
+                mat4f{ worldOrigin * mat4{ frame2.transforms[i + 1] }};
+    }
+    MotionVectors frame3;
+    FView::prepareMotionVectors(frame2, frame3, soa, { 0, 3 }, worldOrigin);
+    expectMatrixNear(mat4f{}, ubo[0].previousWorldFromWorldMatrix);
+    expectMatrixNear(mat4f{}, ubo[1].previousWorldFromWorldMatrix);
+    expectMatrixNear(mat4f{}, ubo[2].previousWorldFromWorldMatrix);
+    EXPECT_EQ(worldOrigin, frame3.worldTransform);
+
+    // frame 4: renderable 3 is hidden, then visible again in frame 5 where it is considered new
+    MotionVectors frame4;
+    FView::prepareMotionVectors(frame3, frame4, soa, { 0, 2 }, worldOrigin);
+    soa.elementAt<FScene::WORLD_TRANSFORM>(2) = mat4f::translation(float3{ 20, 0, 0 });
+    MotionVectors frame5;
+    FView::prepareMotionVectors(frame4, frame5, soa, { 0, 3 }, worldOrigin);
+    expectMatrixNear(mat4f{}, ubo[2].previousWorldFromWorldMatrix);
+}
+
+TEST(FilamentTest, MotionVectorsFrame) {
+    Engine* engine = Engine::create(Engine::Backend::NOOP);
+    SwapChain* swapChain = engine->createSwapChain(64, 64);
+    Renderer* renderer = engine->createRenderer();
+    Scene* scene = engine->createScene();
+    Entity const cameraEntity = EntityManager::get().create();
+    Camera* camera = engine->createCamera(cameraEntity);
+    camera->setProjection(45.0, 1.0, 0.1, 100.0);
+
+    View* view = engine->createView();
+    view->setViewport({ 0, 0, 64, 64 });
+    view->setScene(scene);
+    view->setCamera(camera);
+    TemporalAntiAliasingOptions taaOptions;
+    taaOptions.enabled = true;
+    taaOptions.motionVectors = true;
+    view->setTemporalAntiAliasingOptions(taaOptions);
+
+    static float3 const positions[3] = {{ -1, -1, 0 }, { 1, -1, 0 }, { 0, 1, 0 }};
+    static uint16_t const indices[3] = { 0, 1, 2 };
+    VertexBuffer* vb = VertexBuffer::Builder()
+            .vertexCount(3)
+            .bufferCount(1)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .build(*engine);
+    vb->setBufferAt(*engine, 0, { positions, sizeof(positions) });
+    IndexBuffer* ib = IndexBuffer::Builder()
+            .indexCount(3)
+            .bufferType(IndexBuffer::IndexType::USHORT)
+            .build(*engine);
+    ib->setBuffer(*engine, { indices, sizeof(indices) });
+
+    Entity const entity = EntityManager::get().create();
+    TransformManager& tcm = engine->getTransformManager();
+    tcm.create(entity);
+    RenderableManager::Builder(1)
+            .boundingBox({{ 0, 0, 0 }, { 1, 1, 0.1f }})
+            .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+            .build(*engine, entity);
+    scene->addEntity(entity);
+    uint32_t const instance = engine->getRenderableManager().getInstance(entity).asValue();
+
+    auto renderFrame = [&](float x) {
+        tcm.setTransform(tcm.getInstance(entity), mat4f::translation(float3{ x, 0, -5 }));
+        ASSERT_TRUE(renderer->beginFrame(swapChain));
+        renderer->render(view);
+        renderer->endFrame();
+    };
+    auto getPreviousWorldFromWorld = [&]() -> std140::mat44 const& {
+        FScene::RenderableSoa const& soa = downcast(scene)->getRenderableData();
+        size_t i = 0;
+        while (soa.elementAt<FScene::RENDERABLE_INSTANCE>(i).asValue() != instance) {
+            i++;
+        }
+        return soa.elementAt<FScene::UBO>(i).previousWorldFromWorldMatrix;
+    };
+    auto const& history = downcast(view)->getFrameHistory();
+
+    renderFrame(0.0f);
+    expectMatrixNear(mat4f{}, getPreviousWorldFromWorld());
+
+    // the object moves, and a picking query doesn't interrupt the motion vectors
+    view->pick(32, 32, [](View::PickingQueryResult const&) {});
+    renderFrame(1.0f);
+    expectMatrixNear(mat4f::translation(float3{ -1, 0, 0 }), getPreviousWorldFromWorld());
+    ASSERT_LT(instance, history.getPrevious().motion.transforms.size());
+    EXPECT_EQ(mat4f::translation(float3{ 1, 0, -5 }),
+            history.getPrevious().motion.transforms[instance]);
+
+    renderFrame(3.0f);
+    expectMatrixNear(mat4f::translation(float3{ -2, 0, 0 }), getPreviousWorldFromWorld());
+
+    engine->flushAndWait();
+    engine->destroy(entity);
+    engine->destroy(vb);
+    engine->destroy(ib);
+    engine->destroy(view);
+    engine->destroy(scene);
+    engine->destroyCameraComponent(cameraEntity);
+    EntityManager::get().destroy(entity);
+    EntityManager::get().destroy(cameraEntity);
+    engine->destroy(renderer);
+    engine->destroy(swapChain);
+    Engine::destroy(&engine);
+}
+
 TEST(FilamentTest, ColorConversion) {
     // Linear to Gamma
     // 0.0 stays 0.0
@@ -655,7 +2010,7 @@ TEST(FilamentTest, FroxelData) {
 
     Froxelizer froxelData(*engine);
     froxelData.setOptions(5, 100);
-    froxelData.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 100);
+    froxelData.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 100, 1);
 
     Froxel f = froxelData.getFroxelAt(0,0,0);
 
@@ -741,6 +2096,55 @@ TEST(FilamentTest, FroxelData) {
     Engine::destroy((Engine **)&engine);
 }
 
+TEST(FilamentTest, FroxelDataManyLights) {
+    using namespace filament;
+
+    FEngine* engine = downcast(Engine::create());
+
+    LinearAllocatorArena arena("FRenderer: per-frame allocator", 3 * 1024 * 1024);
+    utils::ArenaScope<LinearAllocatorArena> scope(arena);
+
+    Viewport vp(0, 0, 1280, 640);
+    mat4f p = mat4f::perspective(90, 1.0f, 0.1, 100, mat4f::Fov::HORIZONTAL);
+
+    // more lights than fit in a single 256-bit record
+    constexpr size_t lightCount = 300;
+
+    Froxelizer froxelData(*engine);
+    froxelData.setOptions(5, 100);
+    froxelData.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 100, lightCount);
+
+    Entity e = engine->getEntityManager().create();
+    LightManager::Builder(LightManager::Type::POINT).build(*engine, e);
+    LightManager::Instance instance = engine->getLightManager().getInstance(e);
+
+    // all the lights at the same place, so some froxels see all of them
+    FScene::LightSoa lights;
+    lights.push_back({}, {}, {}, {}, {}, {}, {}, {});   // first one is always skipped
+    for (size_t i = 0; i < lightCount; i++) {
+        lights.push_back(float4{ 0, 0, -3, 1 }, {}, {}, {}, instance, 1, {}, {});
+    }
+
+    froxelData.froxelizeLights(*engine, {}, lights);
+    auto const& froxelBuffer = froxelData.getFroxelBufferUser();
+    auto const& recordBuffer = froxelData.getRecordBufferUser();
+    size_t maxCount = 0;
+    size_t maxIndex = 0;
+    for (const auto& entry : froxelBuffer) {
+        EXPECT_LE(entry.count(), lightCount);
+        maxCount = std::max(maxCount, size_t(entry.count()));
+        for (size_t i = 0; i < entry.count(); i++) {
+            maxIndex = std::max(maxIndex, size_t(recordBuffer[entry.offset() + i]));
+        }
+    }
+    EXPECT_EQ(lightCount, maxCount);
+    EXPECT_EQ(lightCount - 1, maxIndex);
+
+    froxelData.terminate(engine->getDriverApi());
+
+    Engine::destroy((Engine **)&engine);
+}
+
 TEST(FilamentTest, GoogleLineDirective) {
     {
         char s[512] = "#line 10 \"foobar\"";
@@ -69,11 +69,15 @@ enum class ReservedSpecializationConstants : uint8_t {
     CONFIG_DEBUG_DIRECTIONAL_SHADOWMAP = 6,
     CONFIG_DEBUG_FROXEL_VISUALIZATION = 7,
     CONFIG_STEREO_EYE_COUNT = 8,
+    CONFIG_MAX_LIGHT_COUNT = 9,
+    CONFIG_FROXEL_RECORD_BUFFER_HEIGHT = 10,
 };
 
-// This value is limited by UBO size, ES3.0 only guarantees 16 KiB.
-// It's also limited by the Froxelizer's record buffer data type (uint8_t).
-constexpr size_t CONFIG_MAX_LIGHT_COUNT = 256;
+// This value is limited by UBO size, 1024 lights need 64 KiB. ES3.0 only guarantees 16 KiB, which
+// holds 256 lights, so the actual limit is computed at runtime from the maximum UBO size
+// (see FEngine::getMaxLightCount()) and given to the shaders as a specialization constant.
+// It's also limited by the Froxelizer's record buffer data type (uint16_t).
+constexpr size_t CONFIG_MAX_LIGHT_COUNT = 1024;
 constexpr size_t CONFIG_MAX_LIGHT_INDEX = CONFIG_MAX_LIGHT_COUNT - 1;
 
 // The number of specialization constants that Filament reserves for its own use. These are always
@@ -201,8 +201,13 @@ struct PerViewUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     float es2Reserved1;
     float es2Reserved2;
 
+    // --------------------------------------------------------------------------------------------
+    // Motion vectors [variant: VELOCITY (i.e.: VSM | PCK | DEP)]
+    // --------------------------------------------------------------------------------------------
+    math::mat4f previousClipFromWorldMatrix;    // previous frame's clip <- world, without jitter
+
     // bring PerViewUib to 2 KiB
-    math::float4 reserved[40];
+    math::float4 reserved[36];
 };
 
 // 2 KiB == 128 float4s
@@ -221,7 +226,10 @@ struct PerRenderableData {
     // TODO: We need a better solution, this currently holds the average local scale for the renderable
     float userData;
 
-    math::float4 reserved[8];
+    // world (as of the previous frame) <- world, used for motion vectors
+    std140::mat44 previousWorldFromWorldMatrix;
+
+    math::float4 reserved[4];
 
     static uint32_t packFlagsChannels(
             bool skinning, bool morphing, bool contactShadows, bool hasInstanceBuffer,
@@ -274,7 +282,7 @@ struct LightsUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     }
 };
 static_assert(sizeof(LightsUib) == 64,
-        "the actual UBO is an array of 256 mat4");
+        "the actual UBO is an array of mat4");
 
 // ------------------------------------------------------------------------------------------------
 // MARK: -
@@ -304,6 +312,7 @@ static_assert(sizeof(ShadowUib) <= CONFIG_MINSPEC_UBO_SIZE,
 // MARK: -
 
 // UBO froxel record buffer.
+// The actual UBO may be larger, up to CONFIG_FROXEL_RECORD_BUFFER_HEIGHT lines.
 struct FroxelRecordUib { // NOLINT(cppcoreguidelines-pro-type-member-init)
     static constexpr std::string_view _name{ "FroxelRecordUniforms" };
     math::uint4 records[1024];
@@ -71,13 +71,14 @@ struct Variant {
     //
     // Depth variants:
     //                      +-----+-----+-----+-----+-----+-----+-----+-----+
-    //                      | STE | VSM | PCK |  1  | SKN |  0  |  0  |  0  |   16 - 4 = 12
+    //                      | STE | VSM | PCK |  1  | SKN |  0  |  0  |  0  |   16
     //                      +-----+-----+-----+-----+-----+-----+-----+-----+
     //       Vertex depth      X     X     0     1     X     0     0     0
     //     Fragment depth      0     X     X     1     0     0     0     0
-    //           Reserved      X     1     1     1     X     0     0     0     [  -4]
+    //    Vertex velocity      X     1     1     1     X     0     0     0
+    //  Fragment velocity      0     1     1     1     0     0     0     0
     //
-    // 96 variants used, 160 reserved (256 - 96)
+    // 100 variants used, 156 reserved (256 - 100)
     //
     // note: a valid variant can be neither a valid vertex nor a valid fragment variant
     //       (e.g.: FOG|SKN variants), the proper bits are filtered appropriately,
@@ -99,6 +100,7 @@ struct Variant {
 
     // special variants (variants that use the reserved space)
     static constexpr type_t SPECIAL_SSR   = VSM | SRE; // screen-space reflections variant
+    static constexpr type_t SPECIAL_VELOCITY = VSM | PCK | DEP; // motion vectors variant
 
     static constexpr type_t STANDARD_MASK      = DEP;
     static constexpr type_t STANDARD_VARIANT   = 0u;
@@ -127,11 +129,8 @@ struct Variant {
     inline void setStereo(bool v) noexcept              { set(v, STE); }
 
     inline static constexpr bool isValidDepthVariant(Variant variant) noexcept {
-        // Can't have VSM and PICKING together with DEPTH variants
-        constexpr type_t RESERVED_MASK  = VSM | PCK | DEP | SRE | DYN | DIR;
-        constexpr type_t RESERVED_VALUE = VSM | PCK | DEP;
-        return ((variant.key & DEPTH_MASK) == DEPTH_VARIANT) &&
-               ((variant.key & RESERVED_MASK) != RESERVED_VALUE);
+        // VSM and PICKING together are the VELOCITY variant
+        return (variant.key & DEPTH_MASK) == DEPTH_VARIANT;
    }
 
     inline static constexpr bool isValidStandardVariant(Variant variant) noexcept {
@@ -173,8 +172,13 @@ struct Variant {
         return (variant.key & (STE | VSM | DEP | SRE | DYN | DIR)) == (VSM | SRE);
     }
 
+    inline static constexpr bool isVelocityVariant(Variant variant) noexcept {
+        return (variant.key & (VSM | PCK | DEP | SRE | DYN | DIR)) == SPECIAL_VELOCITY;
+    }
+
     inline static constexpr bool isVSMVariant(Variant variant) noexcept {
-        return !isSSRVariant(variant) && ((variant.key & VSM) == VSM);
+        return !isSSRVariant(variant) && !isVelocityVariant(variant) &&
+               ((variant.key & VSM) == VSM);
     }
 
     inline static constexpr bool isShadowReceiverVariant(Variant variant) noexcept {
@@ -186,7 +190,7 @@ struct Variant {
     }
 
     inline static constexpr bool isPickingVariant(Variant variant) noexcept {
-        return (variant.key & (PCK | DEP)) == (PCK | DEP);
+        return (variant.key & (VSM | PCK | DEP)) == (PCK | DEP);
     }
 
     inline static constexpr bool isStereoVariant(Variant variant) noexcept {
@@ -203,6 +207,9 @@ struct Variant {
             return variant & (STE | SKN | SRE | DYN | DIR);
         }
         if ((variant.key & DEPTH_MASK) == DEPTH_VARIANT) {
+            if (isVelocityVariant(variant)) {
+                return variant & (STE | VSM | PCK | SKN | DEP);
+            }
             // Only VSM, skinning, and stereo affect the vertex shader's DEPTH variant
             return variant & (STE | VSM | SKN | DEP);
         }
@@ -216,7 +223,7 @@ struct Variant {
             return variant & (VSM | FOG | SRE | DYN | DIR);
         }
         if ((variant.key & DEPTH_MASK) == DEPTH_VARIANT) {
-            // Only VSM & PICKING affects the fragment shader's DEPTH variant
+            // Only VSM & PICKING (and VELOCITY) affects the fragment shader's DEPTH variant
             return variant & (VSM | PCK | DEP);
         }
         return {};
@@ -225,7 +232,7 @@ struct Variant {
     static constexpr Variant filterVariant(Variant variant, bool isLit) noexcept {
         // special case for depth variant
         if (isValidDepthVariant(variant)) {
-            if (!isLit) {
+            if (!isLit && !isVelocityVariant(variant)) {
                 // if we're unlit, we never need the VSM variant
                 return variant & ~VSM;
             }
@@ -41,9 +41,10 @@ Variant Variant::filterUserVariant(
             variant.key &= ~FOG;
         }
     } else {
-        // depth variants can have their VSM bit filtered
+        // depth variants can have their VSM bit filtered, this also removes the velocity
+        // variant, which would otherwise become the picking variant.
         if (filterMask & (uint32_t)UserVariantFilterBit::VSM) {
-            variant.key &= ~VSM;
+            variant.key &= isVelocityVariant(variant) ? ~(VSM | PCK) : ~VSM;
         }
     }
     if (!isSSRVariant(variant)) {
@@ -164,10 +165,10 @@ constexpr inline size_t fragment_variant_count() noexcept {
 }
 
 static_assert(reserved_is_not_valid());
-static_assert(reserved_variant_count() == 160);
-static_assert(valid_variant_count() == 96);
-static_assert(vertex_variant_count() == 32 - (4 + 0) + 8 - 0);        // 36
-static_assert(fragment_variant_count() == 33 - (2 + 2 + 8) + 4 - 1);    // 24
+static_assert(reserved_variant_count() == 156);
+static_assert(valid_variant_count() == 100);
+static_assert(vertex_variant_count() == 32 - (4 + 0) + 8 - 0 + 4);        // 40
+static_assert(fragment_variant_count() == 33 - (2 + 2 + 8) + 4 - 1 + 1);    // 25
 
 } // namespace details
 
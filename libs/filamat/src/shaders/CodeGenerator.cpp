@@ -20,6 +20,8 @@
 
 #include "generated/shaders.h"
 
+#include <private/filament/UibStructs.h>
+
 #include <utils/sstream.h>
 
 #include <cctype>
@@ -252,12 +254,17 @@ utils::io::sstream& CodeGenerator::generateProlog(utils::io::sstream& out, Shade
         // CONFIG_MAX_INSTANCES is only needed for WebGL, so we can replace it with a constant.
         // CONFIG_FROXEL_BUFFER_HEIGHT can be hardcoded to 2048 because only 3% of Android devices
         //                             only support 16KiB buffer or less (1024 lines).
+        // CONFIG_FROXEL_RECORD_BUFFER_HEIGHT and CONFIG_MAX_LIGHT_COUNT are hardcoded for the
+        //                             same reason, to 32 KiB buffers (2048 lines, 512 lights).
+        //                             This must match VulkanDriver::getMaxUniformBufferSize().
         //
         // We *could* leave these as a specialization constant, but this triggers a crashing bug with
         // some Adreno drivers on Android. see: https://github.com/google/filament/issues/6444
         //
         out << "const int CONFIG_MAX_INSTANCES = " << (int)CONFIG_MAX_INSTANCES << ";\n";
         out << "const int CONFIG_FROXEL_BUFFER_HEIGHT = 2048;\n";
+        out << "const int CONFIG_FROXEL_RECORD_BUFFER_HEIGHT = 2048;\n";
+        out << "const int CONFIG_MAX_LIGHT_COUNT = 512;\n";
     } else {
         generateSpecializationConstant(out, "CONFIG_MAX_INSTANCES",
                 +ReservedSpecializationConstants::CONFIG_MAX_INSTANCES, (int)CONFIG_MAX_INSTANCES);
@@ -265,6 +272,13 @@ utils::io::sstream& CodeGenerator::generateProlog(utils::io::sstream& out, Shade
         // the default of 1024 (16KiB) is needed for 32% of Android devices
         generateSpecializationConstant(out, "CONFIG_FROXEL_BUFFER_HEIGHT",
                 +ReservedSpecializationConstants::CONFIG_FROXEL_BUFFER_HEIGHT, 1024);
+
+        // the defaults are the sizes that fit in 16KiB
+        generateSpecializationConstant(out, "CONFIG_FROXEL_RECORD_BUFFER_HEIGHT",
+                +ReservedSpecializationConstants::CONFIG_FROXEL_RECORD_BUFFER_HEIGHT, 1024);
+        generateSpecializationConstant(out, "CONFIG_MAX_LIGHT_COUNT",
+                +ReservedSpecializationConstants::CONFIG_MAX_LIGHT_COUNT,
+                int(CONFIG_MINSPEC_UBO_SIZE / sizeof(LightsUib)));
     }
 
     // directional shadowmap visualization
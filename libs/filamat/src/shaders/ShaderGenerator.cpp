@@ -53,6 +53,8 @@ void ShaderGenerator::generateSurfaceMaterialVariantDefines(utils::io::sstream&
             filament::Variant::isVSMVariant(variant));
     CodeGenerator::generateDefine(out, "VARIANT_HAS_INSTANCED_STEREO",
             hasInstancedStereo(variant, featureLevel));
+    CodeGenerator::generateDefine(out, "VARIANT_HAS_VELOCITY",
+            filament::Variant::isVelocityVariant(variant));
 
     switch (stage) {
         case ShaderStage::VERTEX:
@@ -153,6 +153,11 @@ BufferInterfaceBlock const& UibGenerator::getPerViewUib() noexcept  {
             { "es2Reserved1",            0, Type::FLOAT                  },
             { "es2Reserved2",            0, Type::FLOAT                  },
 
+            // ------------------------------------------------------------------------------------
+            // Motion vectors [variant: VELOCITY (i.e.: VSM | PCK | DEP)]
+            // ------------------------------------------------------------------------------------
+            { "previousClipFromWorldMatrix", 0, Type::MAT4, Precision::HIGH },
+
             // bring PerViewUib to 2 KiB
             { "reserved", sizeof(PerViewUib::reserved)/16, Type::FLOAT4 }
             })
@@ -173,8 +178,9 @@ BufferInterfaceBlock const& UibGenerator::getPerRenderableUib() noexcept {
 BufferInterfaceBlock const& UibGenerator::getLightsUib() noexcept {
     static BufferInterfaceBlock const uib = BufferInterfaceBlock::Builder()
             .name(LightsUib::_name)
-            .add({{ "lights", CONFIG_MAX_LIGHT_COUNT,
-                    BufferInterfaceBlock::Type::MAT4, Precision::HIGH }})
+            .add({{ "lights", CONFIG_MINSPEC_UBO_SIZE / sizeof(LightsUib),
+                    BufferInterfaceBlock::Type::MAT4, Precision::HIGH, {},
+                    {}, {}, "CONFIG_MAX_LIGHT_COUNT" }})
             .build();
     return uib;
 }
@@ -211,7 +217,8 @@ BufferInterfaceBlock const& UibGenerator::getPerRenderableMorphingUib() noexcept
 BufferInterfaceBlock const& UibGenerator::getFroxelRecordUib() noexcept {
     static BufferInterfaceBlock const uib = BufferInterfaceBlock::Builder()
             .name(FroxelRecordUib::_name)
-            .add({{ "records", 1024, BufferInterfaceBlock::Type::UINT4, Precision::HIGH }})
+            .add({{ "records", 1024, BufferInterfaceBlock::Type::UINT4, Precision::HIGH, {},
+                    {}, {}, "CONFIG_FROXEL_RECORD_BUFFER_HEIGHT" }})
             .build();
     return uib;
 }
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <filament/Engine.h>
+
+#include <gltfio/Animator.h>
+#include <gltfio/AssetLoader.h>
+#include <gltfio/FilamentAsset.h>
+#include <gltfio/FilamentInstance.h>
+#include <gltfio/MaterialProvider.h>
+#include <gltfio/ResourceLoader.h>
+
+#include <utils/EntityManager.h>
+
+#include "materials/uberarchive.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+using namespace filament;
+using namespace filament::gltfio;
+using namespace utils;
+
+namespace {
+
+constexpr size_t JOINT_COUNT = 32;
+constexpr size_t KEYFRAME_COUNT = 60;
+
+template<typename T>
+void append(std::vector<uint8_t>& bin, T const* data, size_t count) {
+    uint8_t const* const p = reinterpret_cast<uint8_t const*>(data);
+    bin.insert(bin.end(), p, p + sizeof(T) * count);
+    bin.resize((bin.size() + 3u) & ~size_t(3u));
+}
+
+// None of the models in third_party/models is skinned, so we build a "tentacle" in memory: a
+// strip of quads along the Y axis, skinned to a chain of JOINT_COUNT joints, each of which has a
+// rotation channel with KEYFRAME_COUNT keyframes.
+std::vector<uint8_t> createSkinnedGlb() {
+    size_t const levelCount = JOINT_COUNT + 1;
+    size_t const vertexCount = levelCount * 2;
+
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<uint16_t> joints;
+    std::vector<float> weights;
+    for (size_t l = 0; l < levelCount; l++) {
+        for (float const x : { -0.5f, 0.5f }) {
+            positions.insert(positions.end(), { x, float(l), 0.0f });
+            normals.insert(normals.end(), { 0.0f, 0.0f, 1.0f });
+            uint16_t const j = uint16_t(std::min(l, JOINT_COUNT - 1));
+            joints.insert(joints.end(), { j, 0, 0, 0 });
+            weights.insert(weights.end(), { 1.0f, 0.0f, 0.0f, 0.0f });
+        }
+    }
+
+    std::vector<uint16_t> indices;
+    for (size_t l = 0; l < JOINT_COUNT; l++) {
+        uint16_t const i = uint16_t(l * 2);
+        indices.insert(indices.end(), { i, uint16_t(i + 1), uint16_t(i + 2) });
+        indices.insert(indices.end(), { uint16_t(i + 2), uint16_t(i + 1), uint16_t(i + 3) });
+    }
+
+    // joint j is at y = j in model space
+    std::vector<float> inverseBindMatrices;
+    for (size_t j = 0; j < JOINT_COUNT; j++) {
+        inverseBindMatrices.insert(inverseBindMatrices.end(), {
+                1, 0, 0, 0,   0, 1, 0, 0,   0, 0, 1, 0,   0, -float(j), 0, 1 });
+    }
+
+    std::vector<float> times;
+    for (size_t k = 0; k < KEYFRAME_COUNT; k++) {
+        times.push_back(float(k) / float(KEYFRAME_COUNT - 1));
+    }
+
+    // each joint bends around Z, out of phase with its parent
+    std::vector<float> rotations;
+    for (size_t j = 0; j < JOINT_COUNT; j++) {
+        for (size_t k = 0; k < KEYFRAME_COUNT; k++) {
+            float const a = 0.3f * std::sin(2.0f * float(M_PI) * times[k] + float(j) * 0.5f);
+            rotations.insert(rotations.end(), { 0.0f, 0.0f, std::sin(a * 0.5f),
+                    std::cos(a * 0.5f) });
+        }
+    }
+
+    // binary chunk, one buffer view per accessor
+    std::vector<uint8_t> bin;
+    std::string views;
+    auto const addView = [&](auto const& data) {
+        size_t const offset = bin.size();
+        append(bin, data.data(), data.size());
+        size_t const length = sizeof(data[0]) * data.size();
+        views += std::string(views.empty() ? "" : ",") + "{\"buffer\":0,\"byteOffset\":"
+                + std::to_string(offset) + ",\"byteLength\":" + std::to_string(length) + "}";
+    };
+    addView(positions);             // 0
+    addView(normals);               // 1
+    addView(joints);                // 2
+    addView(weights);               // 3
+    addView(indices);               // 4
+    addView(inverseBindMatrices);   // 5
+    addView(times);                 // 6
+    addView(rotations);             // 7
+
+    std::string const V = std::to_string(vertexCount);
+    std::string const J = std::to_string(JOINT_COUNT);
+    std::string const K = std::to_string(KEYFRAME_COUNT);
+    std::string accessors =
+            "{\"bufferView\":0,\"componentType\":5126,\"count\":" + V + ",\"type\":\"VEC3\","
+            "\"min\":[-0.5,0,0],\"max\":[0.5," + J + ",0]},"
+            "{\"bufferView\":1,\"componentType\":5126,\"count\":" + V + ",\"type\":\"VEC3\"},"
+            "{\"bufferView\":2,\"componentType\":5123,\"count\":" + V + ",\"type\":\"VEC4\"},"
+            "{\"bufferView\":3,\"componentType\":5126,\"count\":" + V + ",\"type\":\"VEC4\"},"
+            "{\"bufferView\":4,\"componentType\":5123,\"count\":"
+                    + std::to_string(indices.size()) + ",\"type\":\"SCALAR\"},"
+            "{\"bufferView\":5,\"componentType\":5126,\"count\":" + J + ",\"type\":\"MAT4\"},"
+            "{\"bufferView\":6,\"componentType\":5126,\"count\":" + K + ",\"type\":\"SCALAR\","
+            "\"min\":[0],\"max\":[1]}";
+
+    // node 0 is the skinned mesh, nodes 1..JOINT_COUNT are the joint chain
+    std::string nodes = "{\"mesh\":0,\"skin\":0}";
+    std::string skinJoints;
+    std::string samplers;
+    std::string channels;
+    for (size_t j = 0; j < JOINT_COUNT; j++) {
+        std::string const node = std::to_string(j + 1);
+        std::string const sampler = std::to_string(j);
+        nodes += ",{";
+        if (j + 1 < JOINT_COUNT) {
+            nodes += "\"children\":[" + std::to_string(j + 2) + "],";
+        }
+        nodes += std::string("\"translation\":[0,") + (j ? "1" : "0") + ",0]}";
+        skinJoints += (j ? "," : "") + node;
+        accessors += ",{\"bufferView\":7,\"byteOffset\":"
+                + std::to_string(j * KEYFRAME_COUNT * 16)
+                + ",\"componentType\":5126,\"count\":" + K + ",\"type\":\"VEC4\"}";
+        samplers += std::string(j ? "," : "") + "{\"input\":6,\"output\":"
+                + std::to_string(7 + j) + ",\"interpolation\":\"LINEAR\"}";
+        channels += std::string(j ? "," : "") + "{\"sampler\":" + sampler
+                + ",\"target\":{\"node\":" + node + ",\"path\":\"rotation\"}}";
+    }
+
+    std::string json = "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,"
+            "\"scenes\":[{\"nodes\":[0,1]}],"
+            "\"nodes\":[" + nodes + "],"
+            "\"meshes\":[{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1,"
+            "\"JOINTS_0\":2,\"WEIGHTS_0\":3},\"indices\":4}]}],"
+            "\"skins\":[{\"inverseBindMatrices\":5,\"joints\":[" + skinJoints + "]}],"
+            "\"animations\":[{\"samplers\":[" + samplers + "],\"channels\":[" + channels + "]}],"
+            "\"accessors\":[" + accessors + "],"
+            "\"bufferViews\":[" + views + "],"
+            "\"buffers\":[{\"byteLength\":" + std::to_string(bin.size()) + "}]}";
+    json.resize((json.size() + 3u) & ~size_t(3u), ' ');
+
+    std::vector<uint8_t> glb;
+    auto const write32 = [&glb](uint32_t v) {
+        append(glb, &v, 1);
+    };
+    write32(0x46546C67);    // "glTF"
+    write32(2);
+    write32(uint32_t(12 + 8 + json.size() + 8 + bin.size()));
+    write32(uint32_t(json.size()));
+    write32(0x4E4F534A);    // "JSON"
+    append(glb, json.data(), json.size());
+    write32(uint32_t(bin.size()));
+    write32(0x004E4942);    // "BIN\0"
+    append(glb, bin.data(), bin.size());
+    return glb;
+}
+
+} // anonymous namespace
+
+// Animates N instances of a skinned model, this measures the CPU cost of evaluating the
+// animation channels and computing the bone matrices.
+class GltfioAnimatorFixture : public benchmark::Fixture {
+protected:
+    Engine* engine = nullptr;
+    MaterialProvider* materials = nullptr;
+    AssetLoader* assetLoader = nullptr;
+    FilamentAsset* asset = nullptr;
+    std::vector<FilamentInstance*> instances;
+    std::vector<Animator*> animators;
+    std::vector<size_t> animationIndices;
+    std::vector<float> times;
+
+public:
+    void SetUp(benchmark::State const& state) override {
+        size_t const count = size_t(state.range(0));
+
+        engine = Engine::create(Engine::Backend::NOOP);
+        materials = createUbershaderProvider(engine,
+                UBERARCHIVE_DEFAULT_DATA, UBERARCHIVE_DEFAULT_SIZE);
+        assetLoader = AssetLoader::create({ engine, materials });
+
+        std::vector<uint8_t> const glb = createSkinnedGlb();
+        instances.resize(count);
+        asset = assetLoader->createInstancedAsset(glb.data(), uint32_t(glb.size()),
+                instances.data(), count);
+
+        ResourceLoader resourceLoader({ engine, nullptr, false });
+        resourceLoader.loadResources(asset);
+        asset->releaseSourceData();
+
+        // instances are out of phase, so they don't all hit the same keyframes
+        animators.clear();
+        for (size_t i = 0; i < count; i++) {
+            animators.push_back(instances[i]->getAnimator());
+            animationIndices.push_back(0);
+            times.push_back(float(i) / float(count));
+        }
+        engine->flushAndWait();
+    }
+
+    void TearDown(benchmark::State const&) override {
+        engine->flushAndWait();
+        assetLoader->destroyAsset(asset);
+        instances.clear();
+        animators.clear();
+        animationIndices.clear();
+        times.clear();
+        materials->destroyMaterials();
+        delete materials;
+        AssetLoader::destroy(&assetLoader);
+        Engine::destroy(&engine);
+    }
+
+    void advance() noexcept {
+        for (float& time : times) {
+            time += 1.0f / 60.0f;
+        }
+    }
+};
+
+BENCHMARK_DEFINE_F(GltfioAnimatorFixture, applyAnimation)(benchmark::State& state) {
+    size_t const count = animators.size();
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            animators[i]->applyAnimation(0, times[i]);
+            animators[i]->updateBoneMatrices();
+        }
+        state.PauseTiming();
+        advance();
+        engine->flushAndWait();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * count));
+}
+
+BENCHMARK_DEFINE_F(GltfioAnimatorFixture, applyAnimations)(benchmark::State& state) {
+    size_t const count = animators.size();
+    for (auto _ : state) {
+        Animator::applyAnimations(animators.data(), animationIndices.data(), times.data(),
+                count);
+        state.PauseTiming();
+        advance();
+        engine->flushAndWait();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * count));
+}
+
+BENCHMARK_REGISTER_F(GltfioAnimatorFixture, applyAnimation)
+        ->Arg(1)->Arg(64)->Arg(512)->UseRealTime();
+
+BENCHMARK_REGISTER_F(GltfioAnimatorFixture, applyAnimations)
+        ->Arg(1)->Arg(64)->Arg(512)->UseRealTime();
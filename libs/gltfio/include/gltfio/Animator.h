@@ -47,6 +47,24 @@ public:
      */
     void applyAnimation(size_t animationIndex, float time) const;
 
+    /**
+     * Applies an animation to each of the given animators, then updates their bone matrices.
+     * This is equivalent to calling applyAnimation() followed by updateBoneMatrices() on each
+     * animator, but the animations are evaluated in parallel using the Engine's JobSystem, which
+     * is useful when an asset is instanced many times.
+     *
+     * This must be called from the thread that uses the Engine.
+     *
+     * @param animators Animators to update, typically of all the instances of an asset. They must
+     *                  all belong to assets created with the same Engine and each animator
+     *                  must appear only once.
+     * @param animationIndices Zero-based index for the \c animation of each animator.
+     * @param times Elapsed time of each animation in seconds.
+     * @param count Number of animators.
+     */
+    static void applyAnimations(Animator* const* animators, size_t const* animationIndices,
+            float const* times, size_t count);
+
     /**
      * Computes root-to-node transforms for all bone nodes, then passes
      * the results into filament::RenderableManager::setBones.
@@ -183,6 +183,28 @@ public:
     FilamentAsset* createInstancedAsset(const uint8_t* bytes, uint32_t numBytes,
             FilamentInstance** instances, size_t numInstances);
 
+    /**
+     * Memory-maps a GLB or a JSON-based glTF 2.0 file and returns an asset with one instance, or
+     * null on failure.
+     *
+     * Unlike createAsset(), the contents of the file are neither read nor copied: the file is
+     * parsed in place and the vertex data is uploaded to the GPU straight from the mapping. This
+     * lowers the peak memory usage and the load time of large assets. The file is unmapped once
+     * the source data has been released (see FilamentAsset::releaseSourceData()) and all uploads
+     * have completed.
+     *
+     * The file must not be modified while it is mapped.
+     */
+    FilamentAsset* createAssetFromFile(const char* path);
+
+    /**
+     * Memory-maps a glTF 2.0 file and produces a primary asset with one or more instances.
+     *
+     * See createAssetFromFile() and createInstancedAsset().
+     */
+    FilamentAsset* createInstancedAssetFromFile(const char* path,
+            FilamentInstance** instances, size_t numInstances);
+
     /**
      * Adds a new instance to the asset.
      *
@@ -49,6 +49,16 @@ struct ResourceConfiguration {
     //! If true, adjusts skinning weights to sum to 1. Well formed glTF files do not need this,
     //! but it is useful for robustness.
     bool normalizeSkinningWeights;
+
+    //! If non-zero, ResourceLoader::asyncBeginLoad() streams the geometry: each call to
+    //! ResourceLoader::asyncUpdateLoad() decodes and uploads primitives until about this many
+    //! bytes have been processed, and each renderable becomes ready (see
+    //! FilamentAsset::popRenderable()) as soon as all of its primitives have been uploaded.
+    size_t streamingBudget = 0;
+
+    //! If true, the loader records the geometry that it uploads, so that it can be retrieved with
+    //! ResourceLoader::getGeometryCache() and given to subsequent loads of the same asset.
+    bool recordGeometryCache = false;
 };
 
 /**
@@ -90,6 +100,41 @@ public:
      */
     void addResourceData(const char* uri, BufferDescriptor&& buffer);
 
+    /**
+     * Feeds a geometry cache for the next asset to be loaded with #loadResources or
+     * #asyncBeginLoad.
+     *
+     * The cache contains the vertex and index data exactly as it is uploaded to the GPU, i.e.
+     * after Draco and meshopt decoding, format conversions, skinning weights normalization and
+     * tangents generation. If it was created from the same source data, none of this work is done
+     * and the buffers are uploaded straight from the cache, which must therefore stay alive until
+     * the BufferDescriptor callback is called. Otherwise, or if its checksum or the size of any
+     * of its buffers doesn't match, the cache is ignored.
+     *
+     * The cache is ignored when the geometry is streamed. When it is used, compressed meshes are
+     * not decoded in the source data, so FilamentInstance::recomputeBoundingBoxes() should not be
+     * called.
+     *
+     * See ResourceConfiguration::recordGeometryCache and #getGeometryCache.
+     */
+    void setGeometryCache(BufferDescriptor&& cache);
+
+    /**
+     * Maps a geometry cache file and feeds it like #setGeometryCache, the file is unmapped once
+     * the geometry has been uploaded. Returns false if the file cannot be mapped.
+     */
+    bool setGeometryCacheFromFile(const char* path);
+
+    /**
+     * Gets the geometry cache recorded by the last call to #loadResources or #asyncBeginLoad, if
+     * ResourceConfiguration::recordGeometryCache is set.
+     *
+     * Returns null if nothing was recorded, e.g. because a valid cache was given to the load or
+     * the geometry was streamed. The data is owned by the loader and remains valid until the next
+     * load. Clients typically save it to disk, next to the glTF file.
+     */
+    const void* getGeometryCache(size_t* size) const;
+
     /**
      * Register a plugin that can consume PNG / JPEG content and produce filament::Texture objects.
      *
@@ -129,17 +174,24 @@ public:
      *
      * This is an alternative to #loadResources and requires periodic calls to #asyncUpdateLoad.
      * On multi-threaded systems this creates threads for texture decoding.
+     *
+     * If ResourceConfiguration::streamingBudget is set, the geometry is uploaded progressively by
+     * #asyncUpdateLoad, so that large assets can be shown before they are entirely loaded. In
+     * that case, the renderables must be added to the scene as they become ready, with
+     * FilamentAsset::popRenderable(), and the asset must not be destroyed before progress
+     * reaches 100% or the load is cancelled.
      */
     bool asyncBeginLoad(FilamentAsset* asset);
 
     /**
-     * Gets the status of an asynchronous resource load as a percentage in [0,1].
+     * Gets the status of an asynchronous resource load as a percentage in [0,1]. When the
+     * geometry is streamed, this accounts for the primitives that remain to be uploaded.
      */
     float asyncGetLoadProgress() const;
 
     /**
      * Updates an asynchronous load by performing any pending work that must take place
-     * on the main thread.
+     * on the main thread. This includes uploading the next primitives when streaming.
      *
      * Clients must periodically call this until #asyncGetLoadProgress returns 100%.
      * After progress reaches 100%, calling this is harmless; it just does nothing.
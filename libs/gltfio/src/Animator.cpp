@@ -26,15 +26,18 @@
 #include <filament/RenderableManager.h>
 #include <filament/TransformManager.h>
 
+#include <utils/JobSystem.h>
 #include <utils/Log.h>
 
+#include <tsl/robin_map.h>
+
 #include <math/mat4.h>
 #include <math/quat.h>
 #include <math/scalar.h>
 #include <math/vec3.h>
 #include <math/vec4.h>
 
-#include <map>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -45,12 +48,12 @@ using namespace utils;
 
 namespace filament::gltfio {
 
-using TimeValues = map<float, size_t>;
+using TimeValues = vector<float>;
 using SourceValues = vector<float>;
 using BoneVector = vector<mat4f>;
 
 struct Sampler {
-    TimeValues times;
+    TimeValues times;   // sorted, the keyframes are found with a binary search
     SourceValues values;
     enum { LINEAR, STEP, CUBIC } interpolation;
 };
@@ -61,11 +64,31 @@ struct Channel {
     enum { TRANSLATION, ROTATION, SCALE, WEIGHTS } transformType;
 };
 
+// The keyframes surrounding a given time and the interpolant between them.
+struct Keyframe {
+    uint32_t prev;
+    uint32_t next;
+    float t;
+};
+
 struct Animation {
     float duration;
     std::string name;
     vector<Sampler> samplers;
     vector<Channel> channels;
+
+    // Channels with linear rotations, which are evaluated in batch, and all the other channels.
+    // Channels whose sampler has less than two keyframes are ignored.
+    vector<uint32_t> rotationChannels;
+    vector<uint32_t> otherChannels;
+
+    // Nodes targeted by the translation, rotation and scale channels.
+    vector<Entity> nodes;
+
+    // Last keyframe found for each sampler, the next lookup usually finds the same one or the
+    // one after, which avoids a binary search.
+    vector<uint32_t> cursors;
+    vector<Keyframe> keyframes;
 };
 
 struct AnimatorImpl {
@@ -76,19 +99,114 @@ struct AnimatorImpl {
     RenderableManager* renderableManager;
     TransformManager* transformManager;
     TrsTransformManager* trsTransformManager;
-    vector<float> weights;
     FixedCapacityVector<mat4f> crossFade;
+
+    // Results of evaluate() and computeBoneMatrices(), which can run concurrently for different
+    // animators. They're applied by commitTransforms() and commitBoneMatrices(), which use the
+    // TransformManager and RenderableManager and must be called from the Engine's thread.
+    struct Update {
+        Entity entity;
+        uint32_t offset;
+        uint32_t count;
+    };
+    Animation const* evaluated = nullptr;
+    vector<mat4f> transforms;       // local transform of each Animation::nodes
+    vector<float> weights;
+    vector<Update> weightUpdates;
+    vector<Update> boneUpdates;
+    vector<float> rotations;        // scratch space for the batched rotations
+
     void addChannels(const FixedCapacityVector<Entity>& nodeMap, const cgltf_animation& srcAnim,
             Animation& dst);
+    void evaluate(size_t animationIndex, float time);
     void applyAnimation(const Channel& channel, float t, size_t prevIndex, size_t nextIndex);
+    void applyRotations(Animation const& anim);
+    void commitTransforms();
     void stashCrossFade();
     void applyCrossFade(float alpha);
     void resetBoneMatrices(FFilamentInstance* instance);
-    void updateBoneMatrices(FFilamentInstance* instance);
+    void computeBoneMatrices();
+    void computeBoneMatrices(FFilamentInstance* instance);
+    void commitBoneMatrices();
 };
 
+// Finds the keyframes surrounding the given time, "cursor" is the previous keyframe found in
+// these times and is updated.
+static Keyframe findKeyframe(TimeValues const& times, float time, uint32_t& cursor) noexcept {
+    size_t const count = times.size();
+    assert_invariant(count >= 2);
+    size_t i = cursor;
+    if (UTILS_UNLIKELY(!(i + 1 < count && times[i] <= time && time < times[i + 1]))) {
+        if (i + 2 < count && times[i + 1] <= time && time < times[i + 2]) {
+            i = i + 1;
+        } else {
+            // find the first keyframe after the given time
+            auto const pos = std::upper_bound(times.begin(), times.end(), time);
+            if (pos == times.begin()) {
+                cursor = 0;
+                return { 0, 0, 0.0f };
+            }
+            i = size_t(pos - times.begin()) - 1;
+            if (i == count - 1) {
+                cursor = uint32_t(i);
+                return { uint32_t(i), uint32_t(i), 0.0f };
+            }
+        }
+    }
+    cursor = uint32_t(i);
+    // times[i] <= time < times[i + 1], so the interval can't be empty
+    float const prevTime = times[i];
+    float const nextTime = times[i + 1];
+    return { uint32_t(i), uint32_t(i + 1), (time - prevTime) / (nextTime - prevTime) };
+}
+
+// Spherical linear interpolation of "count" pairs of quaternions stored as structures of arrays,
+// the results replace the first quaternions. This is branchless so that the compiler can
+// vectorize it: sin(t * a) / sin(a) is evaluated with its power series in (cos(a) - 1) instead
+// of acos() and sin(). The error is below 2e-5 radians, even for keyframes 180 degrees apart.
+static void slerp(size_t count,
+        float* UTILS_RESTRICT x0, float* UTILS_RESTRICT y0,
+        float* UTILS_RESTRICT z0, float* UTILS_RESTRICT w0,
+        float const* UTILS_RESTRICT x1, float const* UTILS_RESTRICT y1,
+        float const* UTILS_RESTRICT z1, float const* UTILS_RESTRICT w1,
+        float const* UTILS_RESTRICT t) noexcept {
+    constexpr int SERIES_TERM_COUNT = 12;
+    for (size_t i = 0; i < count; i++) {
+        float const d = x0[i] * x1[i] + y0[i] * y1[i] + z0[i] * z1[i] + w0[i] * w1[i];
+        // take the short path
+        float const sign = d < 0.0f ? -1.0f : 1.0f;
+        float const e = std::abs(d) - 1.0f;
+        float const t1 = t[i];
+        float const t0 = 1.0f - t1;
+        float b0 = t0;
+        float b1 = t1;
+        float s0 = t0;
+        float s1 = t1;
+        float p = 1.0f;
+        for (int k = 1; k <= SERIES_TERM_COUNT; k++) {
+            float const kk = float(k * k);
+            float const ik = 1.0f / float(k * (2 * k + 1));
+            p *= e;
+            b0 *= (t0 * t0 - kk) * ik;
+            b1 *= (t1 * t1 - kk) * ik;
+            s0 += b0 * p;
+            s1 += b1 * p;
+        }
+        s1 *= sign;
+        float const x = s0 * x0[i] + s1 * x1[i];
+        float const y = s0 * y0[i] + s1 * y1[i];
+        float const z = s0 * z0[i] + s1 * z1[i];
+        float const w = s0 * w0[i] + s1 * w1[i];
+        float const n = 1.0f / std::sqrt(x * x + y * y + z * z + w * w);
+        x0[i] = x * n;
+        y0[i] = y * n;
+        z0[i] = z * n;
+        w0[i] = w * n;
+    }
+}
+
 static void createSampler(const cgltf_animation_sampler& src, Sampler& dst) {
-    // Copy the time values into a red-black tree.
+    // Copy the time values, which glTF requires to be strictly increasing.
     const cgltf_accessor* timelineAccessor = src.input;
     const uint8_t* timelineBlob = nullptr;
     const float* timelineFloats = nullptr;
@@ -100,8 +218,10 @@ static void createSampler(const cgltf_animation_sampler& src, Sampler& dst) {
         timelineFloats = (const float*) (timelineBlob + timelineAccessor->offset +
                 timelineAccessor->buffer_view->offset);
     }
-    for (size_t i = 0, len = timelineAccessor->count; i < len; ++i) {
-        dst.times[timelineFloats[i]] = i;
+    dst.times.assign(timelineFloats, timelineFloats + timelineAccessor->count);
+    if (UTILS_UNLIKELY(!std::is_sorted(dst.times.begin(), dst.times.end()))) {
+        GLTFIO_WARN("Disabling animation sampler with unsorted keyframes.");
+        dst.times.clear();
     }
 
     // Convert source data to float.
@@ -222,10 +342,12 @@ Animator::Animator(FFilamentAsset const* asset, FFilamentInstance* instance) {
             Sampler& dstSampler = dstAnim.samplers[j];
             createSampler(srcSampler, dstSampler);
             if (dstSampler.times.size() > 1) {
-                float maxtime = (--dstSampler.times.end())->first;
+                float maxtime = dstSampler.times.back();
                 dstAnim.duration = std::max(dstAnim.duration, maxtime);
             }
         }
+        dstAnim.cursors.resize(srcAnim.samplers_count);
+        dstAnim.keyframes.resize(srcAnim.samplers_count);
 
         // Import each glTF channel into a custom data structure.
         if (instance) {
@@ -263,51 +385,49 @@ size_t Animator::getAnimationCount() const {
 }
 
 void Animator::applyAnimation(size_t animationIndex, float time) const {
-    const Animation& anim = mImpl->animations[animationIndex];
-    time = fmod(time, anim.duration);
     TransformManager& transformManager = *mImpl->transformManager;
     transformManager.openLocalTransformTransaction();
-    for (const auto& channel : anim.channels) {
-        const Sampler* sampler = channel.sourceData;
-        if (sampler->times.size() < 2) {
-            continue;
-        }
+    mImpl->evaluate(animationIndex, time);
+    mImpl->commitTransforms();
+    transformManager.commitLocalTransformTransaction();
+}
 
-        const TimeValues& times = sampler->times;
-
-        // Find the first keyframe after the given time, or the keyframe that matches it exactly.
-        TimeValues::const_iterator iter = times.lower_bound(time);
-
-        // Compute the interpolant (between 0 and 1) and determine the keyframe pair.
-        float t = 0.0f;
-        size_t nextIndex;
-        size_t prevIndex;
-        if (iter == times.end()) {
-            nextIndex = times.size() - 1;
-            prevIndex = nextIndex;
-        } else if (iter == times.begin()) {
-            nextIndex = 0;
-            prevIndex = 0;
-        } else {
-            TimeValues::const_iterator prev = iter; --prev;
-            nextIndex = iter->second;
-            prevIndex = prev->second;
-            const float nextTime = iter->first;
-            const float prevTime = prev->first;
-            float deltaTime = nextTime - prevTime;
-            assert(deltaTime >= 0);
-            if (deltaTime > 0) {
-                t = (time - prevTime) / deltaTime;
-            }
-        }
+void Animator::applyAnimations(Animator* const* animators, size_t const* animationIndices,
+        float const* times, size_t count) {
+    if (!count) {
+        return;
+    }
 
-        if (sampler->interpolation == Sampler::STEP) {
-            t = 0.0f;
-        }
+    Engine& engine = *animators[0]->mImpl->asset->mEngine;
+    JobSystem& js = engine.getJobSystem();
+    TransformManager& transformManager = engine.getTransformManager();
+
+    // Evaluate the animations in parallel, this only updates the TrsTransformManager and the
+    // animators themselves.
+    js.runAndWait(jobs::parallel_for(js, nullptr, 0, uint32_t(count),
+            [animators, animationIndices, times](uint32_t s, uint32_t c) {
+                for (uint32_t i = s; i < s + c; i++) {
+                    animators[i]->mImpl->evaluate(animationIndices[i], times[i]);
+                }
+            }, jobs::CountSplitter<8>()));
 
-        mImpl->applyAnimation(channel, t, prevIndex, nextIndex);
+    transformManager.openLocalTransformTransaction();
+    for (size_t i = 0; i < count; i++) {
+        animators[i]->mImpl->commitTransforms();
     }
     transformManager.commitLocalTransformTransaction();
+
+    // The bone matrices need the world transforms, which are known only now.
+    js.runAndWait(jobs::parallel_for(js, nullptr, 0, uint32_t(count),
+            [animators](uint32_t s, uint32_t c) {
+                for (uint32_t i = s; i < s + c; i++) {
+                    animators[i]->mImpl->computeBoneMatrices();
+                }
+            }, jobs::CountSplitter<8>()));
+
+    for (size_t i = 0; i < count; i++) {
+        animators[i]->mImpl->commitBoneMatrices();
+    }
 }
 
 void Animator::resetBoneMatrices() {
@@ -324,16 +444,8 @@ void Animator::resetBoneMatrices() {
 }
 
 void Animator::updateBoneMatrices() {
-    // If this is a single-instance animator, then update only this instance.
-    if (mImpl->instance) {
-        mImpl->updateBoneMatrices(mImpl->instance);
-        return;
-    }
-
-    // If this is a broadcast animator, then update all instances.
-    for (FFilamentInstance* instance : mImpl->asset->mInstances) {
-        mImpl->updateBoneMatrices(instance);
-    }
+    mImpl->computeBoneMatrices();
+    mImpl->commitBoneMatrices();
 }
 
 float Animator::getAnimationDuration(size_t animationIndex) const {
@@ -403,6 +515,8 @@ void AnimatorImpl::addChannels(const FixedCapacityVector<Entity>& nodeMap,
     const cgltf_animation_sampler* srcSamplers = srcAnim.samplers;
     const cgltf_node* nodes = asset->mSourceAsset->hierarchy->nodes;
     const Sampler* samplers = dst.samplers.data();
+    // the nodes targeted by the channels added here, they all belong to the same instance
+    tsl::robin_map<Entity, uint32_t, Entity::Hasher> nodeIndices;
     for (cgltf_size j = 0, nchans = srcAnim.channels_count; j < nchans; ++j) {
         const cgltf_animation_channel& srcChannel = srcChannels[j];
         Entity targetEntity = nodeMap[srcChannel.target_node - nodes];
@@ -424,16 +538,121 @@ void AnimatorImpl::addChannels(const FixedCapacityVector<Entity>& nodeMap,
         dstChannel.sourceData = samplers + (srcChannel.sampler - srcSamplers);
         dstChannel.targetEntity = targetEntity;
         setTransformType(srcChannel, dstChannel);
+
+        if (dstChannel.sourceData->times.size() < 2) {
+            continue;
+        }
+        uint32_t const channelIndex = uint32_t(dst.channels.size());
         dst.channels.push_back(dstChannel);
+        if (dstChannel.transformType == Channel::ROTATION &&
+                dstChannel.sourceData->interpolation != Sampler::CUBIC) {
+            dst.rotationChannels.push_back(channelIndex);
+        } else {
+            dst.otherChannels.push_back(channelIndex);
+        }
+        if (dstChannel.transformType != Channel::WEIGHTS &&
+                nodeIndices.find(targetEntity) == nodeIndices.end()) {
+            nodeIndices[targetEntity] = uint32_t(dst.nodes.size());
+            dst.nodes.push_back(targetEntity);
+        }
     }
 }
 
+void AnimatorImpl::evaluate(size_t animationIndex, float time) {
+    Animation& anim = animations[animationIndex];
+    time = fmod(time, anim.duration);
+
+    // Find the keyframes once per sampler, samplers can be shared by several channels.
+    for (size_t i = 0, c = anim.samplers.size(); i < c; i++) {
+        Sampler const& sampler = anim.samplers[i];
+        if (sampler.times.size() < 2) {
+            continue;
+        }
+        Keyframe& keyframe = anim.keyframes[i];
+        keyframe = findKeyframe(sampler.times, time, anim.cursors[i]);
+        if (sampler.interpolation == Sampler::STEP) {
+            keyframe.t = 0.0f;
+        }
+    }
+
+    weights.clear();
+    weightUpdates.clear();
+    Sampler const* const samplers = anim.samplers.data();
+    for (uint32_t index : anim.otherChannels) {
+        Channel const& channel = anim.channels[index];
+        Keyframe const& keyframe = anim.keyframes[channel.sourceData - samplers];
+        applyAnimation(channel, keyframe.t, keyframe.prev, keyframe.next);
+    }
+    applyRotations(anim);
+
+    // Compute the local transform of each node once, after all its channels are applied.
+    transforms.resize(anim.nodes.size());
+    for (size_t i = 0, c = anim.nodes.size(); i < c; i++) {
+        transforms[i] = trsTransformManager->getTransform(
+                trsTransformManager->getInstance(anim.nodes[i]));
+    }
+    evaluated = &anim;
+}
+
+void AnimatorImpl::applyRotations(Animation const& anim) {
+    size_t const count = anim.rotationChannels.size();
+    if (!count) {
+        return;
+    }
+
+    // gather the keyframes as structures of arrays
+    rotations.resize(count * 9);
+    float* const UTILS_RESTRICT x0 = rotations.data();
+    float* const UTILS_RESTRICT y0 = x0 + count;
+    float* const UTILS_RESTRICT z0 = y0 + count;
+    float* const UTILS_RESTRICT w0 = z0 + count;
+    float* const UTILS_RESTRICT x1 = w0 + count;
+    float* const UTILS_RESTRICT y1 = x1 + count;
+    float* const UTILS_RESTRICT z1 = y1 + count;
+    float* const UTILS_RESTRICT w1 = z1 + count;
+    float* const UTILS_RESTRICT t = w1 + count;
+    Sampler const* const samplers = anim.samplers.data();
+    for (size_t i = 0; i < count; i++) {
+        Channel const& channel = anim.channels[anim.rotationChannels[i]];
+        Keyframe const& keyframe = anim.keyframes[channel.sourceData - samplers];
+        const quatf* srcQuat = (const quatf*) channel.sourceData->values.data();
+        quatf const q0 = srcQuat[keyframe.prev];
+        quatf const q1 = srcQuat[keyframe.next];
+        x0[i] = q0.x; y0[i] = q0.y; z0[i] = q0.z; w0[i] = q0.w;
+        x1[i] = q1.x; y1[i] = q1.y; z1[i] = q1.z; w1[i] = q1.w;
+        t[i] = keyframe.t;
+    }
+
+    slerp(count, x0, y0, z0, w0, x1, y1, z1, w1, t);
+
+    for (size_t i = 0; i < count; i++) {
+        Channel const& channel = anim.channels[anim.rotationChannels[i]];
+        TrsTransformManager::Instance const trsNode =
+                trsTransformManager->getInstance(channel.targetEntity);
+        trsTransformManager->setRotation(trsNode, quatf{ w0[i], x0[i], y0[i], z0[i] });
+    }
+}
+
+void AnimatorImpl::commitTransforms() {
+    if (!evaluated) {
+        return;
+    }
+    std::vector<Entity> const& nodes = evaluated->nodes;
+    for (size_t i = 0, c = nodes.size(); i < c; i++) {
+        transformManager->setTransform(transformManager->getInstance(nodes[i]), transforms[i]);
+    }
+    for (Update const& update : weightUpdates) {
+        auto ci = renderableManager->getInstance(update.entity);
+        renderableManager->setMorphWeights(ci, weights.data() + update.offset, update.count);
+    }
+    evaluated = nullptr;
+}
+
 void AnimatorImpl::applyAnimation(const Channel& channel, float t, size_t prevIndex,
         size_t nextIndex) {
     const Sampler* sampler = channel.sourceData;
     const TimeValues& times = sampler->times;
     TrsTransformManager::Instance trsNode = trsTransformManager->getInstance(channel.targetEntity);
-    TransformManager::Instance node = transformManager->getInstance(channel.targetEntity);
 
     switch (channel.transformType) {
 
@@ -490,6 +709,8 @@ void AnimatorImpl::applyAnimation(const Channel& channel, float t, size_t prevIn
             assert(sampler->values.size() % times.size() == 0);
             const int valuesPerKeyframe = sampler->values.size() / times.size();
 
+            // the weights are uploaded by commitTransforms()
+            size_t const offset = weights.size();
             if (sampler->interpolation == Sampler::CUBIC) {
                 assert(valuesPerKeyframe % 3 == 0);
                 const int numMorphTargets = valuesPerKeyframe / 3;
@@ -497,30 +718,29 @@ void AnimatorImpl::applyAnimation(const Channel& channel, float t, size_t prevIn
                 const float* const splineVerts = samplerValues + numMorphTargets;
                 const float* const outTangents = samplerValues + numMorphTargets * 2;
 
-                weights.resize(numMorphTargets);
+                weights.resize(offset + numMorphTargets);
+                float* const out = weights.data() + offset;
                 for (int comp = 0; comp < numMorphTargets; ++comp) {
                     float vert0 = splineVerts[comp + prevIndex * valuesPerKeyframe];
                     float tang0 = outTangents[comp + prevIndex * valuesPerKeyframe];
                     float tang1 = inTangents[comp + nextIndex * valuesPerKeyframe];
                     float vert1 = splineVerts[comp + nextIndex * valuesPerKeyframe];
-                    weights[comp] = cubicSpline(vert0, tang0, vert1, tang1, t);
+                    out[comp] = cubicSpline(vert0, tang0, vert1, tang1, t);
                 }
             } else {
-                weights.resize(valuesPerKeyframe);
+                weights.resize(offset + valuesPerKeyframe);
+                float* const out = weights.data() + offset;
                 for (int comp = 0; comp < valuesPerKeyframe; ++comp) {
                     float previous = samplerValues[comp + prevIndex * valuesPerKeyframe];
                     float current = samplerValues[comp + nextIndex * valuesPerKeyframe];
-                    weights[comp] = (1 - t) * previous + t * current;
+                    out[comp] = (1 - t) * previous + t * current;
                 }
             }
-
-            auto ci = renderableManager->getInstance(channel.targetEntity);
-            renderableManager->setMorphWeights(ci, weights.data(), weights.size());
-            return;
+            weightUpdates.push_back({ channel.targetEntity,
+                    uint32_t(offset), uint32_t(weights.size() - offset) });
+            break;
         }
     }
-
-    transformManager->setTransform(node, trsTransformManager->getTransform(trsNode));
 }
 
 void AnimatorImpl::resetBoneMatrices(FFilamentInstance* instance) {
@@ -539,13 +759,28 @@ void AnimatorImpl::resetBoneMatrices(FFilamentInstance* instance) {
     }
 }
 
-void AnimatorImpl::updateBoneMatrices(FFilamentInstance* instance) {
+void AnimatorImpl::computeBoneMatrices() {
+    boneMatrices.clear();
+    boneUpdates.clear();
+
+    // If this is a single-instance animator, then update only this instance.
+    if (instance) {
+        computeBoneMatrices(instance);
+        return;
+    }
+
+    // If this is a broadcast animator, then update all instances.
+    for (FFilamentInstance* assetInstance : asset->mInstances) {
+        computeBoneMatrices(assetInstance);
+    }
+}
+
+void AnimatorImpl::computeBoneMatrices(FFilamentInstance* instance) {
     assert_invariant(instance->mSkins.size() == asset->mSkins.size());
     size_t skinIndex = 0;
     for (const auto& skin : instance->mSkins) {
         const auto& assetSkin = asset->mSkins[skinIndex++];
         size_t njoints = skin.joints.size();
-        boneMatrices.resize(njoints);
         for (Entity entity : skin.targets) {
             auto renderable = renderableManager->getInstance(entity);
             if (!renderable) {
@@ -556,18 +791,30 @@ void AnimatorImpl::updateBoneMatrices(FFilamentInstance* instance) {
             if (xformable) {
                 inverseGlobalTransform = inverse(transformManager->getWorldTransformAccurate(xformable));
             }
+            // the bones are uploaded by commitBoneMatrices()
+            size_t const offset = boneMatrices.size();
+            boneMatrices.resize(offset + njoints);
+            mat4f* const bones = boneMatrices.data() + offset;
             for (size_t boneIndex = 0; boneIndex < njoints; ++boneIndex) {
                 const auto& joint = skin.joints[boneIndex];
                 const mat4f& inverseBindMatrix = assetSkin.inverseBindMatrices[boneIndex];
                 TransformManager::Instance jointInstance = transformManager->getInstance(joint);
                 mat4 globalJointTransform = transformManager->getWorldTransformAccurate(jointInstance);
-                boneMatrices[boneIndex] =
+                bones[boneIndex] =
                         mat4f{ inverseGlobalTransform * globalJointTransform } *
                         inverseBindMatrix;
             }
-            renderableManager->setBones(renderable, boneMatrices.data(), boneMatrices.size());
+            boneUpdates.push_back({ entity, uint32_t(offset), uint32_t(njoints) });
         }
     }
 }
 
+void AnimatorImpl::commitBoneMatrices() {
+    for (Update const& update : boneUpdates) {
+        auto renderable = renderableManager->getInstance(update.entity);
+        renderableManager->setBones(renderable, boneMatrices.data() + update.offset, update.count);
+    }
+    boneUpdates.clear();
+}
+
 } // namespace filament::gltfio
@@ -23,6 +23,7 @@
 #include "FNodeManager.h"
 #include "FTrsTransformManager.h"
 #include "GltfEnums.h"
+#include "MappedFile.h"
 
 #include <filament/Box.h>
 #include <filament/BufferObject.h>
@@ -229,6 +230,8 @@ struct FAssetLoader : public AssetLoader {
     FFilamentAsset* createAsset(const uint8_t* bytes, uint32_t nbytes);
     FFilamentAsset* createInstancedAsset(const uint8_t* bytes, uint32_t numBytes,
             FilamentInstance** instances, size_t numInstances);
+    FFilamentAsset* createInstancedAssetFromFile(const char* path,
+            FilamentInstance** instances, size_t numInstances);
     FilamentInstance* createInstance(FFilamentAsset* fAsset);
 
     static void destroy(FAssetLoader** loader) noexcept {
@@ -261,6 +264,8 @@ private:
 
     // Methods used during the first traveral (creation of VertexBuffer, IndexBuffer, etc)
     FFilamentAsset* createRootAsset(const cgltf_data* srcAsset);
+    FFilamentAsset* parseAsset(const uint8_t* bytes, size_t byteCount,
+            FilamentInstance** instances, size_t numInstances);
     void recursePrimitives(const cgltf_node* rootNode, FFilamentAsset* fAsset);
     void createPrimitives(const cgltf_node* node, const char* name, FFilamentAsset* fAsset);
     bool createPrimitive(const cgltf_primitive& inPrim, const char* name, Primitive* outPrim,
@@ -318,6 +323,38 @@ FFilamentAsset* FAssetLoader::createAsset(const uint8_t* bytes, uint32_t byteCou
 
 FFilamentAsset* FAssetLoader::createInstancedAsset(const uint8_t* bytes, uint32_t byteCount,
         FilamentInstance** instances, size_t numInstances) {
+    // Clients can free up their source blob immediately, but cgltf has pointers into the data that
+    // need to stay valid. Therefore we create a copy of the source blob and stash it inside the
+    // asset.
+    utils::FixedCapacityVector<uint8_t> glbdata(byteCount);
+    std::copy_n(bytes, byteCount, glbdata.data());
+
+    FFilamentAsset* fAsset = parseAsset(glbdata.data(), byteCount, instances, numInstances);
+    if (fAsset) {
+        glbdata.swap(fAsset->mSourceAsset->glbData);
+    }
+    return fAsset;
+}
+
+FFilamentAsset* FAssetLoader::createInstancedAssetFromFile(const char* path,
+        FilamentInstance** instances, size_t numInstances) {
+    // The file is parsed in place and the vertex data is uploaded straight from the mapping, which
+    // goes away with the source data, i.e. once it has been released and all uploads are done.
+    MappedFile file(path);
+    if (!file.isValid()) {
+        slog.e << "Unable to map " << path << io::endl;
+        return nullptr;
+    }
+
+    FFilamentAsset* fAsset = parseAsset(file.data(), file.size(), instances, numInstances);
+    if (fAsset) {
+        fAsset->mSourceAsset->mappedFile = std::move(file);
+    }
+    return fAsset;
+}
+
+FFilamentAsset* FAssetLoader::parseAsset(const uint8_t* bytes, size_t byteCount,
+        FilamentInstance** instances, size_t numInstances) {
     // This method can be used to load JSON or GLB. By using a default options struct, we are asking
     // cgltf to examine the magic identifier to determine which type of file is being loaded.
     cgltf_options options {};
@@ -336,15 +373,10 @@ FFilamentAsset* FAssetLoader::createInstancedAsset(const uint8_t* bytes, uint32_
         options.file.release = [](const cgltf_memory_options*, const cgltf_file_options*, void*) {};
     }
 
-    // Clients can free up their source blob immediately, but cgltf has pointers into the data that
-    // need to stay valid. Therefore we create a copy of the source blob and stash it inside the
-    // asset.
-    utils::FixedCapacityVector<uint8_t> glbdata(byteCount);
-    std::copy_n(bytes, byteCount, glbdata.data());
-
     // The ownership of an allocated `sourceAsset` will be moved to FFilamentAsset::mSourceAsset.
+    // The caller must keep the bytes alive, they are referenced by the cgltf hierarchy.
     cgltf_data* sourceAsset;
-    cgltf_result result = cgltf_parse(&options, glbdata.data(), byteCount, &sourceAsset);
+    cgltf_result result = cgltf_parse(&options, bytes, byteCount, &sourceAsset);
     if (result != cgltf_result_success) {
         slog.e << "Unable to parse glTF file." << io::endl;
         return nullptr;
@@ -357,7 +389,6 @@ FFilamentAsset* FAssetLoader::createInstancedAsset(const uint8_t* bytes, uint32_
         mError = false;
         return nullptr;
     }
-    glbdata.swap(fAsset->mSourceAsset->glbData);
 
     createInstances(numInstances, fAsset);
     if (mError) {
@@ -1581,6 +1612,16 @@ FilamentAsset* AssetLoader::createInstancedAsset(const uint8_t* bytes, uint32_t
     return downcast(this)->createInstancedAsset(bytes, numBytes, instances, numInstances);
 }
 
+FilamentAsset* AssetLoader::createAssetFromFile(const char* path) {
+    FilamentInstance* instances;
+    return downcast(this)->createInstancedAssetFromFile(path, &instances, 1);
+}
+
+FilamentAsset* AssetLoader::createInstancedAssetFromFile(const char* path,
+        FilamentInstance** instances, size_t numInstances) {
+    return downcast(this)->createInstancedAssetFromFile(path, instances, numInstances);
+}
+
 FilamentInstance* AssetLoader::createInstance(FilamentAsset* asset) {
     return downcast(this)->createInstance(downcast(asset));
 }
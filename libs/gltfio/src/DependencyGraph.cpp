@@ -38,8 +38,8 @@ size_t DependencyGraph::popRenderables(Entity* result, size_t count) noexcept {
 void DependencyGraph::addEdge(Entity entity, MaterialInstance* mi) {
     if (mDisabled) {
         if (mEntityToMaterial.count(entity) == 0) {
-            mEntityToMaterial[entity] = {};
-            mReadyRenderables.push(entity);
+            EntityNode& status = mEntityToMaterial[entity];
+            checkReadiness(entity, status);
         }
     } else {
         mMaterialToEntity[mi].insert(entity);
@@ -47,6 +47,17 @@ void DependencyGraph::addEdge(Entity entity, MaterialInstance* mi) {
     }
 }
 
+void DependencyGraph::addEdge(Entity entity, VertexBuffer* primitive) {
+    assert_invariant(!mDisabled);
+    auto iter = mEntityToMaterial.find(entity);
+    if (iter == mEntityToMaterial.end()) {
+        // Only renderables are tracked.
+        return;
+    }
+    mPrimitiveToEntity[primitive].push_back(entity);
+    iter.value().numPendingPrimitives++;
+}
+
 void DependencyGraph::addEdge(MaterialInstance* mi, const char* parameter) {
     if (auto iter = mMaterialToTexture.find(mi); iter != mMaterialToTexture.end()) {
         const tsl::robin_map<std::string, TextureNode*>& params = iter.value().params;
@@ -75,6 +86,18 @@ void DependencyGraph::addEdge(Texture* texture, MaterialInstance* material, cons
     }
 }
 
+void DependencyGraph::checkReadiness(Entity entity, EntityNode& status) {
+    // Once progressive reveal is disabled, textures no longer hold back entities but their
+    // geometry still does.
+    if (status.ready || status.numPendingPrimitives > 0) {
+        return;
+    }
+    if (mDisabled || status.numReadyMaterials == status.materials.size()) {
+        status.ready = true;
+        mReadyRenderables.push(entity);
+    }
+}
+
 void DependencyGraph::checkReadiness(Material* material) {
     auto& status = mMaterialToTexture.at(material);
 
@@ -109,6 +132,20 @@ void DependencyGraph::markAsReady(Texture* texture) {
     }
 }
 
+void DependencyGraph::markAsReady(VertexBuffer* primitive) {
+    auto iter = mPrimitiveToEntity.find(primitive);
+    if (iter == mPrimitiveToEntity.end()) {
+        return;
+    }
+    for (auto entity : iter->second) {
+        auto& status = mEntityToMaterial.at(entity);
+        assert_invariant(status.numPendingPrimitives > 0);
+        status.numPendingPrimitives--;
+        checkReadiness(entity, status);
+    }
+    mPrimitiveToEntity.erase(iter);
+}
+
 void DependencyGraph::markAsReady(MaterialInstance* material) {
     auto iter = mMaterialToEntity.find(material);
     if (iter == mMaterialToEntity.end()) {
@@ -121,9 +158,8 @@ void DependencyGraph::markAsReady(MaterialInstance* material) {
         if (status.numReadyMaterials == status.materials.size()) {
             continue;
         }
-        if (++status.numReadyMaterials == status.materials.size()) {
-            mReadyRenderables.push(entity);
-        }
+        ++status.numReadyMaterials;
+        checkReadiness(entity, status);
     }
 }
 
@@ -140,11 +176,26 @@ DependencyGraph::TextureNode* DependencyGraph::getStatus(Texture* texture) {
 
 void DependencyGraph::disableProgressiveReveal() {
     mDisabled = true;
-    for (auto& [entity, status] : mEntityToMaterial) {
-        if (status.numReadyMaterials < status.materials.size()) {
-            mReadyRenderables.push(entity);
+
+    // Renderables without textures are ready as soon as the asset is created. Those that have
+    // not been popped yet must now also wait for their geometry, they are queued again when it
+    // has been uploaded.
+    std::queue<Entity> readyRenderables;
+    while (!mReadyRenderables.empty()) {
+        Entity const entity = mReadyRenderables.front();
+        mReadyRenderables.pop();
+        EntityNode& status = mEntityToMaterial.at(entity);
+        if (status.numPendingPrimitives > 0) {
+            status.ready = false;
+        } else {
+            readyRenderables.push(entity);
         }
     }
+    std::swap(mReadyRenderables, readyRenderables);
+
+    for (auto iter = mEntityToMaterial.begin(); iter != mEntityToMaterial.end(); ++iter) {
+        checkReadiness(iter->first, iter.value());
+    }
 }
 
 } // namespace filament::gltfio
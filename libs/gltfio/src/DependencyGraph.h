@@ -24,10 +24,12 @@
 
 #include <queue>
 #include <string>
+#include <vector>
 
 namespace filament {
     class MaterialInstance;
     class Texture;
+    class VertexBuffer;
 }
 
 namespace filament::gltfio {
@@ -56,6 +58,9 @@ namespace filament::gltfio {
  *
  * Note that the left-most entity in the above graph has no textures, so it becomes ready as soon as
  * commitEdges is called.
+ *
+ * When the geometry is streamed, entities also depend on the VertexBuffer of each of their
+ * primitives, and they cannot become ready before all of them have been uploaded.
  */
 class DependencyGraph {
 public:
@@ -72,6 +77,12 @@ public:
     void addEdge(Material* material, const char* parameter);
     void addEdge(Texture* texture, Material* material, const char* parameter);
 
+    // Makes the given entity wait for the geometry of one of its primitives. Unlike the other
+    // edges, these are honored even when progressive reveal is disabled, but they must be added
+    // before disableProgressiveReveal() is called, which also holds back the entities that are
+    // already ready but haven't been popped.
+    void addEdge(Entity entity, VertexBuffer* primitive);
+
     // Commits a set of edges to the graph. This simply triggers a check to see if
     // any entities are already ready, e.g. if any entities are non-textured.
     void commitEdges();
@@ -79,6 +90,9 @@ public:
     // Marks the given texture as being fully decoded, with all miplevels initialized.
     void markAsReady(Texture* texture);
 
+    // Marks the geometry of the given primitive as being fully uploaded.
+    void markAsReady(VertexBuffer* primitive);
+
     // Causes the dependency graph to enter a disabled state, whereby adding Entity <=> Material
     // edges will immediately mark the entity as ready without actually growing the graph.
     void disableProgressiveReveal();
@@ -96,8 +110,11 @@ private:
     struct EntityNode {
         tsl::robin_set<Material*> materials;
         size_t numReadyMaterials = 0;
+        size_t numPendingPrimitives = 0;
+        bool ready = false;
     };
 
+    void checkReadiness(Entity entity, EntityNode& status);
     void checkReadiness(Material* material);
     void markAsReady(Material* material);
     TextureNode* getStatus(Texture* texture);
@@ -107,6 +124,7 @@ private:
     tsl::robin_map<Material*, tsl::robin_set<Entity, Entity::Hasher>> mMaterialToEntity;
     tsl::robin_map<Material*, MaterialNode> mMaterialToTexture;
     tsl::robin_map<Texture*, tsl::robin_set<Material*>> mTextureToMaterial;
+    tsl::robin_map<VertexBuffer*, std::vector<Entity>> mPrimitiveToEntity;
 
     // Each texture (and its readiness flag) can be referenced from multiple nodes, so we own
     // a collection of wrapper objects in the following map. This uses std::unique_ptr to allow
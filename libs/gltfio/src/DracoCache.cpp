@@ -37,16 +37,17 @@ using namespace utils;
 
 namespace filament::gltfio {
 
-DracoMesh* DracoCache::findOrCreateMesh(const cgltf_buffer_view* key) {
+bool DracoCache::findMesh(const cgltf_buffer_view* key, DracoMesh** mesh) const {
     auto iter = mCache.find(key);
-    if (iter != mCache.end()) {
-        return iter->second.get();
+    if (iter == mCache.end()) {
+        return false;
     }
-    assert(key->buffer && key->buffer->data);
-    const uint8_t* compressedData = key->offset + (uint8_t*) key->buffer->data;
-    DracoMesh* mesh = DracoMesh::decode(compressedData, key->size);
+    *mesh = iter->second.get();
+    return true;
+}
+
+void DracoCache::addMesh(const cgltf_buffer_view* key, DracoMesh* mesh) {
     mCache.emplace(key, mesh);
-    return mesh;
 }
 
 DracoMesh::DracoMesh(struct DracoMeshDetails* details) : mDetails(details) {}
@@ -35,9 +35,17 @@ class DracoMesh;
 //
 // The cache key is the buffer view that holds the compressed data. This allows the loader to
 // avoid duplicated work when a single Draco mesh is referenced from multiple primitives.
+//
+// The cache is not thread-safe. To decode several meshes concurrently, look them up with
+// findMesh(), decode the missing ones with DracoMesh::decode() and add them with addMesh().
 class DracoCache {
 public:
-    DracoMesh* findOrCreateMesh(const cgltf_buffer_view* key);
+    // Returns false if the given buffer view hasn't been decoded yet.
+    bool findMesh(const cgltf_buffer_view* key, DracoMesh** mesh) const;
+
+    // Takes ownership of a mesh decoded from the given buffer view, which can be null.
+    void addMesh(const cgltf_buffer_view* key, DracoMesh* mesh);
+
 private:
     tsl::robin_map<const cgltf_buffer_view*, std::unique_ptr<DracoMesh>> mCache;
 };
@@ -44,6 +44,7 @@
 #include "downcast.h"
 #include "DependencyGraph.h"
 #include "DracoCache.h"
+#include "MappedFile.h"
 #include "FFilamentInstance.h"
 
 #include <tsl/htrie_map.h>
@@ -282,6 +283,7 @@ struct FFilamentAsset : public FilamentAsset {
         cgltf_data* hierarchy;
         DracoCache dracoCache;
         utils::FixedCapacityVector<uint8_t> glbData;
+        MappedFile mappedFile; // replaces glbData for assets created from a file
     };
 
     // We used shared ownership for the raw cgltf data in order to permit ResourceLoader to
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "GeometryCache.h"
+
+#include <utils/Systrace.h>
+
+#include <string.h>
+
+namespace filament::gltfio {
+
+namespace {
+
+constexpr uint32_t CACHE_MAGIC = 0x43544C47; // "GLTC"
+
+// Must be bumped whenever the format, or the way ResourceLoader processes the geometry, changes.
+constexpr uint32_t CACHE_VERSION = 2;
+
+// Entries are aligned so that their data can be uploaded in place.
+constexpr size_t CACHE_ALIGNMENT = 16;
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t entryCount;
+    uint64_t checksum;  // of everything that follows the header
+};
+
+struct TableEntry {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+constexpr size_t align(size_t offset) noexcept {
+    return (offset + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1);
+}
+
+inline uint64_t rotl(uint64_t x, int r) noexcept {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t mixWord(uint64_t h, uint64_t k) noexcept {
+    k *= 0x87c37b91114253d5ull;
+    k = rotl(k, 31);
+    k *= 0x4cf5ad432745937full;
+    h ^= k;
+    return rotl(h, 27) * 5 + 0x52dce729;
+}
+
+// This is the body of 64-bit murmur3, it reads 8 bytes at a time since the source data of large
+// assets is several MB.
+uint64_t hashBytes(const void* data, size_t size, uint64_t h) noexcept {
+    const uint8_t* bytes = (const uint8_t*) data;
+    size_t const wordCount = size / sizeof(uint64_t);
+    for (size_t i = 0; i < wordCount; ++i, bytes += sizeof(uint64_t)) {
+        uint64_t k;
+        memcpy(&k, bytes, sizeof(k));
+        h = mixWord(h, k);
+    }
+    if (size_t const remainder = size % sizeof(uint64_t); remainder) {
+        uint64_t k = 0;
+        memcpy(&k, bytes, remainder);
+        h = mixWord(h, k);
+    }
+    return mixWord(h, size);
+}
+
+// murmur3 finalizer
+uint64_t finalize(uint64_t h) noexcept {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t computeChecksum(const uint8_t* blob, size_t size) noexcept {
+    return finalize(hashBytes(blob + sizeof(Header), size - sizeof(Header), CACHE_MAGIC));
+}
+
+} // anonymous namespace
+
+uint64_t GeometryCache::computeKey(const cgltf_data* gltf,
+        bool normalizeSkinningWeights) noexcept {
+    SYSTRACE_CALL();
+    uint64_t h = hashBytes(gltf->json, gltf->json_size, CACHE_VERSION);
+    for (cgltf_size i = 0; i < gltf->buffers_count; ++i) {
+        const cgltf_buffer& buffer = gltf->buffers[i];
+        if (buffer.data) {
+            h = hashBytes(buffer.data, buffer.size, h);
+        }
+    }
+    h = mixWord(h, normalizeSkinningWeights);
+    return finalize(h);
+}
+
+bool GeometryCache::open(const void* blob, size_t size, uint64_t key) {
+    mEntries.clear();
+    mRecordedData.clear();
+
+    Header header;
+    if (!blob || size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, blob, sizeof(header));
+    if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.key != key ||
+            (size - sizeof(header)) / sizeof(TableEntry) < header.entryCount) {
+        return false;
+    }
+    size_t const entryCount = size_t(header.entryCount);
+
+    // The key only covers the source data, the checksum catches a damaged cache.
+    const uint8_t* const bytes = (const uint8_t*) blob;
+    if (header.checksum != computeChecksum(bytes, size)) {
+        return false;
+    }
+
+    mEntries.reserve(entryCount);
+    for (size_t i = 0; i < entryCount; ++i) {
+        TableEntry entry;
+        memcpy(&entry, bytes + sizeof(header) + i * sizeof(entry), sizeof(entry));
+        if (entry.kind > uint32_t(Kind::MORPH_TANGENTS) || entry.offset > size ||
+                entry.size > size - entry.offset) {
+            mEntries.clear();
+            return false;
+        }
+        mEntries.push_back({ Kind(entry.kind), bytes + entry.offset, size_t(entry.size) });
+    }
+    return true;
+}
+
+void GeometryCache::add(Kind kind, const void* data, size_t size) {
+    const uint8_t* const bytes = (const uint8_t*) data;
+    std::vector<uint8_t>& copy = mRecordedData.emplace_back(bytes, bytes + size);
+    mEntries.push_back({ kind, copy.data(), size });
+}
+
+std::vector<uint8_t> GeometryCache::serialize(uint64_t key) const {
+    SYSTRACE_CALL();
+    size_t const tableSize = sizeof(Header) + mEntries.size() * sizeof(TableEntry);
+    size_t size = align(tableSize);
+    for (const Entry& entry : mEntries) {
+        size = align(size + entry.size);
+    }
+
+    std::vector<uint8_t> blob(size);
+
+    size_t offset = align(tableSize);
+    for (size_t i = 0, n = mEntries.size(); i < n; ++i) {
+        const Entry& entry = mEntries[i];
+        TableEntry const tableEntry{ uint32_t(entry.kind), 0, offset, entry.size };
+        memcpy(blob.data() + sizeof(Header) + i * sizeof(tableEntry), &tableEntry,
+                sizeof(tableEntry));
+        if (entry.size) {
+            memcpy(blob.data() + offset, entry.data, entry.size);
+        }
+        offset = align(offset + entry.size);
+    }
+
+    Header const header{ CACHE_MAGIC, CACHE_VERSION, key, mEntries.size(),
+            computeChecksum(blob.data(), blob.size()) };
+    memcpy(blob.data(), &header, sizeof(header));
+    return blob;
+}
+
+} // namespace filament::gltfio
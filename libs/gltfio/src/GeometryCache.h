@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLTFIO_GEOMETRYCACHE_H
+#define GLTFIO_GEOMETRYCACHE_H
+
+#include <cgltf.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament::gltfio {
+
+// The geometry of an asset as it is uploaded to the GPU by ResourceLoader, i.e. after Draco and
+// meshopt decoding, format conversions, skinning weights normalization and tangents generation.
+//
+// A cache is made of a header, a table of entries and their data. There is one entry per buffer
+// slot of the asset, followed by one entry per tangents job, in the order in which ResourceLoader
+// processes them. Buffer slots that don't upload anything have an empty entry.
+//
+// The cache is keyed by a hash of the source data and its contents are covered by a checksum. The
+// entries are stored in the native byte order and are not meant to be shared between devices.
+class GeometryCache {
+public:
+    enum class Kind : uint32_t {
+        NONE,               // nothing is uploaded
+        BUFFER_OBJECT,      // contents of a BufferObject bound to a VertexBuffer
+        INDICES,            // contents of an IndexBuffer
+        MORPH_POSITIONS3,   // float3 positions of a morph target
+        MORPH_POSITIONS4,   // float4 positions of a morph target
+        MORPH_TANGENTS,     // short4 tangents of a morph target
+    };
+
+    struct Entry {
+        Kind kind;
+        const uint8_t* data;
+        size_t size;
+    };
+
+    // Computes the key of the given asset, its buffers must be loaded.
+    static uint64_t computeKey(const cgltf_data* gltf, bool normalizeSkinningWeights) noexcept;
+
+    // Reads the entries of a serialized cache, the blob must outlive them. Returns false if it
+    // isn't a valid cache for the given key, or if it's damaged.
+    bool open(const void* blob, size_t size, uint64_t key);
+
+    // Adds an entry to the cache being recorded, the data is copied.
+    void add(Kind kind, const void* data, size_t size);
+
+    // Serializes the recorded entries.
+    std::vector<uint8_t> serialize(uint64_t key) const;
+
+    size_t getEntryCount() const noexcept { return mEntries.size(); }
+    Entry const& getEntry(size_t index) const noexcept { return mEntries[index]; }
+
+private:
+    std::vector<Entry> mEntries;
+    std::vector<std::vector<uint8_t>> mRecordedData;
+};
+
+} // namespace filament::gltfio
+
+#endif // GLTFIO_GEOMETRYCACHE_H
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MappedFile.h"
+
+#include <utility>
+
+#if defined(WIN32)
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace filament::gltfio {
+
+#if defined(WIN32)
+
+MappedFile::MappedFile(const char* path) noexcept {
+    HANDLE const file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        // The view keeps a reference to the mapping, which can be closed right away.
+        HANDLE const mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        if (mapping) {
+            mData = (uint8_t*) MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            mSize = mData ? size_t(size.QuadPart) : 0;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+}
+
+void MappedFile::unmap() noexcept {
+    if (mData) {
+        UnmapViewOfFile(mData);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const char* path) noexcept {
+    int const fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        // The mapping stays valid once the file is closed.
+        void* const data = mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            mData = (uint8_t*) data;
+            mSize = size_t(st.st_size);
+        }
+    }
+    close(fd);
+}
+
+void MappedFile::unmap() noexcept {
+    if (mData) {
+        munmap(mData, mSize);
+    }
+}
+
+#endif
+
+MappedFile::~MappedFile() noexcept {
+    unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) noexcept {
+    std::swap(mData, rhs.mData);
+    std::swap(mSize, rhs.mSize);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) noexcept {
+    if (this != &rhs) {
+        unmap();
+        mData = std::exchange(rhs.mData, nullptr);
+        mSize = std::exchange(rhs.mSize, 0);
+    }
+    return *this;
+}
+
+} // namespace filament::gltfio
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLTFIO_MAPPEDFILE_H
+#define GLTFIO_MAPPEDFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament::gltfio {
+
+// The contents of a file mapped in memory, which is unmapped upon destruction.
+//
+// The pages are copy-on-write: the loader can fix up the data in place (e.g. skinning weights)
+// without modifying the file, and only the pages that are written to are duplicated.
+class MappedFile {
+public:
+    MappedFile() noexcept = default;
+
+    // Maps the given file, isValid() returns false if this fails.
+    explicit MappedFile(const char* path) noexcept;
+
+    ~MappedFile() noexcept;
+
+    MappedFile(MappedFile const& rhs) = delete;
+    MappedFile& operator=(MappedFile const& rhs) = delete;
+
+    MappedFile(MappedFile&& rhs) noexcept;
+    MappedFile& operator=(MappedFile&& rhs) noexcept;
+
+    bool isValid() const noexcept { return mData != nullptr; }
+    uint8_t* data() const noexcept { return mData; }
+    size_t size() const noexcept { return mSize; }
+
+private:
+    void unmap() noexcept;
+
+    uint8_t* mData = nullptr;
+    size_t mSize = 0;
+};
+
+} // namespace filament::gltfio
+
+#endif // GLTFIO_MAPPEDFILE_H
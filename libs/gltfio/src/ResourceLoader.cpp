@@ -19,6 +19,8 @@
 
 #include "GltfEnums.h"
 #include "FFilamentAsset.h"
+#include "GeometryCache.h"
+#include "MappedFile.h"
 #include "TangentsJob.h"
 #include "downcast.h"
 
@@ -50,6 +52,7 @@
 #include <fstream>
 #include <memory>
 #include <string>
+#include <vector>
 
 using namespace filament;
 using namespace filament::math;
@@ -65,6 +68,7 @@ using BufferTextureCache = tsl::robin_map<const void*, Texture*>;
 using FilepathTextureCache = tsl::robin_map<std::string, Texture*>;
 using UriDataCache = tsl::robin_map<std::string, gltfio::ResourceLoader::BufferDescriptor>;
 using UriDataCacheHandle = std::shared_ptr<UriDataCache>;
+using GeometryCacheHandle = std::shared_ptr<gltfio::ResourceLoader::BufferDescriptor>;
 using TextureProviderList = tsl::robin_map<std::string, TextureProvider*>;
 
 enum class CacheResult {
@@ -74,15 +78,39 @@ enum class CacheResult {
     MISS,
 };
 
+using PrimitiveEntry = std::pair<const cgltf_primitive*, VertexBuffer*>;
+
+// The geometry of a primitive, which is decoded and uploaded at once when streaming.
+struct StreamedGeometry {
+    VertexBuffer* vertexBuffer; // the primitive's VertexBuffer, even if it fails to decode
+    std::vector<BufferSlot> slots;
+    std::vector<TangentsJob::Params> tangents;
+    size_t size;                // approximate number of bytes to decode and upload
+};
+
+// The state of a streaming load. The primitives are processed in order, the source data is
+// retained until they have all been uploaded since clients may call releaseSourceData() early.
+struct Streaming {
+    FFilamentAsset::SourceHandle source;
+    std::vector<PrimitiveEntry> primitives;
+    std::vector<StreamedGeometry> geometry;
+    size_t next = 0;
+    size_t count = 0;
+};
+
 struct ResourceLoader::Impl {
     explicit Impl(const ResourceConfiguration& config) :
         mEngine(config.engine),
         mNormalizeSkinningWeights(config.normalizeSkinningWeights),
+        mRecordGeometryCache(config.recordGeometryCache),
+        mStreamingBudget(config.streamingBudget),
         mGltfPath(config.gltfPath ? config.gltfPath : ""),
         mUriDataCache(std::make_shared<UriDataCache>()) {}
 
     Engine* const mEngine;
     bool mNormalizeSkinningWeights;
+    bool mRecordGeometryCache;
+    size_t mStreamingBudget;
     std::string mGltfPath;
 
     // User-provided resource data with URI string keys, populated with addResourceData().
@@ -98,9 +126,31 @@ struct ResourceLoader::Impl {
 
     FFilamentAsset* mAsyncAsset = nullptr;
     size_t mRemainingTextureDownloads = 0;
+    Streaming mStreaming;
+
+    // The geometry cache given with setGeometryCache() for the next load. During a load, the
+    // entries of the cache are either read from it or recorded, in which case they are serialized
+    // once the load is done.
+    GeometryCacheHandle mGeometryCacheData;
+    GeometryCache mGeometryCache;
+    bool mRecording = false;
+    std::vector<uint8_t> mRecordedGeometryCache;
 
     void addResourceData(const char* uri, BufferDescriptor&& buffer);
-    void computeTangents(FFilamentAsset* asset);
+    void uploadBufferSlot(FFilamentAsset* asset, const FFilamentAsset::SourceHandle& source,
+            const BufferSlot& slot);
+    std::vector<TangentsJob::Params> getTangentsJobs(FFilamentAsset* asset) const;
+    void computeTangents(FFilamentAsset* asset, std::vector<TangentsJob::Params>& jobParams);
+    void record(GeometryCache::Kind kind, const void* data, size_t size);
+    bool openGeometryCache(FFilamentAsset* asset, const BufferDescriptor& cache, uint64_t key,
+            const std::vector<TangentsJob::Params>& tangents);
+    void uploadCachedGeometry(FFilamentAsset* asset, const GeometryCacheHandle& cache,
+            const std::vector<TangentsJob::Params>& tangents);
+    void uploadCachedEntry(FFilamentAsset* asset, const GeometryCacheHandle& cache,
+            const GeometryCache::Entry& entry, VertexBuffer* vb, IndexBuffer* ib,
+            MorphTargetBuffer* tb, size_t index);
+    void beginStreaming(FFilamentAsset* asset);
+    void updateStreaming(FFilamentAsset* asset);
     void createTextures(FFilamentAsset* asset, bool async);
     void cancelTextureDecoding();
     std::pair<Texture*, CacheResult> getOrCreateTexture(FFilamentAsset* asset, size_t textureIndex,
@@ -112,14 +162,16 @@ uint32_t computeBindingSize(const cgltf_accessor* accessor);
 uint32_t computeBindingOffset(const cgltf_accessor* accessor);
 
 // This little struct holds a shared_ptr that wraps cgltf_data (and, potentially, glb data) while
-// uploading vertex buffer data to the GPU.
+// uploading vertex buffer data to the GPU. Data uploaded from a geometry cache holds the cache
+// instead.
 struct UploadEvent {
     FFilamentAsset::SourceHandle handle;
     UriDataCacheHandle dataCacheHandle;
+    GeometryCacheHandle geometryCacheHandle;
 };
 
-UploadEvent* uploadUserdata(FFilamentAsset* asset, UriDataCacheHandle dataCache) {
-    return new UploadEvent({ asset->mSourceAsset, dataCache });
+UploadEvent* uploadUserdata(FFilamentAsset::SourceHandle source, UriDataCacheHandle dataCache) {
+    return new UploadEvent({ std::move(source), std::move(dataCache), {} });
 }
 
 static void uploadCallback(void* buffer, size_t size, void* user) {
@@ -166,9 +218,16 @@ static bool requiresPacking(const cgltf_accessor* accessor) {
     }
 }
 
-static void decodeDracoMeshes(FFilamentAsset* asset) {
-    DracoCache* dracoCache = &asset->mSourceAsset->dracoCache;
+// A Draco mesh along with the primitives that reference it. Each of them is decoded by a single
+// job, which also fills in the accessors of its primitives.
+struct DracoJob {
+    const cgltf_buffer_view* bufferView = nullptr;
+    DracoMesh* mesh = nullptr;
+    bool cached = false;
+    std::vector<PrimitiveEntry*> primitives;
+};
 
+static void decodeDracoMesh(DracoJob* job, const cgltf_accessor* accessors) {
     // For a given primitive and attribute, find the corresponding accessor.
     auto findAccessor = [](const cgltf_primitive* prim, cgltf_attribute_type type, cgltf_int idx) {
         for (cgltf_size i = 0; i < prim->attributes_count; i++) {
@@ -180,19 +239,21 @@ static void decodeDracoMeshes(FFilamentAsset* asset) {
         return (cgltf_accessor*) nullptr;
     };
 
-    // Go through every primitive and check if it has a Draco mesh.
-    for (auto& [prim, vertexBuffer] : asset->mPrimitives) {
-        if (!prim->has_draco_mesh_compression) {
-            continue;
-        }
+    // Check if we have already decoded this mesh.
+    if (!job->cached) {
+        const cgltf_buffer_view* view = job->bufferView;
+        assert_invariant(view->buffer && view->buffer->data);
+        job->mesh = DracoMesh::decode(view->offset + (const uint8_t*) view->buffer->data,
+                view->size);
+    }
 
+    DracoMesh* mesh = job->mesh;
+    for (auto* primitive : job->primitives) {
+        auto& [prim, vertexBuffer] = *primitive;
         const cgltf_draco_mesh_compression& draco = prim->draco_mesh_compression;
 
         // If an error occurs, we can simply set the primitive's associated VertexBuffer to null.
         // This does not cause a leak because it is a weak reference.
-
-        // Check if we have already decoded this mesh.
-        DracoMesh* mesh = dracoCache->findOrCreateMesh(draco.buffer_view);
         if (!mesh) {
             slog.e << "Cannot decompress mesh, Draco decoding error." << io::endl;
             vertexBuffer = nullptr;
@@ -209,7 +270,7 @@ static void decodeDracoMeshes(FFilamentAsset* asset) {
         for (cgltf_size i = 0; i < draco.attributes_count; i++) {
 
             // In cgltf, each Draco attribute's data pointer is an attribute id, not an accessor.
-            const uint32_t id = draco.attributes[i].data - asset->mSourceAsset->hierarchy->accessors;
+            const uint32_t id = draco.attributes[i].data - accessors;
 
             // Find the destination accessor; this contains the desired component type, etc.
             const cgltf_attribute_type type = draco.attributes[i].type;
@@ -229,61 +290,149 @@ static void decodeDracoMeshes(FFilamentAsset* asset) {
     }
 }
 
-static void decodeMeshoptCompression(cgltf_data* data) {
-    for (size_t i = 0; i < data->buffer_views_count; ++i) {
-        if (!data->buffer_views[i].has_meshopt_compression) {
-            continue;
-        }
+static void decodeMeshoptCompression(cgltf_buffer_view* bufferView) {
+    cgltf_meshopt_compression* compression = &bufferView->meshopt_compression;
+    const uint8_t* source = (const uint8_t*) compression->buffer->data;
+    assert_invariant(source);
+    source += compression->offset;
+
+    // This memory is freed by cgltf.
+    void* destination = malloc(compression->count * compression->stride);
+    assert_invariant(destination);
+
+    UTILS_UNUSED_IN_RELEASE int error = 0;
+    switch (compression->mode) {
+        case cgltf_meshopt_compression_mode_invalid:
+            break;
+        case cgltf_meshopt_compression_mode_attributes:
+            error = meshopt_decodeVertexBuffer(destination, compression->count, compression->stride,
+                    source, compression->size);
+            break;
+        case cgltf_meshopt_compression_mode_triangles:
+            error = meshopt_decodeIndexBuffer(destination, compression->count, compression->stride,
+                    source, compression->size);
+            break;
+        case cgltf_meshopt_compression_mode_indices:
+            error = meshopt_decodeIndexSequence(destination, compression->count,
+                    compression->stride, source, compression->size);
+            break;
+        default:
+            assert_invariant(false);
+            break;
+    }
+    assert_invariant(!error);
+
+    switch (compression->filter) {
+        case cgltf_meshopt_compression_filter_none:
+            break;
+        case cgltf_meshopt_compression_filter_octahedral:
+            meshopt_decodeFilterOct(destination, compression->count, compression->stride);
+            break;
+        case cgltf_meshopt_compression_filter_quaternion:
+            meshopt_decodeFilterQuat(destination, compression->count, compression->stride);
+            break;
+        case cgltf_meshopt_compression_filter_exponential:
+            meshopt_decodeFilterExp(destination, compression->count, compression->stride);
+            break;
+        default:
+            assert_invariant(false);
+            break;
+    }
 
-        cgltf_meshopt_compression* compression = &data->buffer_views[i].meshopt_compression;
-        const uint8_t* source = (const uint8_t*) compression->buffer->data;
-        assert_invariant(source);
-        source += compression->offset;
+    bufferView->data = destination;
+}
 
-        // This memory is freed by cgltf.
-        void* destination = malloc(compression->count * compression->stride);
-        assert_invariant(destination);
+// Returns the meshopt buffer views that need to be decoded. The geometry is not needed when it
+// comes from a geometry cache, in which case only the skins and animations are decoded.
+static std::vector<cgltf_buffer_view*> getMeshoptViews(cgltf_data* gltf, bool geometry) {
+    std::vector<cgltf_buffer_view*> views;
+    if (geometry) {
+        for (size_t i = 0; i < gltf->buffer_views_count; ++i) {
+            if (gltf->buffer_views[i].has_meshopt_compression) {
+                views.push_back(&gltf->buffer_views[i]);
+            }
+        }
+        return views;
+    }
 
-        UTILS_UNUSED_IN_RELEASE int error = 0;
-        switch (compression->mode) {
-            case cgltf_meshopt_compression_mode_invalid:
-                break;
-            case cgltf_meshopt_compression_mode_attributes:
-                error = meshopt_decodeVertexBuffer(destination, compression->count, compression->stride,
-                        source, compression->size);
-                break;
-            case cgltf_meshopt_compression_mode_triangles:
-                error = meshopt_decodeIndexBuffer(destination, compression->count, compression->stride,
-                        source, compression->size);
-                break;
-            case cgltf_meshopt_compression_mode_indices:
-                error = meshopt_decodeIndexSequence(destination, compression->count, compression->stride,
-                        source, compression->size);
-                break;
-            default:
-                assert_invariant(false);
-                break;
+    // Samplers typically share their input, so each view is added only once.
+    std::vector<bool> added(gltf->buffer_views_count);
+    auto const addView = [gltf, &views, &added](const cgltf_accessor* accessor) {
+        cgltf_buffer_view* view = accessor ? accessor->buffer_view : nullptr;
+        if (view && view->has_meshopt_compression && !added[view - gltf->buffer_views]) {
+            added[view - gltf->buffer_views] = true;
+            views.push_back(view);
+        }
+    };
+    for (size_t i = 0; i < gltf->skins_count; ++i) {
+        addView(gltf->skins[i].inverse_bind_matrices);
+    }
+    for (size_t i = 0; i < gltf->animations_count; ++i) {
+        const cgltf_animation& animation = gltf->animations[i];
+        for (size_t j = 0; j < animation.samplers_count; ++j) {
+            addView(animation.samplers[j].input);
+            addView(animation.samplers[j].output);
         }
-        assert_invariant(!error);
+    }
+    return views;
+}
 
-        switch (compression->filter) {
-            case cgltf_meshopt_compression_filter_none:
-                break;
-            case cgltf_meshopt_compression_filter_octahedral:
-                meshopt_decodeFilterOct(destination, compression->count, compression->stride);
-                break;
-            case cgltf_meshopt_compression_filter_quaternion:
-                meshopt_decodeFilterQuat(destination, compression->count, compression->stride);
-                break;
-            case cgltf_meshopt_compression_filter_exponential:
-                meshopt_decodeFilterExp(destination, compression->count, compression->stride);
-                break;
-            default:
-                assert_invariant(false);
-                break;
+// Decompresses the Draco meshes of the given primitives and the given meshopt buffer views. They
+// are all independent from each other and are decoded concurrently on the JobSystem.
+static void decodeCompressedMeshes(FFilamentAsset::SourceAsset* source, JobSystem& js,
+        PrimitiveEntry* primitives, size_t primitiveCount,
+        std::vector<cgltf_buffer_view*> const& meshoptViews) {
+    SYSTRACE_CALL();
+    cgltf_data* gltf = source->hierarchy;
+    DracoCache* dracoCache = &source->dracoCache;
+
+    // Group the primitives by Draco mesh, so that a mesh referenced by several primitives is
+    // decoded only once.
+    std::vector<DracoJob> dracoJobs;
+    tsl::robin_map<const cgltf_buffer_view*, size_t> dracoJobIndices;
+    for (size_t i = 0; i < primitiveCount; i++) {
+        PrimitiveEntry& primitive = primitives[i];
+        const cgltf_primitive* prim = primitive.first;
+        if (!prim->has_draco_mesh_compression) {
+            continue;
+        }
+        const cgltf_buffer_view* view = prim->draco_mesh_compression.buffer_view;
+        auto [pos, inserted] = dracoJobIndices.try_emplace(view, dracoJobs.size());
+        if (inserted) {
+            DracoJob& job = dracoJobs.emplace_back();
+            job.bufferView = view;
+            job.cached = dracoCache->findMesh(view, &job.mesh);
         }
+        dracoJobs[pos->second].primitives.push_back(&primitive);
+    }
 
-        data->buffer_views[i].data = destination;
+    if (dracoJobs.empty() && meshoptViews.empty()) {
+        return;
+    }
+
+    // Draco meshes are expensive to decode and are given a job each, meshopt buffer views are
+    // typically much faster to decode and are batched.
+    JobSystem::Job* parent = js.createJob();
+    const cgltf_accessor* accessors = gltf->accessors;
+    js.run(jobs::parallel_for(js, parent, dracoJobs.data(), uint32_t(dracoJobs.size()),
+            [accessors](DracoJob* jobs, size_t count) {
+                for (size_t i = 0; i < count; i++) {
+                    decodeDracoMesh(&jobs[i], accessors);
+                }
+            }, jobs::CountSplitter<1>()));
+    js.run(jobs::parallel_for(js, parent, meshoptViews.data(), uint32_t(meshoptViews.size()),
+            [](cgltf_buffer_view* const* views, size_t count) {
+                for (size_t i = 0; i < count; i++) {
+                    decodeMeshoptCompression(views[i]);
+                }
+            }, jobs::CountSplitter<16>()));
+    js.runAndWait(parent);
+
+    // The cache is not thread-safe, so the new meshes are added once all the jobs are done.
+    for (const DracoJob& job : dracoJobs) {
+        if (!job.cached) {
+            dracoCache->addMesh(job.bufferView, job.mesh);
+        }
     }
 }
 
@@ -323,6 +472,8 @@ ResourceLoader::~ResourceLoader() {
 
 void ResourceLoader::setConfiguration(const ResourceConfiguration& config) {
     pImpl->mNormalizeSkinningWeights = config.normalizeSkinningWeights;
+    pImpl->mRecordGeometryCache = config.recordGeometryCache;
+    pImpl->mStreamingBudget = config.streamingBudget;
     pImpl->mGltfPath = config.gltfPath;
 }
 
@@ -330,6 +481,27 @@ void ResourceLoader::addResourceData(const char* uri, BufferDescriptor&& buffer)
     pImpl->addResourceData(uri, std::move(buffer));
 }
 
+void ResourceLoader::setGeometryCache(BufferDescriptor&& cache) {
+    pImpl->mGeometryCacheData = std::make_shared<BufferDescriptor>(std::move(cache));
+}
+
+bool ResourceLoader::setGeometryCacheFromFile(const char* path) {
+    MappedFile* file = new MappedFile(path);
+    if (!file->isValid()) {
+        delete file;
+        return false;
+    }
+    setGeometryCache(BufferDescriptor(file->data(), file->size(),
+            [](void*, size_t, void* user) { delete (MappedFile*) user; }, file));
+    return true;
+}
+
+const void* ResourceLoader::getGeometryCache(size_t* size) const {
+    const std::vector<uint8_t>& cache = pImpl->mRecordedGeometryCache;
+    *size = cache.size();
+    return cache.empty() ? nullptr : cache.data();
+}
+
 static bool endsWith(std::string_view expr, std::string_view ending) {
     if (expr.length() >= ending.length()) {
         return (expr.compare(expr.length() - ending.length(), ending.length(), ending) == 0);
@@ -386,6 +558,48 @@ void ResourceLoader::evictResourceData() {
     pImpl->mUriDataCache->clear();
 }
 
+static void normalizeSkinningWeights(const cgltf_primitive& prim) {
+    auto normalize = [](cgltf_accessor* data) {
+        if (data->type != cgltf_type_vec4 || data->component_type != cgltf_component_type_r_32f) {
+            slog.w << "Cannot normalize weights, unsupported attribute type." << io::endl;
+            return;
+        }
+        uint8_t* bytes = (uint8_t*) data->buffer_view->buffer->data;
+        bytes += data->offset + data->buffer_view->offset;
+        for (cgltf_size i = 0, n = data->count; i < n; ++i, bytes += data->stride) {
+            float4* weights = (float4*) bytes;
+            const float sum = weights->x + weights->y + weights->z + weights->w;
+            *weights /= sum;
+        }
+    };
+    cgltf_size acount = prim.attributes_count;
+    for (cgltf_size aindex = 0; aindex < acount; ++aindex) {
+        const auto& attr = prim.attributes[aindex];
+        if (attr.type == cgltf_attribute_type_weights) {
+            normalize(attr.data);
+        }
+    }
+}
+
+// Makes each renderable of the asset wait for the geometry of all its primitives.
+static void addGeometryEdges(FFilamentAsset* asset) {
+    const cgltf_data* gltf = asset->mSourceAsset->hierarchy;
+    for (FFilamentInstance* instance : asset->mInstances) {
+        for (size_t i = 0, n = instance->mNodeMap.size(); i < n; ++i) {
+            const cgltf_mesh* mesh = gltf->nodes[i].mesh;
+            const Entity entity = instance->mNodeMap[i];
+            if (!mesh || !entity) {
+                continue;
+            }
+            for (const Primitive& prim : asset->mMeshCache[mesh - gltf->meshes]) {
+                if (prim.vertices) {
+                    asset->mDependencyGraph.addEdge(entity, prim.vertices);
+                }
+            }
+        }
+    }
+}
+
 bool ResourceLoader::loadResources(FilamentAsset* asset) {
     FFilamentAsset* fasset = downcast(asset);
     return loadResources(fasset, false);
@@ -400,6 +614,17 @@ bool ResourceLoader::loadResources(FFilamentAsset* asset, bool async) {
     }
     asset->mResourcesLoaded = true;
 
+    // A geometry cache is only used by the load that follows setGeometryCache().
+    GeometryCacheHandle geometryCache = std::move(pImpl->mGeometryCacheData);
+    pImpl->mRecordedGeometryCache.clear();
+
+    // When streaming, renderables also wait for their geometry. The dependency graph must know
+    // about it before progressive reveal is disabled.
+    const bool streaming = async && pImpl->mStreamingBudget > 0;
+    if (streaming) {
+        addGeometryEdges(asset);
+    }
+
     // At this point, any entities that are created in the future (i.e. dynamically added instances)
     // will not need the progressive feature to be enabled. This simplifies the dependency graph and
     // prevents it from growing.
@@ -463,14 +688,33 @@ bool ResourceLoader::loadResources(FFilamentAsset* asset, bool async) {
         return false;
     }
     #endif
-    // Decompress Draco meshes early on, which allows us to exploit subsequent processing such as
-    // tangent generation.
-    decodeDracoMeshes(asset);
-    decodeMeshoptCompression((cgltf_data*) gltf);
+
+    // The geometry cache is keyed by the source data, so it must be looked up before the data gets
+    // modified, e.g. by the normalization of skinning weights. The tangents jobs don't depend on
+    // the decoded data, they are needed to check that the cache matches the asset.
+    const bool recording = pImpl->mRecordGeometryCache && !streaming;
+    const bool useCache = geometryCache && !streaming;
+    const uint64_t cacheKey = recording || useCache ?
+            GeometryCache::computeKey(gltf, pImpl->mNormalizeSkinningWeights) : 0;
+    std::vector<TangentsJob::Params> tangents;
+    bool cached = false;
+    if (useCache) {
+        tangents = pImpl->getTangentsJobs(asset);
+        cached = pImpl->openGeometryCache(asset, *geometryCache, cacheKey, tangents);
+    }
+    pImpl->mRecording = recording && !cached;
+
+    // Decompress Draco meshes and meshopt buffers early on, which allows us to exploit subsequent
+    // processing such as tangent generation. When streaming, Draco meshes are decompressed along
+    // with the rest of their primitive's geometry, and when the geometry comes from the cache
+    // they are not decompressed at all.
+    decodeCompressedMeshes(asset->mSourceAsset.get(), pImpl->mEngine->getJobSystem(),
+            asset->mPrimitives.data(), streaming || cached ? 0 : asset->mPrimitives.size(),
+            getMeshoptViews((cgltf_data*) gltf, !cached));
 
     // For each skin, optionally normalize skinning weights and store a copy of the bind matrices.
     if (gltf->skins_count > 0) {
-        if (pImpl->mNormalizeSkinningWeights) {
+        if (pImpl->mNormalizeSkinningWeights && !streaming && !cached) {
             normalizeSkinningWeights(asset);
         }
         asset->mSkins.reserve(gltf->skins_count);
@@ -504,91 +748,29 @@ bool ResourceLoader::loadResources(FFilamentAsset* asset, bool async) {
         }
     }
 
-    Engine& engine = *pImpl->mEngine;
-
-    // Upload VertexBuffer and IndexBuffer data to the GPU.
-    for (auto slot : asset->mBufferSlots) {
-        const cgltf_accessor* accessor = slot.accessor;
-        if (!accessor->buffer_view) {
-            continue;
-        }
-        const uint8_t* bufferData = nullptr;
-        const uint8_t* data = nullptr;
-        if (accessor->buffer_view->has_meshopt_compression) {
-            bufferData = (const uint8_t*) accessor->buffer_view->data;
-            data = bufferData + accessor->offset;
-        } else {
-            bufferData = (const uint8_t*) accessor->buffer_view->buffer->data;
-            data = computeBindingOffset(accessor) + bufferData;
-        }
-        assert_invariant(bufferData);
-        const uint32_t size = computeBindingSize(accessor);
-        if (slot.vertexBuffer) {
-            if (requiresConversion(accessor)) {
-                const size_t floatsCount = accessor->count * cgltf_num_components(accessor->type);
-                const size_t floatsByteCount = sizeof(float) * floatsCount;
-                float* floatsData = (float*) malloc(floatsByteCount);
-                cgltf_accessor_unpack_floats(accessor, floatsData, floatsCount);
-                BufferObject* bo = BufferObject::Builder().size(floatsByteCount).build(engine);
-                asset->mBufferObjects.push_back(bo);
-                bo->setBuffer(engine, BufferDescriptor(floatsData, floatsByteCount, FREE_CALLBACK));
-                slot.vertexBuffer->setBufferObjectAt(engine, slot.bufferIndex, bo);
-                continue;
-            }
-            BufferObject* bo = BufferObject::Builder().size(size).build(engine);
-            asset->mBufferObjects.push_back(bo);
-            bo->setBuffer(engine, BufferDescriptor(data, size,
-                    uploadCallback, uploadUserdata(asset, pImpl->mUriDataCache)));
-            slot.vertexBuffer->setBufferObjectAt(engine, slot.bufferIndex, bo);
-            continue;
-        } else if (slot.indexBuffer) {
-            if (accessor->component_type == cgltf_component_type_r_8u) {
-                const size_t size16 = size * 2;
-                uint16_t* data16 = (uint16_t*) malloc(size16);
-                convertBytesToShorts(data16, data, size);
-                IndexBuffer::BufferDescriptor bd(data16, size16, FREE_CALLBACK);
-                slot.indexBuffer->setBuffer(engine, std::move(bd));
-                continue;
-            }
-            IndexBuffer::BufferDescriptor bd(data, size, uploadCallback,
-                    uploadUserdata(asset, pImpl->mUriDataCache));
-            slot.indexBuffer->setBuffer(engine, std::move(bd));
-            continue;
-        }
-
-        // If the buffer slot does not have an associated VertexBuffer or IndexBuffer, then this
-        // must be a morph target.
-        assert(slot.morphTargetBuffer);
-
-        if (requiresPacking(accessor)) {
-            const size_t floatsCount = accessor->count * cgltf_num_components(accessor->type);
-            const size_t floatsByteCount = sizeof(float) * floatsCount;
-            float* floatsData = (float*) malloc(floatsByteCount);
-            cgltf_accessor_unpack_floats(accessor, floatsData, floatsCount);
-            if (accessor->type == cgltf_type_vec3) {
-                slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
-                        (const float3*) floatsData, slot.morphTargetBuffer->getVertexCount());
-            } else {
-                slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
-                        (const float4*) data, slot.morphTargetBuffer->getVertexCount());
-            }
-            free(floatsData);
-            continue;
+    if (streaming) {
+        // The geometry is uploaded progressively by asyncUpdateLoad().
+        pImpl->beginStreaming(asset);
+    } else if (cached) {
+        pImpl->uploadCachedGeometry(asset, geometryCache, tangents);
+    } else {
+        // Upload VertexBuffer and IndexBuffer data to the GPU.
+        for (const BufferSlot& slot : asset->mBufferSlots) {
+            pImpl->uploadBufferSlot(asset, asset->mSourceAsset, slot);
         }
 
-        if (accessor->type == cgltf_type_vec3) {
-            slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
-                    (const float3*) data, slot.morphTargetBuffer->getVertexCount());
-        } else {
-            assert_invariant(accessor->type == cgltf_type_vec4);
-            slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
-                    (const float4*) data, slot.morphTargetBuffer->getVertexCount());
-        }
+        // Compute surface orientation quaternions if necessary. This is similar to sparse data in
+        // that we need to generate the contents of a GPU buffer by processing one or more CPU
+        // buffer(s).
+        tangents = pImpl->getTangentsJobs(asset);
+        pImpl->computeTangents(asset, tangents);
     }
 
-    // Compute surface orientation quaternions if necessary. This is similar to sparse data in that
-    // we need to generate the contents of a GPU buffer by processing one or more CPU buffer(s).
-    pImpl->computeTangents(asset);
+    if (pImpl->mRecording) {
+        pImpl->mRecordedGeometryCache = pImpl->mGeometryCache.serialize(cacheKey);
+        pImpl->mRecording = false;
+    }
+    pImpl->mGeometryCache = {};
 
     asset->mBufferSlots = {};
     asset->mPrimitives = {};
@@ -615,11 +797,13 @@ bool ResourceLoader::loadResources(FFilamentAsset* asset, bool async) {
 
 bool ResourceLoader::asyncBeginLoad(FilamentAsset* asset) {
     pImpl->mAsyncAsset = downcast(asset);
+    pImpl->mStreaming = {};
     return loadResources(downcast(asset), true);
 }
 
 void ResourceLoader::asyncCancelLoad() {
     pImpl->cancelTextureDecoding();
+    pImpl->mStreaming = {};
     pImpl->mAsyncAsset = nullptr;
     pImpl->mEngine->flushAndWait();
 }
@@ -629,7 +813,8 @@ void ResourceLoader::addTextureProvider(const char* mimeType, TextureProvider* p
 }
 
 float ResourceLoader::asyncGetLoadProgress() const {
-    if (pImpl->mTextureProviders.empty() || !pImpl->mAsyncAsset) {
+    const Streaming& streaming = pImpl->mStreaming;
+    if ((pImpl->mTextureProviders.empty() && !streaming.count) || !pImpl->mAsyncAsset) {
         return 0;
     }
     size_t pushedCount = 0;
@@ -640,10 +825,12 @@ float ResourceLoader::asyncGetLoadProgress() const {
     }
 
     // Textures that haven't been fully downloaded are not yet pushed into one of the
-    // decoding queues, so here we include them in the total "pending" count.
-    const size_t pendingCount = pushedCount + pImpl->mRemainingTextureDownloads;
+    // decoding queues, so here we include them in the total "pending" count. Streamed primitives
+    // are counted like textures.
+    const size_t pendingCount = pushedCount + pImpl->mRemainingTextureDownloads + streaming.count;
+    const size_t doneCount = poppedCount + streaming.next;
 
-    return pendingCount == 0 ? 1 : (float(poppedCount) / pendingCount);
+    return pendingCount == 0 ? 1 : (float(doneCount) / pendingCount);
 }
 
 void ResourceLoader::asyncUpdateLoad() {
@@ -656,6 +843,7 @@ void ResourceLoader::asyncUpdateLoad() {
             pImpl->mAsyncAsset->mDependencyGraph.markAsReady(texture);
         }
     }
+    pImpl->updateStreaming(pImpl->mAsyncAsset);
 }
 
 std::pair<Texture*, CacheResult> ResourceLoader::Impl::getOrCreateTexture(FFilamentAsset* asset,
@@ -807,8 +995,106 @@ void ResourceLoader::Impl::createTextures(FFilamentAsset* asset, bool async) {
     }
 }
 
-void ResourceLoader::Impl::computeTangents(FFilamentAsset* asset) {
-    SYSTRACE_CALL();
+void ResourceLoader::Impl::record(GeometryCache::Kind kind, const void* data, size_t size) {
+    if (mRecording) {
+        mGeometryCache.add(kind, data, size);
+    }
+}
+
+void ResourceLoader::Impl::uploadBufferSlot(FFilamentAsset* asset,
+        const FFilamentAsset::SourceHandle& source, const BufferSlot& slot) {
+    using Kind = GeometryCache::Kind;
+    Engine& engine = *mEngine;
+    const cgltf_accessor* accessor = slot.accessor;
+    if (!accessor->buffer_view) {
+        record(Kind::NONE, nullptr, 0);
+        return;
+    }
+    const uint8_t* bufferData = nullptr;
+    const uint8_t* data = nullptr;
+    if (accessor->buffer_view->has_meshopt_compression) {
+        bufferData = (const uint8_t*) accessor->buffer_view->data;
+        data = bufferData + accessor->offset;
+    } else {
+        bufferData = (const uint8_t*) accessor->buffer_view->buffer->data;
+        data = computeBindingOffset(accessor) + bufferData;
+    }
+    assert_invariant(bufferData);
+    const uint32_t size = computeBindingSize(accessor);
+    if (slot.vertexBuffer) {
+        if (requiresConversion(accessor)) {
+            const size_t floatsCount = accessor->count * cgltf_num_components(accessor->type);
+            const size_t floatsByteCount = sizeof(float) * floatsCount;
+            float* floatsData = (float*) malloc(floatsByteCount);
+            cgltf_accessor_unpack_floats(accessor, floatsData, floatsCount);
+            record(Kind::BUFFER_OBJECT, floatsData, floatsByteCount);
+            BufferObject* bo = BufferObject::Builder().size(floatsByteCount).build(engine);
+            asset->mBufferObjects.push_back(bo);
+            bo->setBuffer(engine, BufferDescriptor(floatsData, floatsByteCount, FREE_CALLBACK));
+            slot.vertexBuffer->setBufferObjectAt(engine, slot.bufferIndex, bo);
+            return;
+        }
+        record(Kind::BUFFER_OBJECT, data, size);
+        BufferObject* bo = BufferObject::Builder().size(size).build(engine);
+        asset->mBufferObjects.push_back(bo);
+        bo->setBuffer(engine, BufferDescriptor(data, size,
+                uploadCallback, uploadUserdata(source, mUriDataCache)));
+        slot.vertexBuffer->setBufferObjectAt(engine, slot.bufferIndex, bo);
+        return;
+    } else if (slot.indexBuffer) {
+        if (accessor->component_type == cgltf_component_type_r_8u) {
+            const size_t size16 = size * 2;
+            uint16_t* data16 = (uint16_t*) malloc(size16);
+            convertBytesToShorts(data16, data, size);
+            record(Kind::INDICES, data16, size16);
+            IndexBuffer::BufferDescriptor bd(data16, size16, FREE_CALLBACK);
+            slot.indexBuffer->setBuffer(engine, std::move(bd));
+            return;
+        }
+        record(Kind::INDICES, data, size);
+        IndexBuffer::BufferDescriptor bd(data, size, uploadCallback,
+                uploadUserdata(source, mUriDataCache));
+        slot.indexBuffer->setBuffer(engine, std::move(bd));
+        return;
+    }
+
+    // If the buffer slot does not have an associated VertexBuffer or IndexBuffer, then this
+    // must be a morph target.
+    assert(slot.morphTargetBuffer);
+    const size_t vertexCount = slot.morphTargetBuffer->getVertexCount();
+
+    if (requiresPacking(accessor)) {
+        const size_t floatsCount = accessor->count * cgltf_num_components(accessor->type);
+        const size_t floatsByteCount = sizeof(float) * floatsCount;
+        float* floatsData = (float*) malloc(floatsByteCount);
+        cgltf_accessor_unpack_floats(accessor, floatsData, floatsCount);
+        if (accessor->type == cgltf_type_vec3) {
+            record(Kind::MORPH_POSITIONS3, floatsData, vertexCount * sizeof(float3));
+            slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
+                    (const float3*) floatsData, vertexCount);
+        } else {
+            record(Kind::MORPH_POSITIONS4, data, vertexCount * sizeof(float4));
+            slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
+                    (const float4*) data, vertexCount);
+        }
+        free(floatsData);
+        return;
+    }
+
+    if (accessor->type == cgltf_type_vec3) {
+        record(Kind::MORPH_POSITIONS3, data, vertexCount * sizeof(float3));
+        slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
+                (const float3*) data, vertexCount);
+    } else {
+        assert_invariant(accessor->type == cgltf_type_vec4);
+        record(Kind::MORPH_POSITIONS4, data, vertexCount * sizeof(float4));
+        slot.morphTargetBuffer->setPositionsAt(engine, slot.bufferIndex,
+                (const float4*) data, vertexCount);
+    }
+}
+
+std::vector<TangentsJob::Params> ResourceLoader::Impl::getTangentsJobs(
+        FFilamentAsset* asset) const {
 
     const cgltf_accessor* kGenerateTangents = &asset->mGenerateTangents;
     const cgltf_accessor* kGenerateNormals = &asset->mGenerateNormals;
@@ -867,6 +1153,13 @@ void ResourceLoader::Impl::computeTangents(FFilamentAsset* asset) {
             }
         }
     }
+    return jobParams;
+}
+
+void ResourceLoader::Impl::computeTangents(FFilamentAsset* asset,
+        std::vector<TangentsJob::Params>& jobParams) {
+    SYSTRACE_CALL();
+    using Params = TangentsJob::Params;
 
     // Kick off jobs for computing tangent frames.
     JobSystem* js = &mEngine->getJobSystem();
@@ -880,6 +1173,8 @@ void ResourceLoader::Impl::computeTangents(FFilamentAsset* asset) {
     // Finally, upload quaternions to the GPU from the main thread.
     for (Params& params : jobParams) {
         if (params.context.vb) {
+            record(GeometryCache::Kind::BUFFER_OBJECT, params.out.results,
+                    params.out.vertexCount * sizeof(short4));
             BufferObject* bo = BufferObject::Builder()
                     .size(params.out.vertexCount * sizeof(short4)).build(*mEngine);
             asset->mBufferObjects.push_back(bo);
@@ -888,6 +1183,8 @@ void ResourceLoader::Impl::computeTangents(FFilamentAsset* asset) {
             params.context.vb->setBufferObjectAt(*mEngine, params.context.slot, bo);
         } else {
             assert_invariant(params.context.tb);
+            record(GeometryCache::Kind::MORPH_TANGENTS, params.out.results,
+                    params.out.vertexCount * sizeof(short4));
             params.context.tb->setTangentsAt(*mEngine, params.in.morphTargetIndex,
                     params.out.results, params.out.vertexCount);
             free(params.out.results);
@@ -895,6 +1192,244 @@ void ResourceLoader::Impl::computeTangents(FFilamentAsset* asset) {
     }
 }
 
+bool ResourceLoader::Impl::openGeometryCache(FFilamentAsset* asset,
+        const BufferDescriptor& cache, uint64_t key,
+        const std::vector<TangentsJob::Params>& tangents) {
+    using Kind = GeometryCache::Kind;
+    GeometryCache& geometryCache = mGeometryCache;
+    if (!geometryCache.open(cache.buffer, cache.size, key) ||
+            geometryCache.getEntryCount() != asset->mBufferSlots.size() + tangents.size()) {
+        slog.w << "Geometry cache doesn't match the asset, ignoring it." << io::endl;
+        geometryCache = {};
+        return false;
+    }
+
+    // Check that each entry has the size of the buffer it's uploaded to, in case the cache was
+    // created by a different version of the loader. Entries that don't upload anything are safe.
+    auto const matches = [](const GeometryCache::Entry& entry, VertexBuffer* vb, IndexBuffer* ib,
+            MorphTargetBuffer* tb, size_t expectedSize) {
+        switch (entry.kind) {
+            case Kind::NONE:
+                return true;
+            case Kind::BUFFER_OBJECT:
+                return vb && entry.size == expectedSize;
+            case Kind::INDICES:
+                return ib && entry.size == expectedSize;
+            case Kind::MORPH_POSITIONS3:
+                return tb && entry.size == tb->getVertexCount() * sizeof(float3);
+            case Kind::MORPH_POSITIONS4:
+                return tb && entry.size == tb->getVertexCount() * sizeof(float4);
+            case Kind::MORPH_TANGENTS:
+                return tb && entry.size == tb->getVertexCount() * sizeof(short4);
+        }
+        return false;
+    };
+
+    // These are the sizes uploadBufferSlot() uploads.
+    auto const getExpectedSize = [](const BufferSlot& slot) -> size_t {
+        const cgltf_accessor* accessor = slot.accessor;
+        if (slot.vertexBuffer) {
+            if (requiresConversion(accessor)) {
+                return slot.vertexBuffer->getVertexCount() * cgltf_num_components(accessor->type) *
+                        sizeof(float);
+            }
+            return computeBindingSize(accessor);
+        }
+        if (slot.indexBuffer) {
+            return slot.indexBuffer->getIndexCount() *
+                    (accessor->component_type == cgltf_component_type_r_32u ? 4 : 2);
+        }
+        return 0;
+    };
+
+    size_t index = 0;
+    bool valid = true;
+    for (const BufferSlot& slot : asset->mBufferSlots) {
+        const GeometryCache::Entry& entry = geometryCache.getEntry(index++);
+        valid = valid && entry.kind != Kind::MORPH_TANGENTS &&
+                matches(entry, slot.vertexBuffer, slot.indexBuffer, slot.morphTargetBuffer,
+                        getExpectedSize(slot));
+    }
+    for (const TangentsJob::Params& params : tangents) {
+        const GeometryCache::Entry& entry = geometryCache.getEntry(index++);
+        const Kind expected = params.context.vb ? Kind::BUFFER_OBJECT : Kind::MORPH_TANGENTS;
+        VertexBuffer* const vb = params.context.vb;
+        valid = valid && entry.kind == expected && matches(entry, vb, nullptr, params.context.tb,
+                vb ? vb->getVertexCount() * sizeof(short4) : 0);
+    }
+    if (!valid) {
+        slog.w << "Geometry cache is corrupted, ignoring it." << io::endl;
+        geometryCache = {};
+    }
+    return valid;
+}
+
+void ResourceLoader::Impl::uploadCachedGeometry(FFilamentAsset* asset,
+        const GeometryCacheHandle& cache, const std::vector<TangentsJob::Params>& tangents) {
+    SYSTRACE_CALL();
+    size_t index = 0;
+    for (const BufferSlot& slot : asset->mBufferSlots) {
+        uploadCachedEntry(asset, cache, mGeometryCache.getEntry(index++), slot.vertexBuffer,
+                slot.indexBuffer, slot.morphTargetBuffer, slot.bufferIndex);
+    }
+    for (const TangentsJob::Params& params : tangents) {
+        uploadCachedEntry(asset, cache, mGeometryCache.getEntry(index++), params.context.vb,
+                nullptr, params.context.tb,
+                params.context.vb ? params.context.slot : size_t(params.in.morphTargetIndex));
+    }
+}
+
+void ResourceLoader::Impl::uploadCachedEntry(FFilamentAsset* asset,
+        const GeometryCacheHandle& cache, const GeometryCache::Entry& entry, VertexBuffer* vb,
+        IndexBuffer* ib, MorphTargetBuffer* tb, size_t index) {
+    using Kind = GeometryCache::Kind;
+    Engine& engine = *mEngine;
+    switch (entry.kind) {
+        case Kind::NONE:
+            break;
+        case Kind::BUFFER_OBJECT: {
+            BufferObject* bo = BufferObject::Builder().size(entry.size).build(engine);
+            asset->mBufferObjects.push_back(bo);
+            bo->setBuffer(engine, BufferDescriptor(entry.data, entry.size, uploadCallback,
+                    new UploadEvent({ {}, {}, cache })));
+            vb->setBufferObjectAt(engine, uint8_t(index), bo);
+            break;
+        }
+        case Kind::INDICES:
+            ib->setBuffer(engine, IndexBuffer::BufferDescriptor(entry.data, entry.size,
+                    uploadCallback, new UploadEvent({ {}, {}, cache })));
+            break;
+        case Kind::MORPH_POSITIONS3:
+            tb->setPositionsAt(engine, index, (const float3*) entry.data,
+                    entry.size / sizeof(float3));
+            break;
+        case Kind::MORPH_POSITIONS4:
+            tb->setPositionsAt(engine, index, (const float4*) entry.data,
+                    entry.size / sizeof(float4));
+            break;
+        case Kind::MORPH_TANGENTS:
+            tb->setTangentsAt(engine, index, (const short4*) entry.data,
+                    entry.size / sizeof(short4));
+            break;
+    }
+}
+
+void ResourceLoader::Impl::beginStreaming(FFilamentAsset* asset) {
+    // This needs the asset's primitives, which are moved to the streaming state below.
+    std::vector<TangentsJob::Params> tangents = getTangentsJobs(asset);
+
+    Streaming& streaming = mStreaming;
+    streaming.source = asset->mSourceAsset;
+    streaming.primitives = std::move(asset->mPrimitives);
+    streaming.geometry.clear();
+    streaming.geometry.reserve(streaming.primitives.size());
+    streaming.next = 0;
+    streaming.count = streaming.primitives.size();
+
+    // Find the primitive that owns each of the buffers that need to be populated.
+    tsl::robin_map<const cgltf_primitive*, size_t> primitiveIndices;
+    tsl::robin_map<const void*, size_t> bufferIndices;
+    for (size_t i = 0, n = streaming.primitives.size(); i < n; ++i) {
+        auto [prim, vb] = streaming.primitives[i];
+        primitiveIndices[prim] = i;
+        bufferIndices[vb] = i;
+        streaming.geometry.push_back({ vb });
+    }
+    const cgltf_data* gltf = asset->mSourceAsset->hierarchy;
+    for (size_t i = 0, n = gltf->meshes_count; i < n; ++i) {
+        const cgltf_mesh& mesh = gltf->meshes[i];
+        const FixedCapacityVector<Primitive>& prims = asset->mMeshCache[i];
+        for (size_t pindex = 0, pcount = prims.size(); pindex < pcount; ++pindex) {
+            auto iter = primitiveIndices.find(&mesh.primitives[pindex]);
+            if (iter != primitiveIndices.end()) {
+                bufferIndices[prims[pindex].indices] = iter->second;
+                bufferIndices[prims[pindex].targets] = iter->second;
+            }
+        }
+    }
+
+    for (const BufferSlot& slot : asset->mBufferSlots) {
+        const void* buffer = slot.vertexBuffer ? (const void*) slot.vertexBuffer :
+                slot.indexBuffer ? (const void*) slot.indexBuffer : slot.morphTargetBuffer;
+        auto iter = bufferIndices.find(buffer);
+        if (UTILS_UNLIKELY(!buffer || iter == bufferIndices.end())) {
+            continue;
+        }
+        StreamedGeometry& geometry = streaming.geometry[iter->second];
+        geometry.slots.push_back(slot);
+        if (slot.accessor->buffer_view || slot.accessor->is_sparse) {
+            geometry.size += computeBindingSize(slot.accessor);
+        }
+    }
+
+    for (const TangentsJob::Params& params : tangents) {
+        auto iter = primitiveIndices.find(params.in.prim);
+        if (iter != primitiveIndices.end()) {
+            StreamedGeometry& geometry = streaming.geometry[iter->second];
+            geometry.tangents.push_back(params);
+            geometry.size += params.in.prim->attributes_count > 0 ?
+                    params.in.prim->attributes[0].data->count * sizeof(short4) : 0;
+        }
+    }
+
+    // Draco meshes are not decoded yet, so their size is estimated from the compressed data.
+    for (size_t i = 0, n = streaming.primitives.size(); i < n; ++i) {
+        const cgltf_primitive* prim = streaming.primitives[i].first;
+        if (prim->has_draco_mesh_compression) {
+            streaming.geometry[i].size += prim->draco_mesh_compression.buffer_view->size;
+        }
+    }
+}
+
+void ResourceLoader::Impl::updateStreaming(FFilamentAsset* asset) {
+    SYSTRACE_CALL();
+    Streaming& streaming = mStreaming;
+    if (streaming.next == streaming.count) {
+        return;
+    }
+
+    // Process at least one primitive, and as many as fit in the budget.
+    const size_t first = streaming.next;
+    size_t last = first;
+    size_t size = 0;
+    do {
+        size += streaming.geometry[last++].size;
+    } while (last < streaming.count && size + streaming.geometry[last].size <= mStreamingBudget);
+
+    decodeCompressedMeshes(streaming.source.get(), mEngine->getJobSystem(),
+            streaming.primitives.data() + first, last - first, {});
+
+    std::vector<TangentsJob::Params> tangents;
+    for (size_t i = first; i < last; ++i) {
+        const auto [prim, vb] = streaming.primitives[i];
+        if (mNormalizeSkinningWeights && vb) {
+            gltfio::normalizeSkinningWeights(*prim);
+        }
+        for (const BufferSlot& slot : streaming.geometry[i].slots) {
+            uploadBufferSlot(asset, streaming.source, slot);
+        }
+        // Primitives that failed to decode don't get tangents.
+        for (const TangentsJob::Params& params : streaming.geometry[i].tangents) {
+            if (vb || !params.context.vb) {
+                tangents.push_back(params);
+            }
+        }
+    }
+    computeTangents(asset, tangents);
+
+    for (size_t i = first; i < last; ++i) {
+        asset->mDependencyGraph.markAsReady(streaming.geometry[i].vertexBuffer);
+    }
+
+    streaming.next = last;
+    if (streaming.next == streaming.count) {
+        // Keep the counts for asyncGetLoadProgress(), but release everything else.
+        streaming.source.reset();
+        streaming.primitives = {};
+        streaming.geometry = std::vector<StreamedGeometry>();
+    }
+}
+
 ResourceLoader::Impl::~Impl() {
     for (const auto& iter : mTextureProviders) {
         iter.second->cancelDecoding();
@@ -902,33 +1437,13 @@ ResourceLoader::Impl::~Impl() {
 }
 
 void ResourceLoader::normalizeSkinningWeights(FFilamentAsset* asset) const {
-    auto normalize = [](cgltf_accessor* data) {
-        if (data->type != cgltf_type_vec4 || data->component_type != cgltf_component_type_r_32f) {
-            slog.w << "Cannot normalize weights, unsupported attribute type." << io::endl;
-            return;
-        }
-        uint8_t* bytes = (uint8_t*) data->buffer_view->buffer->data;
-        bytes += data->offset + data->buffer_view->offset;
-        for (cgltf_size i = 0, n = data->count; i < n; ++i, bytes += data->stride) {
-            float4* weights = (float4*) bytes;
-            const float sum = weights->x + weights->y + weights->z + weights->w;
-            *weights /= sum;
-        }
-    };
     const cgltf_data* gltf = asset->mSourceAsset->hierarchy;
     cgltf_size mcount = gltf->meshes_count;
     for (cgltf_size mindex = 0; mindex < mcount; ++mindex) {
         const cgltf_mesh& mesh = gltf->meshes[mindex];
         cgltf_size pcount = mesh.primitives_count;
         for (cgltf_size pindex = 0; pindex < pcount; ++pindex) {
-            const cgltf_primitive& prim = mesh.primitives[pindex];
-            cgltf_size acount = prim.attributes_count;
-            for (cgltf_size aindex = 0; aindex < acount; ++aindex) {
-                const auto& attr = prim.attributes[aindex];
-                if (attr.type == cgltf_attribute_type_weights) {
-                    normalize(attr.data);
-                }
-            }
+            gltfio::normalizeSkinningWeights(mesh.primitives[pindex]);
         }
     }
 }
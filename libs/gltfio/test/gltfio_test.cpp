@@ -23,8 +23,10 @@
 #include <filament/RenderableManager.h>
 #include <filament/TransformManager.h>
 
+#include <gltfio/Animator.h>
 #include <gltfio/AssetLoader.h>
 #include <gltfio/FilamentAsset.h>
+#include <gltfio/FilamentInstance.h>
 #include <gltfio/ResourceLoader.h>
 #include <gltfio/TextureProvider.h>
 #include <gltfio/math.h>
@@ -35,8 +37,17 @@
 
 #include "materials/uberarchive.h"
 
+#include "../src/GeometryCache.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 using namespace filament;
 using namespace backend;
@@ -44,6 +55,7 @@ using namespace gltfio;
 using namespace utils;
 
 char const* ANIMATED_MORPH_CUBE_GLB = "AnimatedMorphCube.glb";
+char const* MESHOPT_PIRATE_GLB = "pirate.glb";
 
 static std::ifstream::pos_type getFileSize(const char* filename) {
     std::ifstream in(filename, std::ifstream::ate | std::ifstream::binary);
@@ -236,6 +248,441 @@ TEST_F(glTFIOTest, AnimatedMorphCubeRenderables) {
     EXPECT_EQ(morphTargetBuffer->getVertexCount(), 24u);
 }
 
+TEST_F(glTFIOTest, AnimatedMorphCubeFromFile) {
+    Path const filename = Path::getCurrentExecutable().getParent() + Path(ANIMATED_MORPH_CUBE_GLB);
+
+    AssetLoader* assetLoader = AssetLoader::create({ mEngine, mMaterialProvider, mNameManager });
+    EXPECT_EQ(assetLoader->createAssetFromFile("does_not_exist.glb"), nullptr);
+
+    FilamentAsset* asset = assetLoader->createAssetFromFile(filename.c_str());
+    ASSERT_NE(asset, nullptr);
+    EXPECT_EQ(asset->getRenderableEntityCount(), 1u);
+
+    ResourceLoader resourceLoader({ mEngine, filename.getAbsolutePath().c_str(), false });
+    EXPECT_TRUE(resourceLoader.loadResources(asset));
+    asset->releaseSourceData();
+
+    // The mapping must outlive the uploads, which complete asynchronously.
+    mEngine->flushAndWait();
+
+    assetLoader->destroyAsset(asset);
+    AssetLoader::destroy(&assetLoader);
+}
+
+TEST_F(glTFIOTest, AnimatedMorphCubeStreaming) {
+    Path const filename = Path::getCurrentExecutable().getParent() + Path(ANIMATED_MORPH_CUBE_GLB);
+    std::ifstream in(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+    std::vector<uint8_t> buffer(static_cast<unsigned long>(getFileSize(filename.c_str())));
+    ASSERT_TRUE(in.read((char*) buffer.data(), buffer.size()));
+
+    AssetLoader* assetLoader = AssetLoader::create({ mEngine, mMaterialProvider, mNameManager });
+    FilamentAsset* asset = assetLoader->createAsset(buffer.data(), buffer.size());
+    ASSERT_NE(asset, nullptr);
+
+    // With a budget of one byte, each update uploads a single primitive.
+    ResourceLoader resourceLoader({ mEngine, filename.getAbsolutePath().c_str(), false, 1 });
+    ASSERT_TRUE(resourceLoader.asyncBeginLoad(asset));
+    asset->releaseSourceData();
+
+    // The only renderable isn't ready before its geometry has been uploaded.
+    EXPECT_EQ(asset->popRenderables(nullptr, 0), 0u);
+    EXPECT_LT(resourceLoader.asyncGetLoadProgress(), 1.0f);
+
+    resourceLoader.asyncUpdateLoad();
+    EXPECT_EQ(asset->popRenderables(nullptr, 0), 1u);
+    EXPECT_EQ(resourceLoader.asyncGetLoadProgress(), 1.0f);
+
+    assetLoader->destroyAsset(asset);
+    AssetLoader::destroy(&assetLoader);
+}
+
+TEST_F(glTFIOTest, AnimatedMorphCubeGeometryCache) {
+    Path const filename = Path::getCurrentExecutable().getParent() + Path(ANIMATED_MORPH_CUBE_GLB);
+    std::ifstream in(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+    std::vector<uint8_t> buffer(static_cast<unsigned long>(getFileSize(filename.c_str())));
+    ASSERT_TRUE(in.read((char*) buffer.data(), buffer.size()));
+
+    AssetLoader* assetLoader = AssetLoader::create({ mEngine, mMaterialProvider, mNameManager });
+    ResourceLoader resourceLoader({ mEngine, filename.getAbsolutePath().c_str(), false, 0, true });
+
+    // The first load records the cache.
+    FilamentAsset* asset = assetLoader->createAsset(buffer.data(), buffer.size());
+    ASSERT_NE(asset, nullptr);
+    EXPECT_TRUE(resourceLoader.loadResources(asset));
+    size_t size = 0;
+    const uint8_t* data = (const uint8_t*) resourceLoader.getGeometryCache(&size);
+    ASSERT_NE(data, nullptr);
+    std::vector<uint8_t> const cache(data, data + size);
+
+    // A valid cache is used as is, there is nothing new to record.
+    FilamentAsset* cachedAsset = assetLoader->createAsset(buffer.data(), buffer.size());
+    ASSERT_NE(cachedAsset, nullptr);
+    resourceLoader.setGeometryCache({ cache.data(), cache.size() });
+    EXPECT_TRUE(resourceLoader.loadResources(cachedAsset));
+    EXPECT_EQ(resourceLoader.getGeometryCache(&size), nullptr);
+
+    // An invalid cache is ignored, and a new one is recorded from what the load uploads instead,
+    // which must be what the original cache contains.
+    std::vector<FilamentAsset*> assets = { asset, cachedAsset };
+    auto const expectIgnored = [&](std::vector<uint8_t> const& invalid) {
+        FilamentAsset* invalidAsset = assetLoader->createAsset(buffer.data(), buffer.size());
+        ASSERT_NE(invalidAsset, nullptr);
+        assets.push_back(invalidAsset);
+        resourceLoader.setGeometryCache({ invalid.data(), invalid.size() });
+        EXPECT_TRUE(resourceLoader.loadResources(invalidAsset));
+        size_t size = 0;
+        const uint8_t* data = (const uint8_t*) resourceLoader.getGeometryCache(&size);
+        ASSERT_NE(data, nullptr);
+        EXPECT_EQ(std::vector<uint8_t>(data, data + size), cache);
+    };
+
+    // A cache created from different source data.
+    std::vector<uint8_t> stale(cache);
+    stale[8] ^= 0xFF;
+    expectIgnored(stale);
+
+    // A cache whose contents are damaged.
+    std::vector<uint8_t> damaged(cache);
+    damaged[damaged.size() - 1] ^= 0xFF;
+    expectIgnored(damaged);
+
+    // A cache whose vertex or index data doesn't have the size of its buffer, even though the
+    // cache itself is intact.
+    uint64_t key;
+    memcpy(&key, cache.data() + 8, sizeof(key));
+    GeometryCache original;
+    ASSERT_TRUE(original.open(cache.data(), cache.size(), key));
+    std::vector<std::vector<uint8_t>> resizedCaches;
+    for (auto kind : { GeometryCache::Kind::BUFFER_OBJECT, GeometryCache::Kind::INDICES }) {
+        GeometryCache resized;
+        bool found = false;
+        for (size_t i = 0; i < original.getEntryCount(); i++) {
+            GeometryCache::Entry const& entry = original.getEntry(i);
+            bool const truncate = !found && entry.kind == kind;
+            found = found || truncate;
+            resized.add(entry.kind, entry.data, truncate ? entry.size - 4 : entry.size);
+        }
+        ASSERT_TRUE(found);
+        expectIgnored(resizedCaches.emplace_back(resized.serialize(key)));
+    }
+
+    // The caches must outlive the uploads, which complete asynchronously.
+    mEngine->flushAndWait();
+
+    for (FilamentAsset* a : assets) {
+        assetLoader->destroyAsset(a);
+    }
+    AssetLoader::destroy(&assetLoader);
+}
+
+TEST_F(glTFIOTest, MeshoptCompressedGeometry) {
+    Path const filename = Path::getCurrentExecutable().getParent() + Path(MESHOPT_PIRATE_GLB);
+    std::ifstream in(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+    std::vector<uint8_t> buffer(static_cast<unsigned long>(getFileSize(filename.c_str())));
+    ASSERT_TRUE(in.read((char*) buffer.data(), buffer.size()));
+
+    AssetLoader* assetLoader = AssetLoader::create({ mEngine, mMaterialProvider, mNameManager });
+    FilamentAsset* asset = assetLoader->createAsset(buffer.data(), buffer.size());
+    ASSERT_NE(asset, nullptr);
+    ASSERT_EQ(asset->getRenderableEntityCount(), 1u);
+
+    ResourceLoader resourceLoader({ mEngine, filename.getAbsolutePath().c_str(), false });
+    EXPECT_TRUE(resourceLoader.loadResources(asset));
+
+    // The initial bounding box comes from the accessor bounds, the recomputed one from the
+    // decoded positions, they only match if the vertex buffer was decoded correctly.
+    auto& rm = mEngine->getRenderableManager();
+    auto const renderable = rm.getInstance(asset->getRenderableEntities()[0]);
+    Box const expected = rm.getAxisAlignedBoundingBox(renderable);
+    EXPECT_EQ(expected.getMin(), math::float3(0, 0, 0));
+    EXPECT_EQ(expected.getMax(), math::float3(13081, 16383, 3915));
+
+    asset->getInstance()->recomputeBoundingBoxes();
+    Box const decoded = rm.getAxisAlignedBoundingBox(renderable);
+    EXPECT_EQ(decoded.getMin(), expected.getMin());
+    EXPECT_EQ(decoded.getMax(), expected.getMax());
+
+    mEngine->flushAndWait();
+
+    assetLoader->destroyAsset(asset);
+    AssetLoader::destroy(&assetLoader);
+}
+
+// A glTF asset whose single animation targets five nodes, named "node0" to "node4", with linear,
+// step and cubic spline samplers. Two samplers start after the first keyframe and end before the
+// last keyframe of the others, and the rotations include keyframes whose quaternions are opposite
+// or 180 degrees apart.
+class AnimationData {
+public:
+    static constexpr float DURATION = 2.0f;
+    static constexpr size_t NODE_COUNT = 5;
+
+    struct Sampler {
+        std::vector<float> times;
+        std::vector<float> values;
+        char const* interpolation;
+        char const* path;
+        size_t node;
+    };
+
+    AnimationData() {
+        std::vector<float> const t3 = { 0.0f, 1.0f, 2.0f };
+        std::vector<float> const t2 = { 0.5f, 1.5f };
+        float const h = 0.7071068f;
+        mSamplers = {
+                { t3, { 0, 0, 0,   1, 2, 3,   -1, 0, 4 }, "LINEAR", "translation", 0 },
+                { t3, { 0, 0, 0, 1,   0, 1, 0, 0,   0, -h, 0, h }, "LINEAR", "rotation", 0 },
+                { t3, { 1, 1, 1,   2, 2, 2,   0.5f, 1, 3 }, "STEP", "scale", 0 },
+                { t3, { 0, 0, 0, 1,   h, 0, 0, h,   0, 0, 1, 0 }, "STEP", "rotation", 1 },
+                { t3, {
+                        0, 0, 0,   0, 0, 0,   1, 0, 0,
+                        0, 1, 0,   1, 1, 1,   0, 0, 1,
+                        1, 1, 0,   2, 0, -1,   0, 0, 0 }, "CUBICSPLINE", "translation", 1 },
+                { t3, {
+                        0, 0, 0, 0,      0, 0, 0, 1,   0, 0.5f, 0, 0,
+                        0.1f, 0, 0, 0,   0, h, 0, h,   0, 0, 0.2f, 0,
+                        0, 0, 0, 0,      0, 0, 1, 0,   0, 0, 0, 0 }, "CUBICSPLINE", "rotation", 2 },
+                { t2, { 1, 1, 1,   3, 2, 1 }, "LINEAR", "scale", 2 },
+                { t3, { 0, 0, 0, 1,   0, 0, 0, -1,   0, 0, 1, 0 }, "LINEAR", "rotation", 3 },
+                { t2, { 0, 0, 0,   0, 4, 0 }, "LINEAR", "translation", 3 },
+                { t2, { 1, 0, 0, 0,   0, h, 0, h }, "LINEAR", "rotation", 4 },
+        };
+
+        // All the keyframes and values go in a single buffer view, one accessor each.
+        std::string accessors;
+        std::string samplers;
+        std::string channels;
+        for (size_t i = 0; i < mSamplers.size(); i++) {
+            Sampler const& sampler = mSamplers[i];
+            size_t const components = sampler.path[0] == 'r' ? 4 : 3;
+            char const* const type = components == 4 ? "VEC4" : "VEC3";
+            std::string const separator = i ? "," : "";
+            accessors += separator + accessor(sampler.times, "SCALAR");
+            accessors += "," + accessor(sampler.values, type, components);
+            samplers += separator + "{\"input\":" + std::to_string(i * 2) +
+                    ",\"output\":" + std::to_string(i * 2 + 1) +
+                    ",\"interpolation\":\"" + sampler.interpolation + "\"}";
+            channels += separator + "{\"sampler\":" + std::to_string(i) +
+                    ",\"target\":{\"node\":" + std::to_string(sampler.node) +
+                    ",\"path\":\"" + sampler.path + "\"}}";
+        }
+
+        std::string nodes;
+        std::string sceneNodes;
+        for (size_t i = 0; i < NODE_COUNT; i++) {
+            std::string const separator = i ? "," : "";
+            nodes += separator + "{\"name\":\"node" + std::to_string(i) + "\"}";
+            sceneNodes += separator + std::to_string(i);
+        }
+
+        size_t const byteLength = mBuffer.size() * sizeof(float);
+        std::string json = "{\"asset\":{\"version\":\"2.0\"},\"scene\":0,"
+                "\"scenes\":[{\"nodes\":[" + sceneNodes + "]}],"
+                "\"nodes\":[" + nodes + "],"
+                "\"animations\":[{\"samplers\":[" + samplers + "],"
+                "\"channels\":[" + channels + "]}],"
+                "\"accessors\":[" + accessors + "],"
+                "\"bufferViews\":[{\"buffer\":0,\"byteLength\":" +
+                std::to_string(byteLength) + "}],"
+                "\"buffers\":[{\"byteLength\":" + std::to_string(byteLength) + "}]}";
+
+        // Wrap the JSON and the buffer in a binary glTF, so that the buffer doesn't need to be
+        // loaded from a file. Chunks are 4-bytes aligned, the JSON chunk is padded with spaces.
+        json.resize((json.size() + 3) & ~size_t(3), ' ');
+        auto const appendWord = [this](uint32_t word) {
+            mGlb.insert(mGlb.end(), (uint8_t const*) &word, (uint8_t const*) &word + 4);
+        };
+        appendWord(0x46546C67); // "glTF"
+        appendWord(2);
+        appendWord(uint32_t(12 + 8 + json.size() + 8 + byteLength));
+        appendWord(uint32_t(json.size()));
+        appendWord(0x4E4F534A); // "JSON"
+        mGlb.insert(mGlb.end(), json.begin(), json.end());
+        appendWord(uint32_t(byteLength));
+        appendWord(0x004E4942); // "BIN"
+        mGlb.insert(mGlb.end(), (uint8_t const*) mBuffer.data(),
+                (uint8_t const*) mBuffer.data() + byteLength);
+    }
+
+    uint8_t const* getGlb() const { return mGlb.data(); }
+    uint32_t getGlbSize() const { return uint32_t(mGlb.size()); }
+
+    // Computes the local transform of each node at the given time, the way the previous
+    // implementation of Animator did: it looked up the keyframes with std::map::lower_bound() and
+    // interpolated the rotations with math::slerp().
+    std::array<math::mat4f, NODE_COUNT> evaluate(float time) const {
+        time = std::fmod(time, DURATION);
+        std::array<math::float3, NODE_COUNT> translations{};
+        std::array<math::quatf, NODE_COUNT> rotations;
+        std::array<math::float3, NODE_COUNT> scales;
+        rotations.fill(math::quatf{ 1, 0, 0, 0 });
+        scales.fill(math::float3{ 1 });
+
+        for (Sampler const& sampler : mSamplers) {
+            std::vector<float> const& times = sampler.times;
+            bool const step = sampler.interpolation[0] == 'S';
+            bool const cubic = sampler.interpolation[0] == 'C';
+            auto const iter = std::lower_bound(times.begin(), times.end(), time);
+            size_t prev = 0;
+            size_t next = 0;
+            float t = 0.0f;
+            if (iter == times.end()) {
+                prev = next = times.size() - 1;
+            } else if (iter != times.begin()) {
+                next = size_t(iter - times.begin());
+                prev = next - 1;
+                t = (time - times[prev]) / (times[next] - times[prev]);
+            }
+            if (step) {
+                // Exactly on a keyframe, the previous implementation held the value of the
+                // keyframe before it. glTF specifies the value of the keyframe reached, which is
+                // what Animator returns now.
+                if (t == 1.0f) {
+                    prev = next;
+                }
+                t = 0.0f;
+            }
+
+            if (sampler.path[0] == 'r') {
+                math::quatf const* values = (math::quatf const*) sampler.values.data();
+                rotations[sampler.node] = cubic ?
+                        normalize(cubicSpline(values[prev * 3 + 1], values[prev * 3 + 2],
+                                values[next * 3 + 1], values[next * 3], t)) :
+                        slerp(values[prev], values[next], t);
+                continue;
+            }
+            math::float3 const* values = (math::float3 const*) sampler.values.data();
+            math::float3 const value = cubic ?
+                    cubicSpline(values[prev * 3 + 1], values[prev * 3 + 2],
+                            values[next * 3 + 1], values[next * 3], t) :
+                    (1 - t) * values[prev] + t * values[next];
+            if (sampler.path[0] == 't') {
+                translations[sampler.node] = value;
+            } else {
+                scales[sampler.node] = value;
+            }
+        }
+
+        std::array<math::mat4f, NODE_COUNT> transforms;
+        for (size_t i = 0; i < NODE_COUNT; i++) {
+            transforms[i] = composeMatrix(translations[i], rotations[i], scales[i]);
+        }
+        return transforms;
+    }
+
+private:
+    // Appends the data to the buffer and returns the JSON of its accessor.
+    std::string accessor(std::vector<float> const& data, char const* type,
+            size_t components = 1) {
+        std::string const result = "{\"bufferView\":0,\"byteOffset\":" +
+                std::to_string(mBuffer.size() * sizeof(float)) +
+                ",\"componentType\":5126,\"count\":" +
+                std::to_string(data.size() / components) + ",\"type\":\"" + type + "\"}";
+        mBuffer.insert(mBuffer.end(), data.begin(), data.end());
+        return result;
+    }
+
+    std::vector<Sampler> mSamplers;
+    std::vector<float> mBuffer;
+    std::vector<uint8_t> mGlb;
+};
+
+// Returns the entities of the animated nodes of an instance, in the order of the glTF nodes.
+static std::array<Entity, AnimationData::NODE_COUNT> getAnimatedNodes(
+        FilamentInstance const* instance, NameComponentManager const& nameManager) {
+    std::array<Entity, AnimationData::NODE_COUNT> nodes;
+    Entity const* const entities = instance->getEntities();
+    for (size_t i = 0, c = instance->getEntityCount(); i < c; i++) {
+        auto const ni = nameManager.getInstance(entities[i]);
+        char const* const name = ni ? nameManager.getName(ni) : nullptr;
+        if (name && strncmp(name, "node", 4) == 0) {
+            nodes[size_t(name[4] - '0')] = entities[i];
+        }
+    }
+    return nodes;
+}
+
+// Times to evaluate, which go back and forth to exercise the keyframe cursors: before the first
+// keyframe of some samplers, exactly on keyframes, past the last keyframe of some samplers, and
+// past the end of the animation.
+static constexpr float ANIMATION_TIMES[] = {
+        0.0f, 0.25f, 0.5f, 0.75f, 1.0f, 1.2f, 1.5f, 1.75f, 1.999f,
+        1.25f, 0.1f, 1.0f, 0.6f, 2.0f, 2.6f, 5.0f, 3.5f, 0.9f, 1.9f
+};
+
+TEST_F(glTFIOTest, AnimationMatchesReference) {
+    AnimationData const data;
+    AssetLoader* assetLoader = AssetLoader::create({ mEngine, mMaterialProvider, mNameManager });
+    FilamentAsset* asset = assetLoader->createAsset(data.getGlb(), data.getGlbSize());
+    ASSERT_NE(asset, nullptr);
+    ResourceLoader resourceLoader({ mEngine, "animation.glb", false });
+    ASSERT_TRUE(resourceLoader.loadResources(asset));
+
+    Animator* animator = asset->getInstance()->getAnimator();
+    ASSERT_EQ(animator->getAnimationCount(), 1u);
+    EXPECT_EQ(animator->getAnimationDuration(0), AnimationData::DURATION);
+
+    auto const& transformManager = mEngine->getTransformManager();
+    auto const nodes = getAnimatedNodes(asset->getInstance(), *mNameManager);
+    for (float const time : ANIMATION_TIMES) {
+        animator->applyAnimation(0, time);
+        auto const expected = data.evaluate(time);
+        for (size_t i = 0; i < AnimationData::NODE_COUNT; i++) {
+            auto const transform = transformManager.getTransform(
+                    transformManager.getInstance(nodes[i]));
+            SCOPED_TRACE(testing::Message() << "time " << time << ", node" << i);
+            EXPECT_MAT_NEAR(transform, expected[i], 1e-4f);
+        }
+    }
+
+    assetLoader->destroyAsset(asset);
+    AssetLoader::destroy(&assetLoader);
+}
+
+TEST_F(glTFIOTest, InstancedAnimationsMatchReference) {
+    constexpr size_t INSTANCE_COUNT = 3;
+    AnimationData const data;
+    AssetLoader* assetLoader = AssetLoader::create({ mEngine, mMaterialProvider, mNameManager });
+    FilamentInstance* instances[INSTANCE_COUNT] = {};
+    FilamentAsset* asset = assetLoader->createInstancedAsset(data.getGlb(), data.getGlbSize(),
+            instances, INSTANCE_COUNT);
+    ASSERT_NE(asset, nullptr);
+    ResourceLoader resourceLoader({ mEngine, "animation.glb", false });
+    ASSERT_TRUE(resourceLoader.loadResources(asset));
+
+    Animator* animators[INSTANCE_COUNT];
+    std::array<Entity, AnimationData::NODE_COUNT> nodes[INSTANCE_COUNT];
+    for (size_t i = 0; i < INSTANCE_COUNT; i++) {
+        animators[i] = instances[i]->getAnimator();
+        nodes[i] = getAnimatedNodes(instances[i], *mNameManager);
+    }
+
+    // Each instance is at a different time, and each one must only be affected by its own.
+    auto const& transformManager = mEngine->getTransformManager();
+    size_t const indices[INSTANCE_COUNT] = {};
+    size_t const timeCount = std::size(ANIMATION_TIMES);
+    for (size_t frame = 0; frame < timeCount; frame++) {
+        float times[INSTANCE_COUNT];
+        for (size_t i = 0; i < INSTANCE_COUNT; i++) {
+            times[i] = ANIMATION_TIMES[(frame + i * 5) % timeCount];
+        }
+        Animator::applyAnimations(animators, indices, times, INSTANCE_COUNT);
+        for (size_t i = 0; i < INSTANCE_COUNT; i++) {
+            auto const expected = data.evaluate(times[i]);
+            for (size_t j = 0; j < AnimationData::NODE_COUNT; j++) {
+                auto const transform = transformManager.getTransform(
+                        transformManager.getInstance(nodes[i][j]));
+                SCOPED_TRACE(testing::Message() << "instance " << i << ", time " << times[i]
+                        << ", node" << j);
+                EXPECT_MAT_NEAR(transform, expected[j], 1e-4f);
+            }
+        }
+    }
+
+    assetLoader->destroyAsset(asset);
+    AssetLoader::destroy(&assetLoader);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -747,6 +747,8 @@ int parse(jsmntok_t const* tokens, int i, const char* jsonChunk, TemporalAntiAli
             i = parse(tokens, i + 1, jsonChunk, &out->preventFlickering);
         } else if (compare(tok, jsonChunk, "historyReprojection") == 0) {
             i = parse(tokens, i + 1, jsonChunk, &out->historyReprojection);
+        } else if (compare(tok, jsonChunk, "motionVectors") == 0) {
+            i = parse(tokens, i + 1, jsonChunk, &out->motionVectors);
         } else {
             slog.w << "Invalid TemporalAntiAliasingOptions key: '" << STR(tok, jsonChunk) << "'" << io::endl;
             i = parse(tokens, i + 1);
@@ -775,7 +777,8 @@ std::ostream& operator<<(std::ostream& out, const TemporalAntiAliasingOptions& i
         << "\"jitterPattern\": " << (in.jitterPattern) << ",\n"
         << "\"varianceGamma\": " << (in.varianceGamma) << ",\n"
         << "\"preventFlickering\": " << to_string(in.preventFlickering) << ",\n"
-        << "\"historyReprojection\": " << to_string(in.historyReprojection) << "\n"
+        << "\"historyReprojection\": " << to_string(in.historyReprojection) << ",\n"
+        << "\"motionVectors\": " << to_string(in.motionVectors) << "\n"
         << "}";
 }
 
@@ -795,6 +795,7 @@ void ViewerGui::updateUserInterface() {
     if (ImGui::CollapsingHeader("TAA Options")) {
         ImGui::Checkbox("Upscaling", &mSettings.view.taa.upscaling);
         ImGui::Checkbox("History Reprojection", &mSettings.view.taa.historyReprojection);
+        ImGui::Checkbox("Motion Vectors", &mSettings.view.taa.motionVectors);
         ImGui::SliderFloat("Feedback", &mSettings.view.taa.feedback, 0.0f, 1.0f);
         ImGui::Checkbox("Filter History", &mSettings.view.taa.filterHistory);
         ImGui::Checkbox("Filter Input", &mSettings.view.taa.filterInput);
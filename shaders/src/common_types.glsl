@@ -30,7 +30,8 @@ struct PerRenderableData {
     highp int flagsChannels;                   // see packFlags() below (0x00000fll)
     highp int objectId;                        // used for picking
     highp float userData;   // TODO: We need a better solution, this currently holds the average local scale for the renderable
-    highp vec4 reserved[8];
+    highp mat4 previousWorldFromWorldMatrix;   // used for motion vectors
+    highp vec4 reserved[4];
 };
 
 // Bits for flagsChannels
@@ -10,6 +10,8 @@ layout(location = 0) out highp vec4 outPicking;
 layout(location = 0) out highp vec2 outPicking;
 #       endif
 #   endif
+#elif defined(VARIANT_HAS_VELOCITY)
+layout(location = 0) out highp vec2 outVelocity;
 #else
 // not color output
 #endif
@@ -17,7 +19,7 @@ layout(location = 0) out highp vec2 outPicking;
 //------------------------------------------------------------------------------
 // Depth
 //
-// note: VARIANT_HAS_VSM and VARIANT_HAS_PICKING are mutually exclusive
+// note: VARIANT_HAS_VSM, VARIANT_HAS_PICKING and VARIANT_HAS_VELOCITY are mutually exclusive
 //------------------------------------------------------------------------------
 
 highp vec2 computeDepthMomentsVSM(const highp float depth);
@@ -69,6 +71,12 @@ void main() {
 #if __VERSION__ == 100
     gl_FragData[0] = outPicking;
 #endif
+#elif defined(VARIANT_HAS_VELOCITY)
+    // motion of the object in uv space since the previous frame, camera motion excluded
+    highp vec2 previous = vertex_previousPosition.xy * (1.0 / vertex_previousPosition.w);
+    highp vec2 previousStatic =
+            vertex_previousStaticPosition.xy * (1.0 / vertex_previousStaticPosition.w);
+    outVelocity = (previous - previousStatic) * 0.5;
 #else
     // that's it
 #endif
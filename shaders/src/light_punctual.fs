@@ -73,21 +73,21 @@ FroxelParams getFroxelParams(const uint froxelIndex) {
     highp uint f = d[c];
     FroxelParams froxel;
     froxel.recordOffset = f >> 16u;
-    froxel.count = f & 0xFFu;
+    froxel.count = f & 0xFFFFu;
     return froxel;
 }
 
 /**
  * Return the light index from the record index
- * A light record is a single uint index into the lights data buffer (lightsUniforms UBO).
+ * A light record is a single 16-bits index into the lights data buffer (lightsUniforms UBO).
  */
 uint getLightIndex(const uint index) {
-    uint v = index >> 4u;
-    uint c = (index >> 2u) & 0x3u;
-    uint s = (index & 0x3u) * 8u;
+    uint v = index >> 3u;
+    uint c = (index >> 1u) & 0x3u;
+    uint s = (index & 0x1u) * 16u;
     // this intermediate is needed to workaround a bug on qualcomm h/w
     highp uvec4 d = froxelRecordUniforms.records[v];
-    return (d[c] >> s) & 0xFFu;
+    return (d[c] >> s) & 0xFFFFu;
 }
 
 float getSquareFalloffAttenuation(float distanceSquare, float falloff) {
@@ -215,6 +215,22 @@ void main() {
     // this must happen before we compensate for vulkan below
     vertex_position = position;
 
+#if defined(VARIANT_HAS_VELOCITY)
+    // The difference between these two positions is the motion of the object alone, the motion
+    // due to the camera is reconstructed from the depth buffer (see taa.mat).
+#if defined(VERTEX_DOMAIN_DEVICE)
+    // there is no world position, the object doesn't move
+    vertex_previousPosition = position;
+    vertex_previousStaticPosition = position;
+#else
+    highp vec4 currentWorldPosition = getWorldPosition(material);
+    vertex_previousPosition = frameUniforms.previousClipFromWorldMatrix *
+            (object_uniforms_previousWorldFromWorldMatrix * currentWorldPosition);
+    vertex_previousStaticPosition = frameUniforms.previousClipFromWorldMatrix *
+            currentWorldPosition;
+#endif
+#endif
+
 #if defined(VARIANT_HAS_INSTANCED_STEREO)
     // We're transforming a vertex whose x coordinate is within the range (-w to w).
     // To move it to the correct portion of the viewport, we need to modify the x coordinate.
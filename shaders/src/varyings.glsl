@@ -32,6 +32,12 @@ LAYOUT_LOCATION(10) VARYING highp vec4 vertex_uv01;
 LAYOUT_LOCATION(11) VARYING highp vec4 vertex_lightSpacePosition;
 #endif
 
+#if defined(VARIANT_HAS_VELOCITY)
+// clip-space position in the previous frame, and where it would be if only the camera had moved
+LAYOUT_LOCATION(12) VARYING highp vec4 vertex_previousPosition;
+LAYOUT_LOCATION(13) VARYING highp vec4 vertex_previousStaticPosition;
+#endif
+
 // Note that fragColor is an output and is not declared here; see main.fs and depth_main.fs
 
 #if defined(VARIANT_HAS_INSTANCED_STEREO)
@@ -153,6 +153,7 @@ Filament.loadGeneratedExtensions = function() {
             varianceGamma: 1.0,
             preventFlickering: false,
             historyReprojection: true,
+            motionVectors: false,
         };
         return Object.assign(options, overrides);
     };
@@ -1726,6 +1726,10 @@ export interface View$TemporalAntiAliasingOptions {
      * whether to apply history reprojection (debug option)
      */
     historyReprojection?: boolean;
+    /**
+     * reproject the history of moving objects using per-object motion vectors, useful with upscaling
+     */
+    motionVectors?: boolean;
 }
 
 /**
@@ -133,6 +133,7 @@ value_object<View::TemporalAntiAliasingOptions>("View$TemporalAntiAliasingOption
     .field("varianceGamma", &View::TemporalAntiAliasingOptions::varianceGamma)
     .field("preventFlickering", &View::TemporalAntiAliasingOptions::preventFlickering)
     .field("historyReprojection", &View::TemporalAntiAliasingOptions::historyReprojection)
+    .field("motionVectors", &View::TemporalAntiAliasingOptions::motionVectors)
     ;
 
 value_object<View::ScreenSpaceReflectionsOptions>("View$ScreenSpaceReflectionsOptions")